@@ -139,6 +139,23 @@ VLC_API void block_Init( block_t *, void *, size_t );
 VLC_API block_t *block_Alloc( size_t ) VLC_USED VLC_MALLOC;
 VLC_API block_t *block_Realloc( block_t *, ssize_t i_pre, size_t i_body ) VLC_USED;
 
+/**
+ * Statistics of the pool recycling the blocks of block_Alloc()
+ */
+typedef struct
+{
+    uint64_t i_hits;      /**< Allocations served by a thread cache */
+    uint64_t i_recycled;  /**< Releases kept in a thread cache */
+    uint64_t i_refilled;  /**< Blocks moved from the pool to a thread cache */
+    uint64_t i_spilled;   /**< Blocks moved from a thread cache to the pool */
+    uint64_t i_mallocs;   /**< Allocations of new blocks */
+    uint64_t i_frees;     /**< Blocks freed as the pool was full */
+    uint64_t i_oversized; /**< Blocks too large for the pool */
+    size_t   i_pooled;    /**< Bytes in the shared pool */
+} block_pool_stats_t;
+
+VLC_API void block_PoolGetStats( block_pool_stats_t * );
+
 static inline void block_CopyProperties( block_t *dst, block_t *src )
 {
     dst->i_flags   = src->i_flags;
@@ -294,6 +311,8 @@ static inline block_t *block_ChainGather( block_t *p_list )
  * Fifos of blocks.
  ****************************************************************************
  * - block_FifoNew : create and init a new fifo
+ * - block_FifoNewSPSC : create a fifo for one producer and one consumer
+ *      thread, which do not lock each other unless it is empty or paced
  * - block_FifoRelease : destroy a fifo and free all blocks in it.
  * - block_FifoPace : wait for a fifo to drain to a specified number of packets or total data size
  * - block_FifoEmpty : free all blocks in a fifo
@@ -308,6 +327,7 @@ static inline block_t *block_ChainGather( block_t *p_list )
  ****************************************************************************/
 
 VLC_API block_fifo_t *block_FifoNew( void ) VLC_USED VLC_MALLOC;
+VLC_API block_fifo_t *block_FifoNewSPSC( void ) VLC_USED VLC_MALLOC;
 VLC_API void block_FifoRelease( block_fifo_t * );
 VLC_API void block_FifoPace( block_fifo_t *fifo, size_t max_depth, size_t max_size );
 VLC_API void block_FifoEmpty( block_fifo_t * );
@@ -34,6 +34,7 @@ typedef struct
     int64_t i_start;    /* Interpreted as a value return by time() */
     int     i_duration;    /* Duration of the event in second */
 
+    /* Owned by the EPG, possibly shared with other EPG: read only */
     char    *psz_name;
     char    *psz_short_description;
     char    *psz_description;
@@ -46,6 +47,8 @@ typedef struct
     char            *psz_name;
     vlc_epg_event_t *p_current; /* Can be null or should be the same than one of pp_event entry */
 
+    /* Ordered by start time */
+
     int             i_event;
     vlc_epg_event_t **pp_event;
 } vlc_epg_t;
@@ -93,5 +96,53 @@ VLC_API void vlc_epg_SetCurrent(vlc_epg_t *p_epg, int64_t i_start);
  */
 VLC_API void vlc_epg_Merge(vlc_epg_t *p_dst, const vlc_epg_t *p_src);
 
+/**
+ * Callback of vlc_epg_MergeChanges() for an event of the destination EPG
+ * which was added or modified, or which is about to be removed.
+ */
+typedef void (*vlc_epg_changed_cb)(void *p_data, const vlc_epg_event_t *p_evt,
+                                   bool b_removed);
+
+/**
+ * It merges the events of \p p_src into \p p_dst like vlc_epg_Merge, and
+ * reports the events of \p p_dst which changed to \p pf_changed (can be NULL).
+ *
+ * Events are matched on their start time, only those which differ are
+ * updated. The strings are shared with \p p_src rather than copied.
+ *
+ * \return the number of events added, modified or removed, plus one when the
+ * current event changed
+ */
+VLC_API size_t vlc_epg_MergeChanges(vlc_epg_t *p_dst, const vlc_epg_t *p_src, vlc_epg_changed_cb pf_changed, void *p_data);
+
+/**
+ * EPG kept on disk across sessions, per transport stream
+ */
+typedef struct vlc_epg_cache_t vlc_epg_cache_t;
+
+/**
+ * It opens the EPG cache of a transport stream and loads the events which are
+ * not over yet. The EPG of each service has its event on air as current.
+ *
+ * You must call vlc_epg_cache_Close to release the associated resource.
+ */
+VLC_API vlc_epg_cache_t * vlc_epg_cache_Open(vlc_object_t *p_obj, uint16_t i_network_id, uint16_t i_ts_id) VLC_USED;
+
+/**
+ * It stores the EPG cache if it was updated, and releases it.
+ */
+VLC_API void vlc_epg_cache_Close(vlc_epg_cache_t *p_cache);
+
+/**
+ * It returns the EPG of the \p i_index th service of the cache and its
+ * service_id, or NULL past the last one.
+ */
+VLC_API const vlc_epg_t * vlc_epg_cache_Get(vlc_epg_cache_t *p_cache, int i_index, uint16_t *pi_service_id);
+
+/**
+ * It merges the events of \p p_epg into the EPG cached for a service.
+ */
+VLC_API void vlc_epg_cache_Update(vlc_epg_cache_t *p_cache, uint16_t i_service_id, const vlc_epg_t *p_epg);
+
 #endif
 
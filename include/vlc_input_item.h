@@ -289,7 +289,9 @@ typedef enum input_item_meta_request_option_t
     META_REQUEST_OPTION_NONE          = 0x00,
     META_REQUEST_OPTION_SCOPE_LOCAL   = 0x01,
     META_REQUEST_OPTION_SCOPE_NETWORK = 0x02,
-    META_REQUEST_OPTION_SCOPE_ANY     = 0x03
+    META_REQUEST_OPTION_SCOPE_ANY     = 0x03,
+    /* the item is visible or about to play, preparse it first */
+    META_REQUEST_OPTION_PRIORITY      = 0x04
 } input_item_meta_request_option_t;
 
 VLC_API int libvlc_MetaRequest(libvlc_int_t *, input_item_t *,
@@ -334,6 +336,11 @@ struct input_stats_t
     /* Aout */
     int64_t i_played_abuffers;
     int64_t i_lost_abuffers;
+
+    /* Appended to keep the layout of the fields above */
+    int64_t i_read_discontinuity; /**< Data lost by the access */
+    int64_t i_prefetch_level;  /**< Bytes read ahead by the stream */
+    int64_t i_prefetch_stalls; /**< Times the stream waited for data */
 };
 
 #endif
@@ -627,14 +627,16 @@ libvlc_media_get_duration( libvlc_media_t * p_md )
     return from_mtime(input_item_GetDuration( p_md->p_input_item ));
 }
 
-static int media_parse(libvlc_media_t *media)
+static int media_parse(libvlc_media_t *media, bool b_async)
 {
     libvlc_int_t *libvlc = media->p_libvlc_instance->p_libvlc_int;
     input_item_t *item = media->p_input_item;
 
     /* TODO: Fetch art on need basis. But how not to break compatibility? */
     libvlc_ArtRequest(libvlc, item, META_REQUEST_OPTION_NONE);
-    return libvlc_MetaRequest(libvlc, item, META_REQUEST_OPTION_NONE);
+    /* The caller waits for the synchronous parsing, do it first */
+    return libvlc_MetaRequest(libvlc, item, b_async ? META_REQUEST_OPTION_NONE
+                                                    : META_REQUEST_OPTION_PRIORITY);
 }
 
 /**************************************************************************
@@ -649,7 +651,7 @@ libvlc_media_parse(libvlc_media_t *media)
         media->has_asked_preparse = true;
         vlc_mutex_unlock(&media->parsed_lock);
 
-        if (media_parse(media))
+        if (media_parse(media, false))
             /* Parse failed: do not wait! */
             return;
         vlc_mutex_lock(&media->parsed_lock);
@@ -674,7 +676,7 @@ libvlc_media_parse_async(libvlc_media_t *media)
     vlc_mutex_unlock(&media->parsed_lock);
 
     if (needed)
-        media_parse(media);
+        media_parse(media, true);
 }
 
 /**************************************************************************
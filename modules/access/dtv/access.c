@@ -44,9 +44,15 @@
     "the device number must be selected. Numbering starts from zero.")
 #define BUDGET_TEXT N_("Do not demultiplex")
 #define BUDGET_LONGTEXT N_( \
-    "Only useful programs are normally demultiplexed from the transponder. " \
+    "Only useful programs are normally demultiplexed from the transponder, " \
+    "unless the adapter runs out of PID filters. " \
     "This option will disable demultiplexing and receive all programs.")
 
+#define BUFFER_SIZE_TEXT N_("Capture buffer size (KiB)")
+#define BUFFER_SIZE_LONGTEXT N_( \
+    "Size of the kernel buffer holding the captured stream. " \
+    "A larger buffer copes better with high bit rates and system load.")
+
 #define NAME_TEXT N_("Network name")
 #define NAME_LONGTEXT N_("Unique network name in the System Tuning Spaces")
 
@@ -260,6 +266,9 @@ vlc_module_begin ()
         change_integer_range (0, 255)
         change_safe ()
     add_bool ("dvb-budget-mode", false, BUDGET_TEXT, BUDGET_LONGTEXT, true)
+    add_integer ("dvb-buffer-size", 8192, BUFFER_SIZE_TEXT,
+                 BUFFER_SIZE_LONGTEXT, true)
+        change_integer_range (64, 262144)
 #endif
 #ifdef _WIN32
     add_integer ("dvb-adapter", -1, ADAPTER_TEXT, ADAPTER_LONGTEXT, true)
@@ -500,6 +509,15 @@ static void Close (vlc_object_t *obj)
 
 static block_t *Read (access_t *access)
 {
+#ifdef HAVE_LINUX_DVB
+    access_sys_t *sys = access->p_sys;
+    bool eof;
+    block_t *block = dvb_read_block (sys->dev, &eof);
+
+    if (block == NULL && eof)
+        access->info.b_eof = true;
+    return block;
+#else
 #define BUFSIZE (20*188)
     block_t *block = block_Alloc (BUFSIZE);
     if (unlikely(block == NULL))
@@ -519,6 +537,7 @@ static block_t *Read (access_t *access)
     block->i_buffer = val;
 
     return block;
+#endif
 }
 
 static int Control (access_t *access, int query, va_list args)
@@ -584,6 +603,10 @@ static int Control (access_t *access, int query, va_list args)
 #endif
         /*case ACCESS_GET_PRIVATE_ID_STATE: TODO? */
 
+        case ACCESS_IS_TUNER:
+            *va_arg (args, bool *) = true;
+            break;
+
         default:
             return VLC_EGENERIC;
     }
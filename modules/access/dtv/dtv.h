@@ -46,7 +46,11 @@ typedef struct dvb_device dvb_device_t;
 
 dvb_device_t *dvb_open (vlc_object_t *obj);
 void dvb_close (dvb_device_t *);
+#ifdef HAVE_LINUX_DVB
+block_t *dvb_read_block (dvb_device_t *, bool *eof);
+#else
 ssize_t dvb_read (dvb_device_t *, void *, size_t);
+#endif
 
 int dvb_add_pid (dvb_device_t *, uint16_t);
 void dvb_remove_pid (dvb_device_t *, uint16_t);
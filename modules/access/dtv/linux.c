@@ -26,6 +26,8 @@
 
 #include <vlc_common.h>
 #include <vlc_fs.h>
+#include <vlc_block.h>
+#include <vlc_atomic.h>
 
 #include <errno.h>
 #include <assert.h>
@@ -33,6 +35,7 @@
 #include <poll.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/dvb/version.h>
 #include <linux/dvb/frontend.h>
 #include <linux/dvb/dmx.h>
@@ -156,13 +159,20 @@ struct dvb_device
         int fd;
         uint16_t pid;
     } pids[MAX_PIDS];
+    int full_ts; /**< whole TS filter once out of PID filters, or -1 */
+    unsigned max_pids; /**< PID filters the adapter could provide */
+    unsigned wanted_count;
+    uint32_t wanted[0x2000 / 32]; /**< PIDs the demultiplexer asked for */
 #endif
 #ifdef HAVE_DVBPSI
     cam_t *cam;
 #endif
     uint8_t device;
     bool budget;
-    //size_t buffer_size;
+    bool overflow; /**< data lost since the last block */
+#ifdef DMX_REQBUFS
+    struct dvb_ring *ring;
+#endif
 };
 
 /** Opens the device directory for the specified DVB adapter */
@@ -187,6 +197,200 @@ static int dvb_open_node (dvb_device_t *d, const char *type, int flags)
     return fd;
 }
 
+/** Sizes the kernel buffer of the TS being read */
+static void dvb_set_buffer_size (dvb_device_t *d)
+{
+    unsigned long size = var_InheritInteger (d->obj, "dvb-buffer-size");
+
+    if (ioctl (d->demux, DMX_SET_BUFFER_SIZE, size << 10) < 0)
+        msg_Warn (d->obj, "cannot expand demultiplexing buffer: %s",
+                  vlc_strerror_c(errno));
+}
+
+#ifdef DMX_REQBUFS
+/* Size of the buffers of the memory mapped ring, in packets */
+# define DVB_RING_PACKETS 348
+
+/**
+ * Ring of kernel buffers mapped in memory (Linux 4.20 or later, if the
+ * driver supports it). Filled buffers are handed over as blocks without
+ * copy, and queued back to the kernel once released.
+ */
+typedef struct dvb_ring
+{
+    atomic_uint refs; /**< the device and every block of the ring */
+    atomic_uint queued; /**< buffers owned by the kernel */
+    int fd;
+    uint32_t sequence; /**< next expected buffer count */
+    unsigned count;
+    size_t size;
+    uint8_t *maps[];
+} dvb_ring_t;
+
+typedef struct
+{
+    block_t self;
+    dvb_ring_t *ring;
+    unsigned index;
+} dvb_ring_block_t;
+
+static void dvb_ring_queue (dvb_ring_t *ring, unsigned index)
+{
+    struct dmx_buffer buf = { .index = index };
+
+    if (ioctl (ring->fd, DMX_QBUF, &buf) == 0)
+        atomic_fetch_add (&ring->queued, 1);
+}
+
+static void dvb_ring_release (dvb_ring_t *ring)
+{
+    if (atomic_fetch_sub (&ring->refs, 1) != 1)
+        return;
+
+    for (unsigned i = 0; i < ring->count; i++)
+        if (ring->maps[i] != MAP_FAILED)
+            munmap (ring->maps[i], ring->size);
+    close (ring->fd);
+    free (ring);
+}
+
+static void dvb_ring_block_Release (block_t *block)
+{
+    dvb_ring_block_t *rb = (dvb_ring_block_t *)block;
+
+    dvb_ring_queue (rb->ring, rb->index);
+    dvb_ring_release (rb->ring);
+    free (rb);
+}
+
+/** Maps the kernel buffers, if the driver supports it */
+static dvb_ring_t *dvb_ring_new (dvb_device_t *d)
+{
+    unsigned long size = var_InheritInteger (d->obj, "dvb-buffer-size") << 10;
+    struct dmx_requestbuffers req = {
+        .count = size / (DVB_RING_PACKETS * 188),
+        .size = DVB_RING_PACKETS * 188,
+    };
+
+    if (req.count < 4)
+        req.count = 4;
+    if (ioctl (d->demux, DMX_REQBUFS, &req) < 0 || req.count == 0)
+    {
+        msg_Dbg (d->obj, "memory mapped buffers not supported: %s",
+                 vlc_strerror_c(errno));
+        return NULL;
+    }
+
+    dvb_ring_t *ring = malloc (sizeof (*ring)
+                               + req.count * sizeof (ring->maps[0]));
+    if (unlikely(ring == NULL))
+        goto error;
+
+    ring->fd = vlc_dup (d->demux);
+    if (ring->fd == -1)
+    {
+        free (ring);
+        goto error;
+    }
+    atomic_init (&ring->refs, 1);
+    atomic_init (&ring->queued, 0);
+    ring->sequence = 0;
+    ring->count = req.count;
+    ring->size = 0;
+    for (unsigned i = 0; i < ring->count; i++)
+        ring->maps[i] = MAP_FAILED;
+
+    for (unsigned i = 0; i < ring->count; i++)
+    {
+        struct dmx_buffer buf = { .index = i };
+
+        if (ioctl (ring->fd, DMX_QUERYBUF, &buf) < 0)
+            goto error_ring;
+        ring->size = buf.length;
+        /* The demux device is opened read-only, so are the buffers. Blocks
+         * pointing to them are only read: the stream core copies them. */
+        ring->maps[i] = mmap (NULL, buf.length, PROT_READ, MAP_SHARED,
+                              ring->fd, buf.offset);
+        if (ring->maps[i] == MAP_FAILED)
+            goto error_ring;
+    }
+
+    for (unsigned i = 0; i < ring->count; i++)
+        dvb_ring_queue (ring, i);
+    if (atomic_load (&ring->queued) == 0)
+        goto error_ring;
+
+    msg_Dbg (d->obj, "using %u memory mapped buffers of %zu bytes",
+             ring->count, ring->size);
+    return ring;
+
+error_ring:
+    msg_Warn (d->obj, "cannot map buffers: %s", vlc_strerror_c(errno));
+    dvb_ring_release (ring);
+error:
+    req.count = 0;
+    ioctl (d->demux, DMX_REQBUFS, &req);
+    return NULL;
+}
+
+/** Takes the next filled buffer of the ring */
+static block_t *dvb_ring_read (dvb_device_t *d)
+{
+    dvb_ring_t *ring = d->ring;
+    struct dmx_buffer buf = { .index = 0 };
+
+    if (ioctl (ring->fd, DMX_DQBUF, &buf) < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR)
+            msg_Err (d->obj, "cannot dequeue buffer: %s",
+                     vlc_strerror_c(errno));
+        return NULL;
+    }
+
+    atomic_fetch_sub (&ring->queued, 1);
+
+    /* The kernel skips buffer counts when it drops data. Dequeueing the last
+     * queued buffer alone loses nothing: the next one may be queued back in
+     * time. */
+    if ((ring->sequence != 0 && buf.count != ring->sequence)
+     || (buf.flags & DMX_BUFFER_FLAG_DISCONTINUITY_DETECTED))
+    {
+        msg_Err (d->obj, "cannot demux data fast enough!");
+        d->overflow = true;
+    }
+    ring->sequence = buf.count + 1;
+
+    if (buf.bytesused == 0)
+    {
+        dvb_ring_queue (ring, buf.index);
+        return NULL;
+    }
+
+    /* Blocks may be held for long downstream: once half of the ring is out,
+     * copy rather than let the kernel run out of buffers */
+    if (buf.bytesused >= ring->size / 2
+     && atomic_load (&ring->queued) >= ring->count / 2)
+    {
+        dvb_ring_block_t *rb = malloc (sizeof (*rb));
+        if (likely(rb != NULL))
+        {
+            block_Init (&rb->self, ring->maps[buf.index], buf.bytesused);
+            rb->self.pf_release = dvb_ring_block_Release;
+            rb->ring = ring;
+            rb->index = buf.index;
+            atomic_fetch_add (&ring->refs, 1);
+            return &rb->self;
+        }
+    }
+
+    block_t *block = block_Alloc (buf.bytesused);
+    if (likely(block != NULL))
+        memcpy (block->p_buffer, ring->maps[buf.index], buf.bytesused);
+    dvb_ring_queue (ring, buf.index);
+    return block;
+}
+#endif
+
 /**
  * Opens the DVB tuner
  */
@@ -214,6 +418,10 @@ dvb_device_t *dvb_open (vlc_object_t *obj)
     d->cam = NULL;
 #endif
     d->budget = var_InheritBool (obj, "dvb-budget-mode");
+    d->overflow = false;
+#ifdef DMX_REQBUFS
+    d->ring = NULL;
+#endif
 
 #ifndef USE_DMX
     if (d->budget)
@@ -229,9 +437,7 @@ dvb_device_t *dvb_open (vlc_object_t *obj)
            return NULL;
        }
 
-       if (ioctl (d->demux, DMX_SET_BUFFER_SIZE, 1 << 20) < 0)
-           msg_Warn (obj, "cannot expand demultiplexing buffer: %s",
-                     vlc_strerror_c(errno));
+       dvb_set_buffer_size (d);
 
        /* We need to filter at least one PID. The tap for TS demultiplexing
         * cannot be configured otherwise. So add the PAT. */
@@ -254,6 +460,10 @@ dvb_device_t *dvb_open (vlc_object_t *obj)
     {
         for (size_t i = 0; i < MAX_PIDS; i++)
             d->pids[i].pid = d->pids[i].fd = -1;
+        d->full_ts = -1;
+        d->max_pids = 0;
+        d->wanted_count = 0;
+        memset (d->wanted, 0, sizeof (d->wanted));
         d->demux = dvb_open_node (d, "dvr", O_RDONLY);
         if (d->demux == -1)
         {
@@ -262,8 +472,12 @@ dvb_device_t *dvb_open (vlc_object_t *obj)
             free (d);
             return NULL;
         }
+        dvb_set_buffer_size (d);
 #endif
     }
+#ifdef DMX_REQBUFS
+    d->ring = dvb_ring_new (d);
+#endif
 
 #ifdef HAVE_DVBPSI
     int ca = dvb_open_node (d, "ca", O_RDWR);
@@ -292,6 +506,8 @@ void dvb_close (dvb_device_t *d)
         for (size_t i = 0; i < MAX_PIDS; i++)
             if (d->pids[i].fd != -1)
                 close (d->pids[i].fd);
+        if (d->full_ts != -1)
+            close (d->full_ts);
     }
 #endif
 #ifdef HAVE_DVBPSI
@@ -300,16 +516,20 @@ void dvb_close (dvb_device_t *d)
 #endif
     if (d->frontend != -1)
         close (d->frontend);
+#ifdef DMX_REQBUFS
+    if (d->ring != NULL)
+        dvb_ring_release (d->ring);
+#endif
     close (d->demux);
     close (d->dir);
     free (d);
 }
 
 /**
- * Reads TS data from the tuner.
- * @return number of bytes read, 0 on EOF, -1 if no data (yet).
+ * Waits for TS data or frontend events.
+ * @return 1 if TS data is available, 0 on EOF, -1 if no data (yet).
  */
-ssize_t dvb_read (dvb_device_t *d, void *buf, size_t len)
+static int dvb_poll (dvb_device_t *d)
 {
     struct pollfd ufd[2];
     int n;
@@ -352,25 +572,184 @@ ssize_t dvb_read (dvb_device_t *d, void *buf, size_t len)
         msg_Dbg (d->obj, "frontend status: 0x%02X", (unsigned)ev.status);
     }
 
-    if (ufd[0].revents)
+    return ufd[0].revents ? 1 : -1;
+}
+
+/* Largest block read at once (64 KiB worth of packets) */
+#define DVB_READ_SIZE (348 * 188)
+
+/** Reads what the kernel buffer holds, up to DVB_READ_SIZE */
+static block_t *dvb_read_buffer (dvb_device_t *d, bool *restrict eof)
+{
+    block_t *block = block_Alloc (DVB_READ_SIZE);
+    if (unlikely(block == NULL))
+        return NULL;
+
+    size_t len = 0;
+    while (len < DVB_READ_SIZE)
     {
-        ssize_t val = read (d->demux, buf, len);
-        if (val == -1 && (errno != EAGAIN && errno != EINTR))
+        ssize_t val = read (d->demux, block->p_buffer + len,
+                            DVB_READ_SIZE - len);
+        if (val > 0)
         {
-            if (errno == EOVERFLOW)
-            {
-                msg_Err (d->obj, "cannot demux data fast enough!");
-                return -1;
-            }
-            msg_Err (d->obj, "cannot demux: %s", vlc_strerror_c(errno));
-            return 0;
+            len += val;
+            continue;
         }
-        return val;
+        if (val == 0 || errno == EAGAIN)
+            break;
+        if (errno == EINTR)
+            continue;
+        if (errno == EOVERFLOW)
+        {
+            /* the kernel flushed its buffer, carry on with new data */
+            msg_Err (d->obj, "cannot demux data fast enough!");
+            d->overflow = true;
+            continue;
+        }
+        msg_Err (d->obj, "cannot demux: %s", vlc_strerror_c(errno));
+        *eof = true;
+        break;
     }
 
-    return -1;
+    if (len == 0)
+    {
+        block_Release (block);
+        return NULL;
+    }
+
+    /* Large reads are handed over as is, small ones do not waste memory */
+    if (len < DVB_READ_SIZE / 2)
+        return block_Realloc (block, 0, len);
+    block->i_buffer = len;
+    return block;
+}
+
+/**
+ * Reads TS data from the tuner.
+ * @param eof set on EOF or fatal error
+ * @return a block of TS data, or NULL if none (yet).
+ * The block following lost data is flagged with BLOCK_FLAG_DISCONTINUITY.
+ */
+block_t *dvb_read_block (dvb_device_t *d, bool *restrict eof)
+{
+    block_t *block;
+
+    *eof = false;
+    switch (dvb_poll (d))
+    {
+        case 0:
+            *eof = true;
+            /* fall through */
+        case -1:
+            return NULL;
+    }
+
+#ifdef DMX_REQBUFS
+    if (d->ring != NULL)
+        block = dvb_ring_read (d);
+    else
+#endif
+        block = dvb_read_buffer (d, eof);
+
+    if (block != NULL && d->overflow)
+    {
+        block->i_flags |= BLOCK_FLAG_DISCONTINUITY;
+        d->overflow = false;
+    }
+    return block;
+}
+
+#ifndef USE_DMX
+/** Routes one PID, or the whole TS for 0x2000, to the DVR */
+static int dvb_open_filter (dvb_device_t *d, uint16_t pid)
+{
+    int fd = dvb_open_node (d, "demux", O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    struct dmx_pes_filter_params param;
+
+    param.pid = pid;
+    param.input = DMX_IN_FRONTEND;
+    param.output = DMX_OUT_TS_TAP;
+    param.pes_type = DMX_PES_OTHER;
+    param.flags = DMX_IMMEDIATE_START;
+    if (ioctl (fd, DMX_SET_PES_FILTER, &param) < 0)
+    {
+        int saved_errno = errno;
+        close (fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+static bool dvb_pid_wanted (const dvb_device_t *d, uint16_t pid)
+{
+    return (d->wanted[pid / 32] >> (pid % 32)) & 1;
+}
+
+static unsigned dvb_close_filters (dvb_device_t *d)
+{
+    unsigned n = 0;
+
+    for (size_t i = 0; i < MAX_PIDS; i++)
+        if (d->pids[i].fd != -1)
+        {
+            close (d->pids[i].fd);
+            d->pids[i].pid = d->pids[i].fd = -1;
+            n++;
+        }
+    return n;
 }
 
+/**
+ * Replaces the PID filters with the whole TS, when the adapter has no filter
+ * left for one more PID. The PID filters are closed only once the whole TS
+ * flows, so that nothing is lost in between: the packets received twice
+ * meanwhile are adjacent duplicates, which the TS demultiplexer discards.
+ */
+static int dvb_filter_all (dvb_device_t *d)
+{
+    int fd = dvb_open_filter (d, 0x2000);
+    if (fd == -1)
+        return -1;
+
+    d->full_ts = fd;
+    d->max_pids = dvb_close_filters (d);
+    msg_Warn (d->obj, "out of PID filters after %u PIDs, "
+              "receiving the whole transport stream", d->max_pids);
+    return 0;
+}
+
+/** Goes back from the whole TS to PID filters, if they fit again */
+static void dvb_filter_pids (dvb_device_t *d)
+{
+    unsigned n = 0;
+
+    for (unsigned pid = 0; pid < 0x2000; pid++)
+    {
+        if (!dvb_pid_wanted (d, pid))
+            continue;
+
+        int fd = dvb_open_filter (d, pid);
+        if (fd == -1)
+        {   /* Filters are shared with other applications, fewer are left */
+            dvb_close_filters (d);
+            d->max_pids = n;
+            return;
+        }
+        d->pids[n].fd = fd;
+        d->pids[n].pid = pid;
+        n++;
+    }
+
+    close (d->full_ts);
+    d->full_ts = -1;
+    msg_Dbg (d->obj, "back to %u PID filters", n);
+}
+#endif
+
 int dvb_add_pid (dvb_device_t *d, uint16_t pid)
 {
     if (d->budget)
@@ -379,36 +758,34 @@ int dvb_add_pid (dvb_device_t *d, uint16_t pid)
     if (pid == 0 || ioctl (d->demux, DMX_ADD_PID, &pid) >= 0)
         return 0;
 #else
-    for (size_t i = 0; i < MAX_PIDS; i++)
-    {
-        if (d->pids[i].pid == pid)
-            return 0;
-        if (d->pids[i].fd != -1)
-            continue;
+    if (dvb_pid_wanted (d, pid))
+        return 0;
 
-        int fd = dvb_open_node (d, "demux", O_RDONLY);
-        if (fd == -1)
-            goto error;
+    if (d->full_ts == -1)
+    {
+        size_t i = 0;
 
-       /* We need to filter at least one PID. The tap for TS demultiplexing
-        * cannot be configured otherwise. So add the PAT. */
-        struct dmx_pes_filter_params param;
+        while (i < MAX_PIDS && d->pids[i].fd != -1)
+            i++;
 
-        param.pid = pid;
-        param.input = DMX_IN_FRONTEND;
-        param.output = DMX_OUT_TS_TAP;
-        param.pes_type = DMX_PES_OTHER;
-        param.flags = DMX_IMMEDIATE_START;
-        if (ioctl (fd, DMX_SET_PES_FILTER, &param) < 0)
+        int fd = (i < MAX_PIDS) ? dvb_open_filter (d, pid) : -1;
+        if (fd != -1)
         {
-            close (fd);
-            goto error;
+            d->pids[i].fd = fd;
+            d->pids[i].pid = pid;
+        }
+        else
+        {
+            msg_Dbg (d->obj, "cannot add PID 0x%04"PRIu16": %s", pid,
+                     (i < MAX_PIDS) ? vlc_strerror_c(errno) : "too many");
+            if (dvb_filter_all (d))
+                goto error;
         }
-        d->pids[i].fd = fd;
-        d->pids[i].pid = pid;
-        return 0;
     }
-    errno = EMFILE;
+
+    d->wanted[pid / 32] |= 1u << (pid % 32);
+    d->wanted_count++;
+    return 0;
 error:
 #endif
     msg_Err (d->obj, "cannot add PID 0x%04"PRIu16": %s", pid,
@@ -424,6 +801,20 @@ void dvb_remove_pid (dvb_device_t *d, uint16_t pid)
     if (pid != 0)
         ioctl (d->demux, DMX_REMOVE_PID, &pid);
 #else
+    if (!dvb_pid_wanted (d, pid))
+        return;
+
+    d->wanted[pid / 32] &= ~(1u << (pid % 32));
+    d->wanted_count--;
+
+    if (d->full_ts != -1)
+    {
+        /* Keep one filter spare not to switch back and forth */
+        if (d->wanted_count < d->max_pids)
+            dvb_filter_pids (d);
+        return;
+    }
+
     for (size_t i = 0; i < MAX_PIDS; i++)
     {
         if (d->pids[i].pid == pid)
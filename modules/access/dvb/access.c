@@ -392,6 +392,10 @@ static int Control( access_t *p_access, int i_query, va_list args )
             }
             break;
 
+        case ACCESS_IS_TUNER:
+            *va_arg( args, bool * ) = true;
+            break;
+
         default:
             return VLC_EGENERIC;
 
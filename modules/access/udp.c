@@ -157,7 +157,7 @@ static int Open( vlc_object_t *p_this )
         goto error;
     }
 
-    sys->fifo = block_FifoNew();
+    sys->fifo = block_FifoNewSPSC();
     if( unlikely( sys->fifo == NULL ) )
     {
         net_Close( sys->fd );
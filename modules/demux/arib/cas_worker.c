@@ -0,0 +1,654 @@
+/*****************************************************************************
+ * cas_worker.c: asynchronous B-CAS card access for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+
+#include <vlc_common.h>
+
+#include "cas_worker.h"
+
+/* EMMs are repeated by the broadcaster, drop them rather than letting them
+ * pile up behind the ECMs when the card is slow */
+#define CAS_EMM_QUEUE_MAX 16
+
+/* Queueing delay above which a demuxer is told the card is overloaded */
+#define CAS_LATENCY_WARN (CLOCK_FREQ / 2)
+
+/* ECM responses are cached process-wide, so that zapping back to a service
+ * or reopening an input gets its key without a card round trip. Bigger
+ * ECMs than CAS_ECM_CACHE_DATA are simply not cached. */
+#define CAS_ECM_CACHE_SIZE 64
+#define CAS_ECM_CACHE_DATA 256
+
+typedef struct
+{
+    uint32_t i_hash;
+    size_t   i_data;
+    uint8_t  p_data[CAS_ECM_CACHE_DATA];
+    uint8_t  p_key[16];
+} cas_ecm_entry_t;
+
+static vlc_mutex_t ecm_cache_lock = VLC_STATIC_MUTEX;
+static cas_ecm_entry_t ecm_cache[CAS_ECM_CACHE_SIZE];
+/* Entries in most recently used order */
+static cas_ecm_entry_t *ecm_cache_lru[CAS_ECM_CACHE_SIZE];
+static int i_ecm_cache;
+
+typedef struct cas_waiter_t cas_waiter_t;
+typedef struct cas_request_t cas_request_t;
+typedef struct cas_key_t cas_key_t;
+
+/* A demuxer waiting for the answer to an ECM */
+struct cas_waiter_t
+{
+    cas_waiter_t *p_next;
+    cas_worker_t *p_client;
+    int           i_pid;
+    mtime_t       i_date;   /* queueing date */
+};
+
+struct cas_request_t
+{
+    cas_request_t *p_next;
+    bool           b_ecm;
+    cas_waiter_t  *p_waiters;
+    size_t         i_data;
+    uint8_t        p_data[];
+};
+
+typedef struct
+{
+    cas_request_t  *p_first;
+    cas_request_t **pp_last;
+} cas_queue_t;
+
+struct cas_key_t
+{
+    cas_key_t *p_next;
+    int        i_pid;
+    mtime_t    i_latency;
+    uint8_t    p_key[16];
+};
+
+typedef struct
+{
+    B_CAS_CARD        *card;
+    B_CAS_INIT_STATUS  status;
+    unsigned           i_refs;    /* protected by broker_lock */
+
+    vlc_thread_t       thread;
+    vlc_mutex_t        lock;
+    vlc_cond_t         wait;
+
+    /* ECMs announce key changes and are always served before EMMs */
+    cas_queue_t        ecm;
+    cas_queue_t        emm;
+    int                i_emm;
+    cas_request_t     *p_busy;    /* being processed by the card */
+} cas_broker_t;
+
+static vlc_mutex_t broker_lock = VLC_STATIC_MUTEX;
+static cas_broker_t *broker;
+
+struct cas_worker_t
+{
+    vlc_object_t *p_obj;
+    cas_broker_t *p_broker;
+
+    /* Protected by the broker lock */
+    cas_key_t    *p_keys;           /* at most one per ECM PID */
+    unsigned      i_ecm;            /* answered by the card */
+    unsigned      i_ecm_failed;
+    unsigned      i_ecm_cached;
+    mtime_t       i_latency_total;
+    mtime_t       i_latency_max;
+};
+
+/* FNV-1a */
+static uint32_t EcmHash( const uint8_t *p_data, size_t i_data )
+{
+    uint32_t i_hash = 0x811c9dc5;
+    for( size_t i = 0; i < i_data; i++ )
+        i_hash = (i_hash ^ p_data[i]) * 0x01000193;
+    return i_hash;
+}
+
+/* Must be called with ecm_cache_lock held, moves the hit to the front */
+static cas_ecm_entry_t *EcmCacheFind( uint32_t i_hash,
+                                      const uint8_t *p_data, size_t i_data )
+{
+    for( int i = 0; i < i_ecm_cache; i++ )
+    {
+        cas_ecm_entry_t *p_entry = ecm_cache_lru[i];
+        if( p_entry->i_hash != i_hash || p_entry->i_data != i_data ||
+            memcmp( p_entry->p_data, p_data, i_data ) )
+            continue;
+
+        memmove( &ecm_cache_lru[1], &ecm_cache_lru[0],
+                 i * sizeof(*ecm_cache_lru) );
+        ecm_cache_lru[0] = p_entry;
+        return p_entry;
+    }
+    return NULL;
+}
+
+static bool EcmCacheGet( const uint8_t *p_data, size_t i_data,
+                         uint8_t p_key[16] )
+{
+    if( i_data > CAS_ECM_CACHE_DATA )
+        return false;
+
+    const uint32_t i_hash = EcmHash( p_data, i_data );
+
+    vlc_mutex_lock( &ecm_cache_lock );
+    cas_ecm_entry_t *p_entry = EcmCacheFind( i_hash, p_data, i_data );
+    if( p_entry )
+        memcpy( p_key, p_entry->p_key, 16 );
+    vlc_mutex_unlock( &ecm_cache_lock );
+
+    return p_entry != NULL;
+}
+
+static void EcmCachePut( const uint8_t *p_data, size_t i_data,
+                         const uint8_t p_key[16] )
+{
+    if( i_data > CAS_ECM_CACHE_DATA )
+        return;
+
+    const uint32_t i_hash = EcmHash( p_data, i_data );
+
+    vlc_mutex_lock( &ecm_cache_lock );
+    cas_ecm_entry_t *p_entry = EcmCacheFind( i_hash, p_data, i_data );
+    if( !p_entry )
+    {
+        /* Recycle the least recently used slot once full */
+        if( i_ecm_cache < CAS_ECM_CACHE_SIZE )
+            p_entry = &ecm_cache[i_ecm_cache++];
+        else
+            p_entry = ecm_cache_lru[CAS_ECM_CACHE_SIZE - 1];
+
+        memmove( &ecm_cache_lru[1], &ecm_cache_lru[0],
+                 (i_ecm_cache - 1) * sizeof(*ecm_cache_lru) );
+        ecm_cache_lru[0] = p_entry;
+
+        p_entry->i_hash = i_hash;
+        p_entry->i_data = i_data;
+        memcpy( p_entry->p_data, p_data, i_data );
+    }
+    memcpy( p_entry->p_key, p_key, 16 );
+    vlc_mutex_unlock( &ecm_cache_lock );
+}
+
+static void CasQueueInit( cas_queue_t *p_queue )
+{
+    p_queue->p_first = NULL;
+    p_queue->pp_last = &p_queue->p_first;
+}
+
+static void CasQueueAppend( cas_queue_t *p_queue, cas_request_t *p_req )
+{
+    p_req->p_next = NULL;
+    *p_queue->pp_last = p_req;
+    p_queue->pp_last = &p_req->p_next;
+}
+
+static void CasRequestDelete( cas_request_t *p_req )
+{
+    while( p_req->p_waiters )
+    {
+        cas_waiter_t *p_waiter = p_req->p_waiters;
+        p_req->p_waiters = p_waiter->p_next;
+        free( p_waiter );
+    }
+    free( p_req );
+}
+
+static void CasQueueClean( cas_queue_t *p_queue )
+{
+    while( p_queue->p_first )
+    {
+        cas_request_t *p_req = p_queue->p_first;
+        p_queue->p_first = p_req->p_next;
+        CasRequestDelete( p_req );
+    }
+    p_queue->pp_last = &p_queue->p_first;
+}
+
+static cas_request_t *CasQueueFind( cas_queue_t *p_queue,
+                                    const uint8_t *p_data, size_t i_data )
+{
+    for( cas_request_t *p_req = p_queue->p_first; p_req; p_req = p_req->p_next )
+        if( p_req->i_data == i_data && !memcmp( p_req->p_data, p_data, i_data ) )
+            return p_req;
+    return NULL;
+}
+
+/* Removes the waiters of p_client for i_pid (any PID if negative) */
+static void CasRemoveWaiters( cas_request_t *p_req, cas_worker_t *p_client,
+                              int i_pid )
+{
+    cas_waiter_t **pp = &p_req->p_waiters;
+    while( *pp )
+    {
+        cas_waiter_t *p_waiter = *pp;
+        if( p_waiter->p_client == p_client &&
+            ( i_pid < 0 || p_waiter->i_pid == i_pid ) )
+        {
+            *pp = p_waiter->p_next;
+            free( p_waiter );
+        }
+        else
+            pp = &p_waiter->p_next;
+    }
+}
+
+/* Must be called with the broker lock held. ECMs nobody waits for anymore
+ * are dropped, except the one the card is currently processing. */
+static void CasDropWaiters( cas_broker_t *p_broker, cas_worker_t *p_client,
+                            int i_pid )
+{
+    cas_queue_t *p_queue = &p_broker->ecm;
+    cas_request_t **pp = &p_queue->p_first;
+
+    while( *pp )
+    {
+        cas_request_t *p_req = *pp;
+        CasRemoveWaiters( p_req, p_client, i_pid );
+        if( p_req->p_waiters == NULL )
+        {
+            *pp = p_req->p_next;
+            free( p_req );
+        }
+        else
+            pp = &p_req->p_next;
+    }
+    p_queue->pp_last = pp;
+
+    if( p_broker->p_busy && p_broker->p_busy->b_ecm )
+        CasRemoveWaiters( p_broker->p_busy, p_client, i_pid );
+}
+
+/* Must be called with the broker lock held */
+static void CasStoreKey( cas_worker_t *p_client, int i_pid,
+                         const uint8_t p_key[16], mtime_t i_latency )
+{
+    cas_key_t *p_entry;
+    for( p_entry = p_client->p_keys; p_entry != NULL; p_entry = p_entry->p_next )
+        if( p_entry->i_pid == i_pid )
+            break;
+
+    if( p_entry == NULL && (p_entry = malloc( sizeof(*p_entry) )) != NULL )
+    {
+        p_entry->i_pid = i_pid;
+        p_entry->p_next = p_client->p_keys;
+        p_client->p_keys = p_entry;
+    }
+    if( p_entry != NULL )
+    {
+        p_entry->i_latency = i_latency;
+        memcpy( p_entry->p_key, p_key, sizeof(p_entry->p_key) );
+    }
+}
+
+/* Must be called with the broker lock held, p_key is NULL on failure */
+static void CasDispatch( cas_request_t *p_req, const uint8_t *p_key )
+{
+    const mtime_t i_now = mdate();
+
+    for( cas_waiter_t *p_waiter = p_req->p_waiters; p_waiter;
+         p_waiter = p_waiter->p_next )
+    {
+        cas_worker_t *p_client = p_waiter->p_client;
+        const mtime_t i_latency = i_now - p_waiter->i_date;
+
+        p_client->i_latency_total += i_latency;
+        if( i_latency > p_client->i_latency_max )
+            p_client->i_latency_max = i_latency;
+
+        if( p_key )
+        {
+            p_client->i_ecm++;
+            CasStoreKey( p_client, p_waiter->i_pid, p_key, i_latency );
+        }
+        else
+            p_client->i_ecm_failed++;
+    }
+}
+
+static bool CasProcessECM( B_CAS_CARD *card, cas_request_t *p_req,
+                           uint8_t p_key[16] )
+{
+    B_CAS_ECM_RESULT result;
+
+    if( card->proc_ecm( card, &result, p_req->p_data, p_req->i_data ) < 0 )
+        return false;
+
+    if( result.return_code != 0x0800 && result.return_code != 0x0400 &&
+        result.return_code != 0x0200 )
+        return false;
+
+    memcpy( p_key, result.scramble_key, 16 );
+    EcmCachePut( p_req->p_data, p_req->i_data, p_key );
+    return true;
+}
+
+static void *CasRun( void *data )
+{
+    cas_broker_t *p_broker = data;
+    B_CAS_CARD *card = p_broker->card;
+
+    for( ;; )
+    {
+        cas_request_t *p_req;
+        cas_queue_t *p_queue;
+
+        vlc_mutex_lock( &p_broker->lock );
+        mutex_cleanup_push( &p_broker->lock );
+        while( p_broker->ecm.p_first == NULL && p_broker->emm.p_first == NULL )
+            vlc_cond_wait( &p_broker->wait, &p_broker->lock );
+
+        if( p_broker->ecm.p_first )
+            p_queue = &p_broker->ecm;
+        else
+        {
+            p_queue = &p_broker->emm;
+            p_broker->i_emm--;
+        }
+        p_req = p_queue->p_first;
+        p_queue->p_first = p_req->p_next;
+        if( p_queue->p_first == NULL )
+            p_queue->pp_last = &p_queue->p_first;
+        p_broker->p_busy = p_req;
+        vlc_cleanup_pop();
+        vlc_mutex_unlock( &p_broker->lock );
+
+        int canc = vlc_savecancel();
+        uint8_t p_key[16];
+        bool b_ok;
+
+        if( p_req->b_ecm )
+            b_ok = CasProcessECM( card, p_req, p_key );
+        else
+            b_ok = card->proc_emm( card, p_req->p_data, p_req->i_data ) >= 0;
+
+        vlc_mutex_lock( &p_broker->lock );
+        p_broker->p_busy = NULL;
+        if( p_req->b_ecm )
+            CasDispatch( p_req, b_ok ? p_key : NULL );
+        vlc_mutex_unlock( &p_broker->lock );
+
+        CasRequestDelete( p_req );
+        vlc_restorecancel( canc );
+    }
+    return NULL;
+}
+
+static cas_broker_t *CasBrokerNew( void )
+{
+    cas_broker_t *p_broker = malloc( sizeof(*p_broker) );
+    if( !p_broker )
+        return NULL;
+
+    p_broker->card = create_b_cas_card();
+    if( !p_broker->card )
+    {
+        free( p_broker );
+        return NULL;
+    }
+    if( p_broker->card->init( p_broker->card ) < 0 ||
+        p_broker->card->get_init_status( p_broker->card,
+                                         &p_broker->status ) < 0 )
+    {
+        p_broker->card->release( p_broker->card );
+        free( p_broker );
+        return NULL;
+    }
+
+    p_broker->i_refs = 0;
+    CasQueueInit( &p_broker->ecm );
+    CasQueueInit( &p_broker->emm );
+    p_broker->i_emm = 0;
+    p_broker->p_busy = NULL;
+    vlc_mutex_init( &p_broker->lock );
+    vlc_cond_init( &p_broker->wait );
+
+    if( vlc_clone( &p_broker->thread, CasRun, p_broker,
+                   VLC_THREAD_PRIORITY_INPUT ) )
+    {
+        vlc_cond_destroy( &p_broker->wait );
+        vlc_mutex_destroy( &p_broker->lock );
+        p_broker->card->release( p_broker->card );
+        free( p_broker );
+        return NULL;
+    }
+    return p_broker;
+}
+
+static void CasBrokerDelete( cas_broker_t *p_broker )
+{
+    vlc_cancel( p_broker->thread );
+    vlc_join( p_broker->thread, NULL );
+
+    CasQueueClean( &p_broker->ecm );
+    CasQueueClean( &p_broker->emm );
+
+    vlc_cond_destroy( &p_broker->wait );
+    vlc_mutex_destroy( &p_broker->lock );
+    p_broker->card->release( p_broker->card );
+    free( p_broker );
+}
+
+cas_worker_t *cas_worker_New( vlc_object_t *p_obj )
+{
+    cas_worker_t *p_cas = malloc( sizeof(*p_cas) );
+    if( !p_cas )
+        return NULL;
+
+    vlc_mutex_lock( &broker_lock );
+    if( broker == NULL )
+        broker = CasBrokerNew();
+    else
+        msg_Dbg( p_obj, "sharing the B-CAS card with %u other demuxer(s)",
+                 broker->i_refs );
+    if( broker != NULL )
+        broker->i_refs++;
+    p_cas->p_broker = broker;
+    vlc_mutex_unlock( &broker_lock );
+
+    if( p_cas->p_broker == NULL )
+    {
+        free( p_cas );
+        return NULL;
+    }
+
+    p_cas->p_obj = p_obj;
+    p_cas->p_keys = NULL;
+    p_cas->i_ecm = 0;
+    p_cas->i_ecm_failed = 0;
+    p_cas->i_ecm_cached = 0;
+    p_cas->i_latency_total = 0;
+    p_cas->i_latency_max = 0;
+    return p_cas;
+}
+
+void cas_worker_Delete( cas_worker_t *p_cas )
+{
+    cas_broker_t *p_broker = p_cas->p_broker;
+
+    vlc_mutex_lock( &p_broker->lock );
+    CasDropWaiters( p_broker, p_cas, -1 );
+    vlc_mutex_unlock( &p_broker->lock );
+
+    while( p_cas->p_keys )
+    {
+        cas_key_t *p_key = p_cas->p_keys;
+        p_cas->p_keys = p_key->p_next;
+        free( p_key );
+    }
+
+    const unsigned i_answered = p_cas->i_ecm + p_cas->i_ecm_failed;
+    if( i_answered > 0 )
+        msg_Dbg( p_cas->p_obj, "ECM: %u decoded, %u failed, %u cached, "
+                 "queue latency avg %"PRId64" ms max %"PRId64" ms",
+                 p_cas->i_ecm, p_cas->i_ecm_failed, p_cas->i_ecm_cached,
+                 p_cas->i_latency_total / i_answered / 1000,
+                 p_cas->i_latency_max / 1000 );
+
+    vlc_mutex_lock( &broker_lock );
+    if( --p_broker->i_refs == 0 )
+    {
+        broker = NULL;
+        CasBrokerDelete( p_broker );
+    }
+    vlc_mutex_unlock( &broker_lock );
+
+    free( p_cas );
+}
+
+void cas_worker_GetInitStatus( cas_worker_t *p_cas, B_CAS_INIT_STATUS *p_status )
+{
+    /* Read once when the card was opened, never modified afterwards */
+    *p_status = p_cas->p_broker->status;
+}
+
+static cas_request_t *CasRequestNew( bool b_ecm,
+                                     const uint8_t *p_data, size_t i_data )
+{
+    cas_request_t *p_req = malloc( sizeof(*p_req) + i_data );
+    if( !p_req )
+        return NULL;
+
+    p_req->p_next = NULL;
+    p_req->b_ecm = b_ecm;
+    p_req->p_waiters = NULL;
+    p_req->i_data = i_data;
+    memcpy( p_req->p_data, p_data, i_data );
+    return p_req;
+}
+
+int cas_worker_PushECM( cas_worker_t *p_cas, int i_pid,
+                        const uint8_t *p_data, size_t i_data )
+{
+    cas_broker_t *p_broker = p_cas->p_broker;
+    cas_waiter_t *p_waiter = NULL;
+    uint8_t p_key[16];
+
+    assert( i_pid >= 0 );
+
+    const bool b_cached = EcmCacheGet( p_data, i_data, p_key );
+    if( !b_cached )
+    {
+        p_waiter = malloc( sizeof(*p_waiter) );
+        if( !p_waiter )
+            return VLC_ENOMEM;
+        p_waiter->p_client = p_cas;
+        p_waiter->i_pid = i_pid;
+        p_waiter->i_date = mdate();
+    }
+
+    vlc_mutex_lock( &p_broker->lock );
+    /* Only the latest ECM of a PID matters, forget about older ones */
+    CasDropWaiters( p_broker, p_cas, i_pid );
+
+    if( b_cached )
+    {
+        p_cas->i_ecm_cached++;
+        CasStoreKey( p_cas, i_pid, p_key, 0 );
+        vlc_mutex_unlock( &p_broker->lock );
+        return VLC_SUCCESS;
+    }
+
+    /* Another demuxer may already wait for the same ECM */
+    cas_request_t *p_req = p_broker->p_busy;
+    if( !p_req || !p_req->b_ecm || p_req->i_data != i_data ||
+        memcmp( p_req->p_data, p_data, i_data ) )
+        p_req = CasQueueFind( &p_broker->ecm, p_data, i_data );
+
+    if( !p_req )
+    {
+        p_req = CasRequestNew( true, p_data, i_data );
+        if( !p_req )
+        {
+            vlc_mutex_unlock( &p_broker->lock );
+            free( p_waiter );
+            return VLC_ENOMEM;
+        }
+        CasQueueAppend( &p_broker->ecm, p_req );
+        vlc_cond_signal( &p_broker->wait );
+    }
+    p_waiter->p_next = p_req->p_waiters;
+    p_req->p_waiters = p_waiter;
+    vlc_mutex_unlock( &p_broker->lock );
+    return VLC_SUCCESS;
+}
+
+int cas_worker_PushEMM( cas_worker_t *p_cas,
+                        const uint8_t *p_data, size_t i_data )
+{
+    cas_broker_t *p_broker = p_cas->p_broker;
+    int i_ret = VLC_SUCCESS;
+
+    vlc_mutex_lock( &p_broker->lock );
+    if( p_broker->i_emm >= CAS_EMM_QUEUE_MAX )
+        i_ret = VLC_EGENERIC;
+    else if( !CasQueueFind( &p_broker->emm, p_data, i_data ) )
+    {
+        cas_request_t *p_req = CasRequestNew( false, p_data, i_data );
+        if( p_req )
+        {
+            CasQueueAppend( &p_broker->emm, p_req );
+            p_broker->i_emm++;
+            vlc_cond_signal( &p_broker->wait );
+        }
+        else
+            i_ret = VLC_ENOMEM;
+    }
+    vlc_mutex_unlock( &p_broker->lock );
+    return i_ret;
+}
+
+bool cas_worker_PopKey( cas_worker_t *p_cas, int *pi_pid, uint8_t p_key[16] )
+{
+    cas_broker_t *p_broker = p_cas->p_broker;
+    cas_key_t *p_first;
+
+    vlc_mutex_lock( &p_broker->lock );
+    p_first = p_cas->p_keys;
+    if( p_first )
+        p_cas->p_keys = p_first->p_next;
+    vlc_mutex_unlock( &p_broker->lock );
+
+    if( !p_first )
+        return false;
+
+    if( p_first->i_latency > CAS_LATENCY_WARN )
+        msg_Warn( p_cas->p_obj, "ECM on pid %d answered after %"PRId64" ms, "
+                  "the B-CAS card is overloaded", p_first->i_pid,
+                  p_first->i_latency / 1000 );
+
+    *pi_pid = p_first->i_pid;
+    memcpy( p_key, p_first->p_key, sizeof(p_first->p_key) );
+    free( p_first );
+    return true;
+}
@@ -0,0 +1,51 @@
+/*****************************************************************************
+ * cas_worker.h: asynchronous B-CAS card access for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _CAS_WORKER_H
+#define _CAS_WORKER_H 1
+
+#include "b_cas_card.h"
+
+/**
+ * One B-CAS card is shared by every demuxer of the process: the first
+ * cas_worker_New() opens it and starts a thread which performs all card
+ * accesses, the last cas_worker_Delete() closes it. ECM and EMM sections
+ * are queued by the demuxers, identical ECMs are sent to the card once,
+ * and ECMs always go before EMMs. Decoded scramble keys are collected
+ * with cas_worker_PopKey().
+ */
+typedef struct cas_worker_t cas_worker_t;
+
+/* Returns NULL if no card is available */
+cas_worker_t *cas_worker_New( vlc_object_t * );
+void          cas_worker_Delete( cas_worker_t * );
+
+void cas_worker_GetInitStatus( cas_worker_t *, B_CAS_INIT_STATUS * );
+
+/* A queued ECM is superseded by a newer one for the same PID */
+int  cas_worker_PushECM( cas_worker_t *, int i_pid,
+                         const uint8_t *p_data, size_t i_data );
+int  cas_worker_PushEMM( cas_worker_t *, const uint8_t *p_data, size_t i_data );
+
+/* Returns true and fills the ECM PID and its 16 bytes (odd, even) key when
+ * a new key is available */
+bool cas_worker_PopKey( cas_worker_t *, int *pi_pid, uint8_t p_key[16] );
+
+#endif /* _CAS_WORKER_H */
@@ -1,9 +1,32 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
+#include <vlc_common.h>
+#include <vlc_cpu.h>
+
 #include "multi2.h"
 #include "multi2_error_code.h"
 
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ SIMD availability (selected at runtime through vlc_CPU())
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#if defined(HAVE_SSE2_INTRINSICS) && (VLC_GCC_VERSION(4, 9) || defined(__clang__))
+# include <immintrin.h>
+# define MULTI2_HAVE_SSE2 1
+# define MULTI2_HAVE_AVX2 1
+# define MULTI2_TARGET_SSE2 __attribute__ ((__target__ ("sse2")))
+# define MULTI2_TARGET_AVX2 __attribute__ ((__target__ ("avx2")))
+#endif
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+# include <arm_neon.h>
+# define MULTI2_HAVE_NEON 1
+#endif
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  inline functions
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -51,9 +74,14 @@ typedef struct {
 
 	uint32_t   round;
 	uint32_t   state;
+
+	uint32_t   simd;
 	
 } MULTI2_PRIVATE_DATA;
 
+/* decrypts "blocks" 8-byte blocks of each lane, cbc[] is updated per lane */
+typedef void (* CORE_LANES_DECRYPT)(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks);
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  constant values
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -61,6 +89,12 @@ typedef struct {
 #define MULTI2_STATE_SYSTEM_KEY_SET   (0x0002)
 #define MULTI2_STATE_SCRAMBLE_KEY_SET (0x0004)
 
+#define MULTI2_SIMD_SSE2              (0x0001)
+#define MULTI2_SIMD_AVX2              (0x0002)
+#define MULTI2_SIMD_NEON              (0x0004)
+
+#define MULTI2_LANES_MAX              (8)
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  function prottypes (interface method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -73,6 +107,7 @@ static int set_scramble_key_multi2(void *m2, uint8_t *val);
 static int clear_scramble_key_multi2(void *m2);
 static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size);
 static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size);
+static int decrypt_batch_multi2(void *m2, int32_t type, uint8_t **buf, int32_t *size, int32_t count);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
@@ -98,6 +133,20 @@ MULTI2 *create_multi2()
 	prv->ref_count = 1;
 	prv->round = 4;
 
+#if defined(MULTI2_HAVE_SSE2)
+	if(vlc_CPU_SSE2()){
+		prv->simd |= MULTI2_SIMD_SSE2;
+	}
+#endif
+#if defined(MULTI2_HAVE_AVX2)
+	if(vlc_CPU_AVX2()){
+		prv->simd |= MULTI2_SIMD_AVX2;
+	}
+#endif
+#if defined(MULTI2_HAVE_NEON)
+	prv->simd |= MULTI2_SIMD_NEON;
+#endif
+
 	r->release = release_multi2;
 	r->add_ref = add_ref_multi2;
 	r->set_round = set_round_multi2;
@@ -107,6 +156,7 @@ MULTI2 *create_multi2()
 	r->clear_scramble_key = clear_scramble_key_multi2;
 	r->encrypt = encrypt_multi2;
 	r->decrypt = decrypt_multi2;
+	r->decrypt_batch = decrypt_batch_multi2;
 
 	return r;
 }
@@ -115,6 +165,22 @@ MULTI2 *create_multi2()
  function prottypes (private method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 static MULTI2_PRIVATE_DATA *private_data(void *m2);
+static int check_state(MULTI2_PRIVATE_DATA *prv);
+
+static void core_cbc_decrypt(CORE_DATA *cbc, CORE_PARAM *prm, int32_t round, uint8_t *buf, int32_t size);
+#if defined(MULTI2_HAVE_SSE2) || defined(MULTI2_HAVE_AVX2) || defined(MULTI2_HAVE_NEON)
+static void core_batch_decrypt(CORE_DATA *init, CORE_PARAM *prm, int32_t round, uint8_t **buf, int32_t *size, int32_t lanes, CORE_LANES_DECRYPT kernel);
+#endif
+
+#if defined(MULTI2_HAVE_SSE2)
+static void core_decrypt_lanes_sse2(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks);
+#endif
+#if defined(MULTI2_HAVE_AVX2)
+static void core_decrypt_lanes_avx2(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks);
+#endif
+#if defined(MULTI2_HAVE_NEON)
+static void core_decrypt_lanes_neon(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks);
+#endif
 
 static void core_schedule(CORE_PARAM *work, CORE_PARAM *skey, CORE_DATA *dkey);
 
@@ -262,6 +328,8 @@ static int clear_scramble_key_multi2(void *m2)
 
 static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 {
+	int err;
+
 	CORE_DATA src,dst;
 	CORE_PARAM *prm;
 
@@ -274,16 +342,9 @@ static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
-	if(prv->state != (MULTI2_STATE_CBC_INIT_SET|MULTI2_STATE_SYSTEM_KEY_SET|MULTI2_STATE_SCRAMBLE_KEY_SET)){
-		if( (prv->state & MULTI2_STATE_CBC_INIT_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_CBC_INIT;
-		}
-		if( (prv->state & MULTI2_STATE_SYSTEM_KEY_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_SYSTEM_KEY;
-		}
-		if( (prv->state & MULTI2_STATE_SCRAMBLE_KEY_SET) == 0 ){
-			return MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
-		}
+	err = check_state(prv);
+	if(err < 0){
+		return err;
 	}
 	
 	if(type == 0x02){
@@ -327,10 +388,10 @@ static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 
 static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 {
-	CORE_DATA src,dst,cbc;
-	CORE_PARAM *prm;
+	int err;
 
-	uint8_t *p;
+	CORE_DATA cbc;
+	CORE_PARAM *prm;
 
 	MULTI2_PRIVATE_DATA *prv;
 
@@ -339,6 +400,113 @@ static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 		return MULTI2_ERROR_INVALID_PARAMETER;
 	}
 
+	err = check_state(prv);
+	if(err < 0){
+		return err;
+	}
+	
+	if(type == 0x02){
+		prm = prv->wrk+1;
+	}else{
+		prm = prv->wrk+0;
+	}
+
+	cbc.l = prv->cbc_init.l;
+	cbc.r = prv->cbc_init.r;
+
+	core_cbc_decrypt(&cbc, prm, prv->round, buf, size);
+
+	return 0;
+}
+
+static int decrypt_batch_multi2(void *m2, int32_t type, uint8_t **buf, int32_t *size, int32_t count)
+{
+	int err;
+	int32_t i,n;
+
+	CORE_DATA cbc;
+	CORE_PARAM *prm;
+
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if( (prv == NULL) || (buf == NULL) || (size == NULL) || (count < 0) ){
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	for(i=0;i<count;i++){
+		if( (buf[i] == NULL) || (size[i] < 0) ){
+			return MULTI2_ERROR_INVALID_PARAMETER;
+		}
+	}
+
+	err = check_state(prv);
+	if(err < 0){
+		return err;
+	}
+
+	if(type == 0x02){
+		prm = prv->wrk+1;
+	}else{
+		prm = prv->wrk+0;
+	}
+
+	n = 0;
+
+#if defined(MULTI2_HAVE_AVX2)
+	if(prv->simd & MULTI2_SIMD_AVX2){
+		for(;n+8<=count;n+=8){
+			core_batch_decrypt(&(prv->cbc_init), prm, prv->round, buf+n, size+n, 8, core_decrypt_lanes_avx2);
+		}
+	}
+#endif
+#if defined(MULTI2_HAVE_SSE2)
+	if(prv->simd & MULTI2_SIMD_SSE2){
+		for(;n+4<=count;n+=4){
+			core_batch_decrypt(&(prv->cbc_init), prm, prv->round, buf+n, size+n, 4, core_decrypt_lanes_sse2);
+		}
+	}
+#endif
+#if defined(MULTI2_HAVE_NEON)
+	if(prv->simd & MULTI2_SIMD_NEON){
+		for(;n+4<=count;n+=4){
+			core_batch_decrypt(&(prv->cbc_init), prm, prv->round, buf+n, size+n, 4, core_decrypt_lanes_neon);
+		}
+	}
+#endif
+
+	for(;n<count;n++){
+		cbc.l = prv->cbc_init.l;
+		cbc.r = prv->cbc_init.r;
+		core_cbc_decrypt(&cbc, prm, prv->round, buf[n], size[n]);
+	}
+
+	return 0;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static MULTI2_PRIVATE_DATA *private_data(void *m2)
+{
+	MULTI2_PRIVATE_DATA *r;
+	MULTI2 *p;
+
+	p = (MULTI2 *)m2;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (MULTI2_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static int check_state(MULTI2_PRIVATE_DATA *prv)
+{
 	if(prv->state != (MULTI2_STATE_CBC_INIT_SET|MULTI2_STATE_SYSTEM_KEY_SET|MULTI2_STATE_SCRAMBLE_KEY_SET)){
 		if( (prv->state & MULTI2_STATE_CBC_INIT_SET) == 0 ){
 			return MULTI2_ERROR_UNSET_CBC_INIT;
@@ -350,25 +518,25 @@ static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 			return MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
 		}
 	}
-	
-	if(type == 0x02){
-		prm = prv->wrk+1;
-	}else{
-		prm = prv->wrk+0;
-	}
 
-	cbc.l = prv->cbc_init.l;
-	cbc.r = prv->cbc_init.r;
+	return 0;
+}
+
+static void core_cbc_decrypt(CORE_DATA *cbc, CORE_PARAM *prm, int32_t round, uint8_t *buf, int32_t size)
+{
+	CORE_DATA src,dst;
+
+	uint8_t *p;
 
 	p = buf;
 	while(size >= 8){
 		load_be_uint32(&(src.l), p+0);
 		load_be_uint32(&(src.r), p+4);
-		core_decrypt(&dst, &src, prm, prv->round);
-		dst.l = dst.l ^ cbc.l;
-		dst.r = dst.r ^ cbc.r;
-		cbc.l = src.l;
-		cbc.r = src.r;
+		core_decrypt(&dst, &src, prm, round);
+		dst.l = dst.l ^ cbc->l;
+		dst.r = dst.r ^ cbc->r;
+		cbc->l = src.l;
+		cbc->r = src.r;
 		p = save_be_uint32(p, dst.l);
 		p = save_be_uint32(p, dst.r);
 		size -= 8;
@@ -378,7 +546,7 @@ static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 		int i;
 		uint8_t tmp[8];
 		
-		core_encrypt(&dst, &cbc, prm, prv->round);
+		core_encrypt(&dst, cbc, prm, round);
 		save_be_uint32(tmp+0, dst.l);
 		save_be_uint32(tmp+4, dst.r);
 
@@ -386,30 +554,40 @@ static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 			p[i] = (uint8_t)(p[i] ^ tmp[i]);
 		}
 	}
-
-	return 0;
 }
 
-/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
- private method implementation
- ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-static MULTI2_PRIVATE_DATA *private_data(void *m2)
+#if defined(MULTI2_HAVE_SSE2) || defined(MULTI2_HAVE_AVX2) || defined(MULTI2_HAVE_NEON)
+static void core_batch_decrypt(CORE_DATA *init, CORE_PARAM *prm, int32_t round, uint8_t **buf, int32_t *size, int32_t lanes, CORE_LANES_DECRYPT kernel)
 {
-	MULTI2_PRIVATE_DATA *r;
-	MULTI2 *p;
+	int32_t i,blocks;
 
-	p = (MULTI2 *)m2;
-	if(p == NULL){
-		return NULL;
+	CORE_DATA cbc[MULTI2_LANES_MAX];
+	uint8_t *p[MULTI2_LANES_MAX];
+
+	/* the lanes run in lock step over the blocks every payload has */
+	blocks = size[0] / 8;
+	for(i=1;i<lanes;i++){
+		if(size[i] / 8 < blocks){
+			blocks = size[i] / 8;
+		}
 	}
 
-	r = (MULTI2_PRIVATE_DATA *)(p->private_data);
-	if( ((void *)(r+1)) != ((void *)p) ){
-		return NULL;
+	for(i=0;i<lanes;i++){
+		cbc[i].l = init->l;
+		cbc[i].r = init->r;
+		p[i] = buf[i];
 	}
 
-	return r;
+	if(blocks > 0){
+		kernel(cbc, prm, round, p, blocks);
+	}
+
+	/* remaining blocks and OFB residue of each lane */
+	for(i=0;i<lanes;i++){
+		core_cbc_decrypt(cbc+i, prm, round, buf[i]+blocks*8, size[i]-blocks*8);
+	}
 }
+#endif
 
 static void core_schedule(CORE_PARAM *work, CORE_PARAM *skey, CORE_DATA *dkey)
 {
@@ -525,3 +703,223 @@ static void core_pi4(CORE_DATA *dst, CORE_DATA *src, uint32_t a)
 	dst->l = src->l ^ t1;
 	dst->r = src->r;
 }
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ SIMD lane kernels (one independent CBC chain per lane)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define LANES_PI1(V, l, r) \
+	r = V##_XOR(r, l)
+
+#define LANES_PI2(V, l, r, a, one) \
+	t0 = V##_ADD(r, a); \
+	t1 = V##_SUB(V##_ADD(V##_ROTL(t0, 1), t0), one); \
+	l  = V##_XOR(l, V##_XOR(V##_ROTL(t1, 4), t1))
+
+#define LANES_PI3(V, l, r, a, b, one) \
+	t0 = V##_ADD(l, a); \
+	t1 = V##_ADD(V##_ADD(V##_ROTL(t0, 2), t0), one); \
+	t0 = V##_ADD(V##_XOR(V##_ROTL(t1, 8), t1), b); \
+	t1 = V##_SUB(V##_ROTL(t0, 1), t0); \
+	r  = V##_XOR(r, V##_XOR(V##_ROTL(t1, 16), V##_OR(t1, l)))
+
+#define LANES_PI4(V, l, r, a, one) \
+	t0 = V##_ADD(r, a); \
+	l  = V##_XOR(l, V##_ADD(V##_ADD(V##_ROTL(t0, 2), t0), one))
+
+/* same order as core_decrypt() */
+#define LANES_DECRYPT_ROUND(V, l, r, k, one) \
+	LANES_PI4(V, l, r, k[7], one); \
+	LANES_PI3(V, l, r, k[5], k[6], one); \
+	LANES_PI2(V, l, r, k[4], one); \
+	LANES_PI1(V, l, r); \
+	LANES_PI4(V, l, r, k[3], one); \
+	LANES_PI3(V, l, r, k[1], k[2], one); \
+	LANES_PI2(V, l, r, k[0], one); \
+	LANES_PI1(V, l, r)
+
+static __inline void lanes_load(uint32_t *l, uint32_t *r, uint8_t **buf, int32_t lanes, int32_t offset)
+{
+	int32_t i;
+
+	for(i=0;i<lanes;i++){
+		load_be_uint32(l+i, buf[i]+offset+0);
+		load_be_uint32(r+i, buf[i]+offset+4);
+	}
+}
+
+static __inline void lanes_save(uint8_t **buf, uint32_t *l, uint32_t *r, int32_t lanes, int32_t offset)
+{
+	int32_t i;
+
+	for(i=0;i<lanes;i++){
+		save_be_uint32(buf[i]+offset+0, l[i]);
+		save_be_uint32(buf[i]+offset+4, r[i]);
+	}
+}
+
+#if defined(MULTI2_HAVE_SSE2)
+#define SSE2_ADD(a, b)  _mm_add_epi32((a), (b))
+#define SSE2_SUB(a, b)  _mm_sub_epi32((a), (b))
+#define SSE2_XOR(a, b)  _mm_xor_si128((a), (b))
+#define SSE2_OR(a, b)   _mm_or_si128((a), (b))
+#define SSE2_ROTL(x, n) _mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32-(n)))
+
+MULTI2_TARGET_SSE2
+static void core_decrypt_lanes_sse2(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks)
+{
+	int32_t i,n;
+
+	uint32_t l[4],r[4];
+	__m128i k[8],one;
+	__m128i vl,vr,sl,sr,cl,cr,t0,t1;
+
+	for(i=0;i<8;i++){
+		k[i] = _mm_set1_epi32((int)w->key[i]);
+	}
+	one = _mm_set1_epi32(1);
+
+	for(i=0;i<4;i++){
+		l[i] = cbc[i].l;
+		r[i] = cbc[i].r;
+	}
+	cl = _mm_loadu_si128((const __m128i *)l);
+	cr = _mm_loadu_si128((const __m128i *)r);
+
+	for(n=0;n<blocks;n++){
+		lanes_load(l, r, buf, 4, n*8);
+		sl = _mm_loadu_si128((const __m128i *)l);
+		sr = _mm_loadu_si128((const __m128i *)r);
+
+		vl = sl;
+		vr = sr;
+		for(i=0;i<round;i++){
+			LANES_DECRYPT_ROUND(SSE2, vl, vr, k, one);
+		}
+
+		_mm_storeu_si128((__m128i *)l, SSE2_XOR(vl, cl));
+		_mm_storeu_si128((__m128i *)r, SSE2_XOR(vr, cr));
+		lanes_save(buf, l, r, 4, n*8);
+
+		cl = sl;
+		cr = sr;
+	}
+
+	_mm_storeu_si128((__m128i *)l, cl);
+	_mm_storeu_si128((__m128i *)r, cr);
+	for(i=0;i<4;i++){
+		cbc[i].l = l[i];
+		cbc[i].r = r[i];
+	}
+}
+#endif
+
+#if defined(MULTI2_HAVE_AVX2)
+#define AVX2_ADD(a, b)  _mm256_add_epi32((a), (b))
+#define AVX2_SUB(a, b)  _mm256_sub_epi32((a), (b))
+#define AVX2_XOR(a, b)  _mm256_xor_si256((a), (b))
+#define AVX2_OR(a, b)   _mm256_or_si256((a), (b))
+#define AVX2_ROTL(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32-(n)))
+
+MULTI2_TARGET_AVX2
+static void core_decrypt_lanes_avx2(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks)
+{
+	int32_t i,n;
+
+	uint32_t l[8],r[8];
+	__m256i k[8],one;
+	__m256i vl,vr,sl,sr,cl,cr,t0,t1;
+
+	for(i=0;i<8;i++){
+		k[i] = _mm256_set1_epi32((int)w->key[i]);
+	}
+	one = _mm256_set1_epi32(1);
+
+	for(i=0;i<8;i++){
+		l[i] = cbc[i].l;
+		r[i] = cbc[i].r;
+	}
+	cl = _mm256_loadu_si256((const __m256i *)l);
+	cr = _mm256_loadu_si256((const __m256i *)r);
+
+	for(n=0;n<blocks;n++){
+		lanes_load(l, r, buf, 8, n*8);
+		sl = _mm256_loadu_si256((const __m256i *)l);
+		sr = _mm256_loadu_si256((const __m256i *)r);
+
+		vl = sl;
+		vr = sr;
+		for(i=0;i<round;i++){
+			LANES_DECRYPT_ROUND(AVX2, vl, vr, k, one);
+		}
+
+		_mm256_storeu_si256((__m256i *)l, AVX2_XOR(vl, cl));
+		_mm256_storeu_si256((__m256i *)r, AVX2_XOR(vr, cr));
+		lanes_save(buf, l, r, 8, n*8);
+
+		cl = sl;
+		cr = sr;
+	}
+
+	_mm256_storeu_si256((__m256i *)l, cl);
+	_mm256_storeu_si256((__m256i *)r, cr);
+	for(i=0;i<8;i++){
+		cbc[i].l = l[i];
+		cbc[i].r = r[i];
+	}
+}
+#endif
+
+#if defined(MULTI2_HAVE_NEON)
+#define NEON_ADD(a, b)  vaddq_u32((a), (b))
+#define NEON_SUB(a, b)  vsubq_u32((a), (b))
+#define NEON_XOR(a, b)  veorq_u32((a), (b))
+#define NEON_OR(a, b)   vorrq_u32((a), (b))
+#define NEON_ROTL(x, n) vorrq_u32(vshlq_n_u32((x), (n)), vshrq_n_u32((x), 32-(n)))
+
+static void core_decrypt_lanes_neon(CORE_DATA *cbc, CORE_PARAM *w, int32_t round, uint8_t **buf, int32_t blocks)
+{
+	int32_t i,n;
+
+	uint32_t l[4],r[4];
+	uint32x4_t k[8],one;
+	uint32x4_t vl,vr,sl,sr,cl,cr,t0,t1;
+
+	for(i=0;i<8;i++){
+		k[i] = vdupq_n_u32(w->key[i]);
+	}
+	one = vdupq_n_u32(1);
+
+	for(i=0;i<4;i++){
+		l[i] = cbc[i].l;
+		r[i] = cbc[i].r;
+	}
+	cl = vld1q_u32(l);
+	cr = vld1q_u32(r);
+
+	for(n=0;n<blocks;n++){
+		lanes_load(l, r, buf, 4, n*8);
+		sl = vld1q_u32(l);
+		sr = vld1q_u32(r);
+
+		vl = sl;
+		vr = sr;
+		for(i=0;i<round;i++){
+			LANES_DECRYPT_ROUND(NEON, vl, vr, k, one);
+		}
+
+		vst1q_u32(l, NEON_XOR(vl, cl));
+		vst1q_u32(r, NEON_XOR(vr, cr));
+		lanes_save(buf, l, r, 4, n*8);
+
+		cl = sl;
+		cr = sr;
+	}
+
+	vst1q_u32(l, cl);
+	vst1q_u32(r, cr);
+	for(i=0;i<4;i++){
+		cbc[i].l = l[i];
+		cbc[i].r = r[i];
+	}
+}
+#endif
@@ -20,6 +20,9 @@ typedef struct {
 	int (* encrypt)(void *m2, int32_t type, uint8_t *buf, int32_t size);
 	int (* decrypt)(void *m2, int32_t type, uint8_t *buf, int32_t size);
 
+	/* decrypt "count" independent payloads sharing one key and parity */
+	int (* decrypt_batch)(void *m2, int32_t type, uint8_t **buf, int32_t *size, int32_t count);
+
 } MULTI2;
 
 #ifdef __cplusplus
@@ -0,0 +1,195 @@
+/*****************************************************************************
+ * recorder.c: descrambled TS recording for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+
+#include <vlc_common.h>
+#include <vlc_demux.h>
+#include <vlc_input.h>
+#include <vlc_fs.h>
+
+#include "recorder.h"
+
+/* 64 KiB worth of packets per write */
+#define RECORDER_PACKETS 348
+#define RECORDER_BLOCK_SIZE (RECORDER_PACKETS * 188)
+/* Beyond this many pending blocks (64 MiB) the disk cannot keep up, drop
+ * rather than stalling the demuxer */
+#define RECORDER_FIFO_MAX 1024
+
+struct arib_recorder_t
+{
+    vlc_object_t *p_obj;
+    FILE         *f;
+
+    vlc_thread_t  thread;
+    block_fifo_t *p_fifo;
+
+    block_t      *p_block;     /* being filled by the demuxer */
+    bool          b_dropping;
+    bool          b_error;     /* writer thread only */
+};
+
+static void Write( arib_recorder_t *p_rec, block_t *p_block )
+{
+    const bool b_previous_error = p_rec->b_error;
+    const size_t i_written = fwrite( p_block->p_buffer, 1, p_block->i_buffer,
+                                     p_rec->f );
+
+    p_rec->b_error = i_written != p_block->i_buffer;
+    if( p_rec->b_error && !b_previous_error )
+        msg_Err( p_rec->p_obj, "Failed to record data (begin)" );
+    else if( !p_rec->b_error && b_previous_error )
+        msg_Err( p_rec->p_obj, "Failed to record data (end)" );
+
+    block_Release( p_block );
+}
+
+static void *Run( void *data )
+{
+    arib_recorder_t *p_rec = data;
+
+    for( ;; )
+    {
+        block_t *p_block = block_FifoGet( p_rec->p_fifo );
+
+        int canc = vlc_savecancel();
+        Write( p_rec, p_block );
+        vlc_restorecancel( canc );
+    }
+    return NULL;
+}
+
+arib_recorder_t *arib_recorder_New( demux_t *p_demux )
+{
+    arib_recorder_t *p_rec = malloc( sizeof(*p_rec) );
+    if( !p_rec )
+        return NULL;
+
+    char *psz_path = var_CreateGetNonEmptyString( p_demux, "input-record-path" );
+    if( !psz_path )
+        psz_path = config_GetUserDir( VLC_DOWNLOAD_DIR );
+    if( !psz_path )
+        goto error;
+
+    char *psz_file = input_CreateFilename( p_demux->p_input, psz_path,
+                                           INPUT_RECORD_PREFIX, "ts" );
+    free( psz_path );
+    if( !psz_file )
+        goto error;
+
+    p_rec->f = vlc_fopen( psz_file, "wb" );
+    if( !p_rec->f )
+    {
+        msg_Err( p_demux, "cannot record into %s: %s", psz_file,
+                 vlc_strerror_c(errno) );
+        free( psz_file );
+        goto error;
+    }
+
+    /* signal new record file */
+    var_SetString( p_demux->p_libvlc, "record-file", psz_file );
+    msg_Dbg( p_demux, "Recording descrambled stream into %s", psz_file );
+    free( psz_file );
+
+    p_rec->p_obj = VLC_OBJECT(p_demux);
+    p_rec->p_block = NULL;
+    p_rec->b_dropping = false;
+    p_rec->b_error = false;
+    p_rec->p_fifo = block_FifoNew();
+    if( !p_rec->p_fifo )
+    {
+        fclose( p_rec->f );
+        goto error;
+    }
+
+    if( vlc_clone( &p_rec->thread, Run, p_rec, VLC_THREAD_PRIORITY_LOW ) )
+    {
+        block_FifoRelease( p_rec->p_fifo );
+        fclose( p_rec->f );
+        goto error;
+    }
+    return p_rec;
+
+error:
+    free( p_rec );
+    return NULL;
+}
+
+void arib_recorder_Delete( arib_recorder_t *p_rec )
+{
+    arib_recorder_Flush( p_rec );
+
+    vlc_cancel( p_rec->thread );
+    vlc_join( p_rec->thread, NULL );
+
+    /* Complete the file with what the thread did not write yet */
+    while( block_FifoCount( p_rec->p_fifo ) > 0 )
+        Write( p_rec, block_FifoGet( p_rec->p_fifo ) );
+    block_FifoRelease( p_rec->p_fifo );
+
+    msg_Dbg( p_rec->p_obj, "Recording completed" );
+    fclose( p_rec->f );
+    free( p_rec );
+}
+
+uint8_t *arib_recorder_Append( arib_recorder_t *p_rec, const uint8_t *p_packet )
+{
+    block_t *p_block = p_rec->p_block;
+
+    if( !p_block )
+    {
+        p_block = p_rec->p_block = block_Alloc( RECORDER_BLOCK_SIZE );
+        if( !p_block )
+            return NULL;
+        p_block->i_buffer = 0;
+    }
+    else if( p_block->i_buffer + 188 > RECORDER_BLOCK_SIZE )
+        return NULL;
+
+    uint8_t *p_dst = &p_block->p_buffer[p_block->i_buffer];
+    memcpy( p_dst, p_packet, 188 );
+    p_block->i_buffer += 188;
+    return p_dst;
+}
+
+void arib_recorder_Flush( arib_recorder_t *p_rec )
+{
+    block_t *p_block = p_rec->p_block;
+
+    if( !p_block )
+        return;
+    p_rec->p_block = NULL;
+
+    if( block_FifoCount( p_rec->p_fifo ) >= RECORDER_FIFO_MAX )
+    {
+        if( !p_rec->b_dropping )
+            msg_Err( p_rec->p_obj, "recording too slow, dropping data" );
+        p_rec->b_dropping = true;
+        block_Release( p_block );
+        return;
+    }
+    p_rec->b_dropping = false;
+    block_FifoPut( p_rec->p_fifo, p_block );
+}
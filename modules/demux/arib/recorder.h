@@ -0,0 +1,42 @@
+/*****************************************************************************
+ * recorder.h: descrambled TS recording for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _ARIB_RECORDER_H
+#define _ARIB_RECORDER_H 1
+
+/**
+ * Records 188 bytes TS packets as the demuxer sees them once descrambled,
+ * unlike the record stream filter which stores the raw input. Packets are
+ * copied once into large blocks, which are written by a dedicated thread.
+ */
+typedef struct arib_recorder_t arib_recorder_t;
+
+arib_recorder_t *arib_recorder_New( demux_t * );
+void             arib_recorder_Delete( arib_recorder_t * );
+
+/* Copies a packet into the current block and returns its location there,
+ * which stays valid until the next arib_recorder_Flush(). Returns NULL
+ * when the block is full, the caller must flush it first. */
+uint8_t *arib_recorder_Append( arib_recorder_t *, const uint8_t *p_packet );
+
+/* Hands the filled packets over to the writer thread */
+void     arib_recorder_Flush( arib_recorder_t * );
+
+#endif /* _ARIB_RECORDER_H */
@@ -1,1250 +1,1615 @@
 #include <stdio.h>
+#include <string.h>
 #include "str.h"
 
+/* UTF-8 sequences of the JIS characters, computed at compile time so that
+ * decoding a character is a table lookup and a copy */
+struct utf8 {
+	unsigned char len;
+	unsigned char s[4];
+};
+
+#define U(c) { \
+	(c) == 0 ? 0 : (c) < 0x80 ? 1 : (c) < 0x800 ? 2 : (c) < 0x10000 ? 3 : 4, { \
+	(c) < 0x80 ? (c) : (c) < 0x800 ? 0xc0 | (c) >> 6 : \
+	(c) < 0x10000 ? 0xe0 | (c) >> 12 : 0xf0 | (c) >> 18, \
+	(c) < 0x800 ? 0x80 | ((c) & 0x3f) : (c) < 0x10000 ? \
+	0x80 | ((c) >> 6 & 0x3f) : 0x80 | ((c) >> 12 & 0x3f), \
+	(c) < 0x10000 ? 0x80 | ((c) & 0x3f) : 0x80 | ((c) >> 6 & 0x3f), \
+	0x80 | ((c) & 0x3f) } }
+
+enum charset {
+	CHARSET_KANJI,
+	CHARSET_ALNUM,
+	CHARSET_HIRAGANA,
+	CHARSET_KATAKANA,
+};
+
 struct decoder {
 	const unsigned char *buf;
-	size_t count;
+	const unsigned char *end;
 	char *ubuf;
-	size_t ucount;
-	int (*handle_gl)(struct decoder *, int);
-	int (*handle_gl_single)(struct decoder *, int);
-	int (*handle_gr)(struct decoder *, int);
-	int (*handle_g0)(struct decoder *, int);
-	int (*handle_g1)(struct decoder *, int);
-	int (*handle_g2)(struct decoder *, int);
-	int (*handle_g3)(struct decoder *, int);
+	char *uend;
+	enum charset g[4];	/* sets designated as G0..G3 */
+	int gl;			/* G set invoked in GL */
+	int gl_single;		/* single shifted G set, or -1 */
+	int gr;			/* G set invoked in GR */
 	int kanji_ku;
 };
 
-static int decoder_push(struct decoder *decoder, int uc)
-{
-	if (uc < 0)
-		return 0;
-
-	if (uc < 0x7f) {
-
-		if (decoder->ucount < 1)
-			return 0;
-
-		decoder->ubuf[0] = uc;
-
-		decoder->ubuf += 1;
-		decoder->ucount -= 1;
-
-	} else if (uc < 0x7ff) {
-
-		if (decoder->ucount < 2)
-			return 0;
-
-		decoder->ubuf[0] = 0xc0 | (uc >> 6);
-		decoder->ubuf[1] = 0x80 | (uc & 0x3f);
-
-		decoder->ubuf += 2;
-		decoder->ucount -= 2;
-
-	} else if (uc < 0xffff) {
-
-		if (decoder->ucount < 3)
-			return 0;
-
-		decoder->ubuf[0] = 0xe0 | (uc >> 12);
-		decoder->ubuf[1] = 0x80 | (uc >> 6 & 0x3f);
-		decoder->ubuf[2] = 0x80 | (uc & 0x3f);
-
-		decoder->ubuf += 3;
-		decoder->ucount -= 3;
+static const struct utf8 decoder_alnum_table[94] = {
+	U(0x0021), U(0x0022), U(0x0023), U(0x0024), U(0x0025), U(0x0026),
+	U(0x0027), U(0x0028), U(0x0029), U(0x002a), U(0x002b), U(0x002c),
+	U(0x002d), U(0x002e), U(0x002f), U(0x0030), U(0x0031), U(0x0032),
+	U(0x0033), U(0x0034), U(0x0035), U(0x0036), U(0x0037), U(0x0038),
+	U(0x0039), U(0x003a), U(0x003b), U(0x003c), U(0x003d), U(0x003e),
+	U(0x003f), U(0x0040), U(0x0041), U(0x0042), U(0x0043), U(0x0044),
+	U(0x0045), U(0x0046), U(0x0047), U(0x0048), U(0x0049), U(0x004a),
+	U(0x004b), U(0x004c), U(0x004d), U(0x004e), U(0x004f), U(0x0050),
+	U(0x0051), U(0x0052), U(0x0053), U(0x0054), U(0x0055), U(0x0056),
+	U(0x0057), U(0x0058), U(0x0059), U(0x005a), U(0x005b), U(0x00a5),
+	U(0x005d), U(0x005e), U(0x005f), U(0x0060), U(0x0061), U(0x0062),
+	U(0x0063), U(0x0064), U(0x0065), U(0x0066), U(0x0067), U(0x0068),
+	U(0x0069), U(0x006a), U(0x006b), U(0x006c), U(0x006d), U(0x006e),
+	U(0x006f), U(0x0070), U(0x0071), U(0x0072), U(0x0073), U(0x0074),
+	U(0x0075), U(0x0076), U(0x0077), U(0x0078), U(0x0079), U(0x007a),
+	U(0x007b), U(0x007c), U(0x007d), U(0x203e),
+};
 
-	} else if (uc < 0x1fffff) {
+static const struct utf8 decoder_hiragana_table[94] = {
+	U(0x3041), U(0x3042), U(0x3043), U(0x3044), U(0x3045), U(0x3046),
+	U(0x3047), U(0x3048), U(0x3049), U(0x304a), U(0x304b), U(0x304c),
+	U(0x304d), U(0x304e), U(0x304f), U(0x3050), U(0x3051), U(0x3052),
+	U(0x3053), U(0x3054), U(0x3055), U(0x3056), U(0x3057), U(0x3058),
+	U(0x3059), U(0x305a), U(0x305b), U(0x305c), U(0x305d), U(0x305e),
+	U(0x305f), U(0x3060), U(0x3061), U(0x3062), U(0x3063), U(0x3064),
+	U(0x3065), U(0x3066), U(0x3067), U(0x3068), U(0x3069), U(0x306a),
+	U(0x306b), U(0x306c), U(0x306d), U(0x306e), U(0x306f), U(0x3070),
+	U(0x3071), U(0x3072), U(0x3073), U(0x3074), U(0x3075), U(0x3076),
+	U(0x3077), U(0x3078), U(0x3079), U(0x307a), U(0x307b), U(0x307c),
+	U(0x307d), U(0x307e), U(0x307f), U(0x3080), U(0x3081), U(0x3082),
+	U(0x3083), U(0x3084), U(0x3085), U(0x3086), U(0x3087), U(0x3088),
+	U(0x3089), U(0x308a), U(0x308b), U(0x308c), U(0x308d), U(0x308e),
+	U(0x308f), U(0x3090), U(0x3091), U(0x3092), U(0x3093), U(0x3000),
+	U(0x3000), U(0x3000), U(0x309d), U(0x309e), U(0x30fc), U(0x3002),
+	U(0x300c), U(0x300d), U(0x3001), U(0x30fb),
+};
 
-		if (decoder->ucount < 4)
-			return 0;
+static const struct utf8 decoder_katakana_table[94] = {
+	U(0x30a1), U(0x30a2), U(0x30a3), U(0x30a4), U(0x30a5), U(0x30a6),
+	U(0x30a7), U(0x30a8), U(0x30a9), U(0x30aa), U(0x30ab), U(0x30ac),
+	U(0x30ad), U(0x30ae), U(0x30af), U(0x30b0), U(0x30b1), U(0x30b2),
+	U(0x30b3), U(0x30b4), U(0x30b5), U(0x30b6), U(0x30b7), U(0x30b8),
+	U(0x30b9), U(0x30ba), U(0x30bb), U(0x30bc), U(0x30bd), U(0x30be),
+	U(0x30bf), U(0x30c0), U(0x30c1), U(0x30c2), U(0x30c3), U(0x30c4),
+	U(0x30c5), U(0x30c6), U(0x30c7), U(0x30c8), U(0x30c9), U(0x30ca),
+	U(0x30cb), U(0x30cc), U(0x30cd), U(0x30ce), U(0x30cf), U(0x30d0),
+	U(0x30d1), U(0x30d2), U(0x30d3), U(0x30d4), U(0x30d5), U(0x30d6),
+	U(0x30d7), U(0x30d8), U(0x30d9), U(0x30da), U(0x30db), U(0x30dc),
+	U(0x30dd), U(0x30de), U(0x30df), U(0x30e0), U(0x30e1), U(0x30e2),
+	U(0x30e3), U(0x30e4), U(0x30e5), U(0x30e6), U(0x30e7), U(0x30e8),
+	U(0x30e9), U(0x30ea), U(0x30eb), U(0x30ec), U(0x30ed), U(0x30ee),
+	U(0x30ef), U(0x30f0), U(0x30f1), U(0x30f2), U(0x30f3), U(0x30f4),
+	U(0x30f5), U(0x30f6), U(0x30fd), U(0x30fe), U(0x30fc), U(0x3002),
+	U(0x300c), U(0x300d), U(0x3001), U(0x30fb),
+};
 
-		decoder->ubuf[0] = 0xf0 | (uc >> 18);
-		decoder->ubuf[1] = 0x80 | (uc >> 12 & 0x3f);
-		decoder->ubuf[2] = 0x80 | (uc >> 6 & 0x3f);
-		decoder->ubuf[3] = 0x80 | (uc & 0x3f);
+static const struct utf8 decoder_kanji_table[94][94] = {
+	{
+		U(0x3000), U(0x3001), U(0x3002), U(0xff0c), U(0xff0e), U(0x30fb),
+		U(0xff1a), U(0xff1b), U(0xff1f), U(0xff01), U(0x309b), U(0x309c),
+		U(0x00b4), U(0xff40), U(0x00a8), U(0xff3e), U(0xffe3), U(0xff3f),
+		U(0x30fd), U(0x30fe), U(0x309d), U(0x309e), U(0x3003), U(0x4edd),
+		U(0x3005), U(0x3006), U(0x3007), U(0x30fc), U(0x2015), U(0x2010),
+		U(0xff0f), U(0x005c), U(0x301c), U(0x2016), U(0xff5c), U(0x2026),
+		U(0x2025), U(0x2018), U(0x2019), U(0x201c), U(0x201d), U(0xff08),
+		U(0xff09), U(0x3014), U(0x3015), U(0xff3b), U(0xff3d), U(0xff5b),
+		U(0xff5d), U(0x3008), U(0x3009), U(0x300a), U(0x300b), U(0x300c),
+		U(0x300d), U(0x300e), U(0x300f), U(0x3010), U(0x3011), U(0xff0b),
+		U(0x2212), U(0x00b1), U(0x00d7), U(0x00f7), U(0xff1d), U(0x2260),
+		U(0xff1c), U(0xff1e), U(0x2266), U(0x2267), U(0x221e), U(0x2234),
+		U(0x2642), U(0x2640), U(0x00b0), U(0x2032), U(0x2033), U(0x2103),
+		U(0xffe5), U(0xff04), U(0x00a2), U(0x00a3), U(0xff05), U(0xff03),
+		U(0xff06), U(0xff0a), U(0xff20), U(0x00a7), U(0x2606), U(0x2605),
+		U(0x25cb), U(0x25cf), U(0x25ce), U(0x25c7),
+	},
+	{
+		U(0x25c6), U(0x25a1), U(0x25a0), U(0x25b3), U(0x25b2), U(0x25bd),
+		U(0x25bc), U(0x203b), U(0x3012), U(0x2192), U(0x2190), U(0x2191),
+		U(0x2193), U(0x3013), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x2208), U(0x220b), U(0x2286), U(0x2287), U(0x2282),
+		U(0x2283), U(0x222a), U(0x2229), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x2227),
+		U(0x2228), U(0x00ac), U(0x21d2), U(0x21d4), U(0x2200), U(0x2203),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x2220),
+		U(0x22a5), U(0x2312), U(0x2202), U(0x2207), U(0x2261), U(0x2252),
+		U(0x226a), U(0x226b), U(0x221a), U(0x223d), U(0x221d), U(0x2235),
+		U(0x222b), U(0x222c), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x212b), U(0x2030), U(0x266f),
+		U(0x266d), U(0x266a), U(0x2020), U(0x2021), U(0x00b6), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x25ef),
+	},
+	{
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0xff10), U(0xff11), U(0xff12),
+		U(0xff13), U(0xff14), U(0xff15), U(0xff16), U(0xff17), U(0xff18),
+		U(0xff19), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0xff21), U(0xff22), U(0xff23), U(0xff24),
+		U(0xff25), U(0xff26), U(0xff27), U(0xff28), U(0xff29), U(0xff2a),
+		U(0xff2b), U(0xff2c), U(0xff2d), U(0xff2e), U(0xff2f), U(0xff30),
+		U(0xff31), U(0xff32), U(0xff33), U(0xff34), U(0xff35), U(0xff36),
+		U(0xff37), U(0xff38), U(0xff39), U(0xff3a), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0xff41), U(0xff42),
+		U(0xff43), U(0xff44), U(0xff45), U(0xff46), U(0xff47), U(0xff48),
+		U(0xff49), U(0xff4a), U(0xff4b), U(0xff4c), U(0xff4d), U(0xff4e),
+		U(0xff4f), U(0xff50), U(0xff51), U(0xff52), U(0xff53), U(0xff54),
+		U(0xff55), U(0xff56), U(0xff57), U(0xff58), U(0xff59), U(0xff5a),
+	},
+	{
+		U(0x3041), U(0x3042), U(0x3043), U(0x3044), U(0x3045), U(0x3046),
+		U(0x3047), U(0x3048), U(0x3049), U(0x304a), U(0x304b), U(0x304c),
+		U(0x304d), U(0x304e), U(0x304f), U(0x3050), U(0x3051), U(0x3052),
+		U(0x3053), U(0x3054), U(0x3055), U(0x3056), U(0x3057), U(0x3058),
+		U(0x3059), U(0x305a), U(0x305b), U(0x305c), U(0x305d), U(0x305e),
+		U(0x305f), U(0x3060), U(0x3061), U(0x3062), U(0x3063), U(0x3064),
+		U(0x3065), U(0x3066), U(0x3067), U(0x3068), U(0x3069), U(0x306a),
+		U(0x306b), U(0x306c), U(0x306d), U(0x306e), U(0x306f), U(0x3070),
+		U(0x3071), U(0x3072), U(0x3073), U(0x3074), U(0x3075), U(0x3076),
+		U(0x3077), U(0x3078), U(0x3079), U(0x307a), U(0x307b), U(0x307c),
+		U(0x307d), U(0x307e), U(0x307f), U(0x3080), U(0x3081), U(0x3082),
+		U(0x3083), U(0x3084), U(0x3085), U(0x3086), U(0x3087), U(0x3088),
+		U(0x3089), U(0x308a), U(0x308b), U(0x308c), U(0x308d), U(0x308e),
+		U(0x308f), U(0x3090), U(0x3091), U(0x3092), U(0x3093),
+	},
+	{
+		U(0x30a1), U(0x30a2), U(0x30a3), U(0x30a4), U(0x30a5), U(0x30a6),
+		U(0x30a7), U(0x30a8), U(0x30a9), U(0x30aa), U(0x30ab), U(0x30ac),
+		U(0x30ad), U(0x30ae), U(0x30af), U(0x30b0), U(0x30b1), U(0x30b2),
+		U(0x30b3), U(0x30b4), U(0x30b5), U(0x30b6), U(0x30b7), U(0x30b8),
+		U(0x30b9), U(0x30ba), U(0x30bb), U(0x30bc), U(0x30bd), U(0x30be),
+		U(0x30bf), U(0x30c0), U(0x30c1), U(0x30c2), U(0x30c3), U(0x30c4),
+		U(0x30c5), U(0x30c6), U(0x30c7), U(0x30c8), U(0x30c9), U(0x30ca),
+		U(0x30cb), U(0x30cc), U(0x30cd), U(0x30ce), U(0x30cf), U(0x30d0),
+		U(0x30d1), U(0x30d2), U(0x30d3), U(0x30d4), U(0x30d5), U(0x30d6),
+		U(0x30d7), U(0x30d8), U(0x30d9), U(0x30da), U(0x30db), U(0x30dc),
+		U(0x30dd), U(0x30de), U(0x30df), U(0x30e0), U(0x30e1), U(0x30e2),
+		U(0x30e3), U(0x30e4), U(0x30e5), U(0x30e6), U(0x30e7), U(0x30e8),
+		U(0x30e9), U(0x30ea), U(0x30eb), U(0x30ec), U(0x30ed), U(0x30ee),
+		U(0x30ef), U(0x30f0), U(0x30f1), U(0x30f2), U(0x30f3), U(0x30f4),
+		U(0x30f5), U(0x30f6),
+	},
+	{
+		U(0x0391), U(0x0392), U(0x0393), U(0x0394), U(0x0395), U(0x0396),
+		U(0x0397), U(0x0398), U(0x0399), U(0x039a), U(0x039b), U(0x039c),
+		U(0x039d), U(0x039e), U(0x039f), U(0x03a0), U(0x03a1), U(0x03a3),
+		U(0x03a4), U(0x03a5), U(0x03a6), U(0x03a7), U(0x03a8), U(0x03a9),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x03b1), U(0x03b2), U(0x03b3), U(0x03b4),
+		U(0x03b5), U(0x03b6), U(0x03b7), U(0x03b8), U(0x03b9), U(0x03ba),
+		U(0x03bb), U(0x03bc), U(0x03bd), U(0x03be), U(0x03bf), U(0x03c0),
+		U(0x03c1), U(0x03c3), U(0x03c4), U(0x03c5), U(0x03c6), U(0x03c7),
+		U(0x03c8), U(0x03c9),
+	},
+	{
+		U(0x0410), U(0x0411), U(0x0412), U(0x0413), U(0x0414), U(0x0415),
+		U(0x0401), U(0x0416), U(0x0417), U(0x0418), U(0x0419), U(0x041a),
+		U(0x041b), U(0x041c), U(0x041d), U(0x041e), U(0x041f), U(0x0420),
+		U(0x0421), U(0x0422), U(0x0423), U(0x0424), U(0x0425), U(0x0426),
+		U(0x0427), U(0x0428), U(0x0429), U(0x042a), U(0x042b), U(0x042c),
+		U(0x042d), U(0x042e), U(0x042f), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0430), U(0x0431), U(0x0432), U(0x0433), U(0x0434), U(0x0435),
+		U(0x0451), U(0x0436), U(0x0437), U(0x0438), U(0x0439), U(0x043a),
+		U(0x043b), U(0x043c), U(0x043d), U(0x043e), U(0x043f), U(0x0440),
+		U(0x0441), U(0x0442), U(0x0443), U(0x0444), U(0x0445), U(0x0446),
+		U(0x0447), U(0x0448), U(0x0449), U(0x044a), U(0x044b), U(0x044c),
+		U(0x044d), U(0x044e), U(0x044f),
+	},
+	{
+		U(0x2500), U(0x2502), U(0x250c), U(0x2510), U(0x2518), U(0x2514),
+		U(0x251c), U(0x252c), U(0x2524), U(0x2534), U(0x253c), U(0x2501),
+		U(0x2503), U(0x250f), U(0x2513), U(0x251b), U(0x2517), U(0x2523),
+		U(0x2533), U(0x252b), U(0x253b), U(0x254b), U(0x2520), U(0x252f),
+		U(0x2528), U(0x2537), U(0x253f), U(0x251d), U(0x2530), U(0x2525),
+		U(0x2538), U(0x2542),
+	},
+	{
 
-		decoder->ubuf += 4;
-		decoder->ucount -= 4;
+	},
+	{
 
-	} else if (uc < 0x3ffffff) {
+	},
+	{
 
-		if (decoder->ucount < 5)
-			return 0;
+	},
+	{
 
-		decoder->ubuf[0] = 0xf8 | (uc >> 24);
-		decoder->ubuf[1] = 0x80 | (uc >> 18 & 0x3f);
-		decoder->ubuf[2] = 0x80 | (uc >> 12 & 0x3f);
-		decoder->ubuf[3] = 0x80 | (uc >> 6 & 0x3f);
-		decoder->ubuf[4] = 0x80 | (uc & 0x3f);
+	},
+	{
 
-		decoder->ubuf += 5;
-		decoder->ucount -= 5;
+	},
+	{
 
-	} else {
+	},
+	{
 
-		if (decoder->ucount < 6)
-			return 0;
+	},
+	{
+		U(0x4e9c), U(0x5516), U(0x5a03), U(0x963f), U(0x54c0), U(0x611b),
+		U(0x6328), U(0x59f6), U(0x9022), U(0x8475), U(0x831c), U(0x7a50),
+		U(0x60aa), U(0x63e1), U(0x6e25), U(0x65ed), U(0x8466), U(0x82a6),
+		U(0x9bf5), U(0x6893), U(0x5727), U(0x65a1), U(0x6271), U(0x5b9b),
+		U(0x59d0), U(0x867b), U(0x98f4), U(0x7d62), U(0x7dbe), U(0x9b8e),
+		U(0x6216), U(0x7c9f), U(0x88b7), U(0x5b89), U(0x5eb5), U(0x6309),
+		U(0x6697), U(0x6848), U(0x95c7), U(0x978d), U(0x674f), U(0x4ee5),
+		U(0x4f0a), U(0x4f4d), U(0x4f9d), U(0x5049), U(0x56f2), U(0x5937),
+		U(0x59d4), U(0x5a01), U(0x5c09), U(0x60df), U(0x610f), U(0x6170),
+		U(0x6613), U(0x6905), U(0x70ba), U(0x754f), U(0x7570), U(0x79fb),
+		U(0x7dad), U(0x7def), U(0x80c3), U(0x840e), U(0x8863), U(0x8b02),
+		U(0x9055), U(0x907a), U(0x533b), U(0x4e95), U(0x4ea5), U(0x57df),
+		U(0x80b2), U(0x90c1), U(0x78ef), U(0x4e00), U(0x58f1), U(0x6ea2),
+		U(0x9038), U(0x7a32), U(0x8328), U(0x828b), U(0x9c2f), U(0x5141),
+		U(0x5370), U(0x54bd), U(0x54e1), U(0x56e0), U(0x59fb), U(0x5f15),
+		U(0x98f2), U(0x6deb), U(0x80e4), U(0x852d),
+	},
+	{
+		U(0x9662), U(0x9670), U(0x96a0), U(0x97fb), U(0x540b), U(0x53f3),
+		U(0x5b87), U(0x70cf), U(0x7fbd), U(0x8fc2), U(0x96e8), U(0x536f),
+		U(0x9d5c), U(0x7aba), U(0x4e11), U(0x7893), U(0x81fc), U(0x6e26),
+		U(0x5618), U(0x5504), U(0x6b1d), U(0x851a), U(0x9c3b), U(0x59e5),
+		U(0x53a9), U(0x6d66), U(0x74dc), U(0x958f), U(0x5642), U(0x4e91),
+		U(0x904b), U(0x96f2), U(0x834f), U(0x990c), U(0x53e1), U(0x55b6),
+		U(0x5b30), U(0x5f71), U(0x6620), U(0x66f3), U(0x6804), U(0x6c38),
+		U(0x6cf3), U(0x6d29), U(0x745b), U(0x76c8), U(0x7a4e), U(0x9834),
+		U(0x82f1), U(0x885b), U(0x8a60), U(0x92ed), U(0x6db2), U(0x75ab),
+		U(0x76ca), U(0x99c5), U(0x60a6), U(0x8b01), U(0x8d8a), U(0x95b2),
+		U(0x698e), U(0x53ad), U(0x5186), U(0x5712), U(0x5830), U(0x5944),
+		U(0x5bb4), U(0x5ef6), U(0x6028), U(0x63a9), U(0x63f4), U(0x6cbf),
+		U(0x6f14), U(0x708e), U(0x7114), U(0x7159), U(0x71d5), U(0x733f),
+		U(0x7e01), U(0x8276), U(0x82d1), U(0x8597), U(0x9060), U(0x925b),
+		U(0x9d1b), U(0x5869), U(0x65bc), U(0x6c5a), U(0x7525), U(0x51f9),
+		U(0x592e), U(0x5965), U(0x5f80), U(0x5fdc),
+	},
+	{
+		U(0x62bc), U(0x65fa), U(0x6a2a), U(0x6b27), U(0x6bb4), U(0x738b),
+		U(0x7fc1), U(0x8956), U(0x9d2c), U(0x9d0e), U(0x9ec4), U(0x5ca1),
+		U(0x6c96), U(0x837b), U(0x5104), U(0x5c4b), U(0x61b6), U(0x81c6),
+		U(0x6876), U(0x7261), U(0x4e59), U(0x4ffa), U(0x5378), U(0x6069),
+		U(0x6e29), U(0x7a4f), U(0x97f3), U(0x4e0b), U(0x5316), U(0x4eee),
+		U(0x4f55), U(0x4f3d), U(0x4fa1), U(0x4f73), U(0x52a0), U(0x53ef),
+		U(0x5609), U(0x590f), U(0x5ac1), U(0x5bb6), U(0x5be1), U(0x79d1),
+		U(0x6687), U(0x679c), U(0x67b6), U(0x6b4c), U(0x6cb3), U(0x706b),
+		U(0x73c2), U(0x798d), U(0x79be), U(0x7a3c), U(0x7b87), U(0x82b1),
+		U(0x82db), U(0x8304), U(0x8377), U(0x83ef), U(0x83d3), U(0x8766),
+		U(0x8ab2), U(0x5629), U(0x8ca8), U(0x8fe6), U(0x904e), U(0x971e),
+		U(0x868a), U(0x4fc4), U(0x5ce8), U(0x6211), U(0x7259), U(0x753b),
+		U(0x81e5), U(0x82bd), U(0x86fe), U(0x8cc0), U(0x96c5), U(0x9913),
+		U(0x99d5), U(0x4ecb), U(0x4f1a), U(0x89e3), U(0x56de), U(0x584a),
+		U(0x58ca), U(0x5efb), U(0x5feb), U(0x602a), U(0x6094), U(0x6062),
+		U(0x61d0), U(0x6212), U(0x62d0), U(0x6539),
+	},
+	{
+		U(0x9b41), U(0x6666), U(0x68b0), U(0x6d77), U(0x7070), U(0x754c),
+		U(0x7686), U(0x7d75), U(0x82a5), U(0x87f9), U(0x958b), U(0x968e),
+		U(0x8c9d), U(0x51f1), U(0x52be), U(0x5916), U(0x54b3), U(0x5bb3),
+		U(0x5d16), U(0x6168), U(0x6982), U(0x6daf), U(0x788d), U(0x84cb),
+		U(0x8857), U(0x8a72), U(0x93a7), U(0x9ab8), U(0x6d6c), U(0x99a8),
+		U(0x86d9), U(0x57a3), U(0x67ff), U(0x86ce), U(0x920e), U(0x5283),
+		U(0x5687), U(0x5404), U(0x5ed3), U(0x62e1), U(0x64b9), U(0x683c),
+		U(0x6838), U(0x6bbb), U(0x7372), U(0x78ba), U(0x7a6b), U(0x899a),
+		U(0x89d2), U(0x8d6b), U(0x8f03), U(0x90ed), U(0x95a3), U(0x9694),
+		U(0x9769), U(0x5b66), U(0x5cb3), U(0x697d), U(0x984d), U(0x984e),
+		U(0x639b), U(0x7b20), U(0x6a2b), U(0x6a7f), U(0x68b6), U(0x9c0d),
+		U(0x6f5f), U(0x5272), U(0x559d), U(0x6070), U(0x62ec), U(0x6d3b),
+		U(0x6e07), U(0x6ed1), U(0x845b), U(0x8910), U(0x8f44), U(0x4e14),
+		U(0x9c39), U(0x53f6), U(0x691b), U(0x6a3a), U(0x9784), U(0x682a),
+		U(0x515c), U(0x7ac3), U(0x84b2), U(0x91dc), U(0x938c), U(0x565b),
+		U(0x9d28), U(0x6822), U(0x8305), U(0x8431),
+	},
+	{
+		U(0x7ca5), U(0x5208), U(0x82c5), U(0x74e6), U(0x4e7e), U(0x4f83),
+		U(0x51a0), U(0x5bd2), U(0x520a), U(0x52d8), U(0x52e7), U(0x5dfb),
+		U(0x559a), U(0x582a), U(0x59e6), U(0x5b8c), U(0x5b98), U(0x5bdb),
+		U(0x5e72), U(0x5e79), U(0x60a3), U(0x611f), U(0x6163), U(0x61be),
+		U(0x63db), U(0x6562), U(0x67d1), U(0x6853), U(0x68fa), U(0x6b3e),
+		U(0x6b53), U(0x6c57), U(0x6f22), U(0x6f97), U(0x6f45), U(0x74b0),
+		U(0x7518), U(0x76e3), U(0x770b), U(0x7aff), U(0x7ba1), U(0x7c21),
+		U(0x7de9), U(0x7f36), U(0x7ff0), U(0x809d), U(0x8266), U(0x839e),
+		U(0x89b3), U(0x8acc), U(0x8cab), U(0x9084), U(0x9451), U(0x9593),
+		U(0x9591), U(0x95a2), U(0x9665), U(0x97d3), U(0x9928), U(0x8218),
+		U(0x4e38), U(0x542b), U(0x5cb8), U(0x5dcc), U(0x73a9), U(0x764c),
+		U(0x773c), U(0x5ca9), U(0x7feb), U(0x8d0b), U(0x96c1), U(0x9811),
+		U(0x9854), U(0x9858), U(0x4f01), U(0x4f0e), U(0x5371), U(0x559c),
+		U(0x5668), U(0x57fa), U(0x5947), U(0x5b09), U(0x5bc4), U(0x5c90),
+		U(0x5e0c), U(0x5e7e), U(0x5fcc), U(0x63ee), U(0x673a), U(0x65d7),
+		U(0x65e2), U(0x671f), U(0x68cb), U(0x68c4),
+	},
+	{
+		U(0x6a5f), U(0x5e30), U(0x6bc5), U(0x6c17), U(0x6c7d), U(0x757f),
+		U(0x7948), U(0x5b63), U(0x7a00), U(0x7d00), U(0x5fbd), U(0x898f),
+		U(0x8a18), U(0x8cb4), U(0x8d77), U(0x8ecc), U(0x8f1d), U(0x98e2),
+		U(0x9a0e), U(0x9b3c), U(0x4e80), U(0x507d), U(0x5100), U(0x5993),
+		U(0x5b9c), U(0x622f), U(0x6280), U(0x64ec), U(0x6b3a), U(0x72a0),
+		U(0x7591), U(0x7947), U(0x7fa9), U(0x87fb), U(0x8abc), U(0x8b70),
+		U(0x63ac), U(0x83ca), U(0x97a0), U(0x5409), U(0x5403), U(0x55ab),
+		U(0x6854), U(0x6a58), U(0x8a70), U(0x7827), U(0x6775), U(0x9ecd),
+		U(0x5374), U(0x5ba2), U(0x811a), U(0x8650), U(0x9006), U(0x4e18),
+		U(0x4e45), U(0x4ec7), U(0x4f11), U(0x53ca), U(0x5438), U(0x5bae),
+		U(0x5f13), U(0x6025), U(0x6551), U(0x673d), U(0x6c42), U(0x6c72),
+		U(0x6ce3), U(0x7078), U(0x7403), U(0x7a76), U(0x7aae), U(0x7b08),
+		U(0x7d1a), U(0x7cfe), U(0x7d66), U(0x65e7), U(0x725b), U(0x53bb),
+		U(0x5c45), U(0x5de8), U(0x62d2), U(0x62e0), U(0x6319), U(0x6e20),
+		U(0x865a), U(0x8a31), U(0x8ddd), U(0x92f8), U(0x6f01), U(0x79a6),
+		U(0x9b5a), U(0x4ea8), U(0x4eab), U(0x4eac),
+	},
+	{
+		U(0x4f9b), U(0x4fa0), U(0x50d1), U(0x5147), U(0x7af6), U(0x5171),
+		U(0x51f6), U(0x5354), U(0x5321), U(0x537f), U(0x53eb), U(0x55ac),
+		U(0x5883), U(0x5ce1), U(0x5f37), U(0x5f4a), U(0x602f), U(0x6050),
+		U(0x606d), U(0x631f), U(0x6559), U(0x6a4b), U(0x6cc1), U(0x72c2),
+		U(0x72ed), U(0x77ef), U(0x80f8), U(0x8105), U(0x8208), U(0x854e),
+		U(0x90f7), U(0x93e1), U(0x97ff), U(0x9957), U(0x9a5a), U(0x4ef0),
+		U(0x51dd), U(0x5c2d), U(0x6681), U(0x696d), U(0x5c40), U(0x66f2),
+		U(0x6975), U(0x7389), U(0x6850), U(0x7c81), U(0x50c5), U(0x52e4),
+		U(0x5747), U(0x5dfe), U(0x9326), U(0x65a4), U(0x6b23), U(0x6b3d),
+		U(0x7434), U(0x7981), U(0x79bd), U(0x7b4b), U(0x7dca), U(0x82b9),
+		U(0x83cc), U(0x887f), U(0x895f), U(0x8b39), U(0x8fd1), U(0x91d1),
+		U(0x541f), U(0x9280), U(0x4e5d), U(0x5036), U(0x53e5), U(0x533a),
+		U(0x72d7), U(0x7396), U(0x77e9), U(0x82e6), U(0x8eaf), U(0x99c6),
+		U(0x99c8), U(0x99d2), U(0x5177), U(0x611a), U(0x865e), U(0x55b0),
+		U(0x7a7a), U(0x5076), U(0x5bd3), U(0x9047), U(0x9685), U(0x4e32),
+		U(0x6adb), U(0x91e7), U(0x5c51), U(0x5c48),
+	},
+	{
+		U(0x6398), U(0x7a9f), U(0x6c93), U(0x9774), U(0x8f61), U(0x7aaa),
+		U(0x718a), U(0x9688), U(0x7c82), U(0x6817), U(0x7e70), U(0x6851),
+		U(0x936c), U(0x52f2), U(0x541b), U(0x85ab), U(0x8a13), U(0x7fa4),
+		U(0x8ecd), U(0x90e1), U(0x5366), U(0x8888), U(0x7941), U(0x4fc2),
+		U(0x50be), U(0x5211), U(0x5144), U(0x5553), U(0x572d), U(0x73ea),
+		U(0x578b), U(0x5951), U(0x5f62), U(0x5f84), U(0x6075), U(0x6176),
+		U(0x6167), U(0x61a9), U(0x63b2), U(0x643a), U(0x656c), U(0x666f),
+		U(0x6842), U(0x6e13), U(0x7566), U(0x7a3d), U(0x7cfb), U(0x7d4c),
+		U(0x7d99), U(0x7e4b), U(0x7f6b), U(0x830e), U(0x834a), U(0x86cd),
+		U(0x8a08), U(0x8a63), U(0x8b66), U(0x8efd), U(0x981a), U(0x9d8f),
+		U(0x82b8), U(0x8fce), U(0x9be8), U(0x5287), U(0x621f), U(0x6483),
+		U(0x6fc0), U(0x9699), U(0x6841), U(0x5091), U(0x6b20), U(0x6c7a),
+		U(0x6f54), U(0x7a74), U(0x7d50), U(0x8840), U(0x8a23), U(0x6708),
+		U(0x4ef6), U(0x5039), U(0x5026), U(0x5065), U(0x517c), U(0x5238),
+		U(0x5263), U(0x55a7), U(0x570f), U(0x5805), U(0x5acc), U(0x5efa),
+		U(0x61b2), U(0x61f8), U(0x62f3), U(0x6372),
+	},
+	{
+		U(0x691c), U(0x6a29), U(0x727d), U(0x72ac), U(0x732e), U(0x7814),
+		U(0x786f), U(0x7d79), U(0x770c), U(0x80a9), U(0x898b), U(0x8b19),
+		U(0x8ce2), U(0x8ed2), U(0x9063), U(0x9375), U(0x967a), U(0x9855),
+		U(0x9a13), U(0x9e78), U(0x5143), U(0x539f), U(0x53b3), U(0x5e7b),
+		U(0x5f26), U(0x6e1b), U(0x6e90), U(0x7384), U(0x73fe), U(0x7d43),
+		U(0x8237), U(0x8a00), U(0x8afa), U(0x9650), U(0x4e4e), U(0x500b),
+		U(0x53e4), U(0x547c), U(0x56fa), U(0x59d1), U(0x5b64), U(0x5df1),
+		U(0x5eab), U(0x5f27), U(0x6238), U(0x6545), U(0x67af), U(0x6e56),
+		U(0x72d0), U(0x7cca), U(0x88b4), U(0x80a1), U(0x80e1), U(0x83f0),
+		U(0x864e), U(0x8a87), U(0x8de8), U(0x9237), U(0x96c7), U(0x9867),
+		U(0x9f13), U(0x4e94), U(0x4e92), U(0x4f0d), U(0x5348), U(0x5449),
+		U(0x543e), U(0x5a2f), U(0x5f8c), U(0x5fa1), U(0x609f), U(0x68a7),
+		U(0x6a8e), U(0x745a), U(0x7881), U(0x8a9e), U(0x8aa4), U(0x8b77),
+		U(0x9190), U(0x4e5e), U(0x9bc9), U(0x4ea4), U(0x4f7c), U(0x4faf),
+		U(0x5019), U(0x5016), U(0x5149), U(0x516c), U(0x529f), U(0x52b9),
+		U(0x52fe), U(0x539a), U(0x53e3), U(0x5411),
+	},
+	{
+		U(0x540e), U(0x5589), U(0x5751), U(0x57a2), U(0x597d), U(0x5b54),
+		U(0x5b5d), U(0x5b8f), U(0x5de5), U(0x5de7), U(0x5df7), U(0x5e78),
+		U(0x5e83), U(0x5e9a), U(0x5eb7), U(0x5f18), U(0x6052), U(0x614c),
+		U(0x6297), U(0x62d8), U(0x63a7), U(0x653b), U(0x6602), U(0x6643),
+		U(0x66f4), U(0x676d), U(0x6821), U(0x6897), U(0x69cb), U(0x6c5f),
+		U(0x6d2a), U(0x6d69), U(0x6e2f), U(0x6e9d), U(0x7532), U(0x7687),
+		U(0x786c), U(0x7a3f), U(0x7ce0), U(0x7d05), U(0x7d18), U(0x7d5e),
+		U(0x7db1), U(0x8015), U(0x8003), U(0x80af), U(0x80b1), U(0x8154),
+		U(0x818f), U(0x822a), U(0x8352), U(0x884c), U(0x8861), U(0x8b1b),
+		U(0x8ca2), U(0x8cfc), U(0x90ca), U(0x9175), U(0x9271), U(0x783f),
+		U(0x92fc), U(0x95a4), U(0x964d), U(0x9805), U(0x9999), U(0x9ad8),
+		U(0x9d3b), U(0x525b), U(0x52ab), U(0x53f7), U(0x5408), U(0x58d5),
+		U(0x62f7), U(0x6fe0), U(0x8c6a), U(0x8f5f), U(0x9eb9), U(0x514b),
+		U(0x523b), U(0x544a), U(0x56fd), U(0x7a40), U(0x9177), U(0x9d60),
+		U(0x9ed2), U(0x7344), U(0x6f09), U(0x8170), U(0x7511), U(0x5ffd),
+		U(0x60da), U(0x9aa8), U(0x72db), U(0x8fbc),
+	},
+	{
+		U(0x6b64), U(0x9803), U(0x4eca), U(0x56f0), U(0x5764), U(0x58be),
+		U(0x5a5a), U(0x6068), U(0x61c7), U(0x660f), U(0x6606), U(0x6839),
+		U(0x68b1), U(0x6df7), U(0x75d5), U(0x7d3a), U(0x826e), U(0x9b42),
+		U(0x4e9b), U(0x4f50), U(0x53c9), U(0x5506), U(0x5d6f), U(0x5de6),
+		U(0x5dee), U(0x67fb), U(0x6c99), U(0x7473), U(0x7802), U(0x8a50),
+		U(0x9396), U(0x88df), U(0x5750), U(0x5ea7), U(0x632b), U(0x50b5),
+		U(0x50ac), U(0x518d), U(0x6700), U(0x54c9), U(0x585e), U(0x59bb),
+		U(0x5bb0), U(0x5f69), U(0x624d), U(0x63a1), U(0x683d), U(0x6b73),
+		U(0x6e08), U(0x707d), U(0x91c7), U(0x7280), U(0x7815), U(0x7826),
+		U(0x796d), U(0x658e), U(0x7d30), U(0x83dc), U(0x88c1), U(0x8f09),
+		U(0x969b), U(0x5264), U(0x5728), U(0x6750), U(0x7f6a), U(0x8ca1),
+		U(0x51b4), U(0x5742), U(0x962a), U(0x583a), U(0x698a), U(0x80b4),
+		U(0x54b2), U(0x5d0e), U(0x57fc), U(0x7895), U(0x9dfa), U(0x4f5c),
+		U(0x524a), U(0x548b), U(0x643e), U(0x6628), U(0x6714), U(0x67f5),
+		U(0x7a84), U(0x7b56), U(0x7d22), U(0x932f), U(0x685c), U(0x9bad),
+		U(0x7b39), U(0x5319), U(0x518a), U(0x5237),
+	},
+	{
+		U(0x5bdf), U(0x62f6), U(0x64ae), U(0x64e6), U(0x672d), U(0x6bba),
+		U(0x85a9), U(0x96d1), U(0x7690), U(0x9bd6), U(0x634c), U(0x9306),
+		U(0x9bab), U(0x76bf), U(0x6652), U(0x4e09), U(0x5098), U(0x53c2),
+		U(0x5c71), U(0x60e8), U(0x6492), U(0x6563), U(0x685f), U(0x71e6),
+		U(0x73ca), U(0x7523), U(0x7b97), U(0x7e82), U(0x8695), U(0x8b83),
+		U(0x8cdb), U(0x9178), U(0x9910), U(0x65ac), U(0x66ab), U(0x6b8b),
+		U(0x4ed5), U(0x4ed4), U(0x4f3a), U(0x4f7f), U(0x523a), U(0x53f8),
+		U(0x53f2), U(0x55e3), U(0x56db), U(0x58eb), U(0x59cb), U(0x59c9),
+		U(0x59ff), U(0x5b50), U(0x5c4d), U(0x5e02), U(0x5e2b), U(0x5fd7),
+		U(0x601d), U(0x6307), U(0x652f), U(0x5b5c), U(0x65af), U(0x65bd),
+		U(0x65e8), U(0x679d), U(0x6b62), U(0x6b7b), U(0x6c0f), U(0x7345),
+		U(0x7949), U(0x79c1), U(0x7cf8), U(0x7d19), U(0x7d2b), U(0x80a2),
+		U(0x8102), U(0x81f3), U(0x8996), U(0x8a5e), U(0x8a69), U(0x8a66),
+		U(0x8a8c), U(0x8aee), U(0x8cc7), U(0x8cdc), U(0x96cc), U(0x98fc),
+		U(0x6b6f), U(0x4e8b), U(0x4f3c), U(0x4f8d), U(0x5150), U(0x5b57),
+		U(0x5bfa), U(0x6148), U(0x6301), U(0x6642),
+	},
+	{
+		U(0x6b21), U(0x6ecb), U(0x6cbb), U(0x723e), U(0x74bd), U(0x75d4),
+		U(0x78c1), U(0x793a), U(0x800c), U(0x8033), U(0x81ea), U(0x8494),
+		U(0x8f9e), U(0x6c50), U(0x9e7f), U(0x5f0f), U(0x8b58), U(0x9d2b),
+		U(0x7afa), U(0x8ef8), U(0x5b8d), U(0x96eb), U(0x4e03), U(0x53f1),
+		U(0x57f7), U(0x5931), U(0x5ac9), U(0x5ba4), U(0x6089), U(0x6e7f),
+		U(0x6f06), U(0x75be), U(0x8cea), U(0x5b9f), U(0x8500), U(0x7be0),
+		U(0x5072), U(0x67f4), U(0x829d), U(0x5c61), U(0x854a), U(0x7e1e),
+		U(0x820e), U(0x5199), U(0x5c04), U(0x6368), U(0x8d66), U(0x659c),
+		U(0x716e), U(0x793e), U(0x7d17), U(0x8005), U(0x8b1d), U(0x8eca),
+		U(0x906e), U(0x86c7), U(0x90aa), U(0x501f), U(0x52fa), U(0x5c3a),
+		U(0x6753), U(0x707c), U(0x7235), U(0x914c), U(0x91c8), U(0x932b),
+		U(0x82e5), U(0x5bc2), U(0x5f31), U(0x60f9), U(0x4e3b), U(0x53d6),
+		U(0x5b88), U(0x624b), U(0x6731), U(0x6b8a), U(0x72e9), U(0x73e0),
+		U(0x7a2e), U(0x816b), U(0x8da3), U(0x9152), U(0x9996), U(0x5112),
+		U(0x53d7), U(0x546a), U(0x5bff), U(0x6388), U(0x6a39), U(0x7dac),
+		U(0x9700), U(0x56da), U(0x53ce), U(0x5468),
+	},
+	{
+		U(0x5b97), U(0x5c31), U(0x5dde), U(0x4fee), U(0x6101), U(0x62fe),
+		U(0x6d32), U(0x79c0), U(0x79cb), U(0x7d42), U(0x7e4d), U(0x7fd2),
+		U(0x81ed), U(0x821f), U(0x8490), U(0x8846), U(0x8972), U(0x8b90),
+		U(0x8e74), U(0x8f2f), U(0x9031), U(0x914b), U(0x916c), U(0x96c6),
+		U(0x919c), U(0x4ec0), U(0x4f4f), U(0x5145), U(0x5341), U(0x5f93),
+		U(0x620e), U(0x67d4), U(0x6c41), U(0x6e0b), U(0x7363), U(0x7e26),
+		U(0x91cd), U(0x9283), U(0x53d4), U(0x5919), U(0x5bbf), U(0x6dd1),
+		U(0x795d), U(0x7e2e), U(0x7c9b), U(0x587e), U(0x719f), U(0x51fa),
+		U(0x8853), U(0x8ff0), U(0x4fca), U(0x5cfb), U(0x6625), U(0x77ac),
+		U(0x7ae3), U(0x821c), U(0x99ff), U(0x51c6), U(0x5faa), U(0x65ec),
+		U(0x696f), U(0x6b89), U(0x6df3), U(0x6e96), U(0x6f64), U(0x76fe),
+		U(0x7d14), U(0x5de1), U(0x9075), U(0x9187), U(0x9806), U(0x51e6),
+		U(0x521d), U(0x6240), U(0x6691), U(0x66d9), U(0x6e1a), U(0x5eb6),
+		U(0x7dd2), U(0x7f72), U(0x66f8), U(0x85af), U(0x85f7), U(0x8af8),
+		U(0x52a9), U(0x53d9), U(0x5973), U(0x5e8f), U(0x5f90), U(0x6055),
+		U(0x92e4), U(0x9664), U(0x50b7), U(0x511f),
+	},
+	{
+		U(0x52dd), U(0x5320), U(0x5347), U(0x53ec), U(0x54e8), U(0x5546),
+		U(0x5531), U(0x5617), U(0x5968), U(0x59be), U(0x5a3c), U(0x5bb5),
+		U(0x5c06), U(0x5c0f), U(0x5c11), U(0x5c1a), U(0x5e84), U(0x5e8a),
+		U(0x5ee0), U(0x5f70), U(0x627f), U(0x6284), U(0x62db), U(0x638c),
+		U(0x6377), U(0x6607), U(0x660c), U(0x662d), U(0x6676), U(0x677e),
+		U(0x68a2), U(0x6a1f), U(0x6a35), U(0x6cbc), U(0x6d88), U(0x6e09),
+		U(0x6e58), U(0x713c), U(0x7126), U(0x7167), U(0x75c7), U(0x7701),
+		U(0x785d), U(0x7901), U(0x7965), U(0x79f0), U(0x7ae0), U(0x7b11),
+		U(0x7ca7), U(0x7d39), U(0x8096), U(0x83d6), U(0x848b), U(0x8549),
+		U(0x885d), U(0x88f3), U(0x8a1f), U(0x8a3c), U(0x8a54), U(0x8a73),
+		U(0x8c61), U(0x8cde), U(0x91a4), U(0x9266), U(0x937e), U(0x9418),
+		U(0x969c), U(0x9798), U(0x4e0a), U(0x4e08), U(0x4e1e), U(0x4e57),
+		U(0x5197), U(0x5270), U(0x57ce), U(0x5834), U(0x58cc), U(0x5b22),
+		U(0x5e38), U(0x60c5), U(0x64fe), U(0x6761), U(0x6756), U(0x6d44),
+		U(0x72b6), U(0x7573), U(0x7a63), U(0x84b8), U(0x8b72), U(0x91b8),
+		U(0x9320), U(0x5631), U(0x57f4), U(0x98fe),
+	},
+	{
+		U(0x62ed), U(0x690d), U(0x6b96), U(0x71ed), U(0x7e54), U(0x8077),
+		U(0x8272), U(0x89e6), U(0x98df), U(0x8755), U(0x8fb1), U(0x5c3b),
+		U(0x4f38), U(0x4fe1), U(0x4fb5), U(0x5507), U(0x5a20), U(0x5bdd),
+		U(0x5be9), U(0x5fc3), U(0x614e), U(0x632f), U(0x65b0), U(0x664b),
+		U(0x68ee), U(0x699b), U(0x6d78), U(0x6df1), U(0x7533), U(0x75b9),
+		U(0x771f), U(0x795e), U(0x79e6), U(0x7d33), U(0x81e3), U(0x82af),
+		U(0x85aa), U(0x89aa), U(0x8a3a), U(0x8eab), U(0x8f9b), U(0x9032),
+		U(0x91dd), U(0x9707), U(0x4eba), U(0x4ec1), U(0x5203), U(0x5875),
+		U(0x58ec), U(0x5c0b), U(0x751a), U(0x5c3d), U(0x814e), U(0x8a0a),
+		U(0x8fc5), U(0x9663), U(0x976d), U(0x7b25), U(0x8acf), U(0x9808),
+		U(0x9162), U(0x56f3), U(0x53a8), U(0x9017), U(0x5439), U(0x5782),
+		U(0x5e25), U(0x63a8), U(0x6c34), U(0x708a), U(0x7761), U(0x7c8b),
+		U(0x7fe0), U(0x8870), U(0x9042), U(0x9154), U(0x9310), U(0x9318),
+		U(0x968f), U(0x745e), U(0x9ac4), U(0x5d07), U(0x5d69), U(0x6570),
+		U(0x67a2), U(0x8da8), U(0x96db), U(0x636e), U(0x6749), U(0x6919),
+		U(0x83c5), U(0x9817), U(0x96c0), U(0x88fe),
+	},
+	{
+		U(0x6f84), U(0x647a), U(0x5bf8), U(0x4e16), U(0x702c), U(0x755d),
+		U(0x662f), U(0x51c4), U(0x5236), U(0x52e2), U(0x59d3), U(0x5f81),
+		U(0x6027), U(0x6210), U(0x653f), U(0x6574), U(0x661f), U(0x6674),
+		U(0x68f2), U(0x6816), U(0x6b63), U(0x6e05), U(0x7272), U(0x751f),
+		U(0x76db), U(0x7cbe), U(0x8056), U(0x58f0), U(0x88fd), U(0x897f),
+		U(0x8aa0), U(0x8a93), U(0x8acb), U(0x901d), U(0x9192), U(0x9752),
+		U(0x9759), U(0x6589), U(0x7a0e), U(0x8106), U(0x96bb), U(0x5e2d),
+		U(0x60dc), U(0x621a), U(0x65a5), U(0x6614), U(0x6790), U(0x77f3),
+		U(0x7a4d), U(0x7c4d), U(0x7e3e), U(0x810a), U(0x8cac), U(0x8d64),
+		U(0x8de1), U(0x8e5f), U(0x78a9), U(0x5207), U(0x62d9), U(0x63a5),
+		U(0x6442), U(0x6298), U(0x8a2d), U(0x7a83), U(0x7bc0), U(0x8aac),
+		U(0x96ea), U(0x7d76), U(0x820c), U(0x8749), U(0x4ed9), U(0x5148),
+		U(0x5343), U(0x5360), U(0x5ba3), U(0x5c02), U(0x5c16), U(0x5ddd),
+		U(0x6226), U(0x6247), U(0x64b0), U(0x6813), U(0x6834), U(0x6cc9),
+		U(0x6d45), U(0x6d17), U(0x67d3), U(0x6f5c), U(0x714e), U(0x717d),
+		U(0x65cb), U(0x7a7f), U(0x7bad), U(0x7dda),
+	},
+	{
+		U(0x7e4a), U(0x7fa8), U(0x817a), U(0x821b), U(0x8239), U(0x85a6),
+		U(0x8a6e), U(0x8cce), U(0x8df5), U(0x9078), U(0x9077), U(0x92ad),
+		U(0x9291), U(0x9583), U(0x9bae), U(0x524d), U(0x5584), U(0x6f38),
+		U(0x7136), U(0x5168), U(0x7985), U(0x7e55), U(0x81b3), U(0x7cce),
+		U(0x564c), U(0x5851), U(0x5ca8), U(0x63aa), U(0x66fe), U(0x66fd),
+		U(0x695a), U(0x72d9), U(0x758f), U(0x758e), U(0x790e), U(0x7956),
+		U(0x79df), U(0x7c97), U(0x7d20), U(0x7d44), U(0x8607), U(0x8a34),
+		U(0x963b), U(0x9061), U(0x9f20), U(0x50e7), U(0x5275), U(0x53cc),
+		U(0x53e2), U(0x5009), U(0x55aa), U(0x58ee), U(0x594f), U(0x723d),
+		U(0x5b8b), U(0x5c64), U(0x531d), U(0x60e3), U(0x60f3), U(0x635c),
+		U(0x6383), U(0x633f), U(0x63bb), U(0x64cd), U(0x65e9), U(0x66f9),
+		U(0x5de3), U(0x69cd), U(0x69fd), U(0x6f15), U(0x71e5), U(0x4e89),
+		U(0x75e9), U(0x76f8), U(0x7a93), U(0x7cdf), U(0x7dcf), U(0x7d9c),
+		U(0x8061), U(0x8349), U(0x8358), U(0x846c), U(0x84bc), U(0x85fb),
+		U(0x88c5), U(0x8d70), U(0x9001), U(0x906d), U(0x9397), U(0x971c),
+		U(0x9a12), U(0x50cf), U(0x5897), U(0x618e),
+	},
+	{
+		U(0x81d3), U(0x8535), U(0x8d08), U(0x9020), U(0x4fc3), U(0x5074),
+		U(0x5247), U(0x5373), U(0x606f), U(0x6349), U(0x675f), U(0x6e2c),
+		U(0x8db3), U(0x901f), U(0x4fd7), U(0x5c5e), U(0x8cca), U(0x65cf),
+		U(0x7d9a), U(0x5352), U(0x8896), U(0x5176), U(0x63c3), U(0x5b58),
+		U(0x5b6b), U(0x5c0a), U(0x640d), U(0x6751), U(0x905c), U(0x4ed6),
+		U(0x591a), U(0x592a), U(0x6c70), U(0x8a51), U(0x553e), U(0x5815),
+		U(0x59a5), U(0x60f0), U(0x6253), U(0x67c1), U(0x8235), U(0x6955),
+		U(0x9640), U(0x99c4), U(0x9a28), U(0x4f53), U(0x5806), U(0x5bfe),
+		U(0x8010), U(0x5cb1), U(0x5e2f), U(0x5f85), U(0x6020), U(0x614b),
+		U(0x6234), U(0x66ff), U(0x6cf0), U(0x6ede), U(0x80ce), U(0x817f),
+		U(0x82d4), U(0x888b), U(0x8cb8), U(0x9000), U(0x902e), U(0x968a),
+		U(0x9edb), U(0x9bdb), U(0x4ee3), U(0x53f0), U(0x5927), U(0x7b2c),
+		U(0x918d), U(0x984c), U(0x9df9), U(0x6edd), U(0x7027), U(0x5353),
+		U(0x5544), U(0x5b85), U(0x6258), U(0x629e), U(0x62d3), U(0x6ca2),
+		U(0x6fef), U(0x7422), U(0x8a17), U(0x9438), U(0x6fc1), U(0x8afe),
+		U(0x8338), U(0x51e7), U(0x86f8), U(0x53ea),
+	},
+	{
+		U(0x53e9), U(0x4f46), U(0x9054), U(0x8fb0), U(0x596a), U(0x8131),
+		U(0x5dfd), U(0x7aea), U(0x8fbf), U(0x68da), U(0x8c37), U(0x72f8),
+		U(0x9c48), U(0x6a3d), U(0x8ab0), U(0x4e39), U(0x5358), U(0x5606),
+		U(0x5766), U(0x62c5), U(0x63a2), U(0x65e6), U(0x6b4e), U(0x6de1),
+		U(0x6e5b), U(0x70ad), U(0x77ed), U(0x7aef), U(0x7baa), U(0x7dbb),
+		U(0x803d), U(0x80c6), U(0x86cb), U(0x8a95), U(0x935b), U(0x56e3),
+		U(0x58c7), U(0x5f3e), U(0x65ad), U(0x6696), U(0x6a80), U(0x6bb5),
+		U(0x7537), U(0x8ac7), U(0x5024), U(0x77e5), U(0x5730), U(0x5f1b),
+		U(0x6065), U(0x667a), U(0x6c60), U(0x75f4), U(0x7a1a), U(0x7f6e),
+		U(0x81f4), U(0x8718), U(0x9045), U(0x99b3), U(0x7bc9), U(0x755c),
+		U(0x7af9), U(0x7b51), U(0x84c4), U(0x9010), U(0x79e9), U(0x7a92),
+		U(0x8336), U(0x5ae1), U(0x7740), U(0x4e2d), U(0x4ef2), U(0x5b99),
+		U(0x5fe0), U(0x62bd), U(0x663c), U(0x67f1), U(0x6ce8), U(0x866b),
+		U(0x8877), U(0x8a3b), U(0x914e), U(0x92f3), U(0x99d0), U(0x6a17),
+		U(0x7026), U(0x732a), U(0x82e7), U(0x8457), U(0x8caf), U(0x4e01),
+		U(0x5146), U(0x51cb), U(0x558b), U(0x5bf5),
+	},
+	{
+		U(0x5e16), U(0x5e33), U(0x5e81), U(0x5f14), U(0x5f35), U(0x5f6b),
+		U(0x5fb4), U(0x61f2), U(0x6311), U(0x66a2), U(0x671d), U(0x6f6e),
+		U(0x7252), U(0x753a), U(0x773a), U(0x8074), U(0x8139), U(0x8178),
+		U(0x8776), U(0x8abf), U(0x8adc), U(0x8d85), U(0x8df3), U(0x929a),
+		U(0x9577), U(0x9802), U(0x9ce5), U(0x52c5), U(0x6357), U(0x76f4),
+		U(0x6715), U(0x6c88), U(0x73cd), U(0x8cc3), U(0x93ae), U(0x9673),
+		U(0x6d25), U(0x589c), U(0x690e), U(0x69cc), U(0x8ffd), U(0x939a),
+		U(0x75db), U(0x901a), U(0x585a), U(0x6802), U(0x63b4), U(0x69fb),
+		U(0x4f43), U(0x6f2c), U(0x67d8), U(0x8fbb), U(0x8526), U(0x7db4),
+		U(0x9354), U(0x693f), U(0x6f70), U(0x576a), U(0x58f7), U(0x5b2c),
+		U(0x7d2c), U(0x722a), U(0x540a), U(0x91e3), U(0x9db4), U(0x4ead),
+		U(0x4f4e), U(0x505c), U(0x5075), U(0x5243), U(0x8c9e), U(0x5448),
+		U(0x5824), U(0x5b9a), U(0x5e1d), U(0x5e95), U(0x5ead), U(0x5ef7),
+		U(0x5f1f), U(0x608c), U(0x62b5), U(0x633a), U(0x63d0), U(0x68af),
+		U(0x6c40), U(0x7887), U(0x798e), U(0x7a0b), U(0x7de0), U(0x8247),
+		U(0x8a02), U(0x8ae6), U(0x8e44), U(0x9013),
+	},
+	{
+		U(0x90b8), U(0x912d), U(0x91d8), U(0x9f0e), U(0x6ce5), U(0x6458),
+		U(0x64e2), U(0x6575), U(0x6ef4), U(0x7684), U(0x7b1b), U(0x9069),
+		U(0x93d1), U(0x6eba), U(0x54f2), U(0x5fb9), U(0x64a4), U(0x8f4d),
+		U(0x8fed), U(0x9244), U(0x5178), U(0x586b), U(0x5929), U(0x5c55),
+		U(0x5e97), U(0x6dfb), U(0x7e8f), U(0x751c), U(0x8cbc), U(0x8ee2),
+		U(0x985b), U(0x70b9), U(0x4f1d), U(0x6bbf), U(0x6fb1), U(0x7530),
+		U(0x96fb), U(0x514e), U(0x5410), U(0x5835), U(0x5857), U(0x59ac),
+		U(0x5c60), U(0x5f92), U(0x6597), U(0x675c), U(0x6e21), U(0x767b),
+		U(0x83df), U(0x8ced), U(0x9014), U(0x90fd), U(0x934d), U(0x7825),
+		U(0x783a), U(0x52aa), U(0x5ea6), U(0x571f), U(0x5974), U(0x6012),
+		U(0x5012), U(0x515a), U(0x51ac), U(0x51cd), U(0x5200), U(0x5510),
+		U(0x5854), U(0x5858), U(0x5957), U(0x5b95), U(0x5cf6), U(0x5d8b),
+		U(0x60bc), U(0x6295), U(0x642d), U(0x6771), U(0x6843), U(0x68bc),
+		U(0x68df), U(0x76d7), U(0x6dd8), U(0x6e6f), U(0x6d9b), U(0x706f),
+		U(0x71c8), U(0x5f53), U(0x75d8), U(0x7977), U(0x7b49), U(0x7b54),
+		U(0x7b52), U(0x7cd6), U(0x7d71), U(0x5230),
+	},
+	{
+		U(0x8463), U(0x8569), U(0x85e4), U(0x8a0e), U(0x8b04), U(0x8c46),
+		U(0x8e0f), U(0x9003), U(0x900f), U(0x9419), U(0x9676), U(0x982d),
+		U(0x9a30), U(0x95d8), U(0x50cd), U(0x52d5), U(0x540c), U(0x5802),
+		U(0x5c0e), U(0x61a7), U(0x649e), U(0x6d1e), U(0x77b3), U(0x7ae5),
+		U(0x80f4), U(0x8404), U(0x9053), U(0x9285), U(0x5ce0), U(0x9d07),
+		U(0x533f), U(0x5f97), U(0x5fb3), U(0x6d9c), U(0x7279), U(0x7763),
+		U(0x79bf), U(0x7be4), U(0x6bd2), U(0x72ec), U(0x8aad), U(0x6803),
+		U(0x6a61), U(0x51f8), U(0x7a81), U(0x6934), U(0x5c4a), U(0x9cf6),
+		U(0x82eb), U(0x5bc5), U(0x9149), U(0x701e), U(0x5678), U(0x5c6f),
+		U(0x60c7), U(0x6566), U(0x6c8c), U(0x8c5a), U(0x9041), U(0x9813),
+		U(0x5451), U(0x66c7), U(0x920d), U(0x5948), U(0x90a3), U(0x5185),
+		U(0x4e4d), U(0x51ea), U(0x8599), U(0x8b0e), U(0x7058), U(0x637a),
+		U(0x934b), U(0x6962), U(0x99b4), U(0x7e04), U(0x7577), U(0x5357),
+		U(0x6960), U(0x8edf), U(0x96e3), U(0x6c5d), U(0x4e8c), U(0x5c3c),
+		U(0x5f10), U(0x8fe9), U(0x5302), U(0x8cd1), U(0x8089), U(0x8679),
+		U(0x5eff), U(0x65e5), U(0x4e73), U(0x5165),
+	},
+	{
+		U(0x5982), U(0x5c3f), U(0x97ee), U(0x4efb), U(0x598a), U(0x5fcd),
+		U(0x8a8d), U(0x6fe1), U(0x79b0), U(0x7962), U(0x5be7), U(0x8471),
+		U(0x732b), U(0x71b1), U(0x5e74), U(0x5ff5), U(0x637b), U(0x649a),
+		U(0x71c3), U(0x7c98), U(0x4e43), U(0x5efc), U(0x4e4b), U(0x57dc),
+		U(0x56a2), U(0x60a9), U(0x6fc3), U(0x7d0d), U(0x80fd), U(0x8133),
+		U(0x81bf), U(0x8fb2), U(0x8997), U(0x86a4), U(0x5df4), U(0x628a),
+		U(0x64ad), U(0x8987), U(0x6777), U(0x6ce2), U(0x6d3e), U(0x7436),
+		U(0x7834), U(0x5a46), U(0x7f75), U(0x82ad), U(0x99ac), U(0x4ff3),
+		U(0x5ec3), U(0x62dd), U(0x6392), U(0x6557), U(0x676f), U(0x76c3),
+		U(0x724c), U(0x80cc), U(0x80ba), U(0x8f29), U(0x914d), U(0x500d),
+		U(0x57f9), U(0x5a92), U(0x6885), U(0x6973), U(0x7164), U(0x72fd),
+		U(0x8cb7), U(0x58f2), U(0x8ce0), U(0x966a), U(0x9019), U(0x877f),
+		U(0x79e4), U(0x77e7), U(0x8429), U(0x4f2f), U(0x5265), U(0x535a),
+		U(0x62cd), U(0x67cf), U(0x6cca), U(0x767d), U(0x7b94), U(0x7c95),
+		U(0x8236), U(0x8584), U(0x8feb), U(0x66dd), U(0x6f20), U(0x7206),
+		U(0x7e1b), U(0x83ab), U(0x99c1), U(0x9ea6),
+	},
+	{
+		U(0x51fd), U(0x7bb1), U(0x7872), U(0x7bb8), U(0x8087), U(0x7b48),
+		U(0x6ae8), U(0x5e61), U(0x808c), U(0x7551), U(0x7560), U(0x516b),
+		U(0x9262), U(0x6e8c), U(0x767a), U(0x9197), U(0x9aea), U(0x4f10),
+		U(0x7f70), U(0x629c), U(0x7b4f), U(0x95a5), U(0x9ce9), U(0x567a),
+		U(0x5859), U(0x86e4), U(0x96bc), U(0x4f34), U(0x5224), U(0x534a),
+		U(0x53cd), U(0x53db), U(0x5e06), U(0x642c), U(0x6591), U(0x677f),
+		U(0x6c3e), U(0x6c4e), U(0x7248), U(0x72af), U(0x73ed), U(0x7554),
+		U(0x7e41), U(0x822c), U(0x85e9), U(0x8ca9), U(0x7bc4), U(0x91c6),
+		U(0x7169), U(0x9812), U(0x98ef), U(0x633d), U(0x6669), U(0x756a),
+		U(0x76e4), U(0x78d0), U(0x8543), U(0x86ee), U(0x532a), U(0x5351),
+		U(0x5426), U(0x5983), U(0x5e87), U(0x5f7c), U(0x60b2), U(0x6249),
+		U(0x6279), U(0x62ab), U(0x6590), U(0x6bd4), U(0x6ccc), U(0x75b2),
+		U(0x76ae), U(0x7891), U(0x79d8), U(0x7dcb), U(0x7f77), U(0x80a5),
+		U(0x88ab), U(0x8ab9), U(0x8cbb), U(0x907f), U(0x975e), U(0x98db),
+		U(0x6a0b), U(0x7c38), U(0x5099), U(0x5c3e), U(0x5fae), U(0x6787),
+		U(0x6bd8), U(0x7435), U(0x7709), U(0x7f8e),
+	},
+	{
+		U(0x9f3b), U(0x67ca), U(0x7a17), U(0x5339), U(0x758b), U(0x9aed),
+		U(0x5f66), U(0x819d), U(0x83f1), U(0x8098), U(0x5f3c), U(0x5fc5),
+		U(0x7562), U(0x7b46), U(0x903c), U(0x6867), U(0x59eb), U(0x5a9b),
+		U(0x7d10), U(0x767e), U(0x8b2c), U(0x4ff5), U(0x5f6a), U(0x6a19),
+		U(0x6c37), U(0x6f02), U(0x74e2), U(0x7968), U(0x8868), U(0x8a55),
+		U(0x8c79), U(0x5edf), U(0x63cf), U(0x75c5), U(0x79d2), U(0x82d7),
+		U(0x9328), U(0x92f2), U(0x849c), U(0x86ed), U(0x9c2d), U(0x54c1),
+		U(0x5f6c), U(0x658c), U(0x6d5c), U(0x7015), U(0x8ca7), U(0x8cd3),
+		U(0x983b), U(0x654f), U(0x74f6), U(0x4e0d), U(0x4ed8), U(0x57e0),
+		U(0x592b), U(0x5a66), U(0x5bcc), U(0x51a8), U(0x5e03), U(0x5e9c),
+		U(0x6016), U(0x6276), U(0x6577), U(0x65a7), U(0x666e), U(0x6d6e),
+		U(0x7236), U(0x7b26), U(0x8150), U(0x819a), U(0x8299), U(0x8b5c),
+		U(0x8ca0), U(0x8ce6), U(0x8d74), U(0x961c), U(0x9644), U(0x4fae),
+		U(0x64ab), U(0x6b66), U(0x821e), U(0x8461), U(0x856a), U(0x90e8),
+		U(0x5c01), U(0x6953), U(0x98a8), U(0x847a), U(0x8557), U(0x4f0f),
+		U(0x526f), U(0x5fa9), U(0x5e45), U(0x670d),
+	},
+	{
+		U(0x798f), U(0x8179), U(0x8907), U(0x8986), U(0x6df5), U(0x5f17),
+		U(0x6255), U(0x6cb8), U(0x4ecf), U(0x7269), U(0x9b92), U(0x5206),
+		U(0x543b), U(0x5674), U(0x58b3), U(0x61a4), U(0x626e), U(0x711a),
+		U(0x596e), U(0x7c89), U(0x7cde), U(0x7d1b), U(0x96f0), U(0x6587),
+		U(0x805e), U(0x4e19), U(0x4f75), U(0x5175), U(0x5840), U(0x5e63),
+		U(0x5e73), U(0x5f0a), U(0x67c4), U(0x4e26), U(0x853d), U(0x9589),
+		U(0x965b), U(0x7c73), U(0x9801), U(0x50fb), U(0x58c1), U(0x7656),
+		U(0x78a7), U(0x5225), U(0x77a5), U(0x8511), U(0x7b86), U(0x504f),
+		U(0x5909), U(0x7247), U(0x7bc7), U(0x7de8), U(0x8fba), U(0x8fd4),
+		U(0x904d), U(0x4fbf), U(0x52c9), U(0x5a29), U(0x5f01), U(0x97ad),
+		U(0x4fdd), U(0x8217), U(0x92ea), U(0x5703), U(0x6355), U(0x6b69),
+		U(0x752b), U(0x88dc), U(0x8f14), U(0x7a42), U(0x52df), U(0x5893),
+		U(0x6155), U(0x620a), U(0x66ae), U(0x6bcd), U(0x7c3f), U(0x83e9),
+		U(0x5023), U(0x4ff8), U(0x5305), U(0x5446), U(0x5831), U(0x5949),
+		U(0x5b9d), U(0x5cf0), U(0x5cef), U(0x5d29), U(0x5e96), U(0x62b1),
+		U(0x6367), U(0x653e), U(0x65b9), U(0x670b),
+	},
+	{
+		U(0x6cd5), U(0x6ce1), U(0x70f9), U(0x7832), U(0x7e2b), U(0x80de),
+		U(0x82b3), U(0x840c), U(0x84ec), U(0x8702), U(0x8912), U(0x8a2a),
+		U(0x8c4a), U(0x90a6), U(0x92d2), U(0x98fd), U(0x9cf3), U(0x9d6c),
+		U(0x4e4f), U(0x4ea1), U(0x508d), U(0x5256), U(0x574a), U(0x59a8),
+		U(0x5e3d), U(0x5fd8), U(0x5fd9), U(0x623f), U(0x66b4), U(0x671b),
+		U(0x67d0), U(0x68d2), U(0x5192), U(0x7d21), U(0x80aa), U(0x81a8),
+		U(0x8b00), U(0x8c8c), U(0x8cbf), U(0x927e), U(0x9632), U(0x5420),
+		U(0x982c), U(0x5317), U(0x50d5), U(0x535c), U(0x58a8), U(0x64b2),
+		U(0x6734), U(0x7267), U(0x7766), U(0x7a46), U(0x91e6), U(0x52c3),
+		U(0x6ca1), U(0x6b86), U(0x5800), U(0x5e4c), U(0x5954), U(0x672c),
+		U(0x7ffb), U(0x51e1), U(0x76c6), U(0x6469), U(0x78e8), U(0x9b54),
+		U(0x9ebb), U(0x57cb), U(0x59b9), U(0x6627), U(0x679a), U(0x6bce),
+		U(0x54e9), U(0x69d9), U(0x5e55), U(0x819c), U(0x6795), U(0x9baa),
+		U(0x67fe), U(0x9c52), U(0x685d), U(0x4ea6), U(0x4fe3), U(0x53c8),
+		U(0x62b9), U(0x672b), U(0x6cab), U(0x8fc4), U(0x4fad), U(0x7e6d),
+		U(0x9ebf), U(0x4e07), U(0x6162), U(0x6e80),
+	},
+	{
+		U(0x6f2b), U(0x8513), U(0x5473), U(0x672a), U(0x9b45), U(0x5df3),
+		U(0x7b95), U(0x5cac), U(0x5bc6), U(0x871c), U(0x6e4a), U(0x84d1),
+		U(0x7a14), U(0x8108), U(0x5999), U(0x7c8d), U(0x6c11), U(0x7720),
+		U(0x52d9), U(0x5922), U(0x7121), U(0x725f), U(0x77db), U(0x9727),
+		U(0x9d61), U(0x690b), U(0x5a7f), U(0x5a18), U(0x51a5), U(0x540d),
+		U(0x547d), U(0x660e), U(0x76df), U(0x8ff7), U(0x9298), U(0x9cf4),
+		U(0x59ea), U(0x725d), U(0x6ec5), U(0x514d), U(0x68c9), U(0x7dbf),
+		U(0x7dec), U(0x9762), U(0x9eba), U(0x6478), U(0x6a21), U(0x8302),
+		U(0x5984), U(0x5b5f), U(0x6bdb), U(0x731b), U(0x76f2), U(0x7db2),
+		U(0x8017), U(0x8499), U(0x5132), U(0x6728), U(0x9ed9), U(0x76ee),
+		U(0x6762), U(0x52ff), U(0x9905), U(0x5c24), U(0x623b), U(0x7c7e),
+		U(0x8cb0), U(0x554f), U(0x60b6), U(0x7d0b), U(0x9580), U(0x5301),
+		U(0x4e5f), U(0x51b6), U(0x591c), U(0x723a), U(0x8036), U(0x91ce),
+		U(0x5f25), U(0x77e2), U(0x5384), U(0x5f79), U(0x7d04), U(0x85ac),
+		U(0x8a33), U(0x8e8d), U(0x9756), U(0x67f3), U(0x85ae), U(0x9453),
+		U(0x6109), U(0x6108), U(0x6cb9), U(0x7652),
+	},
+	{
+		U(0x8aed), U(0x8f38), U(0x552f), U(0x4f51), U(0x512a), U(0x52c7),
+		U(0x53cb), U(0x5ba5), U(0x5e7d), U(0x60a0), U(0x6182), U(0x63d6),
+		U(0x6709), U(0x67da), U(0x6e67), U(0x6d8c), U(0x7336), U(0x7337),
+		U(0x7531), U(0x7950), U(0x88d5), U(0x8a98), U(0x904a), U(0x9091),
+		U(0x90f5), U(0x96c4), U(0x878d), U(0x5915), U(0x4e88), U(0x4f59),
+		U(0x4e0e), U(0x8a89), U(0x8f3f), U(0x9810), U(0x50ad), U(0x5e7c),
+		U(0x5996), U(0x5bb9), U(0x5eb8), U(0x63da), U(0x63fa), U(0x64c1),
+		U(0x66dc), U(0x694a), U(0x69d8), U(0x6d0b), U(0x6eb6), U(0x7194),
+		U(0x7528), U(0x7aaf), U(0x7f8a), U(0x8000), U(0x8449), U(0x84c9),
+		U(0x8981), U(0x8b21), U(0x8e0a), U(0x9065), U(0x967d), U(0x990a),
+		U(0x617e), U(0x6291), U(0x6b32), U(0x6c83), U(0x6d74), U(0x7fcc),
+		U(0x7ffc), U(0x6dc0), U(0x7f85), U(0x87ba), U(0x88f8), U(0x6765),
+		U(0x83b1), U(0x983c), U(0x96f7), U(0x6d1b), U(0x7d61), U(0x843d),
+		U(0x916a), U(0x4e71), U(0x5375), U(0x5d50), U(0x6b04), U(0x6feb),
+		U(0x85cd), U(0x862d), U(0x89a7), U(0x5229), U(0x540f), U(0x5c65),
+		U(0x674e), U(0x68a8), U(0x7406), U(0x7483),
+	},
+	{
+		U(0x75e2), U(0x88cf), U(0x88e1), U(0x91cc), U(0x96e2), U(0x9678),
+		U(0x5f8b), U(0x7387), U(0x7acb), U(0x844e), U(0x63a0), U(0x7565),
+		U(0x5289), U(0x6d41), U(0x6e9c), U(0x7409), U(0x7559), U(0x786b),
+		U(0x7c92), U(0x9686), U(0x7adc), U(0x9f8d), U(0x4fb6), U(0x616e),
+		U(0x65c5), U(0x865c), U(0x4e86), U(0x4eae), U(0x50da), U(0x4e21),
+		U(0x51cc), U(0x5bee), U(0x6599), U(0x6881), U(0x6dbc), U(0x731f),
+		U(0x7642), U(0x77ad), U(0x7a1c), U(0x7ce7), U(0x826f), U(0x8ad2),
+		U(0x907c), U(0x91cf), U(0x9675), U(0x9818), U(0x529b), U(0x7dd1),
+		U(0x502b), U(0x5398), U(0x6797), U(0x6dcb), U(0x71d0), U(0x7433),
+		U(0x81e8), U(0x8f2a), U(0x96a3), U(0x9c57), U(0x9e9f), U(0x7460),
+		U(0x5841), U(0x6d99), U(0x7d2f), U(0x985e), U(0x4ee4), U(0x4f36),
+		U(0x4f8b), U(0x51b7), U(0x52b1), U(0x5dba), U(0x601c), U(0x73b2),
+		U(0x793c), U(0x82d3), U(0x9234), U(0x96b7), U(0x96f6), U(0x970a),
+		U(0x9e97), U(0x9f62), U(0x66a6), U(0x6b74), U(0x5217), U(0x52a3),
+		U(0x70c8), U(0x88c2), U(0x5ec9), U(0x604b), U(0x6190), U(0x6f23),
+		U(0x7149), U(0x7c3e), U(0x7df4), U(0x806f),
+	},
+	{
+		U(0x84ee), U(0x9023), U(0x932c), U(0x5442), U(0x9b6f), U(0x6ad3),
+		U(0x7089), U(0x8cc2), U(0x8def), U(0x9732), U(0x52b4), U(0x5a41),
+		U(0x5eca), U(0x5f04), U(0x6717), U(0x697c), U(0x6994), U(0x6d6a),
+		U(0x6f0f), U(0x7262), U(0x72fc), U(0x7bed), U(0x8001), U(0x807e),
+		U(0x874b), U(0x90ce), U(0x516d), U(0x9e93), U(0x7984), U(0x808b),
+		U(0x9332), U(0x8ad6), U(0x502d), U(0x548c), U(0x8a71), U(0x6b6a),
+		U(0x8cc4), U(0x8107), U(0x60d1), U(0x67a0), U(0x9df2), U(0x4e99),
+		U(0x4e98), U(0x9c10), U(0x8a6b), U(0x85c1), U(0x8568), U(0x6900),
+		U(0x6e7e), U(0x7897), U(0x8155),
+	},
+	{
+		U(0x5f0c), U(0x4e10), U(0x4e15), U(0x4e2a), U(0x4e31), U(0x4e36),
+		U(0x4e3c), U(0x4e3f), U(0x4e42), U(0x4e56), U(0x4e58), U(0x4e82),
+		U(0x4e85), U(0x8c6b), U(0x4e8a), U(0x8212), U(0x5f0d), U(0x4e8e),
+		U(0x4e9e), U(0x4e9f), U(0x4ea0), U(0x4ea2), U(0x4eb0), U(0x4eb3),
+		U(0x4eb6), U(0x4ece), U(0x4ecd), U(0x4ec4), U(0x4ec6), U(0x4ec2),
+		U(0x4ed7), U(0x4ede), U(0x4eed), U(0x4edf), U(0x4ef7), U(0x4f09),
+		U(0x4f5a), U(0x4f30), U(0x4f5b), U(0x4f5d), U(0x4f57), U(0x4f47),
+		U(0x4f76), U(0x4f88), U(0x4f8f), U(0x4f98), U(0x4f7b), U(0x4f69),
+		U(0x4f70), U(0x4f91), U(0x4f6f), U(0x4f86), U(0x4f96), U(0x5118),
+		U(0x4fd4), U(0x4fdf), U(0x4fce), U(0x4fd8), U(0x4fdb), U(0x4fd1),
+		U(0x4fda), U(0x4fd0), U(0x4fe4), U(0x4fe5), U(0x501a), U(0x5028),
+		U(0x5014), U(0x502a), U(0x5025), U(0x5005), U(0x4f1c), U(0x4ff6),
+		U(0x5021), U(0x5029), U(0x502c), U(0x4ffe), U(0x4fef), U(0x5011),
+		U(0x5006), U(0x5043), U(0x5047), U(0x6703), U(0x5055), U(0x5050),
+		U(0x5048), U(0x505a), U(0x5056), U(0x506c), U(0x5078), U(0x5080),
+		U(0x509a), U(0x5085), U(0x50b4), U(0x50b2),
+	},
+	{
+		U(0x50c9), U(0x50ca), U(0x50b3), U(0x50c2), U(0x50d6), U(0x50de),
+		U(0x50e5), U(0x50ed), U(0x50e3), U(0x50ee), U(0x50f9), U(0x50f5),
+		U(0x5109), U(0x5101), U(0x5102), U(0x5116), U(0x5115), U(0x5114),
+		U(0x511a), U(0x5121), U(0x513a), U(0x5137), U(0x513c), U(0x513b),
+		U(0x513f), U(0x5140), U(0x5152), U(0x514c), U(0x5154), U(0x5162),
+		U(0x7af8), U(0x5169), U(0x516a), U(0x516e), U(0x5180), U(0x5182),
+		U(0x56d8), U(0x518c), U(0x5189), U(0x518f), U(0x5191), U(0x5193),
+		U(0x5195), U(0x5196), U(0x51a4), U(0x51a6), U(0x51a2), U(0x51a9),
+		U(0x51aa), U(0x51ab), U(0x51b3), U(0x51b1), U(0x51b2), U(0x51b0),
+		U(0x51b5), U(0x51bd), U(0x51c5), U(0x51c9), U(0x51db), U(0x51e0),
+		U(0x8655), U(0x51e9), U(0x51ed), U(0x51f0), U(0x51f5), U(0x51fe),
+		U(0x5204), U(0x520b), U(0x5214), U(0x520e), U(0x5227), U(0x522a),
+		U(0x522e), U(0x5233), U(0x5239), U(0x524f), U(0x5244), U(0x524b),
+		U(0x524c), U(0x525e), U(0x5254), U(0x526a), U(0x5274), U(0x5269),
+		U(0x5273), U(0x527f), U(0x527d), U(0x528d), U(0x5294), U(0x5292),
+		U(0x5271), U(0x5288), U(0x5291), U(0x8fa8),
+	},
+	{
+		U(0x8fa7), U(0x52ac), U(0x52ad), U(0x52bc), U(0x52b5), U(0x52c1),
+		U(0x52cd), U(0x52d7), U(0x52de), U(0x52e3), U(0x52e6), U(0x98ed),
+		U(0x52e0), U(0x52f3), U(0x52f5), U(0x52f8), U(0x52f9), U(0x5306),
+		U(0x5308), U(0x7538), U(0x530d), U(0x5310), U(0x530f), U(0x5315),
+		U(0x531a), U(0x5323), U(0x532f), U(0x5331), U(0x5333), U(0x5338),
+		U(0x5340), U(0x5346), U(0x5345), U(0x4e17), U(0x5349), U(0x534d),
+		U(0x51d6), U(0x535e), U(0x5369), U(0x536e), U(0x5918), U(0x537b),
+		U(0x5377), U(0x5382), U(0x5396), U(0x53a0), U(0x53a6), U(0x53a5),
+		U(0x53ae), U(0x53b0), U(0x53b6), U(0x53c3), U(0x7c12), U(0x96d9),
+		U(0x53df), U(0x66fc), U(0x71ee), U(0x53ee), U(0x53e8), U(0x53ed),
+		U(0x53fa), U(0x5401), U(0x543d), U(0x5440), U(0x542c), U(0x542d),
+		U(0x543c), U(0x542e), U(0x5436), U(0x5429), U(0x541d), U(0x544e),
+		U(0x548f), U(0x5475), U(0x548e), U(0x545f), U(0x5471), U(0x5477),
+		U(0x5470), U(0x5492), U(0x547b), U(0x5480), U(0x5476), U(0x5484),
+		U(0x5490), U(0x5486), U(0x54c7), U(0x54a2), U(0x54b8), U(0x54a5),
+		U(0x54ac), U(0x54c4), U(0x54c8), U(0x54a8),
+	},
+	{
+		U(0x54ab), U(0x54c2), U(0x54a4), U(0x54be), U(0x54bc), U(0x54d8),
+		U(0x54e5), U(0x54e6), U(0x550f), U(0x5514), U(0x54fd), U(0x54ee),
+		U(0x54ed), U(0x54fa), U(0x54e2), U(0x5539), U(0x5540), U(0x5563),
+		U(0x554c), U(0x552e), U(0x555c), U(0x5545), U(0x5556), U(0x5557),
+		U(0x5538), U(0x5533), U(0x555d), U(0x5599), U(0x5580), U(0x54af),
+		U(0x558a), U(0x559f), U(0x557b), U(0x557e), U(0x5598), U(0x559e),
+		U(0x55ae), U(0x557c), U(0x5583), U(0x55a9), U(0x5587), U(0x55a8),
+		U(0x55da), U(0x55c5), U(0x55df), U(0x55c4), U(0x55dc), U(0x55e4),
+		U(0x55d4), U(0x5614), U(0x55f7), U(0x5616), U(0x55fe), U(0x55fd),
+		U(0x561b), U(0x55f9), U(0x564e), U(0x5650), U(0x71df), U(0x5634),
+		U(0x5636), U(0x5632), U(0x5638), U(0x566b), U(0x5664), U(0x562f),
+		U(0x566c), U(0x566a), U(0x5686), U(0x5680), U(0x568a), U(0x56a0),
+		U(0x5694), U(0x568f), U(0x56a5), U(0x56ae), U(0x56b6), U(0x56b4),
+		U(0x56c2), U(0x56bc), U(0x56c1), U(0x56c3), U(0x56c0), U(0x56c8),
+		U(0x56ce), U(0x56d1), U(0x56d3), U(0x56d7), U(0x56ee), U(0x56f9),
+		U(0x5700), U(0x56ff), U(0x5704), U(0x5709),
+	},
+	{
+		U(0x5708), U(0x570b), U(0x570d), U(0x5713), U(0x5718), U(0x5716),
+		U(0x55c7), U(0x571c), U(0x5726), U(0x5737), U(0x5738), U(0x574e),
+		U(0x573b), U(0x5740), U(0x574f), U(0x5769), U(0x57c0), U(0x5788),
+		U(0x5761), U(0x577f), U(0x5789), U(0x5793), U(0x57a0), U(0x57b3),
+		U(0x57a4), U(0x57aa), U(0x57b0), U(0x57c3), U(0x57c6), U(0x57d4),
+		U(0x57d2), U(0x57d3), U(0x580a), U(0x57d6), U(0x57e3), U(0x580b),
+		U(0x5819), U(0x581d), U(0x5872), U(0x5821), U(0x5862), U(0x584b),
+		U(0x5870), U(0x6bc0), U(0x5852), U(0x583d), U(0x5879), U(0x5885),
+		U(0x58b9), U(0x589f), U(0x58ab), U(0x58ba), U(0x58de), U(0x58bb),
+		U(0x58b8), U(0x58ae), U(0x58c5), U(0x58d3), U(0x58d1), U(0x58d7),
+		U(0x58d9), U(0x58d8), U(0x58e5), U(0x58dc), U(0x58e4), U(0x58df),
+		U(0x58ef), U(0x58fa), U(0x58f9), U(0x58fb), U(0x58fc), U(0x58fd),
+		U(0x5902), U(0x590a), U(0x5910), U(0x591b), U(0x68a6), U(0x5925),
+		U(0x592c), U(0x592d), U(0x5932), U(0x5938), U(0x593e), U(0x7ad2),
+		U(0x5955), U(0x5950), U(0x594e), U(0x595a), U(0x5958), U(0x5962),
+		U(0x5960), U(0x5967), U(0x596c), U(0x5969),
+	},
+	{
+		U(0x5978), U(0x5981), U(0x599d), U(0x4f5e), U(0x4fab), U(0x59a3),
+		U(0x59b2), U(0x59c6), U(0x59e8), U(0x59dc), U(0x598d), U(0x59d9),
+		U(0x59da), U(0x5a25), U(0x5a1f), U(0x5a11), U(0x5a1c), U(0x5a09),
+		U(0x5a1a), U(0x5a40), U(0x5a6c), U(0x5a49), U(0x5a35), U(0x5a36),
+		U(0x5a62), U(0x5a6a), U(0x5a9a), U(0x5abc), U(0x5abe), U(0x5acb),
+		U(0x5ac2), U(0x5abd), U(0x5ae3), U(0x5ad7), U(0x5ae6), U(0x5ae9),
+		U(0x5ad6), U(0x5afa), U(0x5afb), U(0x5b0c), U(0x5b0b), U(0x5b16),
+		U(0x5b32), U(0x5ad0), U(0x5b2a), U(0x5b36), U(0x5b3e), U(0x5b43),
+		U(0x5b45), U(0x5b40), U(0x5b51), U(0x5b55), U(0x5b5a), U(0x5b5b),
+		U(0x5b65), U(0x5b69), U(0x5b70), U(0x5b73), U(0x5b75), U(0x5b78),
+		U(0x6588), U(0x5b7a), U(0x5b80), U(0x5b83), U(0x5ba6), U(0x5bb8),
+		U(0x5bc3), U(0x5bc7), U(0x5bc9), U(0x5bd4), U(0x5bd0), U(0x5be4),
+		U(0x5be6), U(0x5be2), U(0x5bde), U(0x5be5), U(0x5beb), U(0x5bf0),
+		U(0x5bf6), U(0x5bf3), U(0x5c05), U(0x5c07), U(0x5c08), U(0x5c0d),
+		U(0x5c13), U(0x5c20), U(0x5c22), U(0x5c28), U(0x5c38), U(0x5c39),
+		U(0x5c41), U(0x5c46), U(0x5c4e), U(0x5c53),
+	},
+	{
+		U(0x5c50), U(0x5c4f), U(0x5b71), U(0x5c6c), U(0x5c6e), U(0x4e62),
+		U(0x5c76), U(0x5c79), U(0x5c8c), U(0x5c91), U(0x5c94), U(0x599b),
+		U(0x5cab), U(0x5cbb), U(0x5cb6), U(0x5cbc), U(0x5cb7), U(0x5cc5),
+		U(0x5cbe), U(0x5cc7), U(0x5cd9), U(0x5ce9), U(0x5cfd), U(0x5cfa),
+		U(0x5ced), U(0x5d8c), U(0x5cea), U(0x5d0b), U(0x5d15), U(0x5d17),
+		U(0x5d5c), U(0x5d1f), U(0x5d1b), U(0x5d11), U(0x5d14), U(0x5d22),
+		U(0x5d1a), U(0x5d19), U(0x5d18), U(0x5d4c), U(0x5d52), U(0x5d4e),
+		U(0x5d4b), U(0x5d6c), U(0x5d73), U(0x5d76), U(0x5d87), U(0x5d84),
+		U(0x5d82), U(0x5da2), U(0x5d9d), U(0x5dac), U(0x5dae), U(0x5dbd),
+		U(0x5d90), U(0x5db7), U(0x5dbc), U(0x5dc9), U(0x5dcd), U(0x5dd3),
+		U(0x5dd2), U(0x5dd6), U(0x5ddb), U(0x5deb), U(0x5df2), U(0x5df5),
+		U(0x5e0b), U(0x5e1a), U(0x5e19), U(0x5e11), U(0x5e1b), U(0x5e36),
+		U(0x5e37), U(0x5e44), U(0x5e43), U(0x5e40), U(0x5e4e), U(0x5e57),
+		U(0x5e54), U(0x5e5f), U(0x5e62), U(0x5e64), U(0x5e47), U(0x5e75),
+		U(0x5e76), U(0x5e7a), U(0x9ebc), U(0x5e7f), U(0x5ea0), U(0x5ec1),
+		U(0x5ec2), U(0x5ec8), U(0x5ed0), U(0x5ecf),
+	},
+	{
+		U(0x5ed6), U(0x5ee3), U(0x5edd), U(0x5eda), U(0x5edb), U(0x5ee2),
+		U(0x5ee1), U(0x5ee8), U(0x5ee9), U(0x5eec), U(0x5ef1), U(0x5ef3),
+		U(0x5ef0), U(0x5ef4), U(0x5ef8), U(0x5efe), U(0x5f03), U(0x5f09),
+		U(0x5f5d), U(0x5f5c), U(0x5f0b), U(0x5f11), U(0x5f16), U(0x5f29),
+		U(0x5f2d), U(0x5f38), U(0x5f41), U(0x5f48), U(0x5f4c), U(0x5f4e),
+		U(0x5f2f), U(0x5f51), U(0x5f56), U(0x5f57), U(0x5f59), U(0x5f61),
+		U(0x5f6d), U(0x5f73), U(0x5f77), U(0x5f83), U(0x5f82), U(0x5f7f),
+		U(0x5f8a), U(0x5f88), U(0x5f91), U(0x5f87), U(0x5f9e), U(0x5f99),
+		U(0x5f98), U(0x5fa0), U(0x5fa8), U(0x5fad), U(0x5fbc), U(0x5fd6),
+		U(0x5ffb), U(0x5fe4), U(0x5ff8), U(0x5ff1), U(0x5fdd), U(0x60b3),
+		U(0x5fff), U(0x6021), U(0x6060), U(0x6019), U(0x6010), U(0x6029),
+		U(0x600e), U(0x6031), U(0x601b), U(0x6015), U(0x602b), U(0x6026),
+		U(0x600f), U(0x603a), U(0x605a), U(0x6041), U(0x606a), U(0x6077),
+		U(0x605f), U(0x604a), U(0x6046), U(0x604d), U(0x6063), U(0x6043),
+		U(0x6064), U(0x6042), U(0x606c), U(0x606b), U(0x6059), U(0x6081),
+		U(0x608d), U(0x60e7), U(0x6083), U(0x609a),
+	},
+	{
+		U(0x6084), U(0x609b), U(0x6096), U(0x6097), U(0x6092), U(0x60a7),
+		U(0x608b), U(0x60e1), U(0x60b8), U(0x60e0), U(0x60d3), U(0x60b4),
+		U(0x5ff0), U(0x60bd), U(0x60c6), U(0x60b5), U(0x60d8), U(0x614d),
+		U(0x6115), U(0x6106), U(0x60f6), U(0x60f7), U(0x6100), U(0x60f4),
+		U(0x60fa), U(0x6103), U(0x6121), U(0x60fb), U(0x60f1), U(0x610d),
+		U(0x610e), U(0x6147), U(0x613e), U(0x6128), U(0x6127), U(0x614a),
+		U(0x613f), U(0x613c), U(0x612c), U(0x6134), U(0x613d), U(0x6142),
+		U(0x6144), U(0x6173), U(0x6177), U(0x6158), U(0x6159), U(0x615a),
+		U(0x616b), U(0x6174), U(0x616f), U(0x6165), U(0x6171), U(0x615f),
+		U(0x615d), U(0x6153), U(0x6175), U(0x6199), U(0x6196), U(0x6187),
+		U(0x61ac), U(0x6194), U(0x619a), U(0x618a), U(0x6191), U(0x61ab),
+		U(0x61ae), U(0x61cc), U(0x61ca), U(0x61c9), U(0x61f7), U(0x61c8),
+		U(0x61c3), U(0x61c6), U(0x61ba), U(0x61cb), U(0x7f79), U(0x61cd),
+		U(0x61e6), U(0x61e3), U(0x61f6), U(0x61fa), U(0x61f4), U(0x61ff),
+		U(0x61fd), U(0x61fc), U(0x61fe), U(0x6200), U(0x6208), U(0x6209),
+		U(0x620d), U(0x620c), U(0x6214), U(0x621b),
+	},
+	{
+		U(0x621e), U(0x6221), U(0x622a), U(0x622e), U(0x6230), U(0x6232),
+		U(0x6233), U(0x6241), U(0x624e), U(0x625e), U(0x6263), U(0x625b),
+		U(0x6260), U(0x6268), U(0x627c), U(0x6282), U(0x6289), U(0x627e),
+		U(0x6292), U(0x6293), U(0x6296), U(0x62d4), U(0x6283), U(0x6294),
+		U(0x62d7), U(0x62d1), U(0x62bb), U(0x62cf), U(0x62ff), U(0x62c6),
+		U(0x64d4), U(0x62c8), U(0x62dc), U(0x62cc), U(0x62ca), U(0x62c2),
+		U(0x62c7), U(0x629b), U(0x62c9), U(0x630c), U(0x62ee), U(0x62f1),
+		U(0x6327), U(0x6302), U(0x6308), U(0x62ef), U(0x62f5), U(0x6350),
+		U(0x633e), U(0x634d), U(0x641c), U(0x634f), U(0x6396), U(0x638e),
+		U(0x6380), U(0x63ab), U(0x6376), U(0x63a3), U(0x638f), U(0x6389),
+		U(0x639f), U(0x63b5), U(0x636b), U(0x6369), U(0x63be), U(0x63e9),
+		U(0x63c0), U(0x63c6), U(0x63e3), U(0x63c9), U(0x63d2), U(0x63f6),
+		U(0x63c4), U(0x6416), U(0x6434), U(0x6406), U(0x6413), U(0x6426),
+		U(0x6436), U(0x651d), U(0x6417), U(0x6428), U(0x640f), U(0x6467),
+		U(0x646f), U(0x6476), U(0x644e), U(0x652a), U(0x6495), U(0x6493),
+		U(0x64a5), U(0x64a9), U(0x6488), U(0x64bc),
+	},
+	{
+		U(0x64da), U(0x64d2), U(0x64c5), U(0x64c7), U(0x64bb), U(0x64d8),
+		U(0x64c2), U(0x64f1), U(0x64e7), U(0x8209), U(0x64e0), U(0x64e1),
+		U(0x62ac), U(0x64e3), U(0x64ef), U(0x652c), U(0x64f6), U(0x64f4),
+		U(0x64f2), U(0x64fa), U(0x6500), U(0x64fd), U(0x6518), U(0x651c),
+		U(0x6505), U(0x6524), U(0x6523), U(0x652b), U(0x6534), U(0x6535),
+		U(0x6537), U(0x6536), U(0x6538), U(0x754b), U(0x6548), U(0x6556),
+		U(0x6555), U(0x654d), U(0x6558), U(0x655e), U(0x655d), U(0x6572),
+		U(0x6578), U(0x6582), U(0x6583), U(0x8b8a), U(0x659b), U(0x659f),
+		U(0x65ab), U(0x65b7), U(0x65c3), U(0x65c6), U(0x65c1), U(0x65c4),
+		U(0x65cc), U(0x65d2), U(0x65db), U(0x65d9), U(0x65e0), U(0x65e1),
+		U(0x65f1), U(0x6772), U(0x660a), U(0x6603), U(0x65fb), U(0x6773),
+		U(0x6635), U(0x6636), U(0x6634), U(0x661c), U(0x664f), U(0x6644),
+		U(0x6649), U(0x6641), U(0x665e), U(0x665d), U(0x6664), U(0x6667),
+		U(0x6668), U(0x665f), U(0x6662), U(0x6670), U(0x6683), U(0x6688),
+		U(0x668e), U(0x6689), U(0x6684), U(0x6698), U(0x669d), U(0x66c1),
+		U(0x66b9), U(0x66c9), U(0x66be), U(0x66bc),
+	},
+	{
+		U(0x66c4), U(0x66b8), U(0x66d6), U(0x66da), U(0x66e0), U(0x663f),
+		U(0x66e6), U(0x66e9), U(0x66f0), U(0x66f5), U(0x66f7), U(0x670f),
+		U(0x6716), U(0x671e), U(0x6726), U(0x6727), U(0x9738), U(0x672e),
+		U(0x673f), U(0x6736), U(0x6741), U(0x6738), U(0x6737), U(0x6746),
+		U(0x675e), U(0x6760), U(0x6759), U(0x6763), U(0x6764), U(0x6789),
+		U(0x6770), U(0x67a9), U(0x677c), U(0x676a), U(0x678c), U(0x678b),
+		U(0x67a6), U(0x67a1), U(0x6785), U(0x67b7), U(0x67ef), U(0x67b4),
+		U(0x67ec), U(0x67b3), U(0x67e9), U(0x67b8), U(0x67e4), U(0x67de),
+		U(0x67dd), U(0x67e2), U(0x67ee), U(0x67b9), U(0x67ce), U(0x67c6),
+		U(0x67e7), U(0x6a9c), U(0x681e), U(0x6846), U(0x6829), U(0x6840),
+		U(0x684d), U(0x6832), U(0x684e), U(0x68b3), U(0x682b), U(0x6859),
+		U(0x6863), U(0x6877), U(0x687f), U(0x689f), U(0x688f), U(0x68ad),
+		U(0x6894), U(0x689d), U(0x689b), U(0x6883), U(0x6aae), U(0x68b9),
+		U(0x6874), U(0x68b5), U(0x68a0), U(0x68ba), U(0x690f), U(0x688d),
+		U(0x687e), U(0x6901), U(0x68ca), U(0x6908), U(0x68d8), U(0x6922),
+		U(0x6926), U(0x68e1), U(0x690c), U(0x68cd),
+	},
+	{
+		U(0x68d4), U(0x68e7), U(0x68d5), U(0x6936), U(0x6912), U(0x6904),
+		U(0x68d7), U(0x68e3), U(0x6925), U(0x68f9), U(0x68e0), U(0x68ef),
+		U(0x6928), U(0x692a), U(0x691a), U(0x6923), U(0x6921), U(0x68c6),
+		U(0x6979), U(0x6977), U(0x695c), U(0x6978), U(0x696b), U(0x6954),
+		U(0x697e), U(0x696e), U(0x6939), U(0x6974), U(0x693d), U(0x6959),
+		U(0x6930), U(0x6961), U(0x695e), U(0x695d), U(0x6981), U(0x696a),
+		U(0x69b2), U(0x69ae), U(0x69d0), U(0x69bf), U(0x69c1), U(0x69d3),
+		U(0x69be), U(0x69ce), U(0x5be8), U(0x69ca), U(0x69dd), U(0x69bb),
+		U(0x69c3), U(0x69a7), U(0x6a2e), U(0x6991), U(0x69a0), U(0x699c),
+		U(0x6995), U(0x69b4), U(0x69de), U(0x69e8), U(0x6a02), U(0x6a1b),
+		U(0x69ff), U(0x6b0a), U(0x69f9), U(0x69f2), U(0x69e7), U(0x6a05),
+		U(0x69b1), U(0x6a1e), U(0x69ed), U(0x6a14), U(0x69eb), U(0x6a0a),
+		U(0x6a12), U(0x6ac1), U(0x6a23), U(0x6a13), U(0x6a44), U(0x6a0c),
+		U(0x6a72), U(0x6a36), U(0x6a78), U(0x6a47), U(0x6a62), U(0x6a59),
+		U(0x6a66), U(0x6a48), U(0x6a38), U(0x6a22), U(0x6a90), U(0x6a8d),
+		U(0x6aa0), U(0x6a84), U(0x6aa2), U(0x6aa3),
+	},
+	{
+		U(0x6a97), U(0x8617), U(0x6abb), U(0x6ac3), U(0x6ac2), U(0x6ab8),
+		U(0x6ab3), U(0x6aac), U(0x6ade), U(0x6ad1), U(0x6adf), U(0x6aaa),
+		U(0x6ada), U(0x6aea), U(0x6afb), U(0x6b05), U(0x8616), U(0x6afa),
+		U(0x6b12), U(0x6b16), U(0x9b31), U(0x6b1f), U(0x6b38), U(0x6b37),
+		U(0x76dc), U(0x6b39), U(0x98ee), U(0x6b47), U(0x6b43), U(0x6b49),
+		U(0x6b50), U(0x6b59), U(0x6b54), U(0x6b5b), U(0x6b5f), U(0x6b61),
+		U(0x6b78), U(0x6b79), U(0x6b7f), U(0x6b80), U(0x6b84), U(0x6b83),
+		U(0x6b8d), U(0x6b98), U(0x6b95), U(0x6b9e), U(0x6ba4), U(0x6baa),
+		U(0x6bab), U(0x6baf), U(0x6bb2), U(0x6bb1), U(0x6bb3), U(0x6bb7),
+		U(0x6bbc), U(0x6bc6), U(0x6bcb), U(0x6bd3), U(0x6bdf), U(0x6bec),
+		U(0x6beb), U(0x6bf3), U(0x6bef), U(0x9ebe), U(0x6c08), U(0x6c13),
+		U(0x6c14), U(0x6c1b), U(0x6c24), U(0x6c23), U(0x6c5e), U(0x6c55),
+		U(0x6c62), U(0x6c6a), U(0x6c82), U(0x6c8d), U(0x6c9a), U(0x6c81),
+		U(0x6c9b), U(0x6c7e), U(0x6c68), U(0x6c73), U(0x6c92), U(0x6c90),
+		U(0x6cc4), U(0x6cf1), U(0x6cd3), U(0x6cbd), U(0x6cd7), U(0x6cc5),
+		U(0x6cdd), U(0x6cae), U(0x6cb1), U(0x6cbe),
+	},
+	{
+		U(0x6cba), U(0x6cdb), U(0x6cef), U(0x6cd9), U(0x6cea), U(0x6d1f),
+		U(0x884d), U(0x6d36), U(0x6d2b), U(0x6d3d), U(0x6d38), U(0x6d19),
+		U(0x6d35), U(0x6d33), U(0x6d12), U(0x6d0c), U(0x6d63), U(0x6d93),
+		U(0x6d64), U(0x6d5a), U(0x6d79), U(0x6d59), U(0x6d8e), U(0x6d95),
+		U(0x6fe4), U(0x6d85), U(0x6df9), U(0x6e15), U(0x6e0a), U(0x6db5),
+		U(0x6dc7), U(0x6de6), U(0x6db8), U(0x6dc6), U(0x6dec), U(0x6dde),
+		U(0x6dcc), U(0x6de8), U(0x6dd2), U(0x6dc5), U(0x6dfa), U(0x6dd9),
+		U(0x6de4), U(0x6dd5), U(0x6dea), U(0x6dee), U(0x6e2d), U(0x6e6e),
+		U(0x6e2e), U(0x6e19), U(0x6e72), U(0x6e5f), U(0x6e3e), U(0x6e23),
+		U(0x6e6b), U(0x6e2b), U(0x6e76), U(0x6e4d), U(0x6e1f), U(0x6e43),
+		U(0x6e3a), U(0x6e4e), U(0x6e24), U(0x6eff), U(0x6e1d), U(0x6e38),
+		U(0x6e82), U(0x6eaa), U(0x6e98), U(0x6ec9), U(0x6eb7), U(0x6ed3),
+		U(0x6ebd), U(0x6eaf), U(0x6ec4), U(0x6eb2), U(0x6ed4), U(0x6ed5),
+		U(0x6e8f), U(0x6ea5), U(0x6ec2), U(0x6e9f), U(0x6f41), U(0x6f11),
+		U(0x704c), U(0x6eec), U(0x6ef8), U(0x6efe), U(0x6f3f), U(0x6ef2),
+		U(0x6f31), U(0x6eef), U(0x6f32), U(0x6ecc),
+	},
+	{
+		U(0x6f3e), U(0x6f13), U(0x6ef7), U(0x6f86), U(0x6f7a), U(0x6f78),
+		U(0x6f81), U(0x6f80), U(0x6f6f), U(0x6f5b), U(0x6ff3), U(0x6f6d),
+		U(0x6f82), U(0x6f7c), U(0x6f58), U(0x6f8e), U(0x6f91), U(0x6fc2),
+		U(0x6f66), U(0x6fb3), U(0x6fa3), U(0x6fa1), U(0x6fa4), U(0x6fb9),
+		U(0x6fc6), U(0x6faa), U(0x6fdf), U(0x6fd5), U(0x6fec), U(0x6fd4),
+		U(0x6fd8), U(0x6ff1), U(0x6fee), U(0x6fdb), U(0x7009), U(0x700b),
+		U(0x6ffa), U(0x7011), U(0x7001), U(0x700f), U(0x6ffe), U(0x701b),
+		U(0x701a), U(0x6f74), U(0x701d), U(0x7018), U(0x701f), U(0x7030),
+		U(0x703e), U(0x7032), U(0x7051), U(0x7063), U(0x7099), U(0x7092),
+		U(0x70af), U(0x70f1), U(0x70ac), U(0x70b8), U(0x70b3), U(0x70ae),
+		U(0x70df), U(0x70cb), U(0x70dd), U(0x70d9), U(0x7109), U(0x70fd),
+		U(0x711c), U(0x7119), U(0x7165), U(0x7155), U(0x7188), U(0x7166),
+		U(0x7162), U(0x714c), U(0x7156), U(0x716c), U(0x718f), U(0x71fb),
+		U(0x7184), U(0x7195), U(0x71a8), U(0x71ac), U(0x71d7), U(0x71b9),
+		U(0x71be), U(0x71d2), U(0x71c9), U(0x71d4), U(0x71ce), U(0x71e0),
+		U(0x71ec), U(0x71e7), U(0x71f5), U(0x71fc),
+	},
+	{
+		U(0x71f9), U(0x71ff), U(0x720d), U(0x7210), U(0x721b), U(0x7228),
+		U(0x722d), U(0x722c), U(0x7230), U(0x7232), U(0x723b), U(0x723c),
+		U(0x723f), U(0x7240), U(0x7246), U(0x724b), U(0x7258), U(0x7274),
+		U(0x727e), U(0x7282), U(0x7281), U(0x7287), U(0x7292), U(0x7296),
+		U(0x72a2), U(0x72a7), U(0x72b9), U(0x72b2), U(0x72c3), U(0x72c6),
+		U(0x72c4), U(0x72ce), U(0x72d2), U(0x72e2), U(0x72e0), U(0x72e1),
+		U(0x72f9), U(0x72f7), U(0x500f), U(0x7317), U(0x730a), U(0x731c),
+		U(0x7316), U(0x731d), U(0x7334), U(0x732f), U(0x7329), U(0x7325),
+		U(0x733e), U(0x734e), U(0x734f), U(0x9ed8), U(0x7357), U(0x736a),
+		U(0x7368), U(0x7370), U(0x7378), U(0x7375), U(0x737b), U(0x737a),
+		U(0x73c8), U(0x73b3), U(0x73ce), U(0x73bb), U(0x73c0), U(0x73e5),
+		U(0x73ee), U(0x73de), U(0x74a2), U(0x7405), U(0x746f), U(0x7425),
+		U(0x73f8), U(0x7432), U(0x743a), U(0x7455), U(0x743f), U(0x745f),
+		U(0x7459), U(0x7441), U(0x745c), U(0x7469), U(0x7470), U(0x7463),
+		U(0x746a), U(0x7476), U(0x747e), U(0x748b), U(0x749e), U(0x74a7),
+		U(0x74ca), U(0x74cf), U(0x74d4), U(0x73f1),
+	},
+	{
+		U(0x74e0), U(0x74e3), U(0x74e7), U(0x74e9), U(0x74ee), U(0x74f2),
+		U(0x74f0), U(0x74f1), U(0x74f8), U(0x74f7), U(0x7504), U(0x7503),
+		U(0x7505), U(0x750c), U(0x750e), U(0x750d), U(0x7515), U(0x7513),
+		U(0x751e), U(0x7526), U(0x752c), U(0x753c), U(0x7544), U(0x754d),
+		U(0x754a), U(0x7549), U(0x755b), U(0x7546), U(0x755a), U(0x7569),
+		U(0x7564), U(0x7567), U(0x756b), U(0x756d), U(0x7578), U(0x7576),
+		U(0x7586), U(0x7587), U(0x7574), U(0x758a), U(0x7589), U(0x7582),
+		U(0x7594), U(0x759a), U(0x759d), U(0x75a5), U(0x75a3), U(0x75c2),
+		U(0x75b3), U(0x75c3), U(0x75b5), U(0x75bd), U(0x75b8), U(0x75bc),
+		U(0x75b1), U(0x75cd), U(0x75ca), U(0x75d2), U(0x75d9), U(0x75e3),
+		U(0x75de), U(0x75fe), U(0x75ff), U(0x75fc), U(0x7601), U(0x75f0),
+		U(0x75fa), U(0x75f2), U(0x75f3), U(0x760b), U(0x760d), U(0x7609),
+		U(0x761f), U(0x7627), U(0x7620), U(0x7621), U(0x7622), U(0x7624),
+		U(0x7634), U(0x7630), U(0x763b), U(0x7647), U(0x7648), U(0x7646),
+		U(0x765c), U(0x7658), U(0x7661), U(0x7662), U(0x7668), U(0x7669),
+		U(0x766a), U(0x7667), U(0x766c), U(0x7670),
+	},
+	{
+		U(0x7672), U(0x7676), U(0x7678), U(0x767c), U(0x7680), U(0x7683),
+		U(0x7688), U(0x768b), U(0x768e), U(0x7696), U(0x7693), U(0x7699),
+		U(0x769a), U(0x76b0), U(0x76b4), U(0x76b8), U(0x76b9), U(0x76ba),
+		U(0x76c2), U(0x76cd), U(0x76d6), U(0x76d2), U(0x76de), U(0x76e1),
+		U(0x76e5), U(0x76e7), U(0x76ea), U(0x862f), U(0x76fb), U(0x7708),
+		U(0x7707), U(0x7704), U(0x7729), U(0x7724), U(0x771e), U(0x7725),
+		U(0x7726), U(0x771b), U(0x7737), U(0x7738), U(0x7747), U(0x775a),
+		U(0x7768), U(0x776b), U(0x775b), U(0x7765), U(0x777f), U(0x777e),
+		U(0x7779), U(0x778e), U(0x778b), U(0x7791), U(0x77a0), U(0x779e),
+		U(0x77b0), U(0x77b6), U(0x77b9), U(0x77bf), U(0x77bc), U(0x77bd),
+		U(0x77bb), U(0x77c7), U(0x77cd), U(0x77d7), U(0x77da), U(0x77dc),
+		U(0x77e3), U(0x77ee), U(0x77fc), U(0x780c), U(0x7812), U(0x7926),
+		U(0x7820), U(0x792a), U(0x7845), U(0x788e), U(0x7874), U(0x7886),
+		U(0x787c), U(0x789a), U(0x788c), U(0x78a3), U(0x78b5), U(0x78aa),
+		U(0x78af), U(0x78d1), U(0x78c6), U(0x78cb), U(0x78d4), U(0x78be),
+		U(0x78bc), U(0x78c5), U(0x78ca), U(0x78ec),
+	},
+	{
+		U(0x78e7), U(0x78da), U(0x78fd), U(0x78f4), U(0x7907), U(0x7912),
+		U(0x7911), U(0x7919), U(0x792c), U(0x792b), U(0x7940), U(0x7960),
+		U(0x7957), U(0x795f), U(0x795a), U(0x7955), U(0x7953), U(0x797a),
+		U(0x797f), U(0x798a), U(0x799d), U(0x79a7), U(0x9f4b), U(0x79aa),
+		U(0x79ae), U(0x79b3), U(0x79b9), U(0x79ba), U(0x79c9), U(0x79d5),
+		U(0x79e7), U(0x79ec), U(0x79e1), U(0x79e3), U(0x7a08), U(0x7a0d),
+		U(0x7a18), U(0x7a19), U(0x7a20), U(0x7a1f), U(0x7980), U(0x7a31),
+		U(0x7a3b), U(0x7a3e), U(0x7a37), U(0x7a43), U(0x7a57), U(0x7a49),
+		U(0x7a61), U(0x7a62), U(0x7a69), U(0x9f9d), U(0x7a70), U(0x7a79),
+		U(0x7a7d), U(0x7a88), U(0x7a97), U(0x7a95), U(0x7a98), U(0x7a96),
+		U(0x7aa9), U(0x7ac8), U(0x7ab0), U(0x7ab6), U(0x7ac5), U(0x7ac4),
+		U(0x7abf), U(0x9083), U(0x7ac7), U(0x7aca), U(0x7acd), U(0x7acf),
+		U(0x7ad5), U(0x7ad3), U(0x7ad9), U(0x7ada), U(0x7add), U(0x7ae1),
+		U(0x7ae2), U(0x7ae6), U(0x7aed), U(0x7af0), U(0x7b02), U(0x7b0f),
+		U(0x7b0a), U(0x7b06), U(0x7b33), U(0x7b18), U(0x7b19), U(0x7b1e),
+		U(0x7b35), U(0x7b28), U(0x7b36), U(0x7b50),
+	},
+	{
+		U(0x7b7a), U(0x7b04), U(0x7b4d), U(0x7b0b), U(0x7b4c), U(0x7b45),
+		U(0x7b75), U(0x7b65), U(0x7b74), U(0x7b67), U(0x7b70), U(0x7b71),
+		U(0x7b6c), U(0x7b6e), U(0x7b9d), U(0x7b98), U(0x7b9f), U(0x7b8d),
+		U(0x7b9c), U(0x7b9a), U(0x7b8b), U(0x7b92), U(0x7b8f), U(0x7b5d),
+		U(0x7b99), U(0x7bcb), U(0x7bc1), U(0x7bcc), U(0x7bcf), U(0x7bb4),
+		U(0x7bc6), U(0x7bdd), U(0x7be9), U(0x7c11), U(0x7c14), U(0x7be6),
+		U(0x7be5), U(0x7c60), U(0x7c00), U(0x7c07), U(0x7c13), U(0x7bf3),
+		U(0x7bf7), U(0x7c17), U(0x7c0d), U(0x7bf6), U(0x7c23), U(0x7c27),
+		U(0x7c2a), U(0x7c1f), U(0x7c37), U(0x7c2b), U(0x7c3d), U(0x7c4c),
+		U(0x7c43), U(0x7c54), U(0x7c4f), U(0x7c40), U(0x7c50), U(0x7c58),
+		U(0x7c5f), U(0x7c64), U(0x7c56), U(0x7c65), U(0x7c6c), U(0x7c75),
+		U(0x7c83), U(0x7c90), U(0x7ca4), U(0x7cad), U(0x7ca2), U(0x7cab),
+		U(0x7ca1), U(0x7ca8), U(0x7cb3), U(0x7cb2), U(0x7cb1), U(0x7cae),
+		U(0x7cb9), U(0x7cbd), U(0x7cc0), U(0x7cc5), U(0x7cc2), U(0x7cd8),
+		U(0x7cd2), U(0x7cdc), U(0x7ce2), U(0x9b3b), U(0x7cef), U(0x7cf2),
+		U(0x7cf4), U(0x7cf6), U(0x7cfa), U(0x7d06),
+	},
+	{
+		U(0x7d02), U(0x7d1c), U(0x7d15), U(0x7d0a), U(0x7d45), U(0x7d4b),
+		U(0x7d2e), U(0x7d32), U(0x7d3f), U(0x7d35), U(0x7d46), U(0x7d73),
+		U(0x7d56), U(0x7d4e), U(0x7d72), U(0x7d68), U(0x7d6e), U(0x7d4f),
+		U(0x7d63), U(0x7d93), U(0x7d89), U(0x7d5b), U(0x7d8f), U(0x7d7d),
+		U(0x7d9b), U(0x7dba), U(0x7dae), U(0x7da3), U(0x7db5), U(0x7dc7),
+		U(0x7dbd), U(0x7dab), U(0x7e3d), U(0x7da2), U(0x7daf), U(0x7ddc),
+		U(0x7db8), U(0x7d9f), U(0x7db0), U(0x7dd8), U(0x7ddd), U(0x7de4),
+		U(0x7dde), U(0x7dfb), U(0x7df2), U(0x7de1), U(0x7e05), U(0x7e0a),
+		U(0x7e23), U(0x7e21), U(0x7e12), U(0x7e31), U(0x7e1f), U(0x7e09),
+		U(0x7e0b), U(0x7e22), U(0x7e46), U(0x7e66), U(0x7e3b), U(0x7e35),
+		U(0x7e39), U(0x7e43), U(0x7e37), U(0x7e32), U(0x7e3a), U(0x7e67),
+		U(0x7e5d), U(0x7e56), U(0x7e5e), U(0x7e59), U(0x7e5a), U(0x7e79),
+		U(0x7e6a), U(0x7e69), U(0x7e7c), U(0x7e7b), U(0x7e83), U(0x7dd5),
+		U(0x7e7d), U(0x8fae), U(0x7e7f), U(0x7e88), U(0x7e89), U(0x7e8c),
+		U(0x7e92), U(0x7e90), U(0x7e93), U(0x7e94), U(0x7e96), U(0x7e8e),
+		U(0x7e9b), U(0x7e9c), U(0x7f38), U(0x7f3a),
+	},
+	{
+		U(0x7f45), U(0x7f4c), U(0x7f4d), U(0x7f4e), U(0x7f50), U(0x7f51),
+		U(0x7f55), U(0x7f54), U(0x7f58), U(0x7f5f), U(0x7f60), U(0x7f68),
+		U(0x7f69), U(0x7f67), U(0x7f78), U(0x7f82), U(0x7f86), U(0x7f83),
+		U(0x7f88), U(0x7f87), U(0x7f8c), U(0x7f94), U(0x7f9e), U(0x7f9d),
+		U(0x7f9a), U(0x7fa3), U(0x7faf), U(0x7fb2), U(0x7fb9), U(0x7fae),
+		U(0x7fb6), U(0x7fb8), U(0x8b71), U(0x7fc5), U(0x7fc6), U(0x7fca),
+		U(0x7fd5), U(0x7fd4), U(0x7fe1), U(0x7fe6), U(0x7fe9), U(0x7ff3),
+		U(0x7ff9), U(0x98dc), U(0x8006), U(0x8004), U(0x800b), U(0x8012),
+		U(0x8018), U(0x8019), U(0x801c), U(0x8021), U(0x8028), U(0x803f),
+		U(0x803b), U(0x804a), U(0x8046), U(0x8052), U(0x8058), U(0x805a),
+		U(0x805f), U(0x8062), U(0x8068), U(0x8073), U(0x8072), U(0x8070),
+		U(0x8076), U(0x8079), U(0x807d), U(0x807f), U(0x8084), U(0x8086),
+		U(0x8085), U(0x809b), U(0x8093), U(0x809a), U(0x80ad), U(0x5190),
+		U(0x80ac), U(0x80db), U(0x80e5), U(0x80d9), U(0x80dd), U(0x80c4),
+		U(0x80da), U(0x80d6), U(0x8109), U(0x80ef), U(0x80f1), U(0x811b),
+		U(0x8129), U(0x8123), U(0x812f), U(0x814b),
+	},
+	{
+		U(0x968b), U(0x8146), U(0x813e), U(0x8153), U(0x8151), U(0x80fc),
+		U(0x8171), U(0x816e), U(0x8165), U(0x8166), U(0x8174), U(0x8183),
+		U(0x8188), U(0x818a), U(0x8180), U(0x8182), U(0x81a0), U(0x8195),
+		U(0x81a4), U(0x81a3), U(0x815f), U(0x8193), U(0x81a9), U(0x81b0),
+		U(0x81b5), U(0x81be), U(0x81b8), U(0x81bd), U(0x81c0), U(0x81c2),
+		U(0x81ba), U(0x81c9), U(0x81cd), U(0x81d1), U(0x81d9), U(0x81d8),
+		U(0x81c8), U(0x81da), U(0x81df), U(0x81e0), U(0x81e7), U(0x81fa),
+		U(0x81fb), U(0x81fe), U(0x8201), U(0x8202), U(0x8205), U(0x8207),
+		U(0x820a), U(0x820d), U(0x8210), U(0x8216), U(0x8229), U(0x822b),
+		U(0x8238), U(0x8233), U(0x8240), U(0x8259), U(0x8258), U(0x825d),
+		U(0x825a), U(0x825f), U(0x8264), U(0x8262), U(0x8268), U(0x826a),
+		U(0x826b), U(0x822e), U(0x8271), U(0x8277), U(0x8278), U(0x827e),
+		U(0x828d), U(0x8292), U(0x82ab), U(0x829f), U(0x82bb), U(0x82ac),
+		U(0x82e1), U(0x82e3), U(0x82df), U(0x82d2), U(0x82f4), U(0x82f3),
+		U(0x82fa), U(0x8393), U(0x8303), U(0x82fb), U(0x82f9), U(0x82de),
+		U(0x8306), U(0x82dc), U(0x8309), U(0x82d9),
+	},
+	{
+		U(0x8335), U(0x8334), U(0x8316), U(0x8332), U(0x8331), U(0x8340),
+		U(0x8339), U(0x8350), U(0x8345), U(0x832f), U(0x832b), U(0x8317),
+		U(0x8318), U(0x8385), U(0x839a), U(0x83aa), U(0x839f), U(0x83a2),
+		U(0x8396), U(0x8323), U(0x838e), U(0x8387), U(0x838a), U(0x837c),
+		U(0x83b5), U(0x8373), U(0x8375), U(0x83a0), U(0x8389), U(0x83a8),
+		U(0x83f4), U(0x8413), U(0x83eb), U(0x83ce), U(0x83fd), U(0x8403),
+		U(0x83d8), U(0x840b), U(0x83c1), U(0x83f7), U(0x8407), U(0x83e0),
+		U(0x83f2), U(0x840d), U(0x8422), U(0x8420), U(0x83bd), U(0x8438),
+		U(0x8506), U(0x83fb), U(0x846d), U(0x842a), U(0x843c), U(0x855a),
+		U(0x8484), U(0x8477), U(0x846b), U(0x84ad), U(0x846e), U(0x8482),
+		U(0x8469), U(0x8446), U(0x842c), U(0x846f), U(0x8479), U(0x8435),
+		U(0x84ca), U(0x8462), U(0x84b9), U(0x84bf), U(0x849f), U(0x84d9),
+		U(0x84cd), U(0x84bb), U(0x84da), U(0x84d0), U(0x84c1), U(0x84c6),
+		U(0x84d6), U(0x84a1), U(0x8521), U(0x84ff), U(0x84f4), U(0x8517),
+		U(0x8518), U(0x852c), U(0x851f), U(0x8515), U(0x8514), U(0x84fc),
+		U(0x8540), U(0x8563), U(0x8558), U(0x8548),
+	},
+	{
+		U(0x8541), U(0x8602), U(0x854b), U(0x8555), U(0x8580), U(0x85a4),
+		U(0x8588), U(0x8591), U(0x858a), U(0x85a8), U(0x856d), U(0x8594),
+		U(0x859b), U(0x85ea), U(0x8587), U(0x859c), U(0x8577), U(0x857e),
+		U(0x8590), U(0x85c9), U(0x85ba), U(0x85cf), U(0x85b9), U(0x85d0),
+		U(0x85d5), U(0x85dd), U(0x85e5), U(0x85dc), U(0x85f9), U(0x860a),
+		U(0x8613), U(0x860b), U(0x85fe), U(0x85fa), U(0x8606), U(0x8622),
+		U(0x861a), U(0x8630), U(0x863f), U(0x864d), U(0x4e55), U(0x8654),
+		U(0x865f), U(0x8667), U(0x8671), U(0x8693), U(0x86a3), U(0x86a9),
+		U(0x86aa), U(0x868b), U(0x868c), U(0x86b6), U(0x86af), U(0x86c4),
+		U(0x86c6), U(0x86b0), U(0x86c9), U(0x8823), U(0x86ab), U(0x86d4),
+		U(0x86de), U(0x86e9), U(0x86ec), U(0x86df), U(0x86db), U(0x86ef),
+		U(0x8712), U(0x8706), U(0x8708), U(0x8700), U(0x8703), U(0x86fb),
+		U(0x8711), U(0x8709), U(0x870d), U(0x86f9), U(0x870a), U(0x8734),
+		U(0x873f), U(0x8737), U(0x873b), U(0x8725), U(0x8729), U(0x871a),
+		U(0x8760), U(0x875f), U(0x8778), U(0x874c), U(0x874e), U(0x8774),
+		U(0x8757), U(0x8768), U(0x876e), U(0x8759),
+	},
+	{
+		U(0x8753), U(0x8763), U(0x876a), U(0x8805), U(0x87a2), U(0x879f),
+		U(0x8782), U(0x87af), U(0x87cb), U(0x87bd), U(0x87c0), U(0x87d0),
+		U(0x96d6), U(0x87ab), U(0x87c4), U(0x87b3), U(0x87c7), U(0x87c6),
+		U(0x87bb), U(0x87ef), U(0x87f2), U(0x87e0), U(0x880f), U(0x880d),
+		U(0x87fe), U(0x87f6), U(0x87f7), U(0x880e), U(0x87d2), U(0x8811),
+		U(0x8816), U(0x8815), U(0x8822), U(0x8821), U(0x8831), U(0x8836),
+		U(0x8839), U(0x8827), U(0x883b), U(0x8844), U(0x8842), U(0x8852),
+		U(0x8859), U(0x885e), U(0x8862), U(0x886b), U(0x8881), U(0x887e),
+		U(0x889e), U(0x8875), U(0x887d), U(0x88b5), U(0x8872), U(0x8882),
+		U(0x8897), U(0x8892), U(0x88ae), U(0x8899), U(0x88a2), U(0x888d),
+		U(0x88a4), U(0x88b0), U(0x88bf), U(0x88b1), U(0x88c3), U(0x88c4),
+		U(0x88d4), U(0x88d8), U(0x88d9), U(0x88dd), U(0x88f9), U(0x8902),
+		U(0x88fc), U(0x88f4), U(0x88e8), U(0x88f2), U(0x8904), U(0x890c),
+		U(0x890a), U(0x8913), U(0x8943), U(0x891e), U(0x8925), U(0x892a),
+		U(0x892b), U(0x8941), U(0x8944), U(0x893b), U(0x8936), U(0x8938),
+		U(0x894c), U(0x891d), U(0x8960), U(0x895e),
+	},
+	{
+		U(0x8966), U(0x8964), U(0x896d), U(0x896a), U(0x896f), U(0x8974),
+		U(0x8977), U(0x897e), U(0x8983), U(0x8988), U(0x898a), U(0x8993),
+		U(0x8998), U(0x89a1), U(0x89a9), U(0x89a6), U(0x89ac), U(0x89af),
+		U(0x89b2), U(0x89ba), U(0x89bd), U(0x89bf), U(0x89c0), U(0x89da),
+		U(0x89dc), U(0x89dd), U(0x89e7), U(0x89f4), U(0x89f8), U(0x8a03),
+		U(0x8a16), U(0x8a10), U(0x8a0c), U(0x8a1b), U(0x8a1d), U(0x8a25),
+		U(0x8a36), U(0x8a41), U(0x8a5b), U(0x8a52), U(0x8a46), U(0x8a48),
+		U(0x8a7c), U(0x8a6d), U(0x8a6c), U(0x8a62), U(0x8a85), U(0x8a82),
+		U(0x8a84), U(0x8aa8), U(0x8aa1), U(0x8a91), U(0x8aa5), U(0x8aa6),
+		U(0x8a9a), U(0x8aa3), U(0x8ac4), U(0x8acd), U(0x8ac2), U(0x8ada),
+		U(0x8aeb), U(0x8af3), U(0x8ae7), U(0x8ae4), U(0x8af1), U(0x8b14),
+		U(0x8ae0), U(0x8ae2), U(0x8af7), U(0x8ade), U(0x8adb), U(0x8b0c),
+		U(0x8b07), U(0x8b1a), U(0x8ae1), U(0x8b16), U(0x8b10), U(0x8b17),
+		U(0x8b20), U(0x8b33), U(0x97ab), U(0x8b26), U(0x8b2b), U(0x8b3e),
+		U(0x8b28), U(0x8b41), U(0x8b4c), U(0x8b4f), U(0x8b4e), U(0x8b49),
+		U(0x8b56), U(0x8b5b), U(0x8b5a), U(0x8b6b),
+	},
+	{
+		U(0x8b5f), U(0x8b6c), U(0x8b6f), U(0x8b74), U(0x8b7d), U(0x8b80),
+		U(0x8b8c), U(0x8b8e), U(0x8b92), U(0x8b93), U(0x8b96), U(0x8b99),
+		U(0x8b9a), U(0x8c3a), U(0x8c41), U(0x8c3f), U(0x8c48), U(0x8c4c),
+		U(0x8c4e), U(0x8c50), U(0x8c55), U(0x8c62), U(0x8c6c), U(0x8c78),
+		U(0x8c7a), U(0x8c82), U(0x8c89), U(0x8c85), U(0x8c8a), U(0x8c8d),
+		U(0x8c8e), U(0x8c94), U(0x8c7c), U(0x8c98), U(0x621d), U(0x8cad),
+		U(0x8caa), U(0x8cbd), U(0x8cb2), U(0x8cb3), U(0x8cae), U(0x8cb6),
+		U(0x8cc8), U(0x8cc1), U(0x8ce4), U(0x8ce3), U(0x8cda), U(0x8cfd),
+		U(0x8cfa), U(0x8cfb), U(0x8d04), U(0x8d05), U(0x8d0a), U(0x8d07),
+		U(0x8d0f), U(0x8d0d), U(0x8d10), U(0x9f4e), U(0x8d13), U(0x8ccd),
+		U(0x8d14), U(0x8d16), U(0x8d67), U(0x8d6d), U(0x8d71), U(0x8d73),
+		U(0x8d81), U(0x8d99), U(0x8dc2), U(0x8dbe), U(0x8dba), U(0x8dcf),
+		U(0x8dda), U(0x8dd6), U(0x8dcc), U(0x8ddb), U(0x8dcb), U(0x8dea),
+		U(0x8deb), U(0x8ddf), U(0x8de3), U(0x8dfc), U(0x8e08), U(0x8e09),
+		U(0x8dff), U(0x8e1d), U(0x8e1e), U(0x8e10), U(0x8e1f), U(0x8e42),
+		U(0x8e35), U(0x8e30), U(0x8e34), U(0x8e4a),
+	},
+	{
+		U(0x8e47), U(0x8e49), U(0x8e4c), U(0x8e50), U(0x8e48), U(0x8e59),
+		U(0x8e64), U(0x8e60), U(0x8e2a), U(0x8e63), U(0x8e55), U(0x8e76),
+		U(0x8e72), U(0x8e7c), U(0x8e81), U(0x8e87), U(0x8e85), U(0x8e84),
+		U(0x8e8b), U(0x8e8a), U(0x8e93), U(0x8e91), U(0x8e94), U(0x8e99),
+		U(0x8eaa), U(0x8ea1), U(0x8eac), U(0x8eb0), U(0x8ec6), U(0x8eb1),
+		U(0x8ebe), U(0x8ec5), U(0x8ec8), U(0x8ecb), U(0x8edb), U(0x8ee3),
+		U(0x8efc), U(0x8efb), U(0x8eeb), U(0x8efe), U(0x8f0a), U(0x8f05),
+		U(0x8f15), U(0x8f12), U(0x8f19), U(0x8f13), U(0x8f1c), U(0x8f1f),
+		U(0x8f1b), U(0x8f0c), U(0x8f26), U(0x8f33), U(0x8f3b), U(0x8f39),
+		U(0x8f45), U(0x8f42), U(0x8f3e), U(0x8f4c), U(0x8f49), U(0x8f46),
+		U(0x8f4e), U(0x8f57), U(0x8f5c), U(0x8f62), U(0x8f63), U(0x8f64),
+		U(0x8f9c), U(0x8f9f), U(0x8fa3), U(0x8fad), U(0x8faf), U(0x8fb7),
+		U(0x8fda), U(0x8fe5), U(0x8fe2), U(0x8fea), U(0x8fef), U(0x9087),
+		U(0x8ff4), U(0x9005), U(0x8ff9), U(0x8ffa), U(0x9011), U(0x9015),
+		U(0x9021), U(0x900d), U(0x901e), U(0x9016), U(0x900b), U(0x9027),
+		U(0x9036), U(0x9035), U(0x9039), U(0x8ff8),
+	},
+	{
+		U(0x904f), U(0x9050), U(0x9051), U(0x9052), U(0x900e), U(0x9049),
+		U(0x903e), U(0x9056), U(0x9058), U(0x905e), U(0x9068), U(0x906f),
+		U(0x9076), U(0x96a8), U(0x9072), U(0x9082), U(0x907d), U(0x9081),
+		U(0x9080), U(0x908a), U(0x9089), U(0x908f), U(0x90a8), U(0x90af),
+		U(0x90b1), U(0x90b5), U(0x90e2), U(0x90e4), U(0x6248), U(0x90db),
+		U(0x9102), U(0x9112), U(0x9119), U(0x9132), U(0x9130), U(0x914a),
+		U(0x9156), U(0x9158), U(0x9163), U(0x9165), U(0x9169), U(0x9173),
+		U(0x9172), U(0x918b), U(0x9189), U(0x9182), U(0x91a2), U(0x91ab),
+		U(0x91af), U(0x91aa), U(0x91b5), U(0x91b4), U(0x91ba), U(0x91c0),
+		U(0x91c1), U(0x91c9), U(0x91cb), U(0x91d0), U(0x91d6), U(0x91df),
+		U(0x91e1), U(0x91db), U(0x91fc), U(0x91f5), U(0x91f6), U(0x921e),
+		U(0x91ff), U(0x9214), U(0x922c), U(0x9215), U(0x9211), U(0x925e),
+		U(0x9257), U(0x9245), U(0x9249), U(0x9264), U(0x9248), U(0x9295),
+		U(0x923f), U(0x924b), U(0x9250), U(0x929c), U(0x9296), U(0x9293),
+		U(0x929b), U(0x925a), U(0x92cf), U(0x92b9), U(0x92b7), U(0x92e9),
+		U(0x930f), U(0x92fa), U(0x9344), U(0x932e),
+	},
+	{
+		U(0x9319), U(0x9322), U(0x931a), U(0x9323), U(0x933a), U(0x9335),
+		U(0x933b), U(0x935c), U(0x9360), U(0x937c), U(0x936e), U(0x9356),
+		U(0x93b0), U(0x93ac), U(0x93ad), U(0x9394), U(0x93b9), U(0x93d6),
+		U(0x93d7), U(0x93e8), U(0x93e5), U(0x93d8), U(0x93c3), U(0x93dd),
+		U(0x93d0), U(0x93c8), U(0x93e4), U(0x941a), U(0x9414), U(0x9413),
+		U(0x9403), U(0x9407), U(0x9410), U(0x9436), U(0x942b), U(0x9435),
+		U(0x9421), U(0x943a), U(0x9441), U(0x9452), U(0x9444), U(0x945b),
+		U(0x9460), U(0x9462), U(0x945e), U(0x946a), U(0x9229), U(0x9470),
+		U(0x9475), U(0x9477), U(0x947d), U(0x945a), U(0x947c), U(0x947e),
+		U(0x9481), U(0x947f), U(0x9582), U(0x9587), U(0x958a), U(0x9594),
+		U(0x9596), U(0x9598), U(0x9599), U(0x95a0), U(0x95a8), U(0x95a7),
+		U(0x95ad), U(0x95bc), U(0x95bb), U(0x95b9), U(0x95be), U(0x95ca),
+		U(0x6ff6), U(0x95c3), U(0x95cd), U(0x95cc), U(0x95d5), U(0x95d4),
+		U(0x95d6), U(0x95dc), U(0x95e1), U(0x95e5), U(0x95e2), U(0x9621),
+		U(0x9628), U(0x962e), U(0x962f), U(0x9642), U(0x964c), U(0x964f),
+		U(0x964b), U(0x9677), U(0x965c), U(0x965e),
+	},
+	{
+		U(0x965d), U(0x965f), U(0x9666), U(0x9672), U(0x966c), U(0x968d),
+		U(0x9698), U(0x9695), U(0x9697), U(0x96aa), U(0x96a7), U(0x96b1),
+		U(0x96b2), U(0x96b0), U(0x96b4), U(0x96b6), U(0x96b8), U(0x96b9),
+		U(0x96ce), U(0x96cb), U(0x96c9), U(0x96cd), U(0x894d), U(0x96dc),
+		U(0x970d), U(0x96d5), U(0x96f9), U(0x9704), U(0x9706), U(0x9708),
+		U(0x9713), U(0x970e), U(0x9711), U(0x970f), U(0x9716), U(0x9719),
+		U(0x9724), U(0x972a), U(0x9730), U(0x9739), U(0x973d), U(0x973e),
+		U(0x9744), U(0x9746), U(0x9748), U(0x9742), U(0x9749), U(0x975c),
+		U(0x9760), U(0x9764), U(0x9766), U(0x9768), U(0x52d2), U(0x976b),
+		U(0x9771), U(0x9779), U(0x9785), U(0x977c), U(0x9781), U(0x977a),
+		U(0x9786), U(0x978b), U(0x978f), U(0x9790), U(0x979c), U(0x97a8),
+		U(0x97a6), U(0x97a3), U(0x97b3), U(0x97b4), U(0x97c3), U(0x97c6),
+		U(0x97c8), U(0x97cb), U(0x97dc), U(0x97ed), U(0x9f4f), U(0x97f2),
+		U(0x7adf), U(0x97f6), U(0x97f5), U(0x980f), U(0x980c), U(0x9838),
+		U(0x9824), U(0x9821), U(0x9837), U(0x983d), U(0x9846), U(0x984f),
+		U(0x984b), U(0x986b), U(0x986f), U(0x9870),
+	},
+	{
+		U(0x9871), U(0x9874), U(0x9873), U(0x98aa), U(0x98af), U(0x98b1),
+		U(0x98b6), U(0x98c4), U(0x98c3), U(0x98c6), U(0x98e9), U(0x98eb),
+		U(0x9903), U(0x9909), U(0x9912), U(0x9914), U(0x9918), U(0x9921),
+		U(0x991d), U(0x991e), U(0x9924), U(0x9920), U(0x992c), U(0x992e),
+		U(0x993d), U(0x993e), U(0x9942), U(0x9949), U(0x9945), U(0x9950),
+		U(0x994b), U(0x9951), U(0x9952), U(0x994c), U(0x9955), U(0x9997),
+		U(0x9998), U(0x99a5), U(0x99ad), U(0x99ae), U(0x99bc), U(0x99df),
+		U(0x99db), U(0x99dd), U(0x99d8), U(0x99d1), U(0x99ed), U(0x99ee),
+		U(0x99f1), U(0x99f2), U(0x99fb), U(0x99f8), U(0x9a01), U(0x9a0f),
+		U(0x9a05), U(0x99e2), U(0x9a19), U(0x9a2b), U(0x9a37), U(0x9a45),
+		U(0x9a42), U(0x9a40), U(0x9a43), U(0x9a3e), U(0x9a55), U(0x9a4d),
+		U(0x9a5b), U(0x9a57), U(0x9a5f), U(0x9a62), U(0x9a65), U(0x9a64),
+		U(0x9a69), U(0x9a6b), U(0x9a6a), U(0x9aad), U(0x9ab0), U(0x9abc),
+		U(0x9ac0), U(0x9acf), U(0x9ad1), U(0x9ad3), U(0x9ad4), U(0x9ade),
+		U(0x9adf), U(0x9ae2), U(0x9ae3), U(0x9ae6), U(0x9aef), U(0x9aeb),
+		U(0x9aee), U(0x9af4), U(0x9af1), U(0x9af7),
+	},
+	{
+		U(0x9afb), U(0x9b06), U(0x9b18), U(0x9b1a), U(0x9b1f), U(0x9b22),
+		U(0x9b23), U(0x9b25), U(0x9b27), U(0x9b28), U(0x9b29), U(0x9b2a),
+		U(0x9b2e), U(0x9b2f), U(0x9b32), U(0x9b44), U(0x9b43), U(0x9b4f),
+		U(0x9b4d), U(0x9b4e), U(0x9b51), U(0x9b58), U(0x9b74), U(0x9b93),
+		U(0x9b83), U(0x9b91), U(0x9b96), U(0x9b97), U(0x9b9f), U(0x9ba0),
+		U(0x9ba8), U(0x9bb4), U(0x9bc0), U(0x9bca), U(0x9bb9), U(0x9bc6),
+		U(0x9bcf), U(0x9bd1), U(0x9bd2), U(0x9be3), U(0x9be2), U(0x9be4),
+		U(0x9bd4), U(0x9be1), U(0x9c3a), U(0x9bf2), U(0x9bf1), U(0x9bf0),
+		U(0x9c15), U(0x9c14), U(0x9c09), U(0x9c13), U(0x9c0c), U(0x9c06),
+		U(0x9c08), U(0x9c12), U(0x9c0a), U(0x9c04), U(0x9c2e), U(0x9c1b),
+		U(0x9c25), U(0x9c24), U(0x9c21), U(0x9c30), U(0x9c47), U(0x9c32),
+		U(0x9c46), U(0x9c3e), U(0x9c5a), U(0x9c60), U(0x9c67), U(0x9c76),
+		U(0x9c78), U(0x9ce7), U(0x9cec), U(0x9cf0), U(0x9d09), U(0x9d08),
+		U(0x9ceb), U(0x9d03), U(0x9d06), U(0x9d2a), U(0x9d26), U(0x9daf),
+		U(0x9d23), U(0x9d1f), U(0x9d44), U(0x9d15), U(0x9d12), U(0x9d41),
+		U(0x9d3f), U(0x9d3e), U(0x9d46), U(0x9d48),
+	},
+	{
+		U(0x9d5d), U(0x9d5e), U(0x9d64), U(0x9d51), U(0x9d50), U(0x9d59),
+		U(0x9d72), U(0x9d89), U(0x9d87), U(0x9dab), U(0x9d6f), U(0x9d7a),
+		U(0x9d9a), U(0x9da4), U(0x9da9), U(0x9db2), U(0x9dc4), U(0x9dc1),
+		U(0x9dbb), U(0x9db8), U(0x9dba), U(0x9dc6), U(0x9dcf), U(0x9dc2),
+		U(0x9dd9), U(0x9dd3), U(0x9df8), U(0x9de6), U(0x9ded), U(0x9def),
+		U(0x9dfd), U(0x9e1a), U(0x9e1b), U(0x9e1e), U(0x9e75), U(0x9e79),
+		U(0x9e7d), U(0x9e81), U(0x9e88), U(0x9e8b), U(0x9e8c), U(0x9e92),
+		U(0x9e95), U(0x9e91), U(0x9e9d), U(0x9ea5), U(0x9ea9), U(0x9eb8),
+		U(0x9eaa), U(0x9ead), U(0x9761), U(0x9ecc), U(0x9ece), U(0x9ecf),
+		U(0x9ed0), U(0x9ed4), U(0x9edc), U(0x9ede), U(0x9edd), U(0x9ee0),
+		U(0x9ee5), U(0x9ee8), U(0x9eef), U(0x9ef4), U(0x9ef6), U(0x9ef7),
+		U(0x9ef9), U(0x9efb), U(0x9efc), U(0x9efd), U(0x9f07), U(0x9f08),
+		U(0x76b7), U(0x9f15), U(0x9f21), U(0x9f2c), U(0x9f3e), U(0x9f4a),
+		U(0x9f52), U(0x9f54), U(0x9f63), U(0x9f5f), U(0x9f60), U(0x9f61),
+		U(0x9f66), U(0x9f67), U(0x9f6c), U(0x9f6a), U(0x9f77), U(0x9f72),
+		U(0x9f76), U(0x9f95), U(0x9f9c), U(0x9fa0),
+	},
+	{
+		U(0x582f), U(0x69c7), U(0x9059), U(0x7464), U(0x51dc), U(0x7199),
+	},
+	{
+		U(0x3402), U(0x20158), U(0x4efd), U(0x4eff), U(0x4f9a), U(0x4fc9),
+		U(0x509c), U(0x511e), U(0x51bc), U(0x351f), U(0x5307), U(0x5361),
+		U(0x536c), U(0x8a79), U(0x20bb7), U(0x544d), U(0x5496), U(0x549c),
+		U(0x54a9), U(0x550e), U(0x554a), U(0x5672), U(0x56e4), U(0x5733),
+		U(0x5734), U(0xfa10), U(0x5880), U(0x59e4), U(0x5a23), U(0x5a55),
+		U(0x5bec), U(0xfa11), U(0x37e2), U(0x5eac), U(0x5f34), U(0x5f45),
+		U(0x57b7), U(0x6017), U(0x0000), U(0x6130), U(0x6624), U(0x66c8),
+		U(0x66d9), U(0x66fa), U(0x66fb), U(0x0000), U(0x0000), U(0x6911),
+		U(0x693b), U(0x6a45), U(0x6a91), U(0x6adb), U(0x233cc), U(0x233fe),
+		U(0x235c4), U(0x6bf1), U(0x6ce0), U(0x6d2e), U(0xfa45), U(0x6dbf),
+		U(0x6dca), U(0x6df8), U(0xfa46), U(0x6f5e), U(0x6ff9), U(0x7064),
+		U(0x0000), U(0x242ee), U(0x7147), U(0x71c1), U(0x7200), U(0x739f),
+		U(0x73a8), U(0x73c9), U(0x73d6), U(0x741b), U(0x7421), U(0xfa4a),
+		U(0x7426), U(0x742a), U(0x742c), U(0x7439), U(0x744b), U(0x3eda),
+		U(0x7575), U(0x7581), U(0x7772), U(0x4093), U(0x78c8), U(0x78e0),
+		U(0x7947), U(0x79ae), U(0x0000), U(0x0000),
+	},
+	{
+		U(0x0000), U(0x79da), U(0x7a1e), U(0x7b7f), U(0x7c31), U(0x4246),
+		U(0x7d8b), U(0x7fa1), U(0x8118), U(0x813a), U(0x0000), U(0x82ae),
+		U(0x845b), U(0x84dc), U(0x84ec), U(0x8559), U(0x85ce), U(0x8755),
+		U(0x87ec), U(0x880b), U(0x88f5), U(0x89d2), U(0x8af6), U(0x8dce),
+		U(0x8fbb), U(0x8ff6), U(0x90dd), U(0x9127), U(0x912d), U(0x91b2),
+		U(0x9233), U(0x9288), U(0x9321), U(0x9348), U(0x9592), U(0x96de),
+		U(0x9903), U(0x9940), U(0x9ad9), U(0x9bd6), U(0x9dd7), U(0x9eb4),
+		U(0x9eb5),
+	},
+	{
 
-		decoder->ubuf[0] = 0xfc | (uc >> 30);
-		decoder->ubuf[1] = 0x80 | (uc >> 24 & 0x3f);
-		decoder->ubuf[2] = 0x80 | (uc >> 18 & 0x3f);
-		decoder->ubuf[3] = 0x80 | (uc >> 12 & 0x3f);
-		decoder->ubuf[4] = 0x80 | (uc >> 6 & 0x3f);
-		decoder->ubuf[5] = 0x80 | (uc & 0x3f);
+	},
+	{
 
-		decoder->ubuf += 6;
-		decoder->ucount -= 6;
+	},
+	{
 
-	}
+	},
+	{
+		U(0x26cc), U(0x26cd), U(0x26ce), U(0x26cf), U(0x26d0), U(0x26d1),
+		U(0x0000), U(0x26d2), U(0x26d5), U(0x26d3), U(0x26d4), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x1f17f), U(0x1f18a), U(0x0000),
+		U(0x0000), U(0x26d6), U(0x26d7), U(0x26d8), U(0x26d9), U(0x26da),
+		U(0x26db), U(0x26dc), U(0x26dd), U(0x26de), U(0x26df), U(0x26e0),
+		U(0x26e1), U(0x26e2), U(0x3248), U(0x3249), U(0x324a), U(0x324b),
+		U(0x324c), U(0x324d), U(0x324e), U(0x324f), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x2491), U(0x2492), U(0x2493), U(0x1f14a),
+		U(0x1f14c), U(0x1f13f), U(0x1f146), U(0x1f14b), U(0x1f220), U(0x1f211),
+		U(0x1f212), U(0x1f213), U(0x1f142), U(0x1f214), U(0x1f215), U(0x1f216),
+		U(0x1f14d), U(0x1f131), U(0x1f13d), U(0x25a0), U(0x25cf), U(0x1f217),
+		U(0x1f218), U(0x1f219), U(0x1f21a), U(0x1f21b), U(0x26bf), U(0x1f21c),
+		U(0x1f21d), U(0x1f21e), U(0x1f21f), U(0x1f220), U(0x1f221), U(0x1f222),
+		U(0x1f223), U(0x1f224), U(0x1f225), U(0x1f14e), U(0x3299), U(0x1f200),
+	},
+	{
+		U(0x26e3), U(0x26e4), U(0x26e5), U(0x26e6), U(0x26e7), U(0x2613),
+		U(0x328b), U(0x3012), U(0x26e8), U(0x3246), U(0x3245), U(0x26e9),
+		U(0x0fd6), U(0x26ea), U(0x26eb), U(0x26ec), U(0x2668), U(0x26ed),
+		U(0x26ee), U(0x26ef), U(0x2693), U(0x2708), U(0x26f0), U(0x26f1),
+		U(0x26f2), U(0x26f3), U(0x0000), U(0x26f5), U(0x1f157), U(0x24b9),
+		U(0x24c8), U(0x26f6), U(0x1f15f), U(0x1f18b), U(0x1f18d), U(0x1f18c),
+		U(0x1f179), U(0x26f7), U(0x26f8), U(0x26f9), U(0x26fa), U(0x1f17b),
+		U(0x260e), U(0x26fb), U(0x26fc), U(0x26fd), U(0x26fe), U(0x1f17c),
+		U(0x26ff),
+	},
+	{
+		U(0x27a1), U(0x2b05), U(0x2b06), U(0x2b07), U(0x2b2f), U(0x2b2e),
+		U(0x5e74), U(0x6708), U(0x65e5), U(0x5186), U(0x33a1), U(0x33a5),
+		U(0x339d), U(0x33a0), U(0x33a4), U(0x1f100), U(0x2488), U(0x2489),
+		U(0x248a), U(0x248b), U(0x248c), U(0x248d), U(0x248e), U(0x248f),
+		U(0x2490), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x1f101), U(0x1f102), U(0x1f103), U(0x1f104), U(0x1f105),
+		U(0x1f106), U(0x1f107), U(0x1f108), U(0x1f109), U(0x1f10a), U(0x3233),
+		U(0x3236), U(0x3232), U(0x3231), U(0x3239), U(0x3244), U(0x25b6),
+		U(0x25c0), U(0x3016), U(0x3017), U(0x27d0), U(0x00b2), U(0x00b3),
+		U(0x1f12d), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000), U(0x0000),
+		U(0x0000), U(0x1f12c), U(0x1f12b), U(0x3247), U(0x1f14f), U(0x1f229),
+		U(0x213b),
+	},
+	{
+		U(0x322a), U(0x322b), U(0x322c), U(0x322d), U(0x322e), U(0x322f),
+		U(0x3230), U(0x3237), U(0x337e), U(0x337d), U(0x337c), U(0x337b),
+		U(0x2116), U(0x2121), U(0x3036), U(0x26be), U(0x1f246), U(0x1f240),
+		U(0x1f241), U(0x1f243), U(0x1f247), U(0x1f244), U(0x1f248), U(0x1f242),
+		U(0x1f245), U(0x1f12a), U(0x1f223), U(0x1f225), U(0x1f210), U(0x1f213),
+		U(0x1f211), U(0x1f230), U(0x1f21f), U(0x1f212), U(0x1f219), U(0x1f224),
+		U(0x1f22f), U(0x1f222), U(0x2113), U(0x338f), U(0x3390), U(0x33ca),
+		U(0x339e), U(0x33a2), U(0x3371), U(0x0000), U(0x0000), U(0x00bd),
+		U(0x2189), U(0x2153), U(0x2154), U(0x00bc), U(0x00be), U(0x2155),
+		U(0x2156), U(0x2157), U(0x2158), U(0x2159), U(0x215a), U(0x2150),
+		U(0x0000), U(0x2151), U(0x2152), U(0x2600), U(0x2601), U(0x2602),
+		U(0x26c4), U(0x2616), U(0x2617), U(0x26c9), U(0x26ca), U(0x2666),
+		U(0x2665), U(0x2663), U(0x2660), U(0x26cb), U(0x2a00), U(0x203c),
+		U(0x2049), U(0x26c5), U(0x2614), U(0x26c6), U(0x2603), U(0x26c7),
+		U(0x26a1), U(0x26c8), U(0x0000), U(0x269e), U(0x269f), U(0x266c),
+		U(0x260e),
+	},
+	{
+		U(0x2160), U(0x2161), U(0x2162), U(0x2163), U(0x2164), U(0x2165),
+		U(0x2166), U(0x2167), U(0x2168), U(0x2169), U(0x216a), U(0x216b),
+		U(0x2470), U(0x2471), U(0x2472), U(0x2473), U(0x2474), U(0x2475),
+		U(0x2476), U(0x2477), U(0x2478), U(0x2479), U(0x247a), U(0x247b),
+		U(0x247c), U(0x247d), U(0x247e), U(0x247f), U(0x3251), U(0x3252),
+		U(0x3253), U(0x3254), U(0x1f110), U(0x1f111), U(0x1f112), U(0x1f113),
+		U(0x1f114), U(0x1f115), U(0x1f116), U(0x1f117), U(0x1f118), U(0x1f119),
+		U(0x1f11a), U(0x1f11b), U(0x1f11c), U(0x1f11d), U(0x1f11e), U(0x1f11f),
+		U(0x1f120), U(0x1f121), U(0x1f122), U(0x1f123), U(0x1f124), U(0x1f125),
+		U(0x1f126), U(0x1f127), U(0x1f128), U(0x1f129), U(0x3255), U(0x3256),
+		U(0x3257), U(0x3258), U(0x3259), U(0x325a), U(0x2460), U(0x2461),
+		U(0x2462), U(0x2463), U(0x2464), U(0x2465), U(0x2466), U(0x2467),
+		U(0x2468), U(0x2469), U(0x246a), U(0x246b), U(0x246c), U(0x246d),
+		U(0x246e), U(0x246f), U(0x2776), U(0x2777), U(0x2778), U(0x2779),
+		U(0x277a), U(0x277b), U(0x277c), U(0x277d), U(0x277e), U(0x277f),
+		U(0x24eb), U(0x24ec), U(0x325b),
+	},
+};
 
-	return 1;
-}
+static const struct utf8 *const decoder_tables[] = {
+	[CHARSET_ALNUM] = decoder_alnum_table,
+	[CHARSET_HIRAGANA] = decoder_hiragana_table,
+	[CHARSET_KATAKANA] = decoder_katakana_table,
+};
 
-static int decoder_pull(struct decoder *decoder, int *c)
+static int decoder_put(struct decoder *decoder, const struct utf8 *u)
 {
-	if (!decoder->count)
+	if (!u->len || decoder->uend - decoder->ubuf < u->len)
 		return 0;
 
-	*c = decoder->buf[0];
-
-	decoder->count--;
-	decoder->buf++;
+	memcpy(decoder->ubuf, u->s, u->len);
+	decoder->ubuf += u->len;
 	return 1;
 }
 
-static const int decoder_alnum_table[] = {
-	0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027, 0x0028,
-	0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f, 0x0030,
-	0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037, 0x0038,
-	0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f, 0x0040,
-	0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047, 0x0048,
-	0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f, 0x0050,
-	0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057, 0x0058,
-	0x0059, 0x005a, 0x005b, 0x00a5, 0x005d, 0x005e, 0x005f, 0x0060,
-	0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067, 0x0068,
-	0x0069, 0x006a, 0x006b, 0x006c,	0x006d, 0x006e, 0x006f, 0x0070,
-	0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077, 0x0078,
-	0x0079, 0x007a, 0x007b, 0x007c, 0x007d, 0x203e,
-};
-
-static int decoder_handle_alnum(struct decoder *decoder, int c)
+static int decoder_put_ascii(struct decoder *decoder, int c)
 {
-	int uc;
-	uc = decoder_alnum_table[c];
-	return decoder_push(decoder, uc);
-}
-
-static const int decoder_hiragana_table[] = {
-	0x3041, 0x3042, 0x3043, 0x3044, 0x3045, 0x3046, 0x3047, 0x3048,
-	0x3049, 0x304a, 0x304b, 0x304c, 0x304d, 0x304e, 0x304f, 0x3050,
-	0x3051, 0x3052, 0x3053, 0x3054, 0x3055, 0x3056, 0x3057, 0x3058,
-	0x3059, 0x305a, 0x305b, 0x305c, 0x305d, 0x305e, 0x305f, 0x3060,
-	0x3061, 0x3062, 0x3063, 0x3064, 0x3065, 0x3066, 0x3067, 0x3068,
-	0x3069, 0x306a, 0x306b, 0x306c, 0x306d, 0x306e, 0x306f, 0x3070,
-	0x3071, 0x3072, 0x3073, 0x3074, 0x3075, 0x3076, 0x3077, 0x3078,
-	0x3079, 0x307a, 0x307b, 0x307c, 0x307d, 0x307e, 0x307f, 0x3080,
-	0x3081, 0x3082, 0x3083, 0x3084, 0x3085, 0x3086, 0x3087, 0x3088,
-	0x3089, 0x308a, 0x308b, 0x308c, 0x308d, 0x308e, 0x308f, 0x3090,
-	0x3091, 0x3092, 0x3093, 0x3000, 0x3000, 0x3000, 0x309d, 0x309e,
-	0x30fc, 0x3002, 0x300c, 0x300d, 0x3001, 0x30fb,
-};
+	if (decoder->ubuf == decoder->uend)
+		return 0;
 
-static int decoder_handle_hiragana(struct decoder *decoder, int c)
-{
-	int uc;
-	uc = decoder_hiragana_table[c];
-	return decoder_push(decoder, uc);
+	*decoder->ubuf++ = c;
+	return 1;
 }
 
-static const int decoder_katakana_table[] = {
-	0x30a1, 0x30a2, 0x30a3, 0x30a4, 0x30a5, 0x30a6, 0x30a7, 0x30a8,
-	0x30a9, 0x30aa, 0x30ab, 0x30ac, 0x30ad, 0x30ae, 0x30af, 0x30b0,
-	0x30b1, 0x30b2, 0x30b3, 0x30b4, 0x30b5, 0x30b6, 0x30b7, 0x30b8,
-	0x30b9, 0x30ba, 0x30bb, 0x30bc, 0x30bd, 0x30be, 0x30bf, 0x30c0,
-	0x30c1, 0x30c2, 0x30c3, 0x30c4, 0x30c5, 0x30c6, 0x30c7, 0x30c8,
-	0x30c9, 0x30ca, 0x30cb, 0x30cc, 0x30cd, 0x30ce, 0x30cf, 0x30d0,
-	0x30d1, 0x30d2, 0x30d3, 0x30d4, 0x30d5, 0x30d6, 0x30d7, 0x30d8,
-	0x30d9, 0x30da, 0x30db, 0x30dc, 0x30dd, 0x30de, 0x30df, 0x30e0,
-	0x30e1, 0x30e2, 0x30e3, 0x30e4, 0x30e5, 0x30e6, 0x30e7, 0x30e8,
-	0x30e9, 0x30ea, 0x30eb, 0x30ec, 0x30ed, 0x30ee, 0x30ef, 0x30f0,
-	0x30f1, 0x30f2, 0x30f3, 0x30f4, 0x30f5, 0x30f6, 0x30fd, 0x30fe,
-	0x30fc, 0x3002, 0x300c, 0x300d, 0x3001, 0x30fb,
-};
-
-static int decoder_handle_katakana(struct decoder *decoder, int c)
+/* c is the character code, 0 to 93, in the set */
+static int decoder_handle(struct decoder *decoder, enum charset set, int c)
 {
-	int uc;
-	uc = decoder_katakana_table[c];
-	return decoder_push(decoder, uc);
-}
-
-static const int decoder_kanji_table[][94] = {
-	{
-		0x3000, 0x3001, 0x3002, 0xff0c, 0xff0e, 0x30fb, 0xff1a, 0xff1b,
-		0xff1f, 0xff01, 0x309b, 0x309c, 0x00b4, 0xff40, 0x00a8, 0xff3e,
-		0xffe3, 0xff3f, 0x30fd, 0x30fe, 0x309d, 0x309e, 0x3003, 0x4edd,
-		0x3005, 0x3006, 0x3007, 0x30fc, 0x2015, 0x2010, 0xff0f, 0x005c,
-		0x301c, 0x2016, 0xff5c, 0x2026, 0x2025, 0x2018, 0x2019, 0x201c,
-		0x201d, 0xff08, 0xff09, 0x3014, 0x3015, 0xff3b, 0xff3d, 0xff5b,
-		0xff5d, 0x3008, 0x3009, 0x300a, 0x300b, 0x300c, 0x300d, 0x300e,
-		0x300f, 0x3010, 0x3011, 0xff0b, 0x2212, 0x00b1, 0x00d7, 0x00f7,
-		0xff1d, 0x2260, 0xff1c, 0xff1e, 0x2266, 0x2267, 0x221e, 0x2234,
-		0x2642, 0x2640, 0x00b0, 0x2032, 0x2033, 0x2103, 0xffe5, 0xff04,
-		0x00a2, 0x00a3, 0xff05, 0xff03, 0xff06, 0xff0a, 0xff20, 0x00a7,
-		0x2606, 0x2605, 0x25cb, 0x25cf, 0x25ce, 0x25c7,
-	}, {
-		0x25c6, 0x25a1, 0x25a0, 0x25b3, 0x25b2, 0x25bd, 0x25bc, 0x203b,
-		0x3012, 0x2192, 0x2190, 0x2191, 0x2193, 0x3013, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x2208, 0x220b, 0x2286, 0x2287, 0x2282, 0x2283, 0x222a,
-		0x2229, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x2227, 0x2228, 0x00ac, 0x21d2, 0x21d4, 0x2200, 0x2203,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x2220, 0x22a5, 0x2312, 0x2202, 0x2207,
-		0x2261, 0x2252, 0x226a, 0x226b, 0x221a, 0x223d, 0x221d, 0x2235,
-		0x222b, 0x222c, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x212b, 0x2030, 0x266f, 0x266d, 0x266a, 0x2020, 0x2021,
-		0x00b6, 0x0000, 0x0000, 0x0000, 0x0000, 0x25ef,
-	}, {
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0xff10,
-		0xff11, 0xff12, 0xff13, 0xff14, 0xff15, 0xff16, 0xff17, 0xff18,
-		0xff19, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0xff21, 0xff22, 0xff23, 0xff24, 0xff25, 0xff26, 0xff27, 0xff28,
-		0xff29, 0xff2a, 0xff2b, 0xff2c, 0xff2d, 0xff2e, 0xff2f, 0xff30,
-		0xff31, 0xff32, 0xff33, 0xff34, 0xff35, 0xff36, 0xff37, 0xff38,
-		0xff39, 0xff3a, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0xff41, 0xff42, 0xff43, 0xff44, 0xff45, 0xff46, 0xff47, 0xff48,
-		0xff49, 0xff4a, 0xff4b, 0xff4c, 0xff4d, 0xff4e, 0xff4f, 0xff50,
-		0xff51, 0xff52, 0xff53, 0xff54, 0xff55, 0xff56, 0xff57, 0xff58,
-		0xff59, 0xff5a,
-	}, {
-		0x3041, 0x3042, 0x3043, 0x3044, 0x3045, 0x3046, 0x3047, 0x3048,
-		0x3049, 0x304a, 0x304b, 0x304c, 0x304d, 0x304e, 0x304f, 0x3050,
-		0x3051, 0x3052, 0x3053, 0x3054, 0x3055, 0x3056, 0x3057, 0x3058,
-		0x3059, 0x305a, 0x305b, 0x305c, 0x305d, 0x305e, 0x305f, 0x3060,
-		0x3061, 0x3062, 0x3063, 0x3064, 0x3065, 0x3066, 0x3067, 0x3068,
-		0x3069, 0x306a, 0x306b, 0x306c, 0x306d, 0x306e, 0x306f, 0x3070,
-		0x3071, 0x3072, 0x3073, 0x3074, 0x3075, 0x3076, 0x3077, 0x3078,
-		0x3079, 0x307a, 0x307b, 0x307c, 0x307d, 0x307e, 0x307f, 0x3080,
-		0x3081, 0x3082, 0x3083, 0x3084, 0x3085, 0x3086, 0x3087, 0x3088,
-		0x3089, 0x308a, 0x308b, 0x308c, 0x308d, 0x308e, 0x308f, 0x3090,
-		0x3091, 0x3092, 0x3093,
-	}, {
-		0x30a1, 0x30a2, 0x30a3, 0x30a4, 0x30a5, 0x30a6, 0x30a7, 0x30a8,
-		0x30a9, 0x30aa, 0x30ab, 0x30ac, 0x30ad, 0x30ae, 0x30af, 0x30b0,
-		0x30b1, 0x30b2, 0x30b3, 0x30b4, 0x30b5, 0x30b6, 0x30b7, 0x30b8,
-		0x30b9, 0x30ba, 0x30bb, 0x30bc, 0x30bd, 0x30be, 0x30bf, 0x30c0,
-		0x30c1, 0x30c2, 0x30c3, 0x30c4, 0x30c5, 0x30c6, 0x30c7, 0x30c8,
-		0x30c9, 0x30ca, 0x30cb, 0x30cc, 0x30cd, 0x30ce, 0x30cf, 0x30d0,
-		0x30d1, 0x30d2, 0x30d3, 0x30d4, 0x30d5, 0x30d6, 0x30d7, 0x30d8,
-		0x30d9, 0x30da, 0x30db, 0x30dc, 0x30dd, 0x30de, 0x30df, 0x30e0,
-		0x30e1, 0x30e2, 0x30e3, 0x30e4, 0x30e5, 0x30e6, 0x30e7, 0x30e8,
-		0x30e9, 0x30ea, 0x30eb, 0x30ec, 0x30ed, 0x30ee, 0x30ef, 0x30f0,
-		0x30f1, 0x30f2, 0x30f3, 0x30f4, 0x30f5, 0x30f6,
-	}, {
-		0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397, 0x0398,
-		0x0399, 0x039a, 0x039b, 0x039c, 0x039d, 0x039e, 0x039f, 0x03a0,
-		0x03a1, 0x03a3, 0x03a4, 0x03a5, 0x03a6, 0x03a7, 0x03a8, 0x03a9,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x03b1, 0x03b2, 0x03b3, 0x03b4, 0x03b5, 0x03b6, 0x03b7, 0x03b8,
-		0x03b9, 0x03ba, 0x03bb, 0x03bc, 0x03bd, 0x03be, 0x03bf, 0x03c0,
-		0x03c1, 0x03c3, 0x03c4, 0x03c5, 0x03c6, 0x03c7, 0x03c8, 0x03c9,
-	}, {
-		0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0401, 0x0416,
-		0x0417, 0x0418, 0x0419, 0x041a, 0x041b, 0x041c, 0x041d, 0x041e,
-		0x041f, 0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426,
-		0x0427, 0x0428, 0x0429, 0x042a, 0x042b, 0x042c, 0x042d, 0x042e,
-		0x042f, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0451, 0x0436,
-		0x0437, 0x0438, 0x0439, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e,
-		0x043f, 0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446,
-		0x0447, 0x0448, 0x0449, 0x044a, 0x044b, 0x044c, 0x044d, 0x044e,
-		0x044f,
-	}, {
-		0x2500, 0x2502, 0x250c, 0x2510, 0x2518, 0x2514, 0x251c, 0x252c,
-		0x2524, 0x2534, 0x253c, 0x2501, 0x2503, 0x250f, 0x2513, 0x251b,
-		0x2517, 0x2523, 0x2533, 0x252b, 0x253b, 0x254b, 0x2520, 0x252f,
-		0x2528, 0x2537, 0x253f, 0x251d, 0x2530, 0x2525, 0x2538, 0x2542,
-	}, {
-	}, {
-	}, {
-	}, {
-	}, {
-	}, {
-	}, {
-	}, {
-		0x4e9c, 0x5516, 0x5a03, 0x963f, 0x54c0, 0x611b, 0x6328, 0x59f6,
-		0x9022, 0x8475, 0x831c, 0x7a50, 0x60aa, 0x63e1, 0x6e25, 0x65ed,
-		0x8466, 0x82a6, 0x9bf5, 0x6893, 0x5727, 0x65a1, 0x6271, 0x5b9b,
-		0x59d0, 0x867b, 0x98f4, 0x7d62, 0x7dbe, 0x9b8e, 0x6216, 0x7c9f,
-		0x88b7, 0x5b89, 0x5eb5, 0x6309, 0x6697, 0x6848, 0x95c7, 0x978d,
-		0x674f, 0x4ee5, 0x4f0a, 0x4f4d, 0x4f9d, 0x5049, 0x56f2, 0x5937,
-		0x59d4, 0x5a01, 0x5c09, 0x60df, 0x610f, 0x6170, 0x6613, 0x6905,
-		0x70ba, 0x754f, 0x7570, 0x79fb, 0x7dad, 0x7def, 0x80c3, 0x840e,
-		0x8863, 0x8b02, 0x9055, 0x907a, 0x533b, 0x4e95, 0x4ea5, 0x57df,
-		0x80b2, 0x90c1, 0x78ef, 0x4e00, 0x58f1, 0x6ea2, 0x9038, 0x7a32,
-		0x8328, 0x828b, 0x9c2f, 0x5141, 0x5370, 0x54bd, 0x54e1, 0x56e0,
-		0x59fb, 0x5f15, 0x98f2, 0x6deb, 0x80e4, 0x852d,
-	}, {
-		0x9662, 0x9670, 0x96a0, 0x97fb, 0x540b, 0x53f3, 0x5b87, 0x70cf,
-		0x7fbd, 0x8fc2, 0x96e8, 0x536f, 0x9d5c, 0x7aba, 0x4e11, 0x7893,
-		0x81fc, 0x6e26, 0x5618, 0x5504, 0x6b1d, 0x851a, 0x9c3b, 0x59e5,
-		0x53a9, 0x6d66, 0x74dc, 0x958f, 0x5642, 0x4e91, 0x904b, 0x96f2,
-		0x834f, 0x990c, 0x53e1, 0x55b6, 0x5b30, 0x5f71, 0x6620, 0x66f3,
-		0x6804, 0x6c38, 0x6cf3, 0x6d29, 0x745b, 0x76c8, 0x7a4e, 0x9834,
-		0x82f1, 0x885b, 0x8a60, 0x92ed, 0x6db2, 0x75ab, 0x76ca, 0x99c5,
-		0x60a6, 0x8b01, 0x8d8a, 0x95b2, 0x698e, 0x53ad, 0x5186, 0x5712,
-		0x5830, 0x5944, 0x5bb4, 0x5ef6, 0x6028, 0x63a9, 0x63f4, 0x6cbf,
-		0x6f14, 0x708e, 0x7114, 0x7159, 0x71d5, 0x733f, 0x7e01, 0x8276,
-		0x82d1, 0x8597, 0x9060, 0x925b, 0x9d1b, 0x5869, 0x65bc, 0x6c5a,
-		0x7525, 0x51f9, 0x592e, 0x5965, 0x5f80, 0x5fdc,
-	}, {
-		0x62bc, 0x65fa, 0x6a2a, 0x6b27, 0x6bb4, 0x738b, 0x7fc1, 0x8956,
-		0x9d2c, 0x9d0e, 0x9ec4, 0x5ca1, 0x6c96, 0x837b, 0x5104, 0x5c4b,
-		0x61b6, 0x81c6, 0x6876, 0x7261, 0x4e59, 0x4ffa, 0x5378, 0x6069,
-		0x6e29, 0x7a4f, 0x97f3, 0x4e0b, 0x5316, 0x4eee, 0x4f55, 0x4f3d,
-		0x4fa1, 0x4f73, 0x52a0, 0x53ef, 0x5609, 0x590f, 0x5ac1, 0x5bb6,
-		0x5be1, 0x79d1, 0x6687, 0x679c, 0x67b6, 0x6b4c, 0x6cb3, 0x706b,
-		0x73c2, 0x798d, 0x79be, 0x7a3c, 0x7b87, 0x82b1, 0x82db, 0x8304,
-		0x8377, 0x83ef, 0x83d3, 0x8766, 0x8ab2, 0x5629, 0x8ca8, 0x8fe6,
-		0x904e, 0x971e, 0x868a, 0x4fc4, 0x5ce8, 0x6211, 0x7259, 0x753b,
-		0x81e5, 0x82bd, 0x86fe, 0x8cc0, 0x96c5, 0x9913, 0x99d5, 0x4ecb,
-		0x4f1a, 0x89e3, 0x56de, 0x584a, 0x58ca, 0x5efb, 0x5feb, 0x602a,
-		0x6094, 0x6062, 0x61d0, 0x6212, 0x62d0, 0x6539,
-	}, {
-		0x9b41, 0x6666, 0x68b0, 0x6d77, 0x7070, 0x754c, 0x7686, 0x7d75,
-		0x82a5, 0x87f9, 0x958b, 0x968e, 0x8c9d, 0x51f1, 0x52be, 0x5916,
-		0x54b3, 0x5bb3, 0x5d16, 0x6168, 0x6982, 0x6daf, 0x788d, 0x84cb,
-		0x8857, 0x8a72, 0x93a7, 0x9ab8, 0x6d6c, 0x99a8, 0x86d9, 0x57a3,
-		0x67ff, 0x86ce, 0x920e, 0x5283, 0x5687, 0x5404, 0x5ed3, 0x62e1,
-		0x64b9, 0x683c, 0x6838, 0x6bbb, 0x7372, 0x78ba, 0x7a6b, 0x899a,
-		0x89d2, 0x8d6b, 0x8f03, 0x90ed, 0x95a3, 0x9694, 0x9769, 0x5b66,
-		0x5cb3, 0x697d, 0x984d, 0x984e, 0x639b, 0x7b20, 0x6a2b, 0x6a7f,
-		0x68b6, 0x9c0d, 0x6f5f, 0x5272, 0x559d, 0x6070, 0x62ec, 0x6d3b,
-		0x6e07, 0x6ed1, 0x845b, 0x8910, 0x8f44, 0x4e14, 0x9c39, 0x53f6,
-		0x691b, 0x6a3a, 0x9784, 0x682a, 0x515c, 0x7ac3, 0x84b2, 0x91dc,
-		0x938c, 0x565b, 0x9d28, 0x6822, 0x8305, 0x8431,
-	}, {
-		0x7ca5, 0x5208, 0x82c5, 0x74e6, 0x4e7e, 0x4f83, 0x51a0, 0x5bd2,
-		0x520a, 0x52d8, 0x52e7, 0x5dfb, 0x559a, 0x582a, 0x59e6, 0x5b8c,
-		0x5b98, 0x5bdb, 0x5e72, 0x5e79, 0x60a3, 0x611f, 0x6163, 0x61be,
-		0x63db, 0x6562, 0x67d1, 0x6853, 0x68fa, 0x6b3e, 0x6b53, 0x6c57,
-		0x6f22, 0x6f97, 0x6f45, 0x74b0, 0x7518, 0x76e3, 0x770b, 0x7aff,
-		0x7ba1, 0x7c21, 0x7de9, 0x7f36, 0x7ff0, 0x809d, 0x8266, 0x839e,
-		0x89b3, 0x8acc, 0x8cab, 0x9084, 0x9451, 0x9593, 0x9591, 0x95a2,
-		0x9665, 0x97d3, 0x9928, 0x8218, 0x4e38, 0x542b, 0x5cb8, 0x5dcc,
-		0x73a9, 0x764c, 0x773c, 0x5ca9, 0x7feb, 0x8d0b, 0x96c1, 0x9811,
-		0x9854, 0x9858, 0x4f01, 0x4f0e, 0x5371, 0x559c, 0x5668, 0x57fa,
-		0x5947, 0x5b09, 0x5bc4, 0x5c90, 0x5e0c, 0x5e7e, 0x5fcc, 0x63ee,
-		0x673a, 0x65d7, 0x65e2, 0x671f, 0x68cb, 0x68c4,
-	}, {
-		0x6a5f, 0x5e30, 0x6bc5, 0x6c17, 0x6c7d, 0x757f, 0x7948, 0x5b63,
-		0x7a00, 0x7d00, 0x5fbd, 0x898f, 0x8a18, 0x8cb4, 0x8d77, 0x8ecc,
-		0x8f1d, 0x98e2, 0x9a0e, 0x9b3c, 0x4e80, 0x507d, 0x5100, 0x5993,
-		0x5b9c, 0x622f, 0x6280, 0x64ec, 0x6b3a, 0x72a0, 0x7591, 0x7947,
-		0x7fa9, 0x87fb, 0x8abc, 0x8b70, 0x63ac, 0x83ca, 0x97a0, 0x5409,
-		0x5403, 0x55ab, 0x6854, 0x6a58, 0x8a70, 0x7827, 0x6775, 0x9ecd,
-		0x5374, 0x5ba2, 0x811a, 0x8650, 0x9006, 0x4e18, 0x4e45, 0x4ec7,
-		0x4f11, 0x53ca, 0x5438, 0x5bae, 0x5f13, 0x6025, 0x6551, 0x673d,
-		0x6c42, 0x6c72, 0x6ce3, 0x7078, 0x7403, 0x7a76, 0x7aae, 0x7b08,
-		0x7d1a, 0x7cfe, 0x7d66, 0x65e7, 0x725b, 0x53bb, 0x5c45, 0x5de8,
-		0x62d2, 0x62e0, 0x6319, 0x6e20, 0x865a, 0x8a31, 0x8ddd, 0x92f8,
-		0x6f01, 0x79a6, 0x9b5a, 0x4ea8, 0x4eab, 0x4eac,
-	}, {
-		0x4f9b, 0x4fa0, 0x50d1, 0x5147, 0x7af6, 0x5171, 0x51f6, 0x5354,
-		0x5321, 0x537f, 0x53eb, 0x55ac, 0x5883, 0x5ce1, 0x5f37, 0x5f4a,
-		0x602f, 0x6050, 0x606d, 0x631f, 0x6559, 0x6a4b, 0x6cc1, 0x72c2,
-		0x72ed, 0x77ef, 0x80f8, 0x8105, 0x8208, 0x854e, 0x90f7, 0x93e1,
-		0x97ff, 0x9957, 0x9a5a, 0x4ef0, 0x51dd, 0x5c2d, 0x6681, 0x696d,
-		0x5c40, 0x66f2, 0x6975, 0x7389, 0x6850, 0x7c81, 0x50c5, 0x52e4,
-		0x5747, 0x5dfe, 0x9326, 0x65a4, 0x6b23, 0x6b3d, 0x7434, 0x7981,
-		0x79bd, 0x7b4b, 0x7dca, 0x82b9, 0x83cc, 0x887f, 0x895f, 0x8b39,
-		0x8fd1, 0x91d1, 0x541f, 0x9280, 0x4e5d, 0x5036, 0x53e5, 0x533a,
-		0x72d7, 0x7396, 0x77e9, 0x82e6, 0x8eaf, 0x99c6, 0x99c8, 0x99d2,
-		0x5177, 0x611a, 0x865e, 0x55b0, 0x7a7a, 0x5076, 0x5bd3, 0x9047,
-		0x9685, 0x4e32, 0x6adb, 0x91e7, 0x5c51, 0x5c48,
-	}, {
-		0x6398, 0x7a9f, 0x6c93, 0x9774, 0x8f61, 0x7aaa, 0x718a, 0x9688,
-		0x7c82, 0x6817, 0x7e70, 0x6851, 0x936c, 0x52f2, 0x541b, 0x85ab,
-		0x8a13, 0x7fa4, 0x8ecd, 0x90e1, 0x5366, 0x8888, 0x7941, 0x4fc2,
-		0x50be, 0x5211, 0x5144, 0x5553, 0x572d, 0x73ea, 0x578b, 0x5951,
-		0x5f62, 0x5f84, 0x6075, 0x6176, 0x6167, 0x61a9, 0x63b2, 0x643a,
-		0x656c, 0x666f, 0x6842, 0x6e13, 0x7566, 0x7a3d, 0x7cfb, 0x7d4c,
-		0x7d99, 0x7e4b, 0x7f6b, 0x830e, 0x834a, 0x86cd, 0x8a08, 0x8a63,
-		0x8b66, 0x8efd, 0x981a, 0x9d8f, 0x82b8, 0x8fce, 0x9be8, 0x5287,
-		0x621f, 0x6483, 0x6fc0, 0x9699, 0x6841, 0x5091, 0x6b20, 0x6c7a,
-		0x6f54, 0x7a74, 0x7d50, 0x8840, 0x8a23, 0x6708, 0x4ef6, 0x5039,
-		0x5026, 0x5065, 0x517c, 0x5238, 0x5263, 0x55a7, 0x570f, 0x5805,
-		0x5acc, 0x5efa, 0x61b2, 0x61f8, 0x62f3, 0x6372,
-	}, {
-		0x691c, 0x6a29, 0x727d, 0x72ac, 0x732e, 0x7814, 0x786f, 0x7d79,
-		0x770c, 0x80a9, 0x898b, 0x8b19, 0x8ce2, 0x8ed2, 0x9063, 0x9375,
-		0x967a, 0x9855, 0x9a13, 0x9e78, 0x5143, 0x539f, 0x53b3, 0x5e7b,
-		0x5f26, 0x6e1b, 0x6e90, 0x7384, 0x73fe, 0x7d43, 0x8237, 0x8a00,
-		0x8afa, 0x9650, 0x4e4e, 0x500b, 0x53e4, 0x547c, 0x56fa, 0x59d1,
-		0x5b64, 0x5df1, 0x5eab, 0x5f27, 0x6238, 0x6545, 0x67af, 0x6e56,
-		0x72d0, 0x7cca, 0x88b4, 0x80a1, 0x80e1, 0x83f0, 0x864e, 0x8a87,
-		0x8de8, 0x9237, 0x96c7, 0x9867, 0x9f13, 0x4e94, 0x4e92, 0x4f0d,
-		0x5348, 0x5449, 0x543e, 0x5a2f, 0x5f8c, 0x5fa1, 0x609f, 0x68a7,
-		0x6a8e, 0x745a, 0x7881, 0x8a9e, 0x8aa4, 0x8b77, 0x9190, 0x4e5e,
-		0x9bc9, 0x4ea4, 0x4f7c, 0x4faf, 0x5019, 0x5016, 0x5149, 0x516c,
-		0x529f, 0x52b9, 0x52fe, 0x539a, 0x53e3, 0x5411,
-	}, {
-		0x540e, 0x5589, 0x5751, 0x57a2, 0x597d, 0x5b54, 0x5b5d, 0x5b8f,
-		0x5de5, 0x5de7, 0x5df7, 0x5e78, 0x5e83, 0x5e9a, 0x5eb7, 0x5f18,
-		0x6052, 0x614c, 0x6297, 0x62d8, 0x63a7, 0x653b, 0x6602, 0x6643,
-		0x66f4, 0x676d, 0x6821, 0x6897, 0x69cb, 0x6c5f, 0x6d2a, 0x6d69,
-		0x6e2f, 0x6e9d, 0x7532, 0x7687, 0x786c, 0x7a3f, 0x7ce0, 0x7d05,
-		0x7d18, 0x7d5e, 0x7db1, 0x8015, 0x8003, 0x80af, 0x80b1, 0x8154,
-		0x818f, 0x822a, 0x8352, 0x884c, 0x8861, 0x8b1b, 0x8ca2, 0x8cfc,
-		0x90ca, 0x9175, 0x9271, 0x783f, 0x92fc, 0x95a4, 0x964d, 0x9805,
-		0x9999, 0x9ad8, 0x9d3b, 0x525b, 0x52ab, 0x53f7, 0x5408, 0x58d5,
-		0x62f7, 0x6fe0, 0x8c6a, 0x8f5f, 0x9eb9, 0x514b, 0x523b, 0x544a,
-		0x56fd, 0x7a40, 0x9177, 0x9d60, 0x9ed2, 0x7344, 0x6f09, 0x8170,
-		0x7511, 0x5ffd, 0x60da, 0x9aa8, 0x72db, 0x8fbc,
-	}, {
-		0x6b64, 0x9803, 0x4eca, 0x56f0, 0x5764, 0x58be, 0x5a5a, 0x6068,
-		0x61c7, 0x660f, 0x6606, 0x6839, 0x68b1, 0x6df7, 0x75d5, 0x7d3a,
-		0x826e, 0x9b42, 0x4e9b, 0x4f50, 0x53c9, 0x5506, 0x5d6f, 0x5de6,
-		0x5dee, 0x67fb, 0x6c99, 0x7473, 0x7802, 0x8a50, 0x9396, 0x88df,
-		0x5750, 0x5ea7, 0x632b, 0x50b5, 0x50ac, 0x518d, 0x6700, 0x54c9,
-		0x585e, 0x59bb, 0x5bb0, 0x5f69, 0x624d, 0x63a1, 0x683d, 0x6b73,
-		0x6e08, 0x707d, 0x91c7, 0x7280, 0x7815, 0x7826, 0x796d, 0x658e,
-		0x7d30, 0x83dc, 0x88c1, 0x8f09, 0x969b, 0x5264, 0x5728, 0x6750,
-		0x7f6a, 0x8ca1, 0x51b4, 0x5742, 0x962a, 0x583a, 0x698a, 0x80b4,
-		0x54b2, 0x5d0e, 0x57fc, 0x7895, 0x9dfa, 0x4f5c, 0x524a, 0x548b,
-		0x643e, 0x6628, 0x6714, 0x67f5, 0x7a84, 0x7b56, 0x7d22, 0x932f,
-		0x685c, 0x9bad, 0x7b39, 0x5319, 0x518a, 0x5237,
-	}, {
-		0x5bdf, 0x62f6, 0x64ae, 0x64e6, 0x672d, 0x6bba, 0x85a9, 0x96d1,
-		0x7690, 0x9bd6, 0x634c, 0x9306, 0x9bab, 0x76bf, 0x6652, 0x4e09,
-		0x5098, 0x53c2, 0x5c71, 0x60e8, 0x6492, 0x6563, 0x685f, 0x71e6,
-		0x73ca, 0x7523, 0x7b97, 0x7e82, 0x8695, 0x8b83, 0x8cdb, 0x9178,
-		0x9910, 0x65ac, 0x66ab, 0x6b8b, 0x4ed5, 0x4ed4, 0x4f3a, 0x4f7f,
-		0x523a, 0x53f8, 0x53f2, 0x55e3, 0x56db, 0x58eb, 0x59cb, 0x59c9,
-		0x59ff, 0x5b50, 0x5c4d, 0x5e02, 0x5e2b, 0x5fd7, 0x601d, 0x6307,
-		0x652f, 0x5b5c, 0x65af, 0x65bd, 0x65e8, 0x679d, 0x6b62, 0x6b7b,
-		0x6c0f, 0x7345, 0x7949, 0x79c1, 0x7cf8, 0x7d19, 0x7d2b, 0x80a2,
-		0x8102, 0x81f3, 0x8996, 0x8a5e, 0x8a69, 0x8a66, 0x8a8c, 0x8aee,
-		0x8cc7, 0x8cdc, 0x96cc, 0x98fc, 0x6b6f, 0x4e8b, 0x4f3c, 0x4f8d,
-		0x5150, 0x5b57, 0x5bfa, 0x6148, 0x6301, 0x6642,
-	}, {
-		0x6b21, 0x6ecb, 0x6cbb, 0x723e, 0x74bd, 0x75d4, 0x78c1, 0x793a,
-		0x800c, 0x8033, 0x81ea, 0x8494, 0x8f9e, 0x6c50, 0x9e7f, 0x5f0f,
-		0x8b58, 0x9d2b, 0x7afa, 0x8ef8, 0x5b8d, 0x96eb, 0x4e03, 0x53f1,
-		0x57f7, 0x5931, 0x5ac9, 0x5ba4, 0x6089, 0x6e7f, 0x6f06, 0x75be,
-		0x8cea, 0x5b9f, 0x8500, 0x7be0, 0x5072, 0x67f4, 0x829d, 0x5c61,
-		0x854a, 0x7e1e, 0x820e, 0x5199, 0x5c04, 0x6368, 0x8d66, 0x659c,
-		0x716e, 0x793e, 0x7d17, 0x8005, 0x8b1d, 0x8eca, 0x906e, 0x86c7,
-		0x90aa, 0x501f, 0x52fa, 0x5c3a, 0x6753, 0x707c, 0x7235, 0x914c,
-		0x91c8, 0x932b, 0x82e5, 0x5bc2, 0x5f31, 0x60f9, 0x4e3b, 0x53d6,
-		0x5b88, 0x624b, 0x6731, 0x6b8a, 0x72e9, 0x73e0, 0x7a2e, 0x816b,
-		0x8da3, 0x9152, 0x9996, 0x5112, 0x53d7, 0x546a, 0x5bff, 0x6388,
-		0x6a39, 0x7dac, 0x9700, 0x56da, 0x53ce, 0x5468,
-	}, {
-		0x5b97, 0x5c31, 0x5dde, 0x4fee, 0x6101, 0x62fe, 0x6d32, 0x79c0,
-		0x79cb, 0x7d42, 0x7e4d, 0x7fd2, 0x81ed, 0x821f, 0x8490, 0x8846,
-		0x8972, 0x8b90, 0x8e74, 0x8f2f, 0x9031, 0x914b, 0x916c, 0x96c6,
-		0x919c, 0x4ec0, 0x4f4f, 0x5145, 0x5341, 0x5f93, 0x620e, 0x67d4,
-		0x6c41, 0x6e0b, 0x7363, 0x7e26, 0x91cd, 0x9283, 0x53d4, 0x5919,
-		0x5bbf, 0x6dd1, 0x795d, 0x7e2e, 0x7c9b, 0x587e, 0x719f, 0x51fa,
-		0x8853, 0x8ff0, 0x4fca, 0x5cfb, 0x6625, 0x77ac, 0x7ae3, 0x821c,
-		0x99ff, 0x51c6, 0x5faa, 0x65ec, 0x696f, 0x6b89, 0x6df3, 0x6e96,
-		0x6f64, 0x76fe, 0x7d14, 0x5de1, 0x9075, 0x9187, 0x9806, 0x51e6,
-		0x521d, 0x6240, 0x6691, 0x66d9, 0x6e1a, 0x5eb6, 0x7dd2, 0x7f72,
-		0x66f8, 0x85af, 0x85f7, 0x8af8, 0x52a9, 0x53d9, 0x5973, 0x5e8f,
-		0x5f90, 0x6055, 0x92e4, 0x9664, 0x50b7, 0x511f,
-	}, {
-		0x52dd, 0x5320, 0x5347, 0x53ec, 0x54e8, 0x5546, 0x5531, 0x5617,
-		0x5968, 0x59be, 0x5a3c, 0x5bb5, 0x5c06, 0x5c0f, 0x5c11, 0x5c1a,
-		0x5e84, 0x5e8a, 0x5ee0, 0x5f70, 0x627f, 0x6284, 0x62db, 0x638c,
-		0x6377, 0x6607, 0x660c, 0x662d, 0x6676, 0x677e, 0x68a2, 0x6a1f,
-		0x6a35, 0x6cbc, 0x6d88, 0x6e09, 0x6e58, 0x713c, 0x7126, 0x7167,
-		0x75c7, 0x7701, 0x785d, 0x7901, 0x7965, 0x79f0, 0x7ae0, 0x7b11,
-		0x7ca7, 0x7d39, 0x8096, 0x83d6, 0x848b, 0x8549, 0x885d, 0x88f3,
-		0x8a1f, 0x8a3c, 0x8a54, 0x8a73, 0x8c61, 0x8cde, 0x91a4, 0x9266,
-		0x937e, 0x9418, 0x969c, 0x9798, 0x4e0a, 0x4e08, 0x4e1e, 0x4e57,
-		0x5197, 0x5270, 0x57ce, 0x5834, 0x58cc, 0x5b22, 0x5e38, 0x60c5,
-		0x64fe, 0x6761, 0x6756, 0x6d44, 0x72b6, 0x7573, 0x7a63, 0x84b8,
-		0x8b72, 0x91b8, 0x9320, 0x5631, 0x57f4, 0x98fe,
-	}, {
-		0x62ed, 0x690d, 0x6b96, 0x71ed, 0x7e54, 0x8077, 0x8272, 0x89e6,
-		0x98df, 0x8755, 0x8fb1, 0x5c3b, 0x4f38, 0x4fe1, 0x4fb5, 0x5507,
-		0x5a20, 0x5bdd, 0x5be9, 0x5fc3, 0x614e, 0x632f, 0x65b0, 0x664b,
-		0x68ee, 0x699b, 0x6d78, 0x6df1, 0x7533, 0x75b9, 0x771f, 0x795e,
-		0x79e6, 0x7d33, 0x81e3, 0x82af, 0x85aa, 0x89aa, 0x8a3a, 0x8eab,
-		0x8f9b, 0x9032, 0x91dd, 0x9707, 0x4eba, 0x4ec1, 0x5203, 0x5875,
-		0x58ec, 0x5c0b, 0x751a, 0x5c3d, 0x814e, 0x8a0a, 0x8fc5, 0x9663,
-		0x976d, 0x7b25, 0x8acf, 0x9808, 0x9162, 0x56f3, 0x53a8, 0x9017,
-		0x5439, 0x5782, 0x5e25, 0x63a8, 0x6c34, 0x708a, 0x7761, 0x7c8b,
-		0x7fe0, 0x8870, 0x9042, 0x9154, 0x9310, 0x9318, 0x968f, 0x745e,
-		0x9ac4, 0x5d07, 0x5d69, 0x6570, 0x67a2, 0x8da8, 0x96db, 0x636e,
-		0x6749, 0x6919, 0x83c5, 0x9817, 0x96c0, 0x88fe,
-	}, {
-		0x6f84, 0x647a, 0x5bf8, 0x4e16, 0x702c, 0x755d, 0x662f, 0x51c4,
-		0x5236, 0x52e2, 0x59d3, 0x5f81, 0x6027, 0x6210, 0x653f, 0x6574,
-		0x661f, 0x6674, 0x68f2, 0x6816, 0x6b63, 0x6e05, 0x7272, 0x751f,
-		0x76db, 0x7cbe, 0x8056, 0x58f0, 0x88fd, 0x897f, 0x8aa0, 0x8a93,
-		0x8acb, 0x901d, 0x9192, 0x9752, 0x9759, 0x6589, 0x7a0e, 0x8106,
-		0x96bb, 0x5e2d, 0x60dc, 0x621a, 0x65a5, 0x6614, 0x6790, 0x77f3,
-		0x7a4d, 0x7c4d, 0x7e3e, 0x810a, 0x8cac, 0x8d64, 0x8de1, 0x8e5f,
-		0x78a9, 0x5207, 0x62d9, 0x63a5, 0x6442, 0x6298, 0x8a2d, 0x7a83,
-		0x7bc0, 0x8aac, 0x96ea, 0x7d76, 0x820c, 0x8749, 0x4ed9, 0x5148,
-		0x5343, 0x5360, 0x5ba3, 0x5c02, 0x5c16, 0x5ddd, 0x6226, 0x6247,
-		0x64b0, 0x6813, 0x6834, 0x6cc9, 0x6d45, 0x6d17, 0x67d3, 0x6f5c,
-		0x714e, 0x717d, 0x65cb, 0x7a7f, 0x7bad, 0x7dda,
-	}, {
-		0x7e4a, 0x7fa8, 0x817a, 0x821b, 0x8239, 0x85a6, 0x8a6e, 0x8cce,
-		0x8df5, 0x9078, 0x9077, 0x92ad, 0x9291, 0x9583, 0x9bae, 0x524d,
-		0x5584, 0x6f38, 0x7136, 0x5168, 0x7985, 0x7e55, 0x81b3, 0x7cce,
-		0x564c, 0x5851, 0x5ca8, 0x63aa, 0x66fe, 0x66fd, 0x695a, 0x72d9,
-		0x758f, 0x758e, 0x790e, 0x7956, 0x79df, 0x7c97, 0x7d20, 0x7d44,
-		0x8607, 0x8a34, 0x963b, 0x9061, 0x9f20, 0x50e7, 0x5275, 0x53cc,
-		0x53e2, 0x5009, 0x55aa, 0x58ee, 0x594f, 0x723d, 0x5b8b, 0x5c64,
-		0x531d, 0x60e3, 0x60f3, 0x635c, 0x6383, 0x633f, 0x63bb, 0x64cd,
-		0x65e9, 0x66f9, 0x5de3, 0x69cd, 0x69fd, 0x6f15, 0x71e5, 0x4e89,
-		0x75e9, 0x76f8, 0x7a93, 0x7cdf, 0x7dcf, 0x7d9c, 0x8061, 0x8349,
-		0x8358, 0x846c, 0x84bc, 0x85fb, 0x88c5, 0x8d70, 0x9001, 0x906d,
-		0x9397, 0x971c, 0x9a12, 0x50cf, 0x5897, 0x618e,
-	}, {
-		0x81d3, 0x8535, 0x8d08, 0x9020, 0x4fc3, 0x5074, 0x5247, 0x5373,
-		0x606f, 0x6349, 0x675f, 0x6e2c, 0x8db3, 0x901f, 0x4fd7, 0x5c5e,
-		0x8cca, 0x65cf, 0x7d9a, 0x5352, 0x8896, 0x5176, 0x63c3, 0x5b58,
-		0x5b6b, 0x5c0a, 0x640d, 0x6751, 0x905c, 0x4ed6, 0x591a, 0x592a,
-		0x6c70, 0x8a51, 0x553e, 0x5815, 0x59a5, 0x60f0, 0x6253, 0x67c1,
-		0x8235, 0x6955, 0x9640, 0x99c4, 0x9a28, 0x4f53, 0x5806, 0x5bfe,
-		0x8010, 0x5cb1, 0x5e2f, 0x5f85, 0x6020, 0x614b, 0x6234, 0x66ff,
-		0x6cf0, 0x6ede, 0x80ce, 0x817f, 0x82d4, 0x888b, 0x8cb8, 0x9000,
-		0x902e, 0x968a, 0x9edb, 0x9bdb, 0x4ee3, 0x53f0, 0x5927, 0x7b2c,
-		0x918d, 0x984c, 0x9df9, 0x6edd, 0x7027, 0x5353, 0x5544, 0x5b85,
-		0x6258, 0x629e, 0x62d3, 0x6ca2, 0x6fef, 0x7422, 0x8a17, 0x9438,
-		0x6fc1, 0x8afe, 0x8338, 0x51e7, 0x86f8, 0x53ea,
-	}, {
-		0x53e9, 0x4f46, 0x9054, 0x8fb0, 0x596a, 0x8131, 0x5dfd, 0x7aea,
-		0x8fbf, 0x68da, 0x8c37, 0x72f8, 0x9c48, 0x6a3d, 0x8ab0, 0x4e39,
-		0x5358, 0x5606, 0x5766, 0x62c5, 0x63a2, 0x65e6, 0x6b4e, 0x6de1,
-		0x6e5b, 0x70ad, 0x77ed, 0x7aef, 0x7baa, 0x7dbb, 0x803d, 0x80c6,
-		0x86cb, 0x8a95, 0x935b, 0x56e3, 0x58c7, 0x5f3e, 0x65ad, 0x6696,
-		0x6a80, 0x6bb5, 0x7537, 0x8ac7, 0x5024, 0x77e5, 0x5730, 0x5f1b,
-		0x6065, 0x667a, 0x6c60, 0x75f4, 0x7a1a, 0x7f6e, 0x81f4, 0x8718,
-		0x9045, 0x99b3, 0x7bc9, 0x755c, 0x7af9, 0x7b51, 0x84c4, 0x9010,
-		0x79e9, 0x7a92, 0x8336, 0x5ae1, 0x7740, 0x4e2d, 0x4ef2, 0x5b99,
-		0x5fe0, 0x62bd, 0x663c, 0x67f1, 0x6ce8, 0x866b, 0x8877, 0x8a3b,
-		0x914e, 0x92f3, 0x99d0, 0x6a17, 0x7026, 0x732a, 0x82e7, 0x8457,
-		0x8caf, 0x4e01, 0x5146, 0x51cb, 0x558b, 0x5bf5,
-	}, {
-		0x5e16, 0x5e33, 0x5e81, 0x5f14, 0x5f35, 0x5f6b, 0x5fb4, 0x61f2,
-		0x6311, 0x66a2, 0x671d, 0x6f6e, 0x7252, 0x753a, 0x773a, 0x8074,
-		0x8139, 0x8178, 0x8776, 0x8abf, 0x8adc, 0x8d85, 0x8df3, 0x929a,
-		0x9577, 0x9802, 0x9ce5, 0x52c5, 0x6357, 0x76f4, 0x6715, 0x6c88,
-		0x73cd, 0x8cc3, 0x93ae, 0x9673, 0x6d25, 0x589c, 0x690e, 0x69cc,
-		0x8ffd, 0x939a, 0x75db, 0x901a, 0x585a, 0x6802, 0x63b4, 0x69fb,
-		0x4f43, 0x6f2c, 0x67d8, 0x8fbb, 0x8526, 0x7db4, 0x9354, 0x693f,
-		0x6f70, 0x576a, 0x58f7, 0x5b2c, 0x7d2c, 0x722a, 0x540a, 0x91e3,
-		0x9db4, 0x4ead, 0x4f4e, 0x505c, 0x5075, 0x5243, 0x8c9e, 0x5448,
-		0x5824, 0x5b9a, 0x5e1d, 0x5e95, 0x5ead, 0x5ef7, 0x5f1f, 0x608c,
-		0x62b5, 0x633a, 0x63d0, 0x68af, 0x6c40, 0x7887, 0x798e, 0x7a0b,
-		0x7de0, 0x8247, 0x8a02, 0x8ae6, 0x8e44, 0x9013,
-	}, {
-		0x90b8, 0x912d, 0x91d8, 0x9f0e, 0x6ce5, 0x6458, 0x64e2, 0x6575,
-		0x6ef4, 0x7684, 0x7b1b, 0x9069, 0x93d1, 0x6eba, 0x54f2, 0x5fb9,
-		0x64a4, 0x8f4d, 0x8fed, 0x9244, 0x5178, 0x586b, 0x5929, 0x5c55,
-		0x5e97, 0x6dfb, 0x7e8f, 0x751c, 0x8cbc, 0x8ee2, 0x985b, 0x70b9,
-		0x4f1d, 0x6bbf, 0x6fb1, 0x7530, 0x96fb, 0x514e, 0x5410, 0x5835,
-		0x5857, 0x59ac, 0x5c60, 0x5f92, 0x6597, 0x675c, 0x6e21, 0x767b,
-		0x83df, 0x8ced, 0x9014, 0x90fd, 0x934d, 0x7825, 0x783a, 0x52aa,
-		0x5ea6, 0x571f, 0x5974, 0x6012, 0x5012, 0x515a, 0x51ac, 0x51cd,
-		0x5200, 0x5510, 0x5854, 0x5858, 0x5957, 0x5b95, 0x5cf6, 0x5d8b,
-		0x60bc, 0x6295, 0x642d, 0x6771, 0x6843, 0x68bc, 0x68df, 0x76d7,
-		0x6dd8, 0x6e6f, 0x6d9b, 0x706f, 0x71c8, 0x5f53, 0x75d8, 0x7977,
-		0x7b49, 0x7b54, 0x7b52, 0x7cd6, 0x7d71, 0x5230,
-	}, {
-		0x8463, 0x8569, 0x85e4, 0x8a0e, 0x8b04, 0x8c46, 0x8e0f, 0x9003,
-		0x900f, 0x9419, 0x9676, 0x982d, 0x9a30, 0x95d8, 0x50cd, 0x52d5,
-		0x540c, 0x5802, 0x5c0e, 0x61a7, 0x649e, 0x6d1e, 0x77b3, 0x7ae5,
-		0x80f4, 0x8404, 0x9053, 0x9285, 0x5ce0, 0x9d07, 0x533f, 0x5f97,
-		0x5fb3, 0x6d9c, 0x7279, 0x7763, 0x79bf, 0x7be4, 0x6bd2, 0x72ec,
-		0x8aad, 0x6803, 0x6a61, 0x51f8, 0x7a81, 0x6934, 0x5c4a, 0x9cf6,
-		0x82eb, 0x5bc5, 0x9149, 0x701e, 0x5678, 0x5c6f, 0x60c7, 0x6566,
-		0x6c8c, 0x8c5a, 0x9041, 0x9813, 0x5451, 0x66c7, 0x920d, 0x5948,
-		0x90a3, 0x5185, 0x4e4d, 0x51ea, 0x8599, 0x8b0e, 0x7058, 0x637a,
-		0x934b, 0x6962, 0x99b4, 0x7e04, 0x7577, 0x5357, 0x6960, 0x8edf,
-		0x96e3, 0x6c5d, 0x4e8c, 0x5c3c, 0x5f10, 0x8fe9, 0x5302, 0x8cd1,
-		0x8089, 0x8679, 0x5eff, 0x65e5, 0x4e73, 0x5165,
-	}, {
-		0x5982, 0x5c3f, 0x97ee, 0x4efb, 0x598a, 0x5fcd, 0x8a8d, 0x6fe1,
-		0x79b0, 0x7962, 0x5be7, 0x8471, 0x732b, 0x71b1, 0x5e74, 0x5ff5,
-		0x637b, 0x649a, 0x71c3, 0x7c98, 0x4e43, 0x5efc, 0x4e4b, 0x57dc,
-		0x56a2, 0x60a9, 0x6fc3, 0x7d0d, 0x80fd, 0x8133, 0x81bf, 0x8fb2,
-		0x8997, 0x86a4, 0x5df4, 0x628a, 0x64ad, 0x8987, 0x6777, 0x6ce2,
-		0x6d3e, 0x7436, 0x7834, 0x5a46, 0x7f75, 0x82ad, 0x99ac, 0x4ff3,
-		0x5ec3, 0x62dd, 0x6392, 0x6557, 0x676f, 0x76c3, 0x724c, 0x80cc,
-		0x80ba, 0x8f29, 0x914d, 0x500d, 0x57f9, 0x5a92, 0x6885, 0x6973,
-		0x7164, 0x72fd, 0x8cb7, 0x58f2, 0x8ce0, 0x966a, 0x9019, 0x877f,
-		0x79e4, 0x77e7, 0x8429, 0x4f2f, 0x5265, 0x535a, 0x62cd, 0x67cf,
-		0x6cca, 0x767d, 0x7b94, 0x7c95, 0x8236, 0x8584, 0x8feb, 0x66dd,
-		0x6f20, 0x7206, 0x7e1b, 0x83ab, 0x99c1, 0x9ea6,
-	}, {
-		0x51fd, 0x7bb1, 0x7872, 0x7bb8, 0x8087, 0x7b48, 0x6ae8, 0x5e61,
-		0x808c, 0x7551, 0x7560, 0x516b, 0x9262, 0x6e8c, 0x767a, 0x9197,
-		0x9aea, 0x4f10, 0x7f70, 0x629c, 0x7b4f, 0x95a5, 0x9ce9, 0x567a,
-		0x5859, 0x86e4, 0x96bc, 0x4f34, 0x5224, 0x534a, 0x53cd, 0x53db,
-		0x5e06, 0x642c, 0x6591, 0x677f, 0x6c3e, 0x6c4e, 0x7248, 0x72af,
-		0x73ed, 0x7554, 0x7e41, 0x822c, 0x85e9, 0x8ca9, 0x7bc4, 0x91c6,
-		0x7169, 0x9812, 0x98ef, 0x633d, 0x6669, 0x756a, 0x76e4, 0x78d0,
-		0x8543, 0x86ee, 0x532a, 0x5351, 0x5426, 0x5983, 0x5e87, 0x5f7c,
-		0x60b2, 0x6249, 0x6279, 0x62ab, 0x6590, 0x6bd4, 0x6ccc, 0x75b2,
-		0x76ae, 0x7891, 0x79d8, 0x7dcb, 0x7f77, 0x80a5, 0x88ab, 0x8ab9,
-		0x8cbb, 0x907f, 0x975e, 0x98db, 0x6a0b, 0x7c38, 0x5099, 0x5c3e,
-		0x5fae, 0x6787, 0x6bd8, 0x7435, 0x7709, 0x7f8e,
-	}, {
-		0x9f3b, 0x67ca, 0x7a17, 0x5339, 0x758b, 0x9aed, 0x5f66, 0x819d,
-		0x83f1, 0x8098, 0x5f3c, 0x5fc5, 0x7562, 0x7b46, 0x903c, 0x6867,
-		0x59eb, 0x5a9b, 0x7d10, 0x767e, 0x8b2c, 0x4ff5, 0x5f6a, 0x6a19,
-		0x6c37, 0x6f02, 0x74e2, 0x7968, 0x8868, 0x8a55, 0x8c79, 0x5edf,
-		0x63cf, 0x75c5, 0x79d2, 0x82d7, 0x9328, 0x92f2, 0x849c, 0x86ed,
-		0x9c2d, 0x54c1, 0x5f6c, 0x658c, 0x6d5c, 0x7015, 0x8ca7, 0x8cd3,
-		0x983b, 0x654f, 0x74f6, 0x4e0d, 0x4ed8, 0x57e0, 0x592b, 0x5a66,
-		0x5bcc, 0x51a8, 0x5e03, 0x5e9c, 0x6016, 0x6276, 0x6577, 0x65a7,
-		0x666e, 0x6d6e, 0x7236, 0x7b26, 0x8150, 0x819a, 0x8299, 0x8b5c,
-		0x8ca0, 0x8ce6, 0x8d74, 0x961c, 0x9644, 0x4fae, 0x64ab, 0x6b66,
-		0x821e, 0x8461, 0x856a, 0x90e8, 0x5c01, 0x6953, 0x98a8, 0x847a,
-		0x8557, 0x4f0f, 0x526f, 0x5fa9, 0x5e45, 0x670d,
-	}, {
-		0x798f, 0x8179, 0x8907, 0x8986, 0x6df5, 0x5f17, 0x6255, 0x6cb8,
-		0x4ecf, 0x7269, 0x9b92, 0x5206, 0x543b, 0x5674, 0x58b3, 0x61a4,
-		0x626e, 0x711a, 0x596e, 0x7c89, 0x7cde, 0x7d1b, 0x96f0, 0x6587,
-		0x805e, 0x4e19, 0x4f75, 0x5175, 0x5840, 0x5e63, 0x5e73, 0x5f0a,
-		0x67c4, 0x4e26, 0x853d, 0x9589, 0x965b, 0x7c73, 0x9801, 0x50fb,
-		0x58c1, 0x7656, 0x78a7, 0x5225, 0x77a5, 0x8511, 0x7b86, 0x504f,
-		0x5909, 0x7247, 0x7bc7, 0x7de8, 0x8fba, 0x8fd4, 0x904d, 0x4fbf,
-		0x52c9, 0x5a29, 0x5f01, 0x97ad, 0x4fdd, 0x8217, 0x92ea, 0x5703,
-		0x6355, 0x6b69, 0x752b, 0x88dc, 0x8f14, 0x7a42, 0x52df, 0x5893,
-		0x6155, 0x620a, 0x66ae, 0x6bcd, 0x7c3f, 0x83e9, 0x5023, 0x4ff8,
-		0x5305, 0x5446, 0x5831, 0x5949, 0x5b9d, 0x5cf0, 0x5cef, 0x5d29,
-		0x5e96, 0x62b1, 0x6367, 0x653e, 0x65b9, 0x670b,
-	}, {
-		0x6cd5, 0x6ce1, 0x70f9, 0x7832, 0x7e2b, 0x80de, 0x82b3, 0x840c,
-		0x84ec, 0x8702, 0x8912, 0x8a2a, 0x8c4a, 0x90a6, 0x92d2, 0x98fd,
-		0x9cf3, 0x9d6c, 0x4e4f, 0x4ea1, 0x508d, 0x5256, 0x574a, 0x59a8,
-		0x5e3d, 0x5fd8, 0x5fd9, 0x623f, 0x66b4, 0x671b, 0x67d0, 0x68d2,
-		0x5192, 0x7d21, 0x80aa, 0x81a8, 0x8b00, 0x8c8c, 0x8cbf, 0x927e,
-		0x9632, 0x5420, 0x982c, 0x5317, 0x50d5, 0x535c, 0x58a8, 0x64b2,
-		0x6734, 0x7267, 0x7766, 0x7a46, 0x91e6, 0x52c3, 0x6ca1, 0x6b86,
-		0x5800, 0x5e4c, 0x5954, 0x672c, 0x7ffb, 0x51e1, 0x76c6, 0x6469,
-		0x78e8, 0x9b54, 0x9ebb, 0x57cb, 0x59b9, 0x6627, 0x679a, 0x6bce,
-		0x54e9, 0x69d9, 0x5e55, 0x819c, 0x6795, 0x9baa, 0x67fe, 0x9c52,
-		0x685d, 0x4ea6, 0x4fe3, 0x53c8, 0x62b9, 0x672b, 0x6cab, 0x8fc4,
-		0x4fad, 0x7e6d, 0x9ebf, 0x4e07, 0x6162, 0x6e80,
-	}, {
-		0x6f2b, 0x8513, 0x5473, 0x672a, 0x9b45, 0x5df3, 0x7b95, 0x5cac,
-		0x5bc6, 0x871c, 0x6e4a, 0x84d1, 0x7a14, 0x8108, 0x5999, 0x7c8d,
-		0x6c11, 0x7720, 0x52d9, 0x5922, 0x7121, 0x725f, 0x77db, 0x9727,
-		0x9d61, 0x690b, 0x5a7f, 0x5a18, 0x51a5, 0x540d, 0x547d, 0x660e,
-		0x76df, 0x8ff7, 0x9298, 0x9cf4, 0x59ea, 0x725d, 0x6ec5, 0x514d,
-		0x68c9, 0x7dbf, 0x7dec, 0x9762, 0x9eba, 0x6478, 0x6a21, 0x8302,
-		0x5984, 0x5b5f, 0x6bdb, 0x731b, 0x76f2, 0x7db2, 0x8017, 0x8499,
-		0x5132, 0x6728, 0x9ed9, 0x76ee, 0x6762, 0x52ff, 0x9905, 0x5c24,
-		0x623b, 0x7c7e, 0x8cb0, 0x554f, 0x60b6, 0x7d0b, 0x9580, 0x5301,
-		0x4e5f, 0x51b6, 0x591c, 0x723a, 0x8036, 0x91ce, 0x5f25, 0x77e2,
-		0x5384, 0x5f79, 0x7d04, 0x85ac, 0x8a33, 0x8e8d, 0x9756, 0x67f3,
-		0x85ae, 0x9453, 0x6109, 0x6108, 0x6cb9, 0x7652,
-	}, {
-		0x8aed, 0x8f38, 0x552f, 0x4f51, 0x512a, 0x52c7, 0x53cb, 0x5ba5,
-		0x5e7d, 0x60a0, 0x6182, 0x63d6, 0x6709, 0x67da, 0x6e67, 0x6d8c,
-		0x7336, 0x7337, 0x7531, 0x7950, 0x88d5, 0x8a98, 0x904a, 0x9091,
-		0x90f5, 0x96c4, 0x878d, 0x5915, 0x4e88, 0x4f59, 0x4e0e, 0x8a89,
-		0x8f3f, 0x9810, 0x50ad, 0x5e7c, 0x5996, 0x5bb9, 0x5eb8, 0x63da,
-		0x63fa, 0x64c1, 0x66dc, 0x694a, 0x69d8, 0x6d0b, 0x6eb6, 0x7194,
-		0x7528, 0x7aaf, 0x7f8a, 0x8000, 0x8449, 0x84c9, 0x8981, 0x8b21,
-		0x8e0a, 0x9065, 0x967d, 0x990a, 0x617e, 0x6291, 0x6b32, 0x6c83,
-		0x6d74, 0x7fcc, 0x7ffc, 0x6dc0, 0x7f85, 0x87ba, 0x88f8, 0x6765,
-		0x83b1, 0x983c, 0x96f7, 0x6d1b, 0x7d61, 0x843d, 0x916a, 0x4e71,
-		0x5375, 0x5d50, 0x6b04, 0x6feb, 0x85cd, 0x862d, 0x89a7, 0x5229,
-		0x540f, 0x5c65, 0x674e, 0x68a8, 0x7406, 0x7483,
-	}, {
-		0x75e2, 0x88cf, 0x88e1, 0x91cc, 0x96e2, 0x9678, 0x5f8b, 0x7387,
-		0x7acb, 0x844e, 0x63a0, 0x7565, 0x5289, 0x6d41, 0x6e9c, 0x7409,
-		0x7559, 0x786b, 0x7c92, 0x9686, 0x7adc, 0x9f8d, 0x4fb6, 0x616e,
-		0x65c5, 0x865c, 0x4e86, 0x4eae, 0x50da, 0x4e21, 0x51cc, 0x5bee,
-		0x6599, 0x6881, 0x6dbc, 0x731f, 0x7642, 0x77ad, 0x7a1c, 0x7ce7,
-		0x826f, 0x8ad2, 0x907c, 0x91cf, 0x9675, 0x9818, 0x529b, 0x7dd1,
-		0x502b, 0x5398, 0x6797, 0x6dcb, 0x71d0, 0x7433, 0x81e8, 0x8f2a,
-		0x96a3, 0x9c57, 0x9e9f, 0x7460, 0x5841, 0x6d99, 0x7d2f, 0x985e,
-		0x4ee4, 0x4f36, 0x4f8b, 0x51b7, 0x52b1, 0x5dba, 0x601c, 0x73b2,
-		0x793c, 0x82d3, 0x9234, 0x96b7, 0x96f6, 0x970a, 0x9e97, 0x9f62,
-		0x66a6, 0x6b74, 0x5217, 0x52a3, 0x70c8, 0x88c2, 0x5ec9, 0x604b,
-		0x6190, 0x6f23, 0x7149, 0x7c3e, 0x7df4, 0x806f,
-	}, {
-		0x84ee, 0x9023, 0x932c, 0x5442, 0x9b6f, 0x6ad3, 0x7089, 0x8cc2,
-		0x8def, 0x9732, 0x52b4, 0x5a41, 0x5eca, 0x5f04, 0x6717, 0x697c,
-		0x6994, 0x6d6a, 0x6f0f, 0x7262, 0x72fc, 0x7bed, 0x8001, 0x807e,
-		0x874b, 0x90ce, 0x516d, 0x9e93, 0x7984, 0x808b, 0x9332, 0x8ad6,
-		0x502d, 0x548c, 0x8a71, 0x6b6a, 0x8cc4, 0x8107, 0x60d1, 0x67a0,
-		0x9df2, 0x4e99, 0x4e98, 0x9c10, 0x8a6b, 0x85c1, 0x8568, 0x6900,
-		0x6e7e, 0x7897, 0x8155,
-	}, {
-		0x5f0c, 0x4e10, 0x4e15, 0x4e2a, 0x4e31, 0x4e36, 0x4e3c, 0x4e3f,
-		0x4e42, 0x4e56, 0x4e58, 0x4e82, 0x4e85, 0x8c6b, 0x4e8a, 0x8212,
-		0x5f0d, 0x4e8e, 0x4e9e, 0x4e9f, 0x4ea0, 0x4ea2, 0x4eb0, 0x4eb3,
-		0x4eb6, 0x4ece, 0x4ecd, 0x4ec4, 0x4ec6, 0x4ec2, 0x4ed7, 0x4ede,
-		0x4eed, 0x4edf, 0x4ef7, 0x4f09, 0x4f5a, 0x4f30, 0x4f5b, 0x4f5d,
-		0x4f57, 0x4f47, 0x4f76, 0x4f88, 0x4f8f, 0x4f98, 0x4f7b, 0x4f69,
-		0x4f70, 0x4f91, 0x4f6f, 0x4f86, 0x4f96, 0x5118, 0x4fd4, 0x4fdf,
-		0x4fce, 0x4fd8, 0x4fdb, 0x4fd1, 0x4fda, 0x4fd0, 0x4fe4, 0x4fe5,
-		0x501a, 0x5028, 0x5014, 0x502a, 0x5025, 0x5005, 0x4f1c, 0x4ff6,
-		0x5021, 0x5029, 0x502c, 0x4ffe, 0x4fef, 0x5011, 0x5006, 0x5043,
-		0x5047, 0x6703, 0x5055, 0x5050, 0x5048, 0x505a, 0x5056, 0x506c,
-		0x5078, 0x5080, 0x509a, 0x5085, 0x50b4, 0x50b2,
-	}, {
-		0x50c9, 0x50ca, 0x50b3, 0x50c2, 0x50d6, 0x50de, 0x50e5, 0x50ed,
-		0x50e3, 0x50ee, 0x50f9, 0x50f5, 0x5109, 0x5101, 0x5102, 0x5116,
-		0x5115, 0x5114, 0x511a, 0x5121, 0x513a, 0x5137, 0x513c, 0x513b,
-		0x513f, 0x5140, 0x5152, 0x514c, 0x5154, 0x5162, 0x7af8, 0x5169,
-		0x516a, 0x516e, 0x5180, 0x5182, 0x56d8, 0x518c, 0x5189, 0x518f,
-		0x5191, 0x5193, 0x5195, 0x5196, 0x51a4, 0x51a6, 0x51a2, 0x51a9,
-		0x51aa, 0x51ab, 0x51b3, 0x51b1, 0x51b2, 0x51b0, 0x51b5, 0x51bd,
-		0x51c5, 0x51c9, 0x51db, 0x51e0, 0x8655, 0x51e9, 0x51ed, 0x51f0,
-		0x51f5, 0x51fe, 0x5204, 0x520b, 0x5214, 0x520e, 0x5227, 0x522a,
-		0x522e, 0x5233, 0x5239, 0x524f, 0x5244, 0x524b, 0x524c, 0x525e,
-		0x5254, 0x526a, 0x5274, 0x5269, 0x5273, 0x527f, 0x527d, 0x528d,
-		0x5294, 0x5292, 0x5271, 0x5288, 0x5291, 0x8fa8,
-	}, {
-		0x8fa7, 0x52ac, 0x52ad, 0x52bc, 0x52b5, 0x52c1, 0x52cd, 0x52d7,
-		0x52de, 0x52e3, 0x52e6, 0x98ed, 0x52e0, 0x52f3, 0x52f5, 0x52f8,
-		0x52f9, 0x5306, 0x5308, 0x7538, 0x530d, 0x5310, 0x530f, 0x5315,
-		0x531a, 0x5323, 0x532f, 0x5331, 0x5333, 0x5338, 0x5340, 0x5346,
-		0x5345, 0x4e17, 0x5349, 0x534d, 0x51d6, 0x535e, 0x5369, 0x536e,
-		0x5918, 0x537b, 0x5377, 0x5382, 0x5396, 0x53a0, 0x53a6, 0x53a5,
-		0x53ae, 0x53b0, 0x53b6, 0x53c3, 0x7c12, 0x96d9, 0x53df, 0x66fc,
-		0x71ee, 0x53ee, 0x53e8, 0x53ed, 0x53fa, 0x5401, 0x543d, 0x5440,
-		0x542c, 0x542d, 0x543c, 0x542e, 0x5436, 0x5429, 0x541d, 0x544e,
-		0x548f, 0x5475, 0x548e, 0x545f, 0x5471, 0x5477, 0x5470, 0x5492,
-		0x547b, 0x5480, 0x5476, 0x5484, 0x5490, 0x5486, 0x54c7, 0x54a2,
-		0x54b8, 0x54a5, 0x54ac, 0x54c4, 0x54c8, 0x54a8,
-	}, {
-		0x54ab, 0x54c2, 0x54a4, 0x54be, 0x54bc, 0x54d8, 0x54e5, 0x54e6,
-		0x550f, 0x5514, 0x54fd, 0x54ee, 0x54ed, 0x54fa, 0x54e2, 0x5539,
-		0x5540, 0x5563, 0x554c, 0x552e, 0x555c, 0x5545, 0x5556, 0x5557,
-		0x5538, 0x5533, 0x555d, 0x5599, 0x5580, 0x54af, 0x558a, 0x559f,
-		0x557b, 0x557e, 0x5598, 0x559e, 0x55ae, 0x557c, 0x5583, 0x55a9,
-		0x5587, 0x55a8, 0x55da, 0x55c5, 0x55df, 0x55c4, 0x55dc, 0x55e4,
-		0x55d4, 0x5614, 0x55f7, 0x5616, 0x55fe, 0x55fd, 0x561b, 0x55f9,
-		0x564e, 0x5650, 0x71df, 0x5634, 0x5636, 0x5632, 0x5638, 0x566b,
-		0x5664, 0x562f, 0x566c, 0x566a, 0x5686, 0x5680, 0x568a, 0x56a0,
-		0x5694, 0x568f, 0x56a5, 0x56ae, 0x56b6, 0x56b4, 0x56c2, 0x56bc,
-		0x56c1, 0x56c3, 0x56c0, 0x56c8, 0x56ce, 0x56d1, 0x56d3, 0x56d7,
-		0x56ee, 0x56f9, 0x5700, 0x56ff, 0x5704, 0x5709,
-	}, {
-		0x5708, 0x570b, 0x570d, 0x5713, 0x5718, 0x5716, 0x55c7, 0x571c,
-		0x5726, 0x5737, 0x5738, 0x574e, 0x573b, 0x5740, 0x574f, 0x5769,
-		0x57c0, 0x5788, 0x5761, 0x577f, 0x5789, 0x5793, 0x57a0, 0x57b3,
-		0x57a4, 0x57aa, 0x57b0, 0x57c3, 0x57c6, 0x57d4, 0x57d2, 0x57d3,
-		0x580a, 0x57d6, 0x57e3, 0x580b, 0x5819, 0x581d, 0x5872, 0x5821,
-		0x5862, 0x584b, 0x5870, 0x6bc0, 0x5852, 0x583d, 0x5879, 0x5885,
-		0x58b9, 0x589f, 0x58ab, 0x58ba, 0x58de, 0x58bb, 0x58b8, 0x58ae,
-		0x58c5, 0x58d3, 0x58d1, 0x58d7, 0x58d9, 0x58d8, 0x58e5, 0x58dc,
-		0x58e4, 0x58df, 0x58ef, 0x58fa, 0x58f9, 0x58fb, 0x58fc, 0x58fd,
-		0x5902, 0x590a, 0x5910, 0x591b, 0x68a6, 0x5925, 0x592c, 0x592d,
-		0x5932, 0x5938, 0x593e, 0x7ad2, 0x5955, 0x5950, 0x594e, 0x595a,
-		0x5958, 0x5962, 0x5960, 0x5967, 0x596c, 0x5969,
-	}, {
-		0x5978, 0x5981, 0x599d, 0x4f5e, 0x4fab, 0x59a3, 0x59b2, 0x59c6,
-		0x59e8, 0x59dc, 0x598d, 0x59d9, 0x59da, 0x5a25, 0x5a1f, 0x5a11,
-		0x5a1c, 0x5a09, 0x5a1a, 0x5a40, 0x5a6c, 0x5a49, 0x5a35, 0x5a36,
-		0x5a62, 0x5a6a, 0x5a9a, 0x5abc, 0x5abe, 0x5acb, 0x5ac2, 0x5abd,
-		0x5ae3, 0x5ad7, 0x5ae6, 0x5ae9, 0x5ad6, 0x5afa, 0x5afb, 0x5b0c,
-		0x5b0b, 0x5b16, 0x5b32, 0x5ad0, 0x5b2a, 0x5b36, 0x5b3e, 0x5b43,
-		0x5b45, 0x5b40, 0x5b51, 0x5b55, 0x5b5a, 0x5b5b, 0x5b65, 0x5b69,
-		0x5b70, 0x5b73, 0x5b75, 0x5b78, 0x6588, 0x5b7a, 0x5b80, 0x5b83,
-		0x5ba6, 0x5bb8, 0x5bc3, 0x5bc7, 0x5bc9, 0x5bd4, 0x5bd0, 0x5be4,
-		0x5be6, 0x5be2, 0x5bde, 0x5be5, 0x5beb, 0x5bf0, 0x5bf6, 0x5bf3,
-		0x5c05, 0x5c07, 0x5c08, 0x5c0d, 0x5c13, 0x5c20, 0x5c22, 0x5c28,
-		0x5c38, 0x5c39, 0x5c41, 0x5c46, 0x5c4e, 0x5c53,
-	}, {
-		0x5c50, 0x5c4f, 0x5b71, 0x5c6c, 0x5c6e, 0x4e62, 0x5c76, 0x5c79,
-		0x5c8c, 0x5c91, 0x5c94, 0x599b, 0x5cab, 0x5cbb, 0x5cb6, 0x5cbc,
-		0x5cb7, 0x5cc5, 0x5cbe, 0x5cc7, 0x5cd9, 0x5ce9, 0x5cfd, 0x5cfa,
-		0x5ced, 0x5d8c, 0x5cea, 0x5d0b, 0x5d15, 0x5d17, 0x5d5c, 0x5d1f,
-		0x5d1b, 0x5d11, 0x5d14, 0x5d22, 0x5d1a, 0x5d19, 0x5d18, 0x5d4c,
-		0x5d52, 0x5d4e, 0x5d4b, 0x5d6c, 0x5d73, 0x5d76, 0x5d87, 0x5d84,
-		0x5d82, 0x5da2, 0x5d9d, 0x5dac, 0x5dae, 0x5dbd, 0x5d90, 0x5db7,
-		0x5dbc, 0x5dc9, 0x5dcd, 0x5dd3, 0x5dd2, 0x5dd6, 0x5ddb, 0x5deb,
-		0x5df2, 0x5df5, 0x5e0b, 0x5e1a, 0x5e19, 0x5e11, 0x5e1b, 0x5e36,
-		0x5e37, 0x5e44, 0x5e43, 0x5e40, 0x5e4e, 0x5e57, 0x5e54, 0x5e5f,
-		0x5e62, 0x5e64, 0x5e47, 0x5e75, 0x5e76, 0x5e7a, 0x9ebc, 0x5e7f,
-		0x5ea0, 0x5ec1, 0x5ec2, 0x5ec8, 0x5ed0, 0x5ecf,
-	}, {
-		0x5ed6, 0x5ee3, 0x5edd, 0x5eda, 0x5edb, 0x5ee2, 0x5ee1, 0x5ee8,
-		0x5ee9, 0x5eec, 0x5ef1, 0x5ef3, 0x5ef0, 0x5ef4, 0x5ef8, 0x5efe,
-		0x5f03, 0x5f09, 0x5f5d, 0x5f5c, 0x5f0b, 0x5f11, 0x5f16, 0x5f29,
-		0x5f2d, 0x5f38, 0x5f41, 0x5f48, 0x5f4c, 0x5f4e, 0x5f2f, 0x5f51,
-		0x5f56, 0x5f57, 0x5f59, 0x5f61, 0x5f6d, 0x5f73, 0x5f77, 0x5f83,
-		0x5f82, 0x5f7f, 0x5f8a, 0x5f88, 0x5f91, 0x5f87, 0x5f9e, 0x5f99,
-		0x5f98, 0x5fa0, 0x5fa8, 0x5fad, 0x5fbc, 0x5fd6, 0x5ffb, 0x5fe4,
-		0x5ff8, 0x5ff1, 0x5fdd, 0x60b3, 0x5fff, 0x6021, 0x6060, 0x6019,
-		0x6010, 0x6029, 0x600e, 0x6031, 0x601b, 0x6015, 0x602b, 0x6026,
-		0x600f, 0x603a, 0x605a, 0x6041, 0x606a, 0x6077, 0x605f, 0x604a,
-		0x6046, 0x604d, 0x6063, 0x6043, 0x6064, 0x6042, 0x606c, 0x606b,
-		0x6059, 0x6081, 0x608d, 0x60e7, 0x6083, 0x609a,
-	}, {
-		0x6084, 0x609b, 0x6096, 0x6097, 0x6092, 0x60a7, 0x608b, 0x60e1,
-		0x60b8, 0x60e0, 0x60d3, 0x60b4, 0x5ff0, 0x60bd, 0x60c6, 0x60b5,
-		0x60d8, 0x614d, 0x6115, 0x6106, 0x60f6, 0x60f7, 0x6100, 0x60f4,
-		0x60fa, 0x6103, 0x6121, 0x60fb, 0x60f1, 0x610d, 0x610e, 0x6147,
-		0x613e, 0x6128, 0x6127, 0x614a, 0x613f, 0x613c, 0x612c, 0x6134,
-		0x613d, 0x6142, 0x6144, 0x6173, 0x6177, 0x6158, 0x6159, 0x615a,
-		0x616b, 0x6174, 0x616f, 0x6165, 0x6171, 0x615f, 0x615d, 0x6153,
-		0x6175, 0x6199, 0x6196, 0x6187, 0x61ac, 0x6194, 0x619a, 0x618a,
-		0x6191, 0x61ab, 0x61ae, 0x61cc, 0x61ca, 0x61c9, 0x61f7, 0x61c8,
-		0x61c3, 0x61c6, 0x61ba, 0x61cb, 0x7f79, 0x61cd, 0x61e6, 0x61e3,
-		0x61f6, 0x61fa, 0x61f4, 0x61ff, 0x61fd, 0x61fc, 0x61fe, 0x6200,
-		0x6208, 0x6209, 0x620d, 0x620c, 0x6214, 0x621b,
-	}, {
-		0x621e, 0x6221, 0x622a, 0x622e, 0x6230, 0x6232, 0x6233, 0x6241,
-		0x624e, 0x625e, 0x6263, 0x625b, 0x6260, 0x6268, 0x627c, 0x6282,
-		0x6289, 0x627e, 0x6292, 0x6293, 0x6296, 0x62d4, 0x6283, 0x6294,
-		0x62d7, 0x62d1, 0x62bb, 0x62cf, 0x62ff, 0x62c6, 0x64d4, 0x62c8,
-		0x62dc, 0x62cc, 0x62ca, 0x62c2, 0x62c7, 0x629b, 0x62c9, 0x630c,
-		0x62ee, 0x62f1, 0x6327, 0x6302, 0x6308, 0x62ef, 0x62f5, 0x6350,
-		0x633e, 0x634d, 0x641c, 0x634f, 0x6396, 0x638e, 0x6380, 0x63ab,
-		0x6376, 0x63a3, 0x638f, 0x6389, 0x639f, 0x63b5, 0x636b, 0x6369,
-		0x63be, 0x63e9, 0x63c0, 0x63c6, 0x63e3, 0x63c9, 0x63d2, 0x63f6,
-		0x63c4, 0x6416, 0x6434, 0x6406, 0x6413, 0x6426, 0x6436, 0x651d,
-		0x6417, 0x6428, 0x640f, 0x6467, 0x646f, 0x6476, 0x644e, 0x652a,
-		0x6495, 0x6493, 0x64a5, 0x64a9, 0x6488, 0x64bc,
-	}, {
-		0x64da, 0x64d2, 0x64c5, 0x64c7, 0x64bb, 0x64d8, 0x64c2, 0x64f1,
-		0x64e7, 0x8209, 0x64e0, 0x64e1, 0x62ac, 0x64e3, 0x64ef, 0x652c,
-		0x64f6, 0x64f4, 0x64f2, 0x64fa, 0x6500, 0x64fd, 0x6518, 0x651c,
-		0x6505, 0x6524, 0x6523, 0x652b, 0x6534, 0x6535, 0x6537, 0x6536,
-		0x6538, 0x754b, 0x6548, 0x6556, 0x6555, 0x654d, 0x6558, 0x655e,
-		0x655d, 0x6572, 0x6578, 0x6582, 0x6583, 0x8b8a, 0x659b, 0x659f,
-		0x65ab, 0x65b7, 0x65c3, 0x65c6, 0x65c1, 0x65c4, 0x65cc, 0x65d2,
-		0x65db, 0x65d9, 0x65e0, 0x65e1, 0x65f1, 0x6772, 0x660a, 0x6603,
-		0x65fb, 0x6773, 0x6635, 0x6636, 0x6634, 0x661c, 0x664f, 0x6644,
-		0x6649, 0x6641, 0x665e, 0x665d, 0x6664, 0x6667, 0x6668, 0x665f,
-		0x6662, 0x6670, 0x6683, 0x6688, 0x668e, 0x6689, 0x6684, 0x6698,
-		0x669d, 0x66c1, 0x66b9, 0x66c9, 0x66be, 0x66bc,
-	}, {
-		0x66c4, 0x66b8, 0x66d6, 0x66da, 0x66e0, 0x663f, 0x66e6, 0x66e9,
-		0x66f0, 0x66f5, 0x66f7, 0x670f, 0x6716, 0x671e, 0x6726, 0x6727,
-		0x9738, 0x672e, 0x673f, 0x6736, 0x6741, 0x6738, 0x6737, 0x6746,
-		0x675e, 0x6760, 0x6759, 0x6763, 0x6764, 0x6789, 0x6770, 0x67a9,
-		0x677c, 0x676a, 0x678c, 0x678b, 0x67a6, 0x67a1, 0x6785, 0x67b7,
-		0x67ef, 0x67b4, 0x67ec, 0x67b3, 0x67e9, 0x67b8, 0x67e4, 0x67de,
-		0x67dd, 0x67e2, 0x67ee, 0x67b9, 0x67ce, 0x67c6, 0x67e7, 0x6a9c,
-		0x681e, 0x6846, 0x6829, 0x6840, 0x684d, 0x6832, 0x684e, 0x68b3,
-		0x682b, 0x6859, 0x6863, 0x6877, 0x687f, 0x689f, 0x688f, 0x68ad,
-		0x6894, 0x689d, 0x689b, 0x6883, 0x6aae, 0x68b9, 0x6874, 0x68b5,
-		0x68a0, 0x68ba, 0x690f, 0x688d, 0x687e, 0x6901, 0x68ca, 0x6908,
-		0x68d8, 0x6922, 0x6926, 0x68e1, 0x690c, 0x68cd,
-	}, {
-		0x68d4, 0x68e7, 0x68d5, 0x6936, 0x6912, 0x6904, 0x68d7, 0x68e3,
-		0x6925, 0x68f9, 0x68e0, 0x68ef, 0x6928, 0x692a, 0x691a, 0x6923,
-		0x6921, 0x68c6, 0x6979, 0x6977, 0x695c, 0x6978, 0x696b, 0x6954,
-		0x697e, 0x696e, 0x6939, 0x6974, 0x693d, 0x6959, 0x6930, 0x6961,
-		0x695e, 0x695d, 0x6981, 0x696a, 0x69b2, 0x69ae, 0x69d0, 0x69bf,
-		0x69c1, 0x69d3, 0x69be, 0x69ce, 0x5be8, 0x69ca, 0x69dd, 0x69bb,
-		0x69c3, 0x69a7, 0x6a2e, 0x6991, 0x69a0, 0x699c, 0x6995, 0x69b4,
-		0x69de, 0x69e8, 0x6a02, 0x6a1b, 0x69ff, 0x6b0a, 0x69f9, 0x69f2,
-		0x69e7, 0x6a05, 0x69b1, 0x6a1e, 0x69ed, 0x6a14, 0x69eb, 0x6a0a,
-		0x6a12, 0x6ac1, 0x6a23, 0x6a13, 0x6a44, 0x6a0c, 0x6a72, 0x6a36,
-		0x6a78, 0x6a47, 0x6a62, 0x6a59, 0x6a66, 0x6a48, 0x6a38, 0x6a22,
-		0x6a90, 0x6a8d, 0x6aa0, 0x6a84, 0x6aa2, 0x6aa3,
-	}, {
-		0x6a97, 0x8617, 0x6abb, 0x6ac3, 0x6ac2, 0x6ab8, 0x6ab3, 0x6aac,
-		0x6ade, 0x6ad1, 0x6adf, 0x6aaa, 0x6ada, 0x6aea, 0x6afb, 0x6b05,
-		0x8616, 0x6afa, 0x6b12, 0x6b16, 0x9b31, 0x6b1f, 0x6b38, 0x6b37,
-		0x76dc, 0x6b39, 0x98ee, 0x6b47, 0x6b43, 0x6b49, 0x6b50, 0x6b59,
-		0x6b54, 0x6b5b, 0x6b5f, 0x6b61, 0x6b78, 0x6b79, 0x6b7f, 0x6b80,
-		0x6b84, 0x6b83, 0x6b8d, 0x6b98, 0x6b95, 0x6b9e, 0x6ba4, 0x6baa,
-		0x6bab, 0x6baf, 0x6bb2, 0x6bb1, 0x6bb3, 0x6bb7, 0x6bbc, 0x6bc6,
-		0x6bcb, 0x6bd3, 0x6bdf, 0x6bec, 0x6beb, 0x6bf3, 0x6bef, 0x9ebe,
-		0x6c08, 0x6c13, 0x6c14, 0x6c1b, 0x6c24, 0x6c23, 0x6c5e, 0x6c55,
-		0x6c62, 0x6c6a, 0x6c82, 0x6c8d, 0x6c9a, 0x6c81, 0x6c9b, 0x6c7e,
-		0x6c68, 0x6c73, 0x6c92, 0x6c90, 0x6cc4, 0x6cf1, 0x6cd3, 0x6cbd,
-		0x6cd7, 0x6cc5, 0x6cdd, 0x6cae, 0x6cb1, 0x6cbe,
-	}, {
-		0x6cba, 0x6cdb, 0x6cef, 0x6cd9, 0x6cea, 0x6d1f, 0x884d, 0x6d36,
-		0x6d2b, 0x6d3d, 0x6d38, 0x6d19, 0x6d35, 0x6d33, 0x6d12, 0x6d0c,
-		0x6d63, 0x6d93, 0x6d64, 0x6d5a, 0x6d79, 0x6d59, 0x6d8e, 0x6d95,
-		0x6fe4, 0x6d85, 0x6df9, 0x6e15, 0x6e0a, 0x6db5, 0x6dc7, 0x6de6,
-		0x6db8, 0x6dc6, 0x6dec, 0x6dde, 0x6dcc, 0x6de8, 0x6dd2, 0x6dc5,
-		0x6dfa, 0x6dd9, 0x6de4, 0x6dd5, 0x6dea, 0x6dee, 0x6e2d, 0x6e6e,
-		0x6e2e, 0x6e19, 0x6e72, 0x6e5f, 0x6e3e, 0x6e23, 0x6e6b, 0x6e2b,
-		0x6e76, 0x6e4d, 0x6e1f, 0x6e43, 0x6e3a, 0x6e4e, 0x6e24, 0x6eff,
-		0x6e1d, 0x6e38, 0x6e82, 0x6eaa, 0x6e98, 0x6ec9, 0x6eb7, 0x6ed3,
-		0x6ebd, 0x6eaf, 0x6ec4, 0x6eb2, 0x6ed4, 0x6ed5, 0x6e8f, 0x6ea5,
-		0x6ec2, 0x6e9f, 0x6f41, 0x6f11, 0x704c, 0x6eec, 0x6ef8, 0x6efe,
-		0x6f3f, 0x6ef2, 0x6f31, 0x6eef, 0x6f32, 0x6ecc,
-	}, {
-		0x6f3e, 0x6f13, 0x6ef7, 0x6f86, 0x6f7a, 0x6f78, 0x6f81, 0x6f80,
-		0x6f6f, 0x6f5b, 0x6ff3, 0x6f6d, 0x6f82, 0x6f7c, 0x6f58, 0x6f8e,
-		0x6f91, 0x6fc2, 0x6f66, 0x6fb3, 0x6fa3, 0x6fa1, 0x6fa4, 0x6fb9,
-		0x6fc6, 0x6faa, 0x6fdf, 0x6fd5, 0x6fec, 0x6fd4, 0x6fd8, 0x6ff1,
-		0x6fee, 0x6fdb, 0x7009, 0x700b, 0x6ffa, 0x7011, 0x7001, 0x700f,
-		0x6ffe, 0x701b, 0x701a, 0x6f74, 0x701d, 0x7018, 0x701f, 0x7030,
-		0x703e, 0x7032, 0x7051, 0x7063, 0x7099, 0x7092, 0x70af, 0x70f1,
-		0x70ac, 0x70b8, 0x70b3, 0x70ae, 0x70df, 0x70cb, 0x70dd, 0x70d9,
-		0x7109, 0x70fd, 0x711c, 0x7119, 0x7165, 0x7155, 0x7188, 0x7166,
-		0x7162, 0x714c, 0x7156, 0x716c, 0x718f, 0x71fb, 0x7184, 0x7195,
-		0x71a8, 0x71ac, 0x71d7, 0x71b9, 0x71be, 0x71d2, 0x71c9, 0x71d4,
-		0x71ce, 0x71e0, 0x71ec, 0x71e7, 0x71f5, 0x71fc,
-	}, {
-		0x71f9, 0x71ff, 0x720d, 0x7210, 0x721b, 0x7228, 0x722d, 0x722c,
-		0x7230, 0x7232, 0x723b, 0x723c, 0x723f, 0x7240, 0x7246, 0x724b,
-		0x7258, 0x7274, 0x727e, 0x7282, 0x7281, 0x7287, 0x7292, 0x7296,
-		0x72a2, 0x72a7, 0x72b9, 0x72b2, 0x72c3, 0x72c6, 0x72c4, 0x72ce,
-		0x72d2, 0x72e2, 0x72e0, 0x72e1, 0x72f9, 0x72f7, 0x500f, 0x7317,
-		0x730a, 0x731c, 0x7316, 0x731d, 0x7334, 0x732f, 0x7329, 0x7325,
-		0x733e, 0x734e, 0x734f, 0x9ed8, 0x7357, 0x736a, 0x7368, 0x7370,
-		0x7378, 0x7375, 0x737b, 0x737a, 0x73c8, 0x73b3, 0x73ce, 0x73bb,
-		0x73c0, 0x73e5, 0x73ee, 0x73de, 0x74a2, 0x7405, 0x746f, 0x7425,
-		0x73f8, 0x7432, 0x743a, 0x7455, 0x743f, 0x745f, 0x7459, 0x7441,
-		0x745c, 0x7469, 0x7470, 0x7463, 0x746a, 0x7476, 0x747e, 0x748b,
-		0x749e, 0x74a7, 0x74ca, 0x74cf, 0x74d4, 0x73f1,
-	}, {
-		0x74e0, 0x74e3, 0x74e7, 0x74e9, 0x74ee, 0x74f2, 0x74f0, 0x74f1,
-		0x74f8, 0x74f7, 0x7504, 0x7503, 0x7505, 0x750c, 0x750e, 0x750d,
-		0x7515, 0x7513, 0x751e, 0x7526, 0x752c, 0x753c, 0x7544, 0x754d,
-		0x754a, 0x7549, 0x755b, 0x7546, 0x755a, 0x7569, 0x7564, 0x7567,
-		0x756b, 0x756d, 0x7578, 0x7576, 0x7586, 0x7587, 0x7574, 0x758a,
-		0x7589, 0x7582, 0x7594, 0x759a, 0x759d, 0x75a5, 0x75a3, 0x75c2,
-		0x75b3, 0x75c3, 0x75b5, 0x75bd, 0x75b8, 0x75bc, 0x75b1, 0x75cd,
-		0x75ca, 0x75d2, 0x75d9, 0x75e3, 0x75de, 0x75fe, 0x75ff, 0x75fc,
-		0x7601, 0x75f0, 0x75fa, 0x75f2, 0x75f3, 0x760b, 0x760d, 0x7609,
-		0x761f, 0x7627, 0x7620, 0x7621, 0x7622, 0x7624, 0x7634, 0x7630,
-		0x763b, 0x7647, 0x7648, 0x7646, 0x765c, 0x7658, 0x7661, 0x7662,
-		0x7668, 0x7669, 0x766a, 0x7667, 0x766c, 0x7670,
-	}, {
-		0x7672, 0x7676, 0x7678, 0x767c, 0x7680, 0x7683, 0x7688, 0x768b,
-		0x768e, 0x7696, 0x7693, 0x7699, 0x769a, 0x76b0, 0x76b4, 0x76b8,
-		0x76b9, 0x76ba, 0x76c2, 0x76cd, 0x76d6, 0x76d2, 0x76de, 0x76e1,
-		0x76e5, 0x76e7, 0x76ea, 0x862f, 0x76fb, 0x7708, 0x7707, 0x7704,
-		0x7729, 0x7724, 0x771e, 0x7725, 0x7726, 0x771b, 0x7737, 0x7738,
-		0x7747, 0x775a, 0x7768, 0x776b, 0x775b, 0x7765, 0x777f, 0x777e,
-		0x7779, 0x778e, 0x778b, 0x7791, 0x77a0, 0x779e, 0x77b0, 0x77b6,
-		0x77b9, 0x77bf, 0x77bc, 0x77bd, 0x77bb, 0x77c7, 0x77cd, 0x77d7,
-		0x77da, 0x77dc, 0x77e3, 0x77ee, 0x77fc, 0x780c, 0x7812, 0x7926,
-		0x7820, 0x792a, 0x7845, 0x788e, 0x7874, 0x7886, 0x787c, 0x789a,
-		0x788c, 0x78a3, 0x78b5, 0x78aa, 0x78af, 0x78d1, 0x78c6, 0x78cb,
-		0x78d4, 0x78be, 0x78bc, 0x78c5, 0x78ca, 0x78ec,
-	}, {
-		0x78e7, 0x78da, 0x78fd, 0x78f4, 0x7907, 0x7912, 0x7911, 0x7919,
-		0x792c, 0x792b, 0x7940, 0x7960, 0x7957, 0x795f, 0x795a, 0x7955,
-		0x7953, 0x797a, 0x797f, 0x798a, 0x799d, 0x79a7, 0x9f4b, 0x79aa,
-		0x79ae, 0x79b3, 0x79b9, 0x79ba, 0x79c9, 0x79d5, 0x79e7, 0x79ec,
-		0x79e1, 0x79e3, 0x7a08, 0x7a0d, 0x7a18, 0x7a19, 0x7a20, 0x7a1f,
-		0x7980, 0x7a31, 0x7a3b, 0x7a3e, 0x7a37, 0x7a43, 0x7a57, 0x7a49,
-		0x7a61, 0x7a62, 0x7a69, 0x9f9d, 0x7a70, 0x7a79, 0x7a7d, 0x7a88,
-		0x7a97, 0x7a95, 0x7a98, 0x7a96, 0x7aa9, 0x7ac8, 0x7ab0, 0x7ab6,
-		0x7ac5, 0x7ac4, 0x7abf, 0x9083, 0x7ac7, 0x7aca, 0x7acd, 0x7acf,
-		0x7ad5, 0x7ad3, 0x7ad9, 0x7ada, 0x7add, 0x7ae1, 0x7ae2, 0x7ae6,
-		0x7aed, 0x7af0, 0x7b02, 0x7b0f, 0x7b0a, 0x7b06, 0x7b33, 0x7b18,
-		0x7b19, 0x7b1e, 0x7b35, 0x7b28, 0x7b36, 0x7b50,
-	}, {
-		0x7b7a, 0x7b04, 0x7b4d, 0x7b0b, 0x7b4c, 0x7b45, 0x7b75, 0x7b65,
-		0x7b74, 0x7b67, 0x7b70, 0x7b71, 0x7b6c, 0x7b6e, 0x7b9d, 0x7b98,
-		0x7b9f, 0x7b8d, 0x7b9c, 0x7b9a, 0x7b8b, 0x7b92, 0x7b8f, 0x7b5d,
-		0x7b99, 0x7bcb, 0x7bc1, 0x7bcc, 0x7bcf, 0x7bb4, 0x7bc6, 0x7bdd,
-		0x7be9, 0x7c11, 0x7c14, 0x7be6, 0x7be5, 0x7c60, 0x7c00, 0x7c07,
-		0x7c13, 0x7bf3, 0x7bf7, 0x7c17, 0x7c0d, 0x7bf6, 0x7c23, 0x7c27,
-		0x7c2a, 0x7c1f, 0x7c37, 0x7c2b, 0x7c3d, 0x7c4c, 0x7c43, 0x7c54,
-		0x7c4f, 0x7c40, 0x7c50, 0x7c58, 0x7c5f, 0x7c64, 0x7c56, 0x7c65,
-		0x7c6c, 0x7c75, 0x7c83, 0x7c90, 0x7ca4, 0x7cad, 0x7ca2, 0x7cab,
-		0x7ca1, 0x7ca8, 0x7cb3, 0x7cb2, 0x7cb1, 0x7cae, 0x7cb9, 0x7cbd,
-		0x7cc0, 0x7cc5, 0x7cc2, 0x7cd8, 0x7cd2, 0x7cdc, 0x7ce2, 0x9b3b,
-		0x7cef, 0x7cf2, 0x7cf4, 0x7cf6, 0x7cfa, 0x7d06,
-	}, {
-		0x7d02, 0x7d1c, 0x7d15, 0x7d0a, 0x7d45, 0x7d4b, 0x7d2e, 0x7d32,
-		0x7d3f, 0x7d35, 0x7d46, 0x7d73, 0x7d56, 0x7d4e, 0x7d72, 0x7d68,
-		0x7d6e, 0x7d4f, 0x7d63, 0x7d93, 0x7d89, 0x7d5b, 0x7d8f, 0x7d7d,
-		0x7d9b, 0x7dba, 0x7dae, 0x7da3, 0x7db5, 0x7dc7, 0x7dbd, 0x7dab,
-		0x7e3d, 0x7da2, 0x7daf, 0x7ddc, 0x7db8, 0x7d9f, 0x7db0, 0x7dd8,
-		0x7ddd, 0x7de4, 0x7dde, 0x7dfb, 0x7df2, 0x7de1, 0x7e05, 0x7e0a,
-		0x7e23, 0x7e21, 0x7e12, 0x7e31, 0x7e1f, 0x7e09, 0x7e0b, 0x7e22,
-		0x7e46, 0x7e66, 0x7e3b, 0x7e35, 0x7e39, 0x7e43, 0x7e37, 0x7e32,
-		0x7e3a, 0x7e67, 0x7e5d, 0x7e56, 0x7e5e, 0x7e59, 0x7e5a, 0x7e79,
-		0x7e6a, 0x7e69, 0x7e7c, 0x7e7b, 0x7e83, 0x7dd5, 0x7e7d, 0x8fae,
-		0x7e7f, 0x7e88, 0x7e89, 0x7e8c, 0x7e92, 0x7e90, 0x7e93, 0x7e94,
-		0x7e96, 0x7e8e, 0x7e9b, 0x7e9c, 0x7f38, 0x7f3a,
-	}, {
-		0x7f45, 0x7f4c, 0x7f4d, 0x7f4e, 0x7f50, 0x7f51, 0x7f55, 0x7f54,
-		0x7f58, 0x7f5f, 0x7f60, 0x7f68, 0x7f69, 0x7f67, 0x7f78, 0x7f82,
-		0x7f86, 0x7f83, 0x7f88, 0x7f87, 0x7f8c, 0x7f94, 0x7f9e, 0x7f9d,
-		0x7f9a, 0x7fa3, 0x7faf, 0x7fb2, 0x7fb9, 0x7fae, 0x7fb6, 0x7fb8,
-		0x8b71, 0x7fc5, 0x7fc6, 0x7fca, 0x7fd5, 0x7fd4, 0x7fe1, 0x7fe6,
-		0x7fe9, 0x7ff3, 0x7ff9, 0x98dc, 0x8006, 0x8004, 0x800b, 0x8012,
-		0x8018, 0x8019, 0x801c, 0x8021, 0x8028, 0x803f, 0x803b, 0x804a,
-		0x8046, 0x8052, 0x8058, 0x805a, 0x805f, 0x8062, 0x8068, 0x8073,
-		0x8072, 0x8070, 0x8076, 0x8079, 0x807d, 0x807f, 0x8084, 0x8086,
-		0x8085, 0x809b, 0x8093, 0x809a, 0x80ad, 0x5190, 0x80ac, 0x80db,
-		0x80e5, 0x80d9, 0x80dd, 0x80c4, 0x80da, 0x80d6, 0x8109, 0x80ef,
-		0x80f1, 0x811b, 0x8129, 0x8123, 0x812f, 0x814b,
-	}, {
-		0x968b, 0x8146, 0x813e, 0x8153, 0x8151, 0x80fc, 0x8171, 0x816e,
-		0x8165, 0x8166, 0x8174, 0x8183, 0x8188, 0x818a, 0x8180, 0x8182,
-		0x81a0, 0x8195, 0x81a4, 0x81a3, 0x815f, 0x8193, 0x81a9, 0x81b0,
-		0x81b5, 0x81be, 0x81b8, 0x81bd, 0x81c0, 0x81c2, 0x81ba, 0x81c9,
-		0x81cd, 0x81d1, 0x81d9, 0x81d8, 0x81c8, 0x81da, 0x81df, 0x81e0,
-		0x81e7, 0x81fa, 0x81fb, 0x81fe, 0x8201, 0x8202, 0x8205, 0x8207,
-		0x820a, 0x820d, 0x8210, 0x8216, 0x8229, 0x822b, 0x8238, 0x8233,
-		0x8240, 0x8259, 0x8258, 0x825d, 0x825a, 0x825f, 0x8264, 0x8262,
-		0x8268, 0x826a, 0x826b, 0x822e, 0x8271, 0x8277, 0x8278, 0x827e,
-		0x828d, 0x8292, 0x82ab, 0x829f, 0x82bb, 0x82ac, 0x82e1, 0x82e3,
-		0x82df, 0x82d2, 0x82f4, 0x82f3, 0x82fa, 0x8393, 0x8303, 0x82fb,
-		0x82f9, 0x82de, 0x8306, 0x82dc, 0x8309, 0x82d9,
-	}, {
-		0x8335, 0x8334, 0x8316, 0x8332, 0x8331, 0x8340, 0x8339, 0x8350,
-		0x8345, 0x832f, 0x832b, 0x8317, 0x8318, 0x8385, 0x839a, 0x83aa,
-		0x839f, 0x83a2, 0x8396, 0x8323, 0x838e, 0x8387, 0x838a, 0x837c,
-		0x83b5, 0x8373, 0x8375, 0x83a0, 0x8389, 0x83a8, 0x83f4, 0x8413,
-		0x83eb, 0x83ce, 0x83fd, 0x8403, 0x83d8, 0x840b, 0x83c1, 0x83f7,
-		0x8407, 0x83e0, 0x83f2, 0x840d, 0x8422, 0x8420, 0x83bd, 0x8438,
-		0x8506, 0x83fb, 0x846d, 0x842a, 0x843c, 0x855a, 0x8484, 0x8477,
-		0x846b, 0x84ad, 0x846e, 0x8482, 0x8469, 0x8446, 0x842c, 0x846f,
-		0x8479, 0x8435, 0x84ca, 0x8462, 0x84b9, 0x84bf, 0x849f, 0x84d9,
-		0x84cd, 0x84bb, 0x84da, 0x84d0, 0x84c1, 0x84c6, 0x84d6, 0x84a1,
-		0x8521, 0x84ff, 0x84f4, 0x8517, 0x8518, 0x852c, 0x851f, 0x8515,
-		0x8514, 0x84fc, 0x8540, 0x8563, 0x8558, 0x8548,
-	}, {
-		0x8541, 0x8602, 0x854b, 0x8555, 0x8580, 0x85a4, 0x8588, 0x8591,
-		0x858a, 0x85a8, 0x856d, 0x8594, 0x859b, 0x85ea, 0x8587, 0x859c,
-		0x8577, 0x857e, 0x8590, 0x85c9, 0x85ba, 0x85cf, 0x85b9, 0x85d0,
-		0x85d5, 0x85dd, 0x85e5, 0x85dc, 0x85f9, 0x860a, 0x8613, 0x860b,
-		0x85fe, 0x85fa, 0x8606, 0x8622, 0x861a, 0x8630, 0x863f, 0x864d,
-		0x4e55, 0x8654, 0x865f, 0x8667, 0x8671, 0x8693, 0x86a3, 0x86a9,
-		0x86aa, 0x868b, 0x868c, 0x86b6, 0x86af, 0x86c4, 0x86c6, 0x86b0,
-		0x86c9, 0x8823, 0x86ab, 0x86d4, 0x86de, 0x86e9, 0x86ec, 0x86df,
-		0x86db, 0x86ef, 0x8712, 0x8706, 0x8708, 0x8700, 0x8703, 0x86fb,
-		0x8711, 0x8709, 0x870d, 0x86f9, 0x870a, 0x8734, 0x873f, 0x8737,
-		0x873b, 0x8725, 0x8729, 0x871a, 0x8760, 0x875f, 0x8778, 0x874c,
-		0x874e, 0x8774, 0x8757, 0x8768, 0x876e, 0x8759,
-	}, {
-		0x8753, 0x8763, 0x876a, 0x8805, 0x87a2, 0x879f, 0x8782, 0x87af,
-		0x87cb, 0x87bd, 0x87c0, 0x87d0, 0x96d6, 0x87ab, 0x87c4, 0x87b3,
-		0x87c7, 0x87c6, 0x87bb, 0x87ef, 0x87f2, 0x87e0, 0x880f, 0x880d,
-		0x87fe, 0x87f6, 0x87f7, 0x880e, 0x87d2, 0x8811, 0x8816, 0x8815,
-		0x8822, 0x8821, 0x8831, 0x8836, 0x8839, 0x8827, 0x883b, 0x8844,
-		0x8842, 0x8852, 0x8859, 0x885e, 0x8862, 0x886b, 0x8881, 0x887e,
-		0x889e, 0x8875, 0x887d, 0x88b5, 0x8872, 0x8882, 0x8897, 0x8892,
-		0x88ae, 0x8899, 0x88a2, 0x888d, 0x88a4, 0x88b0, 0x88bf, 0x88b1,
-		0x88c3, 0x88c4, 0x88d4, 0x88d8, 0x88d9, 0x88dd, 0x88f9, 0x8902,
-		0x88fc, 0x88f4, 0x88e8, 0x88f2, 0x8904, 0x890c, 0x890a, 0x8913,
-		0x8943, 0x891e, 0x8925, 0x892a, 0x892b, 0x8941, 0x8944, 0x893b,
-		0x8936, 0x8938, 0x894c, 0x891d, 0x8960, 0x895e,
-	}, {
-		0x8966, 0x8964, 0x896d, 0x896a, 0x896f, 0x8974, 0x8977, 0x897e,
-		0x8983, 0x8988, 0x898a, 0x8993, 0x8998, 0x89a1, 0x89a9, 0x89a6,
-		0x89ac, 0x89af, 0x89b2, 0x89ba, 0x89bd, 0x89bf, 0x89c0, 0x89da,
-		0x89dc, 0x89dd, 0x89e7, 0x89f4, 0x89f8, 0x8a03, 0x8a16, 0x8a10,
-		0x8a0c, 0x8a1b, 0x8a1d, 0x8a25, 0x8a36, 0x8a41, 0x8a5b, 0x8a52,
-		0x8a46, 0x8a48, 0x8a7c, 0x8a6d, 0x8a6c, 0x8a62, 0x8a85, 0x8a82,
-		0x8a84, 0x8aa8, 0x8aa1, 0x8a91, 0x8aa5, 0x8aa6, 0x8a9a, 0x8aa3,
-		0x8ac4, 0x8acd, 0x8ac2, 0x8ada, 0x8aeb, 0x8af3, 0x8ae7, 0x8ae4,
-		0x8af1, 0x8b14, 0x8ae0, 0x8ae2, 0x8af7, 0x8ade, 0x8adb, 0x8b0c,
-		0x8b07, 0x8b1a, 0x8ae1, 0x8b16, 0x8b10, 0x8b17, 0x8b20, 0x8b33,
-		0x97ab, 0x8b26, 0x8b2b, 0x8b3e, 0x8b28, 0x8b41, 0x8b4c, 0x8b4f,
-		0x8b4e, 0x8b49, 0x8b56, 0x8b5b, 0x8b5a, 0x8b6b,
-	}, {
-		0x8b5f, 0x8b6c, 0x8b6f, 0x8b74, 0x8b7d, 0x8b80, 0x8b8c, 0x8b8e,
-		0x8b92, 0x8b93, 0x8b96, 0x8b99, 0x8b9a, 0x8c3a, 0x8c41, 0x8c3f,
-		0x8c48, 0x8c4c, 0x8c4e, 0x8c50, 0x8c55, 0x8c62, 0x8c6c, 0x8c78,
-		0x8c7a, 0x8c82, 0x8c89, 0x8c85, 0x8c8a, 0x8c8d, 0x8c8e, 0x8c94,
-		0x8c7c, 0x8c98, 0x621d, 0x8cad, 0x8caa, 0x8cbd, 0x8cb2, 0x8cb3,
-		0x8cae, 0x8cb6, 0x8cc8, 0x8cc1, 0x8ce4, 0x8ce3, 0x8cda, 0x8cfd,
-		0x8cfa, 0x8cfb, 0x8d04, 0x8d05, 0x8d0a, 0x8d07, 0x8d0f, 0x8d0d,
-		0x8d10, 0x9f4e, 0x8d13, 0x8ccd, 0x8d14, 0x8d16, 0x8d67, 0x8d6d,
-		0x8d71, 0x8d73, 0x8d81, 0x8d99, 0x8dc2, 0x8dbe, 0x8dba, 0x8dcf,
-		0x8dda, 0x8dd6, 0x8dcc, 0x8ddb, 0x8dcb, 0x8dea, 0x8deb, 0x8ddf,
-		0x8de3, 0x8dfc, 0x8e08, 0x8e09, 0x8dff, 0x8e1d, 0x8e1e, 0x8e10,
-		0x8e1f, 0x8e42, 0x8e35, 0x8e30, 0x8e34, 0x8e4a,
-	}, {
-		0x8e47, 0x8e49, 0x8e4c, 0x8e50, 0x8e48, 0x8e59, 0x8e64, 0x8e60,
-		0x8e2a, 0x8e63, 0x8e55, 0x8e76, 0x8e72, 0x8e7c, 0x8e81, 0x8e87,
-		0x8e85, 0x8e84, 0x8e8b, 0x8e8a, 0x8e93, 0x8e91, 0x8e94, 0x8e99,
-		0x8eaa, 0x8ea1, 0x8eac, 0x8eb0, 0x8ec6, 0x8eb1, 0x8ebe, 0x8ec5,
-		0x8ec8, 0x8ecb, 0x8edb, 0x8ee3, 0x8efc, 0x8efb, 0x8eeb, 0x8efe,
-		0x8f0a, 0x8f05, 0x8f15, 0x8f12, 0x8f19, 0x8f13, 0x8f1c, 0x8f1f,
-		0x8f1b, 0x8f0c, 0x8f26, 0x8f33, 0x8f3b, 0x8f39, 0x8f45, 0x8f42,
-		0x8f3e, 0x8f4c, 0x8f49, 0x8f46, 0x8f4e, 0x8f57, 0x8f5c, 0x8f62,
-		0x8f63, 0x8f64, 0x8f9c, 0x8f9f, 0x8fa3, 0x8fad, 0x8faf, 0x8fb7,
-		0x8fda, 0x8fe5, 0x8fe2, 0x8fea, 0x8fef, 0x9087, 0x8ff4, 0x9005,
-		0x8ff9, 0x8ffa, 0x9011, 0x9015, 0x9021, 0x900d, 0x901e, 0x9016,
-		0x900b, 0x9027, 0x9036, 0x9035, 0x9039, 0x8ff8,
-	}, {
-		0x904f, 0x9050, 0x9051, 0x9052, 0x900e, 0x9049, 0x903e, 0x9056,
-		0x9058, 0x905e, 0x9068, 0x906f, 0x9076, 0x96a8, 0x9072, 0x9082,
-		0x907d, 0x9081, 0x9080, 0x908a, 0x9089, 0x908f, 0x90a8, 0x90af,
-		0x90b1, 0x90b5, 0x90e2, 0x90e4, 0x6248, 0x90db, 0x9102, 0x9112,
-		0x9119, 0x9132, 0x9130, 0x914a, 0x9156, 0x9158, 0x9163, 0x9165,
-		0x9169, 0x9173, 0x9172, 0x918b, 0x9189, 0x9182, 0x91a2, 0x91ab,
-		0x91af, 0x91aa, 0x91b5, 0x91b4, 0x91ba, 0x91c0, 0x91c1, 0x91c9,
-		0x91cb, 0x91d0, 0x91d6, 0x91df, 0x91e1, 0x91db, 0x91fc, 0x91f5,
-		0x91f6, 0x921e, 0x91ff, 0x9214, 0x922c, 0x9215, 0x9211, 0x925e,
-		0x9257, 0x9245, 0x9249, 0x9264, 0x9248, 0x9295, 0x923f, 0x924b,
-		0x9250, 0x929c, 0x9296, 0x9293, 0x929b, 0x925a, 0x92cf, 0x92b9,
-		0x92b7, 0x92e9, 0x930f, 0x92fa, 0x9344, 0x932e,
-	}, {
-		0x9319, 0x9322, 0x931a, 0x9323, 0x933a, 0x9335, 0x933b, 0x935c,
-		0x9360, 0x937c, 0x936e, 0x9356, 0x93b0, 0x93ac, 0x93ad, 0x9394,
-		0x93b9, 0x93d6, 0x93d7, 0x93e8, 0x93e5, 0x93d8, 0x93c3, 0x93dd,
-		0x93d0, 0x93c8, 0x93e4, 0x941a, 0x9414, 0x9413, 0x9403, 0x9407,
-		0x9410, 0x9436, 0x942b, 0x9435, 0x9421, 0x943a, 0x9441, 0x9452,
-		0x9444, 0x945b, 0x9460, 0x9462, 0x945e, 0x946a, 0x9229, 0x9470,
-		0x9475, 0x9477, 0x947d, 0x945a, 0x947c, 0x947e, 0x9481, 0x947f,
-		0x9582, 0x9587, 0x958a, 0x9594, 0x9596, 0x9598, 0x9599, 0x95a0,
-		0x95a8, 0x95a7, 0x95ad, 0x95bc, 0x95bb, 0x95b9, 0x95be, 0x95ca,
-		0x6ff6, 0x95c3, 0x95cd, 0x95cc, 0x95d5, 0x95d4, 0x95d6, 0x95dc,
-		0x95e1, 0x95e5, 0x95e2, 0x9621, 0x9628, 0x962e, 0x962f, 0x9642,
-		0x964c, 0x964f, 0x964b, 0x9677, 0x965c, 0x965e,
-	}, {
-		0x965d, 0x965f, 0x9666, 0x9672, 0x966c, 0x968d, 0x9698, 0x9695,
-		0x9697, 0x96aa, 0x96a7, 0x96b1, 0x96b2, 0x96b0, 0x96b4, 0x96b6,
-		0x96b8, 0x96b9, 0x96ce, 0x96cb, 0x96c9, 0x96cd, 0x894d, 0x96dc,
-		0x970d, 0x96d5, 0x96f9, 0x9704, 0x9706, 0x9708, 0x9713, 0x970e,
-		0x9711, 0x970f, 0x9716, 0x9719, 0x9724, 0x972a, 0x9730, 0x9739,
-		0x973d, 0x973e, 0x9744, 0x9746, 0x9748, 0x9742, 0x9749, 0x975c,
-		0x9760, 0x9764, 0x9766, 0x9768, 0x52d2, 0x976b, 0x9771, 0x9779,
-		0x9785, 0x977c, 0x9781, 0x977a, 0x9786, 0x978b, 0x978f, 0x9790,
-		0x979c, 0x97a8, 0x97a6, 0x97a3, 0x97b3, 0x97b4, 0x97c3, 0x97c6,
-		0x97c8, 0x97cb, 0x97dc, 0x97ed, 0x9f4f, 0x97f2, 0x7adf, 0x97f6,
-		0x97f5, 0x980f, 0x980c, 0x9838, 0x9824, 0x9821, 0x9837, 0x983d,
-		0x9846, 0x984f, 0x984b, 0x986b, 0x986f, 0x9870,
-	}, {
-		0x9871, 0x9874, 0x9873, 0x98aa, 0x98af, 0x98b1, 0x98b6, 0x98c4,
-		0x98c3, 0x98c6, 0x98e9, 0x98eb, 0x9903, 0x9909, 0x9912, 0x9914,
-		0x9918, 0x9921, 0x991d, 0x991e, 0x9924, 0x9920, 0x992c, 0x992e,
-		0x993d, 0x993e, 0x9942, 0x9949, 0x9945, 0x9950, 0x994b, 0x9951,
-		0x9952, 0x994c, 0x9955, 0x9997, 0x9998, 0x99a5, 0x99ad, 0x99ae,
-		0x99bc, 0x99df, 0x99db, 0x99dd, 0x99d8, 0x99d1, 0x99ed, 0x99ee,
-		0x99f1, 0x99f2, 0x99fb, 0x99f8, 0x9a01, 0x9a0f, 0x9a05, 0x99e2,
-		0x9a19, 0x9a2b, 0x9a37, 0x9a45, 0x9a42, 0x9a40, 0x9a43, 0x9a3e,
-		0x9a55, 0x9a4d, 0x9a5b, 0x9a57, 0x9a5f, 0x9a62, 0x9a65, 0x9a64,
-		0x9a69, 0x9a6b, 0x9a6a, 0x9aad, 0x9ab0, 0x9abc, 0x9ac0, 0x9acf,
-		0x9ad1, 0x9ad3, 0x9ad4, 0x9ade, 0x9adf, 0x9ae2, 0x9ae3, 0x9ae6,
-		0x9aef, 0x9aeb, 0x9aee, 0x9af4, 0x9af1, 0x9af7,
-	}, {
-		0x9afb, 0x9b06, 0x9b18, 0x9b1a, 0x9b1f, 0x9b22, 0x9b23, 0x9b25,
-		0x9b27, 0x9b28, 0x9b29, 0x9b2a, 0x9b2e, 0x9b2f, 0x9b32, 0x9b44,
-		0x9b43, 0x9b4f, 0x9b4d, 0x9b4e, 0x9b51, 0x9b58, 0x9b74, 0x9b93,
-		0x9b83, 0x9b91, 0x9b96, 0x9b97, 0x9b9f, 0x9ba0, 0x9ba8, 0x9bb4,
-		0x9bc0, 0x9bca, 0x9bb9, 0x9bc6, 0x9bcf, 0x9bd1, 0x9bd2, 0x9be3,
-		0x9be2, 0x9be4, 0x9bd4, 0x9be1, 0x9c3a, 0x9bf2, 0x9bf1, 0x9bf0,
-		0x9c15, 0x9c14, 0x9c09, 0x9c13, 0x9c0c, 0x9c06, 0x9c08, 0x9c12,
-		0x9c0a, 0x9c04, 0x9c2e, 0x9c1b, 0x9c25, 0x9c24, 0x9c21, 0x9c30,
-		0x9c47, 0x9c32, 0x9c46, 0x9c3e, 0x9c5a, 0x9c60, 0x9c67, 0x9c76,
-		0x9c78, 0x9ce7, 0x9cec, 0x9cf0, 0x9d09, 0x9d08, 0x9ceb, 0x9d03,
-		0x9d06, 0x9d2a, 0x9d26, 0x9daf, 0x9d23, 0x9d1f, 0x9d44, 0x9d15,
-		0x9d12, 0x9d41, 0x9d3f, 0x9d3e, 0x9d46, 0x9d48,
-	}, {
-		0x9d5d, 0x9d5e, 0x9d64, 0x9d51, 0x9d50, 0x9d59, 0x9d72, 0x9d89,
-		0x9d87, 0x9dab, 0x9d6f, 0x9d7a, 0x9d9a, 0x9da4, 0x9da9, 0x9db2,
-		0x9dc4, 0x9dc1, 0x9dbb, 0x9db8, 0x9dba, 0x9dc6, 0x9dcf, 0x9dc2,
-		0x9dd9, 0x9dd3, 0x9df8, 0x9de6, 0x9ded, 0x9def, 0x9dfd, 0x9e1a,
-		0x9e1b, 0x9e1e, 0x9e75, 0x9e79, 0x9e7d, 0x9e81, 0x9e88, 0x9e8b,
-		0x9e8c, 0x9e92, 0x9e95, 0x9e91, 0x9e9d, 0x9ea5, 0x9ea9, 0x9eb8,
-		0x9eaa, 0x9ead, 0x9761, 0x9ecc, 0x9ece, 0x9ecf, 0x9ed0, 0x9ed4,
-		0x9edc, 0x9ede, 0x9edd, 0x9ee0, 0x9ee5, 0x9ee8, 0x9eef, 0x9ef4,
-		0x9ef6, 0x9ef7, 0x9ef9, 0x9efb, 0x9efc, 0x9efd, 0x9f07, 0x9f08,
-		0x76b7, 0x9f15, 0x9f21, 0x9f2c, 0x9f3e, 0x9f4a, 0x9f52, 0x9f54,
-		0x9f63, 0x9f5f, 0x9f60, 0x9f61, 0x9f66, 0x9f67, 0x9f6c, 0x9f6a,
-		0x9f77, 0x9f72, 0x9f76, 0x9f95, 0x9f9c, 0x9fa0,
-	}, {
-		0x582f, 0x69c7, 0x9059, 0x7464, 0x51dc, 0x7199,
-	}, {
-		0x3402, 0x20158,0x4efd, 0x4eff, 0x4f9a, 0x4fc9, 0x509c, 0x511e,
-		0x51bc, 0x351f, 0x5307, 0x5361, 0x536c, 0x8a79, 0x20bb7,0x544d,
-		0x5496, 0x549c, 0x54a9, 0x550e, 0x554a, 0x5672, 0x56e4, 0x5733,
-		0x5734, 0xfa10, 0x5880, 0x59e4, 0x5a23, 0x5a55, 0x5bec, 0xfa11,
-		0x37e2, 0x5eac, 0x5f34, 0x5f45, 0x57b7, 0x6017, 0x0000, 0x6130,
-		0x6624, 0x66c8, 0x66d9, 0x66fa, 0x66fb, 0x0000, 0x0000, 0x6911,
-		0x693b, 0x6a45, 0x6a91, 0x6adb, 0x233cc,0x233fe,0x235c4,0x6bf1,
-		0x6ce0, 0x6d2e, 0xfa45, 0x6dbf, 0x6dca, 0x6df8, 0xfa46, 0x6f5e,
-		0x6ff9, 0x7064, 0x0000, 0x242ee,0x7147, 0x71c1, 0x7200, 0x739f,
-		0x73a8, 0x73c9, 0x73d6, 0x741b, 0x7421, 0xfa4a, 0x7426, 0x742a,
-		0x742c, 0x7439, 0x744b, 0x3eda, 0x7575, 0x7581, 0x7772, 0x4093,
-		0x78c8, 0x78e0, 0x7947, 0x79ae, 0x0000, 0x0000,
-	}, {
-		0x0000, 0x79da, 0x7a1e, 0x7b7f, 0x7c31, 0x4246, 0x7d8b, 0x7fa1,
-		0x8118, 0x813a, 0x0000, 0x82ae, 0x845b, 0x84dc, 0x84ec, 0x8559,
-		0x85ce, 0x8755, 0x87ec, 0x880b, 0x88f5, 0x89d2, 0x8af6, 0x8dce,
-		0x8fbb, 0x8ff6, 0x90dd, 0x9127, 0x912d, 0x91b2, 0x9233, 0x9288,
-		0x9321, 0x9348, 0x9592, 0x96de, 0x9903, 0x9940, 0x9ad9, 0x9bd6,
-		0x9dd7, 0x9eb4, 0x9eb5,
-	}, {
-	}, {
-	}, {
-	}, {
-		0x26cc, 0x26cd, 0x26ce, 0x26cf, 0x26d0, 0x26d1, 0x0000, 0x26d2,
-		0x26d5, 0x26d3, 0x26d4, 0x0000, 0x0000, 0x0000, 0x0000, 0x1f17f,
-		0x1f18a, 0x0000, 0x0000, 0x26d6, 0x26d7, 0x26d8, 0x26d9, 0x26da,
-		0x26db, 0x26dc, 0x26dd, 0x26de, 0x26df, 0x26e0, 0x26e1, 0x26e2,
-		0x3248, 0x3249, 0x324a, 0x324b, 0x324c, 0x324d, 0x324e, 0x324f,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x2491, 0x2492, 0x2493, 0x1f14a,
-		0x1f14c,0x1f13f,0x1f146,0x1f14b,0x1f220,0x1f211,0x1f212,0x1f213,
-		0x1f142,0x1f214,0x1f215,0x1f216,0x1f14d,0x1f131,0x1f13d,0x25a0,
-		0x25cf, 0x1f217,0x1f218,0x1f219,0x1f21a,0x1f21b,0x26bf, 0x1f21c,
-		0x1f21d,0x1f21e,0x1f21f,0x1f220,0x1f221,0x1f222,0x1f223,0x1f224,
-		0x1f225,0x1f14e,0x3299, 0x1f200,
-	}, {
-		0x26e3, 0x26e4, 0x26e5, 0x26e6, 0x26e7, 0x2613, 0x328b, 0x3012,
-		0x26e8, 0x3246, 0x3245, 0x26e9, 0x0fd6, 0x26ea, 0x26eb, 0x26ec,
-		0x2668, 0x26ed, 0x26ee, 0x26ef, 0x2693, 0x2708, 0x26f0, 0x26f1,
-		0x26f2, 0x26f3, 0x0000, 0x26f5, 0x1f157,0x24b9, 0x24c8, 0x26f6,
-		0x1f15f,0x1f18b,0x1f18d,0x1f18c,0x1f179,0x26f7, 0x26f8, 0x26f9,
-		0x26fa, 0x1f17b,0x260e, 0x26fb, 0x26fc, 0x26fd, 0x26fe, 0x1f17c,
-		0x26ff,
-	}, {
-		0x27a1, 0x2b05, 0x2b06, 0x2b07, 0x2b2f, 0x2b2e, 0x5e74, 0x6708,
-		0x65e5, 0x5186, 0x33a1, 0x33a5, 0x339d, 0x33a0, 0x33a4, 0x1f100,
-		0x2488, 0x2489, 0x248a, 0x248b, 0x248c, 0x248d, 0x248e, 0x248f,
-		0x2490, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x1f101,
-		0x1f102,0x1f103,0x1f104,0x1f105,0x1f106,0x1f107,0x1f108,0x1f109,
-		0x1f10a,0x3233, 0x3236, 0x3232, 0x3231, 0x3239, 0x3244, 0x25b6,
-		0x25c0, 0x3016, 0x3017, 0x27d0, 0x00b2, 0x00b3, 0x1f12d,0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
-		0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x1f12c,0x1f12b,0x3247,
-		0x1f14f,0x1f229,0x213b,
-	}, {
-		0x322a, 0x322b, 0x322c, 0x322d, 0x322e, 0x322f, 0x3230, 0x3237,
-		0x337e, 0x337d, 0x337c, 0x337b, 0x2116, 0x2121, 0x3036, 0x26be,
-		0x1f246,0x1f240,0x1f241,0x1f243,0x1f247,0x1f244,0x1f248,0x1f242,
-		0x1f245,0x1f12a,0x1f223,0x1f225,0x1f210,0x1f213,0x1f211,0x1f230,
-		0x1f21f,0x1f212,0x1f219,0x1f224,0x1f22f,0x1f222,0x2113, 0x338f,
-		0x3390, 0x33ca, 0x339e, 0x33a2, 0x3371, 0x0000, 0x0000, 0x00bd,
-		0x2189, 0x2153, 0x2154, 0x00bc, 0x00be, 0x2155, 0x2156, 0x2157,
-		0x2158, 0x2159, 0x215a, 0x2150, 0x0000, 0x2151, 0x2152, 0x2600,
-		0x2601, 0x2602, 0x26c4, 0x2616, 0x2617, 0x26c9, 0x26ca, 0x2666,
-		0x2665, 0x2663, 0x2660, 0x26cb, 0x2a00, 0x203c, 0x2049, 0x26c5,
-		0x2614, 0x26c6, 0x2603, 0x26c7, 0x26a1, 0x26c8, 0x0000, 0x269e,
-		0x269f, 0x266c, 0x260e,
-	}, {
-		0x2160, 0x2161, 0x2162, 0x2163, 0x2164, 0x2165, 0x2166, 0x2167,
-		0x2168, 0x2169, 0x216a, 0x216b, 0x2470, 0x2471, 0x2472, 0x2473,
-		0x2474, 0x2475, 0x2476, 0x2477, 0x2478, 0x2479, 0x247a, 0x247b,
-		0x247c, 0x247d, 0x247e, 0x247f, 0x3251, 0x3252, 0x3253, 0x3254,
-		0x1f110,0x1f111,0x1f112,0x1f113,0x1f114,0x1f115,0x1f116,0x1f117,
-		0x1f118,0x1f119,0x1f11a,0x1f11b,0x1f11c,0x1f11d,0x1f11e,0x1f11f,
-		0x1f120,0x1f121,0x1f122,0x1f123,0x1f124,0x1f125,0x1f126,0x1f127,
-		0x1f128,0x1f129,0x3255, 0x3256, 0x3257, 0x3258, 0x3259, 0x325a,
-		0x2460, 0x2461, 0x2462, 0x2463, 0x2464, 0x2465, 0x2466, 0x2467,
-		0x2468, 0x2469, 0x246a, 0x246b, 0x246c, 0x246d, 0x246e, 0x246f,
-		0x2776, 0x2777, 0x2778, 0x2779, 0x277a, 0x277b, 0x277c, 0x277d,
-		0x277e, 0x277f, 0x24eb, 0x24ec, 0x325b,
-	},
-};
+	int ku;
 
-static int decoder_handle_kanji(struct decoder *decoder, int c)
-{
-	int ku, ten;
-	int uc;
+	if (set != CHARSET_KANJI)
+		return decoder_put(decoder, &decoder_tables[set][c]);
 
 	ku = decoder->kanji_ku;
 	if (ku < 0) {
@@ -1253,30 +1618,23 @@ static int decoder_handle_kanji(struct decoder *decoder, int c)
 	}
 	decoder->kanji_ku = -1;
 
-	ten = c;
-
-	uc = decoder_kanji_table[ku][ten];
-	if (!uc) {
-		return 0;
-	}
-
-	return decoder_push(decoder, uc);
+	return decoder_put(decoder, &decoder_kanji_table[ku][c]);
 }
 
 static int decoder_handle_gl(struct decoder *decoder, int c)
 {
-	int (*handle)(struct decoder *, int);
+	int g;
 
 	if (c == 0x20 || c == 0x7f)
-		return decoder_push(decoder, c);
+		return decoder_put_ascii(decoder, c);
 
-	handle = decoder->handle_gl_single;
-	if (!handle)
-		handle = decoder->handle_gl;
-	else
-		decoder->handle_gl_single = NULL;
+	g = decoder->gl;
+	if (decoder->gl_single >= 0) {
+		g = decoder->gl_single;
+		decoder->gl_single = -1;
+	}
 
-	return handle(decoder, c - 0x21);
+	return decoder_handle(decoder, decoder->g[g], c - 0x21);
 }
 
 static int decoder_handle_gr(struct decoder *decoder, int c)
@@ -1284,57 +1642,55 @@ static int decoder_handle_gr(struct decoder *decoder, int c)
 	if (c == 0xa0 || c == 0xff)
 		return 0;
 
-	return decoder->handle_gr(decoder, c - 0xa1);
+	return decoder_handle(decoder, decoder->g[decoder->gr], c - 0xa1);
 }
 
 static int decoder_handle_esc(struct decoder *decoder)
 {
-	int c;
-	int (**handle)(struct decoder *, int);
+	int g = 0;
 
-	handle = &decoder->handle_g0;
-	while (decoder_pull(decoder, &c)) {
-		switch (c) {
+	while (decoder->buf < decoder->end) {
+		switch (*decoder->buf++) {
 		case 0x24:
 		case 0x28:
 			break;
 		case 0x29:
-			handle = &decoder->handle_g1;
+			g = 1;
 			break;
 		case 0x2a:
-			handle = &decoder->handle_g2;
+			g = 2;
 			break;
 		case 0x2b:
-			handle = &decoder->handle_g3;
+			g = 3;
 			break;
 		case 0x30:
-			*handle = decoder_handle_hiragana;
+			decoder->g[g] = CHARSET_HIRAGANA;
 			return 1;
 		case 0x31:
-			*handle = decoder_handle_katakana;
+			decoder->g[g] = CHARSET_KATAKANA;
 			return 1;
 		case 0x39:
 		case 0x3b:
 		case 0x42:
-			*handle = decoder_handle_kanji;
+			decoder->g[g] = CHARSET_KANJI;
 			return 1;
 		case 0x4a:
-			*handle = decoder_handle_alnum;
+			decoder->g[g] = CHARSET_ALNUM;
 			return 1;
 		case 0x6e:
-			decoder->handle_gl = decoder->handle_g2;
+			decoder->gl = 2;
 			return 1;
 		case 0x6f:
-			decoder->handle_gl = decoder->handle_g3;
+			decoder->gl = 3;
 			return 1;
 		case 0x7c:
-			decoder->handle_gr = decoder->handle_g3;
+			decoder->gr = 3;
 			return 1;
 		case 0x7d:
-			decoder->handle_gr = decoder->handle_g2;
+			decoder->gr = 2;
 			return 1;
 		case 0x7e:
-			decoder->handle_gr = decoder->handle_g1;
+			decoder->gr = 1;
 			return 1;
 		default:
 			return 0;
@@ -1347,20 +1703,20 @@ static int decoder_handle_c0(struct decoder *decoder, int c)
 {
 	switch (c) {
 	case 0x0d:
-		return decoder_push(decoder, 0x000d);
+		return decoder_put_ascii(decoder, 0x0d);
 	case 0x0e:
-		decoder->handle_gl = decoder->handle_g1;
+		decoder->gl = 1;
 		return 1;
 	case 0x0f:
-		decoder->handle_gl = decoder->handle_g0;
+		decoder->gl = 0;
 		return 1;
 	case 0x19:
-		decoder->handle_gl_single = decoder->handle_g2;
+		decoder->gl_single = 2;
 		return 1;
 	case 0x1b:
 		return decoder_handle_esc(decoder);
 	case 0x1d:
-		decoder->handle_gl_single = decoder->handle_g3;
+		decoder->gl_single = 3;
 		return 1;
 	default:
 		return 0;
@@ -1368,6 +1724,8 @@ static int decoder_handle_c0(struct decoder *decoder, int c)
 }
 
 static int decoder_handle_c1(struct decoder *decoder, int c) {
+	(void)decoder;
+
 	switch (c) {
 	case 0x88:
 	case 0x89:
@@ -1378,6 +1736,28 @@ static int decoder_handle_c1(struct decoder *decoder, int c) {
 	}
 }
 
+/* Copies a run of characters which are the same in ASCII, when the
+ * alphanumeric set is invoked in GL. Returns the number of bytes copied. */
+static size_t decoder_copy_ascii(struct decoder *decoder)
+{
+	const unsigned char *p = decoder->buf;
+	size_t n, max;
+
+	max = decoder->end - p;
+	if (max > (size_t)(decoder->uend - decoder->ubuf))
+		max = decoder->uend - decoder->ubuf;
+
+	for (n = 0; n < max; n++) {
+		if (p[n] < 0x20 || p[n] >= 0x7e || p[n] == 0x5c)
+			break;
+	}
+
+	memcpy(decoder->ubuf, p, n);
+	decoder->ubuf += n;
+	decoder->buf += n;
+	return n;
+}
+
 static void dump(const unsigned char *start, const unsigned char *end)
 {
 	fprintf(stderr, "could not decode ARIB string:\n");
@@ -1391,36 +1771,40 @@ int arib_str_decode(const unsigned char *buf, size_t count, char *ubuf,
 {
 	struct decoder decoder;
 	int c;
-	int (*handle)(struct decoder *, int);
+	int ret;
 
 	decoder.buf = buf;
-	decoder.count = count;
+	decoder.end = buf + count;
 	decoder.ubuf = ubuf;
-	decoder.ucount = ucount;
-	decoder.handle_gl = decoder_handle_kanji;
-	decoder.handle_gl_single = NULL;
-	decoder.handle_gr = decoder_handle_hiragana;
-	decoder.handle_g0 = decoder_handle_kanji;
-	decoder.handle_g1 = decoder_handle_alnum;
-	decoder.handle_g2 = decoder_handle_hiragana;
-	decoder.handle_g3 = decoder_handle_katakana;
+	decoder.uend = ubuf + ucount;
+	decoder.g[0] = CHARSET_KANJI;
+	decoder.g[1] = CHARSET_ALNUM;
+	decoder.g[2] = CHARSET_HIRAGANA;
+	decoder.g[3] = CHARSET_KATAKANA;
+	decoder.gl = 0;
+	decoder.gl_single = -1;
+	decoder.gr = 2;
 	decoder.kanji_ku = -1;
 
-	while (decoder_pull(&decoder, &c)) {
-		if (c < 0x20) {
-			handle = decoder_handle_c0;
-		} else if (c < 0x80) {
-			handle = decoder_handle_gl;
-		} else if (c < 0xa0) {
-			handle = decoder_handle_c1;
+	while (decoder.buf < decoder.end) {
+		if (decoder.g[decoder.gl] == CHARSET_ALNUM &&
+		    decoder.gl_single < 0 && decoder_copy_ascii(&decoder))
+			continue;
 
-		} else {
-			handle = decoder_handle_gr;
-		}
-		if (!handle(&decoder, c)) {
+		c = *decoder.buf++;
+		if (c < 0x20)
+			ret = decoder_handle_c0(&decoder, c);
+		else if (c < 0x80)
+			ret = decoder_handle_gl(&decoder, c);
+		else if (c < 0xa0)
+			ret = decoder_handle_c1(&decoder, c);
+		else
+			ret = decoder_handle_gr(&decoder, c);
+
+		if (!ret) {
 			dump(buf, decoder.buf);
 			break;
 		}
 	}
-	return ucount - decoder.ucount;
+	return decoder.ubuf - ubuf;
 }
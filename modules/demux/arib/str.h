@@ -1,5 +1,10 @@
 #ifndef ARIB_STR_H
 #define ARIB_STR_H
+/* Upper bound of the UTF-8 output for count bytes of ARIB string */
+#define ARIB_STR_MAX(count) ((count) * 3)
+
+/* Decodes into the caller buffer, which is not NUL-terminated, and returns
+ * the number of bytes written */
 extern int arib_str_decode(const unsigned char *buf, size_t count,
 			   char *ubuf, int ucount);
 #endif
@@ -37,6 +37,7 @@
 
 #include <vlc_access.h>    /* DVB-specific things */
 #include <vlc_demux.h>
+#include <vlc_input.h>     /* b_preparsing */
 #include <vlc_meta.h>
 #include <vlc_epg.h>
 #include <vlc_charset.h>   /* FromCharset, for EIT */
@@ -60,6 +61,9 @@
 # include <dvbpsi/tot.h>
 
 #include "../mux/mpeg/dvbpsi_compat.h"
+#include "ts_index.h"
+#include "ts_sync.h"
+#include "ts_rs.h"
 
 #undef TS_DEBUG
 VLC_FORMAT(1, 2) static void ts_debug(const char *format, ...)
@@ -78,6 +82,8 @@ VLC_FORMAT(1, 2) static void ts_debug(const char *format, ...)
 #  include <dvbpsi/cat.h>
 #  include "arib/b_cas_card.h"
 #  include "arib/multi2.h"
+#  include "arib/cas_worker.h"
+#  include "arib/recorder.h"
 #  include "arib/str.h"
 #endif
 
@@ -127,6 +133,18 @@ static void Close ( vlc_object_t * );
     "The decryption routines subtract the TS-header from the value before " \
     "decrypting. " )
 
+#define RS_CORRECT_TEXT N_("Reed-Solomon error correction")
+#define RS_CORRECT_LONGTEXT N_( \
+    "Repair 204 bytes packets with their 16 parity bytes, and flag those " \
+    "beyond repair as corrupted. This is turned off by itself when the " \
+    "parity does not match the packets, as it does not on DVB streams." )
+
+#define SPLIT_PROGRAMS_TEXT N_("Demultiplex programs in parallel")
+#define SPLIT_PROGRAMS_LONGTEXT N_( \
+    "Assemble and descramble the packets of each program in a thread of " \
+    "its own, so that a whole multiplex can be streamed out using all the " \
+    "processors." )
+
 #define SPLIT_ES_TEXT N_("Separate sub-streams")
 #define SPLIT_ES_LONGTEXT N_( \
     "Separate teletex/dvbs pages into independent ES. " \
@@ -137,9 +155,41 @@ static void Close ( vlc_object_t * );
     "Seek and position based on a percent byte position, not a PCR generated " \
     "time position. If seeking doesn't work property, turn on this option." )
 
+#define SEEK_INDEX_TEXT N_("Seek index")
+#define SEEK_INDEX_LONGTEXT N_( \
+    "Index the PCR and the video random access points of local files in " \
+    "the background, and keep the index in the user cache directory, " \
+    "so that seeking needs a single read once the file is indexed. " \
+    "Files are not indexed while preparsed, and the oldest indexes are " \
+    "removed once the directory grows too large." )
+
+#define EPG_CACHE_TEXT N_("Keep the program guide")
+#define EPG_CACHE_LONGTEXT N_( \
+    "Keep the program guide of digital TV receivers in the user cache " \
+    "directory, so that it is complete as soon as the service description " \
+    "table of the transport stream is received again." )
+
 #define PCR_TEXT N_("Trust in-stream PCR")
 #define PCR_LONGTEXT N_("Use the stream PCR as a reference.")
 
+#ifdef HAVE_ARIB
+#define ARIB_ALL_TEXT N_("Descramble all ARIB programs")
+#define ARIB_ALL_LONGTEXT N_( \
+    "By default only the selected programs are descrambled and have their " \
+    "ECMs sent to the B-CAS card, the other programs are passed through " \
+    "untouched. Enable this to descramble the whole multiplex." )
+
+#define ARIB_RECORD_TEXT N_("Record descrambled ARIB streams")
+#define ARIB_RECORD_LONGTEXT N_( \
+    "When a B-CAS card is available, record the transport stream once " \
+    "descrambled by the demuxer instead of the raw input, so that the " \
+    "recording can be played back without the card." )
+
+#define ARIB_RECORD_CAS_TEXT N_("Drop ECM/EMM from ARIB recordings")
+#define ARIB_RECORD_CAS_LONGTEXT N_( \
+    "Do not store the ECM and EMM packets in descrambled recordings." )
+#endif
+
 vlc_module_begin ()
     set_description( N_("MPEG Transport Stream demuxer") )
     set_shortname ( "MPEG-TS" )
@@ -161,7 +211,21 @@ vlc_module_begin ()
         change_safe()
 
     add_bool( "ts-split-es", true, SPLIT_ES_TEXT, SPLIT_ES_LONGTEXT, false )
+    add_bool( "ts-rs-correct", true, RS_CORRECT_TEXT, RS_CORRECT_LONGTEXT,
+              true )
+    add_bool( "ts-split-programs", false, SPLIT_PROGRAMS_TEXT,
+              SPLIT_PROGRAMS_LONGTEXT, true )
     add_bool( "ts-seek-percent", false, SEEK_PERCENT_TEXT, SEEK_PERCENT_LONGTEXT, true )
+    add_bool( "ts-seek-index", true, SEEK_INDEX_TEXT, SEEK_INDEX_LONGTEXT, true )
+    add_bool( "ts-epg-cache", true, EPG_CACHE_TEXT, EPG_CACHE_LONGTEXT, true )
+#ifdef HAVE_ARIB
+    add_bool( "ts-arib-descramble-all", false, ARIB_ALL_TEXT,
+              ARIB_ALL_LONGTEXT, true )
+    add_bool( "ts-arib-record-descrambled", true, ARIB_RECORD_TEXT,
+              ARIB_RECORD_LONGTEXT, true )
+    add_bool( "ts-arib-record-drop-cas", false, ARIB_RECORD_CAS_TEXT,
+              ARIB_RECORD_CAS_LONGTEXT, true )
+#endif
 
     add_obsolete_bool( "ts-silent" );
 
@@ -222,6 +286,7 @@ typedef struct
     int             i_pid_pmt;
 #ifdef HAVE_ARIB
     int             i_pid_ecm;
+    bool            b_arib_selected; /* descramble this program */
 #endif
     mtime_t         i_pcr_value;
     /* IOD stuff (mpeg4) */
@@ -247,6 +312,14 @@ typedef struct
 
 #ifdef HAVE_ARIB
     MULTI2          *arib_descrambler;
+    bool            b_arib_selected; /* used by a descrambled program */
+    /* Keys come back from the card asynchronously, a new one is only
+     * installed once the stream switches to the other key half */
+    int             i_arib_parity;
+    bool            b_arib_key;
+    bool            b_arib_key_pending;
+    uint8_t         arib_key[16];
+    uint8_t         arib_key_pending[16];
 #endif
 } ts_psi_t;
 
@@ -267,15 +340,18 @@ typedef struct
     es_format_t  fmt;
     es_out_id_t *id;
     ts_es_data_type_t data_type;
-    int         i_data_size;
-    int         i_data_gathered;
+    /* The unit being gathered is written in a single block */
     block_t     *p_data;
-    block_t     **pp_last;
+    int         i_data_size;    /* expected size, 0 if unknown */
+    int         i_data_alloc;   /* room in p_data */
+    int         i_data_hint;    /* size of the previous unit */
 
     es_mpeg4_descriptor_t *p_mpeg4desc;
 
 } ts_es_t;
 
+typedef struct ts_split_worker_t ts_split_worker_t;
+
 typedef struct
 {
     int         i_pid;
@@ -284,6 +360,7 @@ typedef struct
     bool        b_valid;
     int         i_cc;   /* countinuity counter */
     bool        b_scrambled;
+    bool        b_filtered; /* selected at access level */
 
     /* PSI owner (ie PMT -> PAT, ES -> PMT */
     ts_psi_t   *p_owner;
@@ -297,8 +374,76 @@ typedef struct
     ts_es_t     **extra_es;
     int         i_extra_es;
 
+    /* Thread its packets are handed to, NULL for the input thread */
+    ts_split_worker_t *p_worker;
+
 } ts_pid_t;
 
+/* What Demux() does with the packets of a PID, derived from its ts_pid_t
+ * and kept in a compact table so that the hot loop does not have to walk
+ * the large ts_pid_t entries. The PAT, CAT and PMT callbacks reset it to
+ * TS_PID_HOT_STALE when a new version changes the PID layout. */
+enum
+{
+    TS_PID_HOT_STALE = 0,   /* to be derived again */
+    TS_PID_HOT_UNKNOWN,     /* not declared, only PCR is looked at */
+    TS_PID_HOT_PCR,         /* ES without output, only PCR is looked at */
+    TS_PID_HOT_ES,          /* gathered */
+    TS_PID_HOT_PSI,         /* pushed to its own decoder */
+    TS_PID_HOT_PSI_PRG,     /* pushed to the PMT decoder of each program */
+};
+
+#ifdef HAVE_ARIB
+/* Scrambled payloads are queued until their content is needed, so that
+ * MULTI2 can descramble many of them in one pass */
+#define TS_ARIB_BATCH_MAX 64
+
+typedef struct
+{
+    MULTI2      *descrambler;
+    int         i_type;
+    uint8_t     *p_buffer;
+    int32_t     i_buffer;
+    uint8_t     *p_record;  /* recorded copy of the packet, or NULL */
+} arib_payload_t;
+
+/* Payloads queued by one thread */
+typedef struct
+{
+    int             i_batch;
+    arib_payload_t  batch[TS_ARIB_BATCH_MAX];
+} arib_queue_t;
+#endif
+
+/* With ts-split-programs, the ES and PCR packets of each program are copied
+ * by the input thread into batches for a worker thread, which gathers and
+ * sends them. The input thread keeps the PSI, and waits for the workers to
+ * be done with what it handed them before it changes the PID layout. */
+#define TS_SPLIT_MAX 16
+#define TS_SPLIT_PACKETS 128
+#define TS_SPLIT_READ 1024  /* packets per Demux() call */
+
+struct ts_split_worker_t
+{
+    demux_t       *p_demux;
+    vlc_thread_t  thread;
+    block_fifo_t  *p_fifo;
+    block_t       *p_batch;     /* being filled by the input thread */
+    int           i_key;        /* program, or ECM PID of its programs */
+#ifdef HAVE_ARIB
+    arib_queue_t  arib_queue;
+#endif
+};
+
+/* A section of the EIT or SDT, as last received */
+typedef struct
+{
+    uint32_t    i_key;      /* table_id, extension, section_number, 0 if free */
+    uint32_t    i_crc;
+    uint8_t     i_version;
+    bool        b_decoded;  /* its table was sent since */
+} ts_section_t;
+
 struct demux_sys_t
 {
     vlc_mutex_t     csa_lock;
@@ -312,6 +457,20 @@ struct demux_sys_t
     /* how many TS packet we read at once */
     int         i_ts_read;
 
+    /* packets read in bulk by NextTSPacket(), consumed in place */
+    block_t     *p_packets;
+
+    /* losses of sync */
+    unsigned    i_sync_lost;
+    uint64_t    i_sync_skipped; /* bytes */
+    mtime_t     i_sync_lost_time;
+
+    /* Reed-Solomon correction of 204 bytes packets */
+    ts_rs_t     *p_rs;
+    uint64_t    i_rs_packets;
+    uint64_t    i_rs_corrected;
+    uint64_t    i_rs_uncorrectable;
+
     /* to determine length and time */
     int         i_pid_ref_pcr;
     mtime_t     i_first_pcr;
@@ -321,9 +480,11 @@ struct demux_sys_t
     int         i_pcrs_num;
     mtime_t     *p_pcrs;
     int64_t     *p_pos;
+    ts_index_t  *p_index;
 
     /* All pid */
     ts_pid_t    pid[8192];
+    uint8_t     pid_hot[8192];
 
     /* All PMT */
     bool        b_user_pmt;
@@ -349,6 +510,19 @@ struct demux_sys_t
     int64_t     i_dvb_length;
     bool        b_broken_charset; /* True if broken encoding is used in EPG/SDT */
 
+    /* EIT/SDT sections seen, unchanged ones are not decoded again */
+    ts_section_t *p_sections;
+    int         i_sections;
+    int         i_sections_mask;  /* size of p_sections minus one */
+    unsigned    i_sections_decoded;
+    unsigned    i_sections_skipped;
+
+    /* EPG kept across sessions, live streams only */
+    bool        b_epg_cache;
+    vlc_epg_cache_t *p_epg_cache;
+    uint16_t    i_epg_cache_network_id;
+    uint16_t    i_epg_cache_ts_id;
+
     /* */
     int         i_current_program;
     vlc_list_t  programs_list;
@@ -356,9 +530,27 @@ struct demux_sys_t
     /* */
     bool        b_start_record;
 
+    /* Program worker threads */
+    bool        b_split_programs;
+    int         i_split;
+    int         i_split_max;
+    ts_split_worker_t *split[TS_SPLIT_MAX];
+    vlc_mutex_t split_lock;
+    vlc_cond_t  split_wait;
+    unsigned    i_split_pending; /* batches not done yet */
+
 #ifdef HAVE_ARIB
-    B_CAS_CARD  *arib_card;
+    cas_worker_t *arib_cas;
     int         i_pid_emm;
+    bool        b_arib_descramble_all;
+
+    /* Descrambled recording */
+    bool            b_arib_record;
+    bool            b_arib_record_drop_cas;
+    arib_recorder_t *p_arib_record;
+    uint8_t         *p_arib_record_pkt; /* copy of the current packet */
+
+    arib_queue_t    arib_queue; /* of the input thread */
 #endif
 };
 
@@ -392,6 +584,7 @@ static void EMMCallBack( dvbpsi_t *handle, dvbpsi_psi_section_t *p_section);
 #if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
 static void PSINewTableCallBack( dvbpsi_t *handle, uint8_t  i_table_id,
                                  uint16_t i_extension, demux_t * );
+static void PSISectionGather( dvbpsi_t *handle, dvbpsi_psi_section_t * );
 #else
 static void PSINewTableCallBack( demux_t *, dvbpsi_handle,
                                  uint8_t  i_table_id, uint16_t i_extension );
@@ -399,19 +592,38 @@ static void PSINewTableCallBack( demux_t *, dvbpsi_handle,
 
 static int ChangeKeyCallback( vlc_object_t *, char const *, vlc_value_t, vlc_value_t, void * );
 
-static inline int PIDGet( block_t *p )
+static inline int PIDGet( const uint8_t *p )
 {
-    return ( (p->p_buffer[1]&0x1f)<<8 )|p->p_buffer[2];
+    return ( (p[1]&0x1f)<<8 )|p[2];
 }
 
-static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk );
+static bool GatherData( demux_t *p_demux, ts_pid_t *pid, uint8_t *p );
+
+static void SplitAssign( demux_t *p_demux, ts_pid_t *pid );
+static void SplitQueue( demux_sys_t *p_sys, ts_split_worker_t *p_worker,
+                        const uint8_t *p_pkt );
+static void SplitFlush( demux_sys_t *p_sys );
+static void SplitDrain( demux_sys_t *p_sys );
+static void SplitReset( demux_sys_t *p_sys );
+static void SplitStop( demux_sys_t *p_sys );
+#ifdef HAVE_ARIB
+static void ARIBFlushPayloads( arib_queue_t *p_queue );
+static arib_queue_t *ARIBQueue( demux_sys_t *p_sys, const ts_pid_t *pid );
+static void ARIBPollKeys( demux_sys_t *p_sys );
+static void ARIBUpdateSelection( demux_t *p_demux );
+static void ARIBRecordPacket( demux_sys_t *p_sys, const ts_pid_t *p_pid,
+                              const uint8_t *p_packet );
+#endif
 
 static block_t* ReadTSPacket( demux_t *p_demux );
+static uint8_t *NextTSPacket( demux_t *p_demux );
+static void DropTSPackets( demux_t *p_demux );
+static int64_t TellTS( demux_t *p_demux );
 static int Seek( demux_t *p_demux, double f_percent );
 static void GetFirstPCR( demux_t *p_demux );
 static void GetLastPCR( demux_t *p_demux );
 static void CheckPCR( demux_t *p_demux );
-static void PCRHandle( demux_t *p_demux, ts_pid_t *, block_t * );
+static void PCRHandle( demux_t *p_demux, ts_pid_t *, const uint8_t * );
 
 static void              IODFree( iod_descriptor_t * );
 
@@ -420,6 +632,7 @@ static int UserPmt( demux_t *p_demux, const char * );
 
 static int  SetPIDFilter( demux_t *, int i_pid, bool b_selected );
 static void SetPrgFilter( demux_t *, int i_prg, bool b_selected );
+static bool ProgramIsSelected( demux_t *p_demux, uint16_t i_pgrm );
 
 #define TS_PACKET_SIZE_188 188
 #define TS_PACKET_SIZE_192 192
@@ -513,40 +726,21 @@ static int DetectPacketSize( demux_t *p_demux, int *pi_header_size )
         return TS_PACKET_SIZE_188;
     }
 
-    for( int i_sync = 0; i_sync < TS_PACKET_SIZE_MAX; i_sync++ )
+    /* 4 sync bytes in a row, the first one within the first packet */
+    static const unsigned pi_size[] = {
+        TS_PACKET_SIZE_188, TS_PACKET_SIZE_192, TS_PACKET_SIZE_204 };
+    unsigned i_found;
+    const int i_peek_sync = stream_Peek( p_demux->s, &p_peek,
+                                         TS_PACKET_SIZE_MAX * 4 );
+    const int i_first = ts_sync_Find( p_peek, __MAX( i_peek_sync, 0 ),
+                                      TS_PACKET_SIZE_MAX, pi_size, 3, 4,
+                                      &i_found );
+    if( i_first >= 0 )
     {
-        if( p_peek[i_sync] != 0x47 )
-            continue;
-
-        /* Check next 3 sync bytes */
-        int i_peek = TS_PACKET_SIZE_MAX * 3 + i_sync + 1;
-        if( ( stream_Peek( p_demux->s, &p_peek, i_peek ) ) < i_peek )
-        {
-            msg_Err( p_demux, "cannot peek" );
-            return -1;
-        }
-        if( p_peek[i_sync + 1 * TS_PACKET_SIZE_188] == 0x47 &&
-            p_peek[i_sync + 2 * TS_PACKET_SIZE_188] == 0x47 &&
-            p_peek[i_sync + 3 * TS_PACKET_SIZE_188] == 0x47 )
-        {
-            return TS_PACKET_SIZE_188;
-        }
-        else if( p_peek[i_sync + 1 * TS_PACKET_SIZE_192] == 0x47 &&
-                 p_peek[i_sync + 2 * TS_PACKET_SIZE_192] == 0x47 &&
-                 p_peek[i_sync + 3 * TS_PACKET_SIZE_192] == 0x47 )
-        {
-            if( i_sync == 4 )
-            {
-                *pi_header_size = 4; /* BluRay TS packets have 4-byte header */
-            }
-            return TS_PACKET_SIZE_192;
-        }
-        else if( p_peek[i_sync + 1 * TS_PACKET_SIZE_204] == 0x47 &&
-                 p_peek[i_sync + 2 * TS_PACKET_SIZE_204] == 0x47 &&
-                 p_peek[i_sync + 3 * TS_PACKET_SIZE_204] == 0x47 )
-        {
-            return TS_PACKET_SIZE_204;
-        }
+        /* BluRay TS packets have 4-byte header */
+        if( pi_size[i_found] == TS_PACKET_SIZE_192 && i_first == 4 )
+            *pi_header_size = 4;
+        return pi_size[i_found];
     }
 
     if( p_demux->b_force )
@@ -615,6 +809,16 @@ static void vlc_dvbpsi_reset( demux_t *p_demux )
 }
 #endif
 
+/* Whether the stream comes from a digital TV receiver, the only source whose
+ * program guide is worth keeping across sessions */
+static bool IsTuner( demux_t *p_demux )
+{
+    bool b_tuner;
+
+    return stream_Control( p_demux->s, STREAM_IS_TUNER, &b_tuner ) == VLC_SUCCESS
+        && b_tuner;
+}
+
 /*****************************************************************************
  * Open
  *****************************************************************************/
@@ -655,6 +859,13 @@ static int Open( vlc_object_t *p_this )
     p_sys->i_dvb_length = 0;
 
     p_sys->b_broken_charset = false;
+    p_sys->p_sections = NULL;
+    p_sys->i_sections = 0;
+    p_sys->i_sections_mask = 0;
+    p_sys->i_sections_decoded = 0;
+    p_sys->i_sections_skipped = 0;
+    p_sys->b_epg_cache = false;
+    p_sys->p_epg_cache = NULL;
 
     for( int i = 0; i < 8192; i++ )
     {
@@ -662,29 +873,29 @@ static int Open( vlc_object_t *p_this )
         pid->i_pid      = i;
         pid->b_seen     = false;
         pid->b_valid    = false;
+        pid->b_filtered = false;
+        pid->p_worker   = NULL;
     }
     /* PID 8191 is padding */
     p_sys->pid[8191].b_seen = true;
     p_sys->i_packet_size = i_packet_size;
     p_sys->i_packet_header_size = i_packet_header_size;
     p_sys->i_ts_read = 50;
+    p_sys->p_packets = NULL;
+    p_sys->i_sync_lost = 0;
+    p_sys->i_sync_skipped = 0;
+    p_sys->i_sync_lost_time = 0;
+    p_sys->p_rs = NULL;
+    p_sys->i_rs_packets = 0;
+    p_sys->i_rs_corrected = 0;
+    p_sys->i_rs_uncorrectable = 0;
     p_sys->csa = NULL;
     p_sys->b_start_record = false;
 
 #ifdef HAVE_ARIB
-    p_sys->arib_card = create_b_cas_card();
-    if( p_sys->arib_card )
-    {
-        if( p_sys->arib_card->init( p_sys->arib_card ) < 0 )
-        {
-            p_sys->arib_card->release( p_sys->arib_card );
-            p_sys->arib_card = NULL;
-        }
-    }
-    if( p_sys->arib_card ) {
-        msg_Info( p_demux, "ARIB card detected" );
-    }
+    p_sys->arib_cas = NULL;
     p_sys->i_pid_emm = -1;
+    p_sys->arib_queue.i_batch = 0;
 #endif
 #if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
 # define VLC_DVBPSI_DEMUX_TABLE_INIT(table,obj) \
@@ -728,28 +939,6 @@ static int Open( vlc_object_t *p_this )
     }
 #else
     pat->psi->handle = dvbpsi_AttachPAT( PATCallBack, p_demux );
-#endif
-#ifdef HAVE_ARIB
-    if( p_sys->arib_card )
-    {
-        cat = &p_sys->pid[1];
-        PIDInit( cat, true, NULL );
-	cat->psi->handle = dvbpsi_new( &dvbpsi_messages, DVBPSI_MSG_DEBUG );
-	if( !cat->psi->handle )
-	{
-	    vlc_mutex_destroy( &p_sys->csa_lock );
-	    free( p_sys );
-	    return VLC_ENOMEM;
-	}
-	cat->psi->handle->p_sys = (void *) p_demux;
-        if ( !dvbpsi_cat_attach( cat->psi->handle, CATCallBack, p_demux ) )
-	{
-	    vlc_dvbpsi_reset( p_demux );
-	    vlc_mutex_destroy( &p_sys->csa_lock );
-	    free( p_sys );
-	    return VLC_EGENERIC;
-	}
-    }
 #endif
     if( p_sys->b_dvb_meta )
     {
@@ -759,6 +948,7 @@ static int Open( vlc_object_t *p_this )
         PIDInit( sdt, true, NULL );
 #if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
         VLC_DVBPSI_DEMUX_TABLE_INIT( sdt, p_demux )
+        sdt->psi->handle->p_decoder->pf_gather = PSISectionGather;
 #else
         sdt->psi->handle =
             dvbpsi_AttachDemux( (dvbpsi_demux_new_cb_t)PSINewTableCallBack,
@@ -767,6 +957,7 @@ static int Open( vlc_object_t *p_this )
         PIDInit( eit, true, NULL );
 #if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
         VLC_DVBPSI_DEMUX_TABLE_INIT( eit, p_demux )
+        eit->psi->handle->p_decoder->pf_gather = PSISectionGather;
 #else
         eit->psi->handle =
             dvbpsi_AttachDemux( (dvbpsi_demux_new_cb_t)PSINewTableCallBack,
@@ -795,6 +986,37 @@ static int Open( vlc_object_t *p_this )
 # undef VLC_DVBPSI_DEMUX_TABLE_INIT
 #endif
 
+#ifdef HAVE_ARIB
+    /* The card is shared with the other demuxers of the process */
+    p_sys->arib_cas = cas_worker_New( VLC_OBJECT(p_demux) );
+    if( p_sys->arib_cas )
+    {
+        msg_Info( p_demux, "ARIB card detected" );
+
+        cat = &p_sys->pid[1];
+        PIDInit( cat, true, NULL );
+	cat->psi->handle = dvbpsi_new( &dvbpsi_messages, DVBPSI_MSG_DEBUG );
+	if( !cat->psi->handle )
+	{
+	    cas_worker_Delete( p_sys->arib_cas );
+	    vlc_mutex_destroy( &p_sys->csa_lock );
+	    free( p_sys );
+	    return VLC_ENOMEM;
+	}
+	cat->psi->handle->p_sys = (void *) p_demux;
+        if ( !dvbpsi_cat_attach( cat->psi->handle, CATCallBack, p_demux ) )
+	{
+	    vlc_dvbpsi_reset( p_demux );
+	    cas_worker_Delete( p_sys->arib_cas );
+	    vlc_mutex_destroy( &p_sys->csa_lock );
+	    free( p_sys );
+	    return VLC_EGENERIC;
+	}
+        /* The CAT leads to the EMM */
+        SetPIDFilter( p_demux, 1, true );
+    }
+#endif
+
     /* Init PMT array */
     TAB_INIT( p_sys->i_pmt, p_sys->pmt );
     p_sys->i_pmt_es = 0;
@@ -804,6 +1026,17 @@ static int Open( vlc_object_t *p_this )
 
     p_sys->b_trust_pcr = var_CreateGetBool( p_demux, "ts-trust-pcr" );
 
+#ifdef HAVE_ARIB
+    p_sys->b_arib_descramble_all =
+        var_CreateGetBool( p_demux, "ts-arib-descramble-all" );
+    p_sys->b_arib_record =
+        var_CreateGetBool( p_demux, "ts-arib-record-descrambled" );
+    p_sys->b_arib_record_drop_cas =
+        var_CreateGetBool( p_demux, "ts-arib-record-drop-cas" );
+    p_sys->p_arib_record = NULL;
+    p_sys->p_arib_record_pkt = NULL;
+#endif
+
     /* We handle description of an extra PMT */
     char* psz_string = var_CreateGetString( p_demux, "ts-extra-pmt" );
     p_sys->b_user_pmt = false;
@@ -860,6 +1093,18 @@ static int Open( vlc_object_t *p_this )
 
     p_sys->b_split_es = var_InheritBool( p_demux, "ts-split-es" );
 
+    if( p_sys->i_packet_size == TS_PACKET_SIZE_204 &&
+        var_InheritBool( p_demux, "ts-rs-correct" ) )
+        p_sys->p_rs = ts_rs_New();
+
+    vlc_mutex_init( &p_sys->split_lock );
+    vlc_cond_init( &p_sys->split_wait );
+    p_sys->i_split = 0;
+    p_sys->i_split_max = __MIN( vlc_GetCPUCount(), TS_SPLIT_MAX );
+    p_sys->i_split_pending = 0;
+    p_sys->b_split_programs = p_sys->i_split_max > 1 &&
+                              var_InheritBool( p_demux, "ts-split-programs" );
+
     p_sys->i_pid_ref_pcr = -1;
     p_sys->i_first_pcr = -1;
     p_sys->i_current_pcr = -1;
@@ -888,12 +1133,39 @@ static int Open( vlc_object_t *p_this )
         msg_Dbg( p_demux, "Force Seek Per Percent: PCR's not found,");
         p_sys->b_force_seek_per_percent = true;
     }
+    p_sys->b_epg_cache = IsTuner( p_demux ) &&
+                         var_InheritBool( p_demux, "ts-epg-cache" );
 
     while( p_sys->i_pmt_es <= 0 && vlc_object_alive( p_demux ) )
     {
         if( Demux( p_demux ) != 1 )
             break;
     }
+
+    /* Preparsing only needs the ES, not a background pass over the file */
+    input_thread_t *p_input = demux_GetParentInput( p_demux );
+    const bool b_preparsing = p_input && p_input->b_preparsing;
+    if( p_input )
+        vlc_object_release( p_input );
+
+    /* The video PIDs are known once the PMT have been parsed */
+    if( can_seek && !p_sys->b_force_seek_per_percent && !b_preparsing &&
+        var_InheritBool( p_demux, "ts-seek-index" ) )
+    {
+        uint16_t pi_video_pid[16];
+        int i_video_pid = 0;
+
+        for( int i = 0; i < 8192 && i_video_pid < 16; i++ )
+        {
+            const ts_pid_t *pid = &p_sys->pid[i];
+            if( pid->b_valid && pid->es && pid->es->fmt.i_cat == VIDEO_ES )
+                pi_video_pid[i_video_pid++] = i;
+        }
+        p_sys->p_index = ts_index_New( p_demux, p_sys->i_packet_size,
+                                       p_sys->i_packet_header_size,
+                                       p_sys->i_pid_ref_pcr,
+                                       pi_video_pid, i_video_pid );
+    }
     return VLC_SUCCESS;
 }
 
@@ -905,6 +1177,8 @@ static void Close( vlc_object_t *p_this )
     demux_t     *p_demux = (demux_t*)p_this;
     demux_sys_t *p_sys = p_demux->p_sys;
 
+    SplitStop( p_sys );
+
     msg_Dbg( p_demux, "pid list:" );
     for( int i = 0; i < 8192; i++ )
     {
@@ -980,14 +1254,40 @@ static void Close( vlc_object_t *p_this )
 
     free( p_sys->programs_list.p_values );
 
+    if( p_sys->i_sync_lost > 0 )
+        msg_Dbg( p_demux, "sync lost %u times: %"PRIu64" bytes skipped, "
+                 "%"PRId64" ms without sync", p_sys->i_sync_lost,
+                 p_sys->i_sync_skipped, p_sys->i_sync_lost_time / 1000 );
+    if( p_sys->i_rs_corrected > 0 || p_sys->i_rs_uncorrectable > 0 )
+        msg_Dbg( p_demux, "Reed-Solomon: %"PRIu64" packets, %"PRIu64
+                 " corrected, %"PRIu64" uncorrectable", p_sys->i_rs_packets,
+                 p_sys->i_rs_corrected, p_sys->i_rs_uncorrectable );
+    if( p_sys->p_rs )
+        ts_rs_Delete( p_sys->p_rs );
+    if( p_sys->i_sections_decoded > 0 )
+        msg_Dbg( p_demux, "EIT/SDT sections: %u decoded, %u unchanged skipped",
+                 p_sys->i_sections_decoded, p_sys->i_sections_skipped );
+    free( p_sys->p_sections );
+    if( p_sys->p_epg_cache )
+        vlc_epg_cache_Close( p_sys->p_epg_cache );
+
+    if( p_sys->p_index )
+        ts_index_Delete( p_sys->p_index );
     free( p_sys->p_pcrs );
     free( p_sys->p_pos );
 
+    if( p_sys->p_packets )
+        block_Release( p_sys->p_packets );
+
 #ifdef HAVE_ARIB
-    if( p_sys->arib_card )
-        p_sys->arib_card->release( p_sys->arib_card );
+    if( p_sys->p_arib_record )
+        arib_recorder_Delete( p_sys->p_arib_record );
+    if( p_sys->arib_cas )
+        cas_worker_Delete( p_sys->arib_cas );
 #endif
 
+    vlc_cond_destroy( &p_sys->split_wait );
+    vlc_mutex_destroy( &p_sys->split_lock );
     vlc_mutex_destroy( &p_sys->csa_lock );
     free( p_sys );
 }
@@ -1014,6 +1314,44 @@ static int ChangeKeyCallback( vlc_object_t *p_this, char const *psz_cmd,
     return i_tmp;
 }
 
+/* Derives what Demux() does with the packets of a PID */
+static uint8_t PIDClassify( demux_t *p_demux, ts_pid_t *p_pid )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const int i_pid = p_pid->i_pid;
+
+    if( !p_pid->b_valid )
+    {
+        if( !p_pid->b_seen )
+            msg_Dbg( p_demux, "pid[%d] unknown", i_pid );
+        p_pid->b_seen = true;
+        return TS_PID_HOT_UNKNOWN;
+    }
+    p_pid->b_seen = true;
+
+    if( !p_pid->psi )
+        return p_pid->es->id ? TS_PID_HOT_ES : TS_PID_HOT_PCR;
+
+#ifdef HAVE_ARIB
+    if( i_pid == 0 || ( p_sys->arib_cas && i_pid == 1 ) ||
+        ( p_sys->b_dvb_meta && (i_pid == 0x11 || i_pid == 0x12 ||
+                                i_pid == 0x14) ) ||
+        p_pid->psi->arib_descrambler || i_pid == p_sys->i_pid_emm )
+        return TS_PID_HOT_PSI;
+#else
+    if( i_pid == 0 ||
+        ( p_sys->b_dvb_meta && ( i_pid == 0x11 || i_pid == 0x12 || i_pid == 0x14 ) ) )
+        return TS_PID_HOT_PSI;
+#endif
+    return TS_PID_HOT_PSI_PRG;
+}
+
+/* The PID layout changed, Demux() derives again what to do with each PID */
+static void PIDHotReset( demux_sys_t *p_sys )
+{
+    memset( p_sys->pid_hot, TS_PID_HOT_STALE, sizeof(p_sys->pid_hot) );
+}
+
 /*****************************************************************************
  * Demux:
  *****************************************************************************/
@@ -1022,79 +1360,332 @@ static int Demux( demux_t *p_demux )
     demux_sys_t *p_sys = p_demux->p_sys;
     bool b_wait_es = p_sys->i_pmt_es <= 0;
 
+#ifdef HAVE_ARIB
+    ARIBPollKeys( p_sys );
+#endif
+
+    /* The frames of the programs handed to workers are completed there */
+    const int i_read = p_sys->i_split > 0 ? TS_SPLIT_READ : p_sys->i_ts_read;
+
     /* We read at most 100 TS packet or until a frame is completed */
-    for( int i_pkt = 0; i_pkt < p_sys->i_ts_read; i_pkt++ )
+    for( int i_pkt = 0; i_pkt < i_read; i_pkt++ )
     {
         bool         b_frame = false;
-        block_t     *p_pkt;
-        if( !(p_pkt = ReadTSPacket( p_demux )) )
+        uint8_t     *p_pkt;
+        if( !(p_pkt = NextTSPacket( p_demux )) )
         {
+#ifdef HAVE_ARIB
+            ARIBFlushPayloads( &p_sys->arib_queue );
+#endif
+            SplitDrain( p_sys );
             return 0;
         }
 
         if( p_sys->b_start_record )
         {
             /* Enable recording once synchronized */
+#ifdef HAVE_ARIB
+            if( p_sys->arib_cas && p_sys->b_arib_record )
+            {
+                /* Recorded payloads are descrambled by the input thread */
+                SplitReset( p_sys );
+                p_sys->p_arib_record = arib_recorder_New( p_demux );
+            }
+            if( !p_sys->p_arib_record )
+#endif
             stream_Control( p_demux->s, STREAM_SET_RECORD_STATE, true, "ts" );
             p_sys->b_start_record = false;
         }
 
         /* Parse the TS packet */
-        ts_pid_t *p_pid = &p_sys->pid[PIDGet( p_pkt )];
+        const int i_pid = PIDGet( p_pkt );
+        ts_pid_t *p_pid = &p_sys->pid[i_pid];
 
-        if( p_pid->b_valid )
-        {
-            if( p_pid->psi )
-            {
 #ifdef HAVE_ARIB
-                if( p_pid->i_pid == 0 ||
-                    ( p_sys->b_dvb_meta && (p_pid->i_pid == 0x11 ||
-                                            p_pid->i_pid == 0x12 ||
-                                            p_pid->i_pid == 0x14) ) ||
-                    ( p_sys->arib_card && p_pid->i_pid == 1 ) ||
-                    ( p_pid->psi->arib_descrambler ) ||
-                    ( p_pid->i_pid == p_sys->i_pid_emm ) )
-#else
-                if( p_pid->i_pid == 0 || ( p_sys->b_dvb_meta && ( p_pid->i_pid == 0x11 || p_pid->i_pid == 0x12 || p_pid->i_pid == 0x14 ) ) )
+        if( p_sys->p_arib_record )
+            ARIBRecordPacket( p_sys, p_pid, p_pkt );
 #endif
-                {
-                    dvbpsi_PushPacket( p_pid->psi->handle, p_pkt->p_buffer );
-                }
-                else
-                {
-                    for( int i_prg = 0; i_prg < p_pid->psi->i_prg; i_prg++ )
-                    {
-                        dvbpsi_PushPacket( p_pid->psi->prg[i_prg]->handle,
-                                           p_pkt->p_buffer );
-                    }
-                }
-                block_Release( p_pkt );
-            }
-            else
-            {
-                b_frame = GatherData( p_demux, p_pid, p_pkt );
-            }
+
+        if( p_sys->pid_hot[i_pid] == TS_PID_HOT_STALE )
+        {
+            p_sys->pid_hot[i_pid] = PIDClassify( p_demux, p_pid );
+            if( p_sys->b_split_programs )
+                SplitAssign( p_demux, p_pid );
         }
-        else
+
+        if( p_pid->p_worker )
+        {
+            SplitQueue( p_sys, p_pid->p_worker, p_pkt );
+            continue;
+        }
+
+        switch( p_sys->pid_hot[i_pid] )
         {
-            if( !p_pid->b_seen )
+            case TS_PID_HOT_ES:
+                b_frame = GatherData( p_demux, p_pid, p_pkt );
+                break;
+
+            case TS_PID_HOT_PSI:
             {
-                msg_Dbg( p_demux, "pid[%d] unknown", p_pid->i_pid );
+#ifdef HAVE_ARIB
+                /* Tables may change keys or PIDs, drain pending payloads */
+                ARIBFlushPayloads( &p_sys->arib_queue );
+                const bool b_ecm = p_pid->psi->arib_descrambler != NULL;
+#endif
+                dvbpsi_PushPacket( p_pid->psi->handle, p_pkt );
+#ifdef HAVE_ARIB
+                /* Cached ECM responses are available right away */
+                if( b_ecm )
+                    ARIBPollKeys( p_sys );
+#endif
+                break;
             }
-            /* We have to handle PCR if present */
-            PCRHandle( p_demux, p_pid, p_pkt );
-            block_Release( p_pkt );
+
+            case TS_PID_HOT_PSI_PRG:
+#ifdef HAVE_ARIB
+                ARIBFlushPayloads( &p_sys->arib_queue );
+#endif
+                for( int i_prg = 0; i_prg < p_pid->psi->i_prg; i_prg++ )
+                {
+                    dvbpsi_PushPacket( p_pid->psi->prg[i_prg]->handle,
+                                       p_pkt );
+                }
+                break;
+
+            default:
+                /* Nothing will be gathered, spare the copy, but we have to
+                 * handle PCR if present */
+                PCRHandle( p_demux, p_pid, p_pkt );
+                break;
         }
-        p_pid->b_seen = true;
 
         if( b_frame || ( b_wait_es && p_sys->i_pmt_es > 0 ) )
             break;
     }
 
+#ifdef HAVE_ARIB
+    ARIBFlushPayloads( &p_sys->arib_queue );
+#endif
+    SplitFlush( p_sys );
     demux_UpdateTitleFromStream( p_demux );
     return 1;
 }
 
+/*****************************************************************************
+ * Program workers
+ *****************************************************************************/
+static void *SplitRun( void *data )
+{
+    ts_split_worker_t *p_worker = data;
+    demux_t *p_demux = p_worker->p_demux;
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    for( ;; )
+    {
+        block_t *p_batch = block_FifoGet( p_worker->p_fifo );
+
+        int canc = vlc_savecancel();
+        for( size_t i = 0; i < p_batch->i_buffer; i += TS_PACKET_SIZE_188 )
+        {
+            uint8_t *p_pkt = &p_batch->p_buffer[i];
+            ts_pid_t *p_pid = &p_sys->pid[PIDGet( p_pkt )];
+
+            /* Same as TS_PID_HOT_ES, which only the input thread updates */
+            if( p_pid->b_valid && !p_pid->psi && p_pid->es->id )
+                GatherData( p_demux, p_pid, p_pkt );
+            else
+                PCRHandle( p_demux, p_pid, p_pkt );
+        }
+#ifdef HAVE_ARIB
+        ARIBFlushPayloads( &p_worker->arib_queue );
+#endif
+        block_Release( p_batch );
+
+        vlc_mutex_lock( &p_sys->split_lock );
+        if( --p_sys->i_split_pending == 0 )
+            vlc_cond_signal( &p_sys->split_wait );
+        vlc_mutex_unlock( &p_sys->split_lock );
+        vlc_restorecancel( canc );
+    }
+    return NULL;
+}
+
+static ts_split_worker_t *SplitNew( demux_t *p_demux, int i_key )
+{
+    ts_split_worker_t *p_worker = malloc( sizeof(*p_worker) );
+    if( !p_worker )
+        return NULL;
+
+    p_worker->p_demux = p_demux;
+    p_worker->p_batch = NULL;
+    p_worker->i_key = i_key;
+#ifdef HAVE_ARIB
+    p_worker->arib_queue.i_batch = 0;
+#endif
+    p_worker->p_fifo = block_FifoNew();
+    if( !p_worker->p_fifo )
+    {
+        free( p_worker );
+        return NULL;
+    }
+    if( vlc_clone( &p_worker->thread, SplitRun, p_worker,
+                   VLC_THREAD_PRIORITY_INPUT ) )
+    {
+        block_FifoRelease( p_worker->p_fifo );
+        free( p_worker );
+        return NULL;
+    }
+    return p_worker;
+}
+
+/* Picks the worker of the program of an ES or PCR PID. Programs sharing
+ * their ECM PID share the worker, as it owns the descrambler state. */
+static void SplitAssign( demux_t *p_demux, ts_pid_t *pid )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const ts_prg_psi_t *p_prg = NULL;
+    ts_split_worker_t *p_worker = NULL;
+
+#ifdef HAVE_ARIB
+    if( p_sys->p_arib_record )
+        goto out;
+#endif
+    switch( p_sys->pid_hot[pid->i_pid] )
+    {
+        case TS_PID_HOT_ES:
+        case TS_PID_HOT_PCR:
+            for( int i = 0; pid->p_owner && i < pid->p_owner->i_prg; i++ )
+                if( pid->p_owner->prg[i]->i_number == pid->i_owner_number )
+                    p_prg = pid->p_owner->prg[i];
+            break;
+
+        case TS_PID_HOT_UNKNOWN:
+            /* PCR only PID */
+            for( int i = 0; i < p_sys->i_pmt && !p_prg; i++ )
+            {
+                const ts_psi_t *p_psi = p_sys->pmt[i]->psi;
+                for( int i_prg = 0; i_prg < p_psi->i_prg; i_prg++ )
+                    if( p_psi->prg[i_prg]->i_pid_pcr == pid->i_pid )
+                        p_prg = p_psi->prg[i_prg];
+            }
+            break;
+    }
+    if( !p_prg )
+        goto out;
+
+    int i_key = p_prg->i_number;
+#ifdef HAVE_ARIB
+    if( p_prg->i_pid_ecm >= 0 )
+        i_key = 0x10000 + p_prg->i_pid_ecm;
+#endif
+    for( int i = 0; i < p_sys->i_split && !p_worker; i++ )
+        if( p_sys->split[i]->i_key == i_key )
+            p_worker = p_sys->split[i];
+
+    if( !p_worker && p_sys->i_split < p_sys->i_split_max )
+    {
+        p_worker = SplitNew( p_demux, i_key );
+        if( p_worker )
+        {
+            msg_Dbg( p_demux, "program %d handled by worker %d",
+                     p_prg->i_number, p_sys->i_split );
+            p_sys->split[p_sys->i_split++] = p_worker;
+        }
+    }
+    if( !p_worker && p_sys->i_split > 0 )
+        p_worker = p_sys->split[i_key % p_sys->i_split];
+
+out:
+    /* Unchanged unless the workers were drained, see SplitDrain() */
+    if( pid->p_worker != p_worker )
+        pid->p_worker = p_worker;
+}
+
+static void SplitHand( demux_sys_t *p_sys, ts_split_worker_t *p_worker )
+{
+    block_t *p_batch = p_worker->p_batch;
+
+    if( !p_batch )
+        return;
+    p_worker->p_batch = NULL;
+
+    vlc_mutex_lock( &p_sys->split_lock );
+    p_sys->i_split_pending++;
+    vlc_mutex_unlock( &p_sys->split_lock );
+    block_FifoPut( p_worker->p_fifo, p_batch );
+}
+
+static void SplitQueue( demux_sys_t *p_sys, ts_split_worker_t *p_worker,
+                        const uint8_t *p_pkt )
+{
+    block_t *p_batch = p_worker->p_batch;
+
+    if( !p_batch )
+    {
+        p_batch = block_Alloc( TS_SPLIT_PACKETS * TS_PACKET_SIZE_188 );
+        if( !p_batch )
+            return;
+        p_batch->i_buffer = 0;
+        p_worker->p_batch = p_batch;
+    }
+
+    memcpy( &p_batch->p_buffer[p_batch->i_buffer], p_pkt, TS_PACKET_SIZE_188 );
+    p_batch->i_buffer += TS_PACKET_SIZE_188;
+    if( p_batch->i_buffer >= TS_SPLIT_PACKETS * TS_PACKET_SIZE_188 )
+        SplitHand( p_sys, p_worker );
+}
+
+/* Hands the partially filled batches */
+static void SplitFlush( demux_sys_t *p_sys )
+{
+    for( int i = 0; i < p_sys->i_split; i++ )
+        SplitHand( p_sys, p_sys->split[i] );
+}
+
+/* Waits for the workers to be done with every packet handed so far. The
+ * input thread does so before it changes the state they use: PID layout,
+ * program selection, descrambling keys, or anything Control() does. */
+static void SplitDrain( demux_sys_t *p_sys )
+{
+    if( p_sys->i_split == 0 )
+        return;
+
+    SplitFlush( p_sys );
+    vlc_mutex_lock( &p_sys->split_lock );
+    while( p_sys->i_split_pending > 0 )
+        vlc_cond_wait( &p_sys->split_wait, &p_sys->split_lock );
+    vlc_mutex_unlock( &p_sys->split_lock );
+}
+
+/* Takes every PID back to the input thread until they are assigned again */
+static void SplitReset( demux_sys_t *p_sys )
+{
+    if( p_sys->i_split == 0 )
+        return;
+
+    SplitDrain( p_sys );
+    for( int i = 0; i < 8192; i++ )
+        p_sys->pid[i].p_worker = NULL;
+    PIDHotReset( p_sys );
+}
+
+static void SplitStop( demux_sys_t *p_sys )
+{
+    SplitDrain( p_sys );
+    for( int i = 0; i < p_sys->i_split; i++ )
+    {
+        ts_split_worker_t *p_worker = p_sys->split[i];
+
+        vlc_cancel( p_worker->thread );
+        vlc_join( p_worker->thread, NULL );
+        block_FifoRelease( p_worker->p_fifo );
+        free( p_worker );
+    }
+    p_sys->i_split = 0;
+    for( int i = 0; i < 8192; i++ )
+        p_sys->pid[i].p_worker = NULL;
+}
+
 /*****************************************************************************
  * Control:
  *****************************************************************************/
@@ -1131,6 +1722,9 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
     int64_t *pi64;
     int i_int;
 
+    /* Positions, PCR and ES state are updated by the program workers */
+    SplitDrain( p_sys );
+
     switch( i_query )
     {
     case DEMUX_GET_POSITION:
@@ -1146,7 +1740,7 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
                 *pf = (double)i_time/(double)i_length;
             else if( (i64 = stream_Size( p_demux->s) ) > 0 )
             {
-                int64_t offset = stream_Tell( p_demux->s );
+                int64_t offset = TellTS( p_demux );
 
                 *pf = (double)offset / (double)i64;
             }
@@ -1167,6 +1761,7 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
             p_sys->i_last_pcr - p_sys->i_first_pcr <= 0 )
         {
             i64 = stream_Size( p_demux->s );
+            DropTSPackets( p_demux );
             if( stream_Seek( p_demux->s, (int64_t)(i64 * f) ) )
                 return VLC_EGENERIC;
         }
@@ -1274,6 +1869,9 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
                  }
             }
         }
+#ifdef HAVE_ARIB
+        ARIBUpdateSelection( p_demux );
+#endif
         return VLC_SUCCESS;
     }
 
@@ -1288,9 +1886,11 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
     }
 
     case DEMUX_SET_TITLE:
+        DropTSPackets( p_demux );
         return stream_vaControl( p_demux->s, STREAM_SET_TITLE, args );
 
     case DEMUX_SET_SEEKPOINT:
+        DropTSPackets( p_demux );
         return stream_vaControl( p_demux->s, STREAM_SET_SEEKPOINT, args );
 
     case DEMUX_GET_META:
@@ -1305,7 +1905,21 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
         b_bool = (bool)va_arg( args, int );
 
         if( !b_bool )
+        {
+#ifdef HAVE_ARIB
+            if( p_sys->p_arib_record )
+            {
+                ARIBFlushPayloads( &p_sys->arib_queue );
+                arib_recorder_Delete( p_sys->p_arib_record );
+                p_sys->p_arib_record = NULL;
+                p_sys->p_arib_record_pkt = NULL;
+                /* Hand the programs back to their workers */
+                SplitReset( p_sys );
+            }
+            else
+#endif
             stream_Control( p_demux->s, STREAM_SET_RECORD_STATE, false );
+        }
         p_sys->b_start_record = b_bool;
         return VLC_SUCCESS;
 
@@ -1467,8 +2081,16 @@ static int SetPIDFilter( demux_t *p_demux, int i_pid, bool b_selected )
     if( !p_sys->b_access_control )
         return VLC_EGENERIC;
 
-    return stream_Control( p_demux->s, STREAM_SET_PRIVATE_ID_STATE,
-                           i_pid, b_selected );
+    /* Only forward changes, so that the access filters incrementally */
+    ts_pid_t *pid = &p_sys->pid[i_pid];
+    if( pid->b_filtered == b_selected )
+        return VLC_SUCCESS;
+
+    if( stream_Control( p_demux->s, STREAM_SET_PRIVATE_ID_STATE,
+                        i_pid, b_selected ) )
+        return VLC_EGENERIC;
+    pid->b_filtered = b_selected;
+    return VLC_SUCCESS;
 }
 
 static void SetPrgFilter( demux_t *p_demux, int i_prg_id, bool b_selected )
@@ -1501,6 +2123,10 @@ static void SetPrgFilter( demux_t *p_demux, int i_prg_id, bool b_selected )
     SetPIDFilter( p_demux, i_pmt_pid, b_selected );
     if( p_prg->i_pid_pcr > 0 )
         SetPIDFilter( p_demux, p_prg->i_pid_pcr, b_selected );
+#ifdef HAVE_ARIB
+    if( p_prg->i_pid_ecm > 0 )
+        SetPIDFilter( p_demux, p_prg->i_pid_ecm, b_selected );
+#endif
 
     /* All ES */
     for( int i = 2; i < 8192; i++ )
@@ -1567,6 +2193,7 @@ static void PIDInit( ts_pid_t *pid, bool b_psi, ts_psi_t *p_owner )
             prg->i_pid_pmt  = -1;
 #ifdef HAVE_ARIB
             prg->i_pid_ecm  = -1;
+            prg->b_arib_selected = false;
 #endif
             prg->i_pcr_value= -1;
             prg->iod        = NULL;
@@ -1584,7 +2211,6 @@ static void PIDInit( ts_pid_t *pid, bool b_psi, ts_psi_t *p_owner )
 
         es_format_Init( &pid->es->fmt, UNKNOWN_ES, 0 );
         pid->es->data_type = TS_ES_DATA_PES;
-        pid->es->pp_last = &pid->es->p_data;
     }
 }
 
@@ -1962,11 +2588,15 @@ static void ParseData( demux_t *p_demux, ts_pid_t *pid )
 {
     block_t *p_data = pid->es->p_data;
 
+#ifdef HAVE_ARIB
+    ARIBFlushPayloads( ARIBQueue( p_demux->p_sys, pid ) );
+#endif
+
     /* remove the pes from pid */
     pid->es->p_data = NULL;
     pid->es->i_data_size = 0;
-    pid->es->i_data_gathered = 0;
-    pid->es->pp_last = &pid->es->p_data;
+    pid->es->i_data_alloc = 0;
+    pid->es->i_data_hint = p_data->i_buffer;
 
     if( pid->es->data_type == TS_ES_DATA_PES )
     {
@@ -1982,6 +2612,55 @@ static void ParseData( demux_t *p_demux, ts_pid_t *pid )
     }
 }
 
+/* Packets in a row for the stream to be in sync again */
+#define TS_SYNC_LOCK 5
+
+/* Skips garbage up to the next TS_SYNC_LOCK packets in a row, looking at
+ * large windows at once, returns false at the end of the stream */
+static bool Resync( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const unsigned i_size = p_sys->i_packet_size;
+    const int i_header = p_sys->i_packet_header_size;
+    const mtime_t i_start = mdate();
+    uint64_t i_skipped = 0;
+    bool b_synced = false;
+
+    while( !b_synced && vlc_object_alive (p_demux) )
+    {
+        const uint8_t *p_peek;
+        int i_peek = stream_Peek( p_demux->s, &p_peek, TS_SYNC_WINDOW );
+        if( i_peek < i_header + (int)i_size + 1 )
+        {
+            msg_Dbg( p_demux, "eof ?" );
+            break;
+        }
+        i_peek -= i_header;
+
+        /* Fewer packets are left to confirm the lock at the end */
+        const unsigned i_lock = __MIN( TS_SYNC_LOCK, (i_peek - 1) / i_size + 1 );
+        unsigned i_found;
+        int i_skip = ts_sync_Find( &p_peek[i_header], i_peek, i_peek,
+                                   &i_size, 1, i_lock, &i_found );
+        if( i_skip >= 0 )
+            b_synced = true;
+        else /* no run can start before that */
+            i_skip = i_peek - (i_lock - 1) * i_size;
+
+        stream_Read( p_demux->s, NULL, i_skip );
+        i_skipped += i_skip;
+    }
+
+    const mtime_t i_lost = mdate() - i_start;
+    p_sys->i_sync_lost++;
+    p_sys->i_sync_skipped += i_skipped;
+    p_sys->i_sync_lost_time += i_lost;
+    msg_Warn( p_demux, "%s after skipping %"PRIu64" bytes of garbage in "
+              "%"PRId64" ms", b_synced ? "resynchronized" : "no sync",
+              i_skipped, i_lost / 1000 );
+    return b_synced;
+}
+
 static block_t* ReadTSPacket( demux_t *p_demux )
 {
     demux_sys_t *p_sys = p_demux->p_sys;
@@ -2007,45 +2686,176 @@ static block_t* ReadTSPacket( demux_t *p_demux )
     {
         msg_Warn( p_demux, "lost synchro" );
         block_Release( p_pkt );
-        while( vlc_object_alive (p_demux) )
+        if( !Resync( p_demux ) )
+            return NULL;
+        if( !( p_pkt = stream_Block( p_demux->s, p_sys->i_packet_size ) ) )
         {
-            const uint8_t *p_peek;
-            int i_peek, i_skip = 0;
+            msg_Dbg( p_demux, "eof ?" );
+            return NULL;
+        }
+    }
+    return p_pkt;
+}
 
-            i_peek = stream_Peek( p_demux->s, &p_peek,
-                    p_sys->i_packet_size * 10 );
-            if( i_peek < p_sys->i_packet_size + 1 )
-            {
-                msg_Dbg( p_demux, "eof ?" );
-                return NULL;
-            }
+/* Packets taken from the stream at once by NextTSPacket(), more of them when
+ * descrambling so that they fill the batches of csa_DecryptBatch() */
+#define TS_READ_PACKETS 20
+#define TS_READ_PACKETS_CSA 128
 
-            while( i_skip < i_peek - p_sys->i_packet_size )
-            {
-                if( p_peek[i_skip + p_sys->i_packet_header_size] == 0x47 &&
-                        p_peek[i_skip + p_sys->i_packet_header_size + p_sys->i_packet_size] == 0x47 )
-                {
-                    break;
-                }
-                i_skip++;
-            }
-            msg_Dbg( p_demux, "skipping %d bytes of garbage", i_skip );
-            stream_Read( p_demux->s, NULL, i_skip );
+/* Reads as many packets as possible, up to TS_READ_PACKETS, as long as they
+ * are in sync. The block starts at the first packet header. */
+static block_t *ReadTSPackets( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const int i_size = p_sys->i_packet_size;
+    const int i_header = p_sys->i_packet_header_size;
+    const int i_read = p_sys->csa ? TS_READ_PACKETS_CSA : TS_READ_PACKETS;
 
-            if( i_skip < i_peek - p_sys->i_packet_size )
-            {
-                break;
-            }
-        }
-        if( !( p_pkt = stream_Block( p_demux->s, p_sys->i_packet_size ) ) )
+    for( ;; )
+    {
+        const uint8_t *p_peek;
+        int i_peek = stream_Peek( p_demux->s, &p_peek, i_size * i_read );
+        int i_count = 0;
+
+        while( (i_count + 1) * i_size <= i_peek &&
+               p_peek[i_count * i_size + i_header] == 0x47 )
+            i_count++;
+
+        if( i_count > 0 )
+            return stream_Block( p_demux->s, i_count * i_size );
+
+        if( i_peek < i_size )
         {
             msg_Dbg( p_demux, "eof ?" );
             return NULL;
-        }
+        }
+
+        msg_Warn( p_demux, "lost synchro" );
+        if( !Resync( p_demux ) )
+            return NULL;
+    }
+}
+
+/* Packets checked before giving up on a parity that never matches */
+#define TS_RS_PROBE 256
+
+/* Repairs the 204 bytes packets of a buffer in place with their parity,
+ * and sets the transport_error_indicator of those beyond repair. */
+static void CorrectTSPackets( demux_t *p_demux, block_t *p_packets )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    for( size_t i = 0; i + TS_RS_PACKET_SIZE <= p_packets->i_buffer;
+         i += TS_RS_PACKET_SIZE )
+    {
+        uint8_t *p_pkt = &p_packets->p_buffer[i];
+        const int i_ret = ts_rs_Correct( p_sys->p_rs, p_pkt );
+
+        p_sys->i_rs_packets++;
+        if( i_ret > 0 )
+            p_sys->i_rs_corrected++;
+        else if( i_ret < 0 )
+        {
+            p_sys->i_rs_uncorrectable++;
+            /* Until a packet matches, the parity may not be what we expect */
+            if( p_sys->i_rs_uncorrectable < p_sys->i_rs_packets )
+                p_pkt[1] |= 0x80;
+        }
+    }
+
+    if( p_sys->i_rs_packets >= TS_RS_PROBE &&
+        p_sys->i_rs_uncorrectable == p_sys->i_rs_packets )
+    {
+        msg_Warn( p_demux, "Reed-Solomon parity does not match the packets, "
+                  "error correction disabled" );
+        ts_rs_Delete( p_sys->p_rs );
+        p_sys->p_rs = NULL;
+        p_sys->i_rs_packets = p_sys->i_rs_uncorrectable = 0;
+    }
+}
+
+/* Descrambles the elementary stream packets of a buffer all at once, under a
+ * single lock. GatherData() still handles those of PIDs unknown yet. */
+static void DescrambleTSPackets( demux_t *p_demux, block_t *p_packets )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const size_t i_size = p_sys->i_packet_size;
+    uint8_t *pp_pkt[TS_READ_PACKETS_CSA];
+    int i_pkt = 0;
+
+    for( size_t i = 0; i + i_size <= p_packets->i_buffer; i += i_size )
+    {
+        uint8_t *p_pkt = &p_packets->p_buffer[i + p_sys->i_packet_header_size];
+        const int i_pid = PIDGet( p_pkt );
+
+        if( !( p_pkt[3]&0x80 ) )
+            continue;
+        if( p_sys->pid_hot[i_pid] == TS_PID_HOT_STALE )
+            p_sys->pid_hot[i_pid] = PIDClassify( p_demux, &p_sys->pid[i_pid] );
+        if( p_sys->pid_hot[i_pid] == TS_PID_HOT_ES )
+            pp_pkt[i_pkt++] = p_pkt;
+    }
+    if( i_pkt == 0 )
+        return;
+
+    vlc_mutex_lock( &p_sys->csa_lock );
+    csa_DecryptBatch( p_sys->csa, pp_pkt, i_pkt, p_sys->i_csa_pkt_size );
+    vlc_mutex_unlock( &p_sys->csa_lock );
+}
+
+/* Returns the next packet, starting at the sync byte, from a buffer of
+ * packets read in bulk. It stays valid until the next call and may be
+ * descrambled in place, nothing is allocated per packet. */
+static uint8_t *NextTSPacket( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    block_t *p_packets = p_sys->p_packets;
+    const size_t i_size = p_sys->i_packet_size;
+
+    if( !p_packets || p_packets->i_buffer < i_size )
+    {
+        if( p_packets )
+            block_Release( p_packets );
+        p_sys->p_packets = p_packets = ReadTSPackets( p_demux );
+        if( !p_packets )
+            return NULL;
+        if( p_sys->p_rs )
+            CorrectTSPackets( p_demux, p_packets );
+        if( p_sys->csa )
+            DescrambleTSPackets( p_demux, p_packets );
     }
+
+    uint8_t *p_pkt = &p_packets->p_buffer[p_sys->i_packet_header_size];
+    p_packets->p_buffer += i_size;
+    p_packets->i_buffer -= i_size;
     return p_pkt;
 }
 
+/* Gives the packets read in advance back to the stream, before seeking */
+static void DropTSPackets( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    if( !p_sys->p_packets )
+        return;
+
+    if( p_sys->p_packets->i_buffer > 0 )
+        stream_Seek( p_demux->s, TellTS( p_demux ) );
+    block_Release( p_sys->p_packets );
+    p_sys->p_packets = NULL;
+}
+
+/* Position of the next packet to be demuxed */
+static int64_t TellTS( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    int64_t i_pos = stream_Tell( p_demux->s );
+
+    if( p_sys->p_packets )
+        i_pos -= p_sys->p_packets->i_buffer;
+    return i_pos;
+}
+
 static mtime_t AdjustPCRWrapAround( demux_t *p_demux, mtime_t i_pcr )
 {
     demux_sys_t   *p_sys = p_demux->p_sys;
@@ -2054,7 +2864,7 @@ static mtime_t AdjustPCRWrapAround( demux_t *p_demux, mtime_t i_pcr )
      * So, need to add 0x1FFFFFFFF, for calculating duration or current position.
      */
     mtime_t i_adjust = 0;
-    int64_t i_pos = stream_Tell( p_demux->s );
+    int64_t i_pos = TellTS( p_demux );
     int i;
     for( i = 1; i < p_sys->i_pcrs_num && p_sys->p_pos[i] <= i_pos; ++i )
     {
@@ -2067,10 +2877,8 @@ static mtime_t AdjustPCRWrapAround( demux_t *p_demux, mtime_t i_pcr )
     return i_pcr + i_adjust;
 }
 
-static mtime_t GetPCR( block_t *p_pkt )
+static mtime_t GetPCR( const uint8_t *p )
 {
-    const uint8_t *p = p_pkt->p_buffer;
-
     mtime_t i_pcr = -1;
 
     if( ( p[3]&0x20 ) && /* adaptation */
@@ -2112,9 +2920,9 @@ static int SeekToPCR( demux_t *p_demux, int64_t i_pos )
         {
             break;
         }
-        if( PIDGet( p_pkt ) == p_sys->i_pid_ref_pcr )
+        if( PIDGet( p_pkt->p_buffer ) == p_sys->i_pid_ref_pcr )
         {
-            i_pcr = GetPCR( p_pkt );
+            i_pcr = GetPCR( p_pkt->p_buffer );
         }
         block_Release( p_pkt );
         if( i_pcr >= 0 )
@@ -2137,6 +2945,7 @@ static int Seek( demux_t *p_demux, double f_percent )
 {
     demux_sys_t *p_sys = p_demux->p_sys;
 
+    DropTSPackets( p_demux );
     int64_t i_initial_pos = stream_Tell( p_demux->s );
     mtime_t i_initial_pcr = p_sys->i_current_pcr;
 
@@ -2145,6 +2954,20 @@ static int Seek( demux_t *p_demux, double f_percent )
      */
     mtime_t i_target_pcr = (p_sys->i_last_pcr - p_sys->i_first_pcr) * f_percent + p_sys->i_first_pcr;
 
+    /* A single read once the index covers the target */
+    if( p_sys->p_index )
+    {
+        int64_t i_pos;
+        mtime_t i_pcr;
+
+        if( !ts_index_Lookup( p_sys->p_index, i_target_pcr, &i_pos, &i_pcr ) &&
+            !stream_Seek( p_demux->s, i_pos ) )
+        {
+            p_sys->i_current_pcr = i_pcr;
+            return VLC_SUCCESS;
+        }
+    }
+
     int64_t i_head_pos = 0;
     int64_t i_tail_pos;
     {
@@ -2221,10 +3044,10 @@ static void GetFirstPCR( demux_t *p_demux )
         {
             break;
         }
-        mtime_t i_pcr = GetPCR( p_pkt );
+        mtime_t i_pcr = GetPCR( p_pkt->p_buffer );
         if( i_pcr >= 0 )
         {
-            p_sys->i_pid_ref_pcr = PIDGet( p_pkt );
+            p_sys->i_pid_ref_pcr = PIDGet( p_pkt->p_buffer );
             p_sys->i_first_pcr = i_pcr;
             p_sys->i_current_pcr = i_pcr;
         }
@@ -2320,14 +3143,14 @@ static void CheckPCR( demux_t *p_demux )
     p_sys->i_current_pcr = i_initial_pcr;
 }
 
-static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
+static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, const uint8_t *p )
 {
     demux_sys_t   *p_sys = p_demux->p_sys;
 
     if( p_sys->i_pmt_es <= 0 )
         return;
 
-    mtime_t i_pcr = GetPCR( p_bk );
+    mtime_t i_pcr = GetPCR( p );
     if( i_pcr < 0 )
         return;
 
@@ -2365,9 +3188,265 @@ static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
     }
 }
 
-static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
+#ifdef HAVE_ARIB
+/* Stores a descrambled payload into the recorded copy of its packet */
+static void ARIBRecordPayload( uint8_t *p_record, const uint8_t *p_payload,
+                               size_t i_payload )
+{
+    memcpy( &p_record[TS_PACKET_SIZE_188 - i_payload], p_payload, i_payload );
+    p_record[3] &= 0x3f; /* transport_scrambling_control: not scrambled */
+}
+
+static void ARIBRecordPacket( demux_sys_t *p_sys, const ts_pid_t *p_pid,
+                              const uint8_t *p_packet )
+{
+    p_sys->p_arib_record_pkt = NULL;
+
+    if( p_sys->b_arib_record_drop_cas && p_pid->b_valid && p_pid->psi &&
+        ( p_pid->psi->arib_descrambler || p_pid->i_pid == p_sys->i_pid_emm ) )
+        return;
+
+    uint8_t *p_record = arib_recorder_Append( p_sys->p_arib_record, p_packet );
+    if( !p_record )
+    {
+        /* Queued payloads are still to be copied into the full block */
+        ARIBFlushPayloads( &p_sys->arib_queue );
+        arib_recorder_Flush( p_sys->p_arib_record );
+        p_record = arib_recorder_Append( p_sys->p_arib_record, p_packet );
+    }
+    p_sys->p_arib_record_pkt = p_record;
+}
+
+static void ARIBFlushPayloads( arib_queue_t *p_queue )
+{
+    arib_payload_t *batch = p_queue->batch;
+    int i_pending = p_queue->i_batch;
+
+    while( i_pending > 0 )
+    {
+        /* Descramble every payload sharing the first one's key and parity */
+        MULTI2 *descrambler = batch[0].descrambler;
+        const int i_type = batch[0].i_type;
+        uint8_t *pp_buffer[TS_ARIB_BATCH_MAX];
+        int32_t pi_buffer[TS_ARIB_BATCH_MAX];
+        uint8_t *pp_record[TS_ARIB_BATCH_MAX];
+        int i_count = 0;
+        int i_left = 0;
+
+        for( int i = 0; i < i_pending; i++ )
+        {
+            if( batch[i].descrambler == descrambler &&
+                batch[i].i_type == i_type )
+            {
+                pp_buffer[i_count] = batch[i].p_buffer;
+                pi_buffer[i_count] = batch[i].i_buffer;
+                pp_record[i_count] = batch[i].p_record;
+                i_count++;
+            }
+            else
+            {
+                batch[i_left++] = batch[i];
+            }
+        }
+        if( descrambler->decrypt_batch( descrambler, i_type,
+                                        pp_buffer, pi_buffer, i_count ) >= 0 )
+        {
+            for( int i = 0; i < i_count; i++ )
+                if( pp_record[i] )
+                    ARIBRecordPayload( pp_record[i], pp_buffer[i],
+                                       pi_buffer[i] );
+        }
+        i_pending = i_left;
+    }
+    p_queue->i_batch = 0;
+}
+
+/* Offset of the key half used for a transport_scrambling_control value */
+#define ARIB_KEY_HALF( parity ) ( (parity) == 0x02 ? 8 : 0 )
+
+static void ARIBSetKey( arib_queue_t *p_queue, ts_psi_t *p_ecm )
+{
+    /* Queued payloads were scrambled with the previous key */
+    ARIBFlushPayloads( p_queue );
+
+    MULTI2 *descrambler = p_ecm->arib_descrambler;
+    descrambler->set_scramble_key( descrambler, p_ecm->arib_key_pending );
+    memcpy( p_ecm->arib_key, p_ecm->arib_key_pending, 16 );
+    p_ecm->b_arib_key = true;
+    p_ecm->b_arib_key_pending = false;
+}
+
+static void ARIBPollKeys( demux_sys_t *p_sys )
+{
+    uint8_t key[16];
+    int i_pid;
+
+    if( !p_sys->arib_cas )
+        return;
+
+    while( cas_worker_PopKey( p_sys->arib_cas, &i_pid, key ) )
+    {
+        /* The program workers descramble with the keys being changed */
+        SplitDrain( p_sys );
+
+        ts_pid_t *ecm = &p_sys->pid[i_pid];
+        if( !ecm->b_valid || !ecm->psi || !ecm->psi->arib_descrambler )
+            continue;
+
+        ts_psi_t *p_ecm = ecm->psi;
+        memcpy( p_ecm->arib_key_pending, key, 16 );
+        p_ecm->b_arib_key_pending = true;
+
+        /* The half in use is normally unchanged by a new ECM, install the
+         * key right away then, otherwise wait for the parity flip */
+        const int i_parity = p_ecm->i_arib_parity;
+        if( !p_ecm->b_arib_key || i_parity < 0x02 ||
+            !memcmp( &key[ARIB_KEY_HALF(i_parity)],
+                     &p_ecm->arib_key[ARIB_KEY_HALF(i_parity)], 8 ) )
+            ARIBSetKey( &p_sys->arib_queue, p_ecm );
+    }
+}
+
+/* Caches ProgramIsSelected() for the descrambling path, ECMs are only sent
+ * to the card for PIDs used by at least one descrambled program */
+static void ARIBUpdateSelection( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    bool pb_selected[8192];
+
+    memset( pb_selected, 0, sizeof(pb_selected) );
+    for( int i = 0; i < p_sys->i_pmt; i++ )
+    {
+        ts_psi_t *p_psi = p_sys->pmt[i]->psi;
+        for( int i_prg = 0; i_prg < p_psi->i_prg; i_prg++ )
+        {
+            ts_prg_psi_t *p_prg = p_psi->prg[i_prg];
+            p_prg->b_arib_selected = p_sys->b_arib_descramble_all ||
+                                     ProgramIsSelected( p_demux, p_prg->i_number );
+            if( p_prg->b_arib_selected && p_prg->i_pid_ecm >= 0 )
+                pb_selected[p_prg->i_pid_ecm] = true;
+        }
+    }
+
+    for( int i = 0; i < p_sys->i_pmt; i++ )
+    {
+        ts_psi_t *p_psi = p_sys->pmt[i]->psi;
+        for( int i_prg = 0; i_prg < p_psi->i_prg; i_prg++ )
+        {
+            const int i_pid_ecm = p_psi->prg[i_prg]->i_pid_ecm;
+            if( i_pid_ecm < 0 )
+                continue;
+
+            ts_psi_t *p_ecm = p_sys->pid[i_pid_ecm].psi;
+            if( !p_ecm || !p_ecm->arib_descrambler ||
+                p_ecm->b_arib_selected == pb_selected[i_pid_ecm] )
+                continue;
+
+            /* ECMs were ignored meanwhile, take the next one whatever
+             * its version */
+            if( pb_selected[i_pid_ecm] )
+                p_ecm->i_ecm_version = -1;
+            p_ecm->b_arib_selected = pb_selected[i_pid_ecm];
+        }
+    }
+}
+
+static void ARIBQueuePayload( arib_queue_t *p_queue, MULTI2 *descrambler,
+                              int i_type, uint8_t *p_buffer, size_t i_buffer,
+                              uint8_t *p_record )
+{
+    if( p_queue->i_batch >= TS_ARIB_BATCH_MAX )
+        ARIBFlushPayloads( p_queue );
+
+    arib_payload_t *p_payload = &p_queue->batch[p_queue->i_batch++];
+    p_payload->descrambler = descrambler;
+    p_payload->i_type = i_type;
+    p_payload->p_buffer = p_buffer;
+    p_payload->i_buffer = i_buffer;
+    p_payload->p_record = p_record;
+}
+
+/* Payloads are queued by the thread handling the packets of their PID */
+static arib_queue_t *ARIBQueue( demux_sys_t *p_sys, const ts_pid_t *pid )
+{
+    return pid->p_worker ? &pid->p_worker->arib_queue : &p_sys->arib_queue;
+}
+#endif
+
+/* Room allocated for a unit of unknown size, past the previous unit size */
+#define TS_DATA_MIN_ALLOC 4096
+
+/* Starts gathering a unit in a single block, sized after its header when it
+ * tells the size, or after the previous unit of the PID */
+static bool GatherStart( ts_es_t *es, const uint8_t *p, int i )
+{
+    es->i_data_size = 0;
+    if( es->data_type == TS_ES_DATA_PES )
+    {
+        if( i > 6 )
+        {
+            es->i_data_size = GetWBE( &p[4] );
+            if( es->i_data_size > 0 )
+                es->i_data_size += 6;
+        }
+    }
+    else if( es->data_type == TS_ES_DATA_TABLE_SECTION )
+    {
+        if( i > 3 && p[0] != 0xff )
+            es->i_data_size = 3 + (((p[1] & 0xf) << 8) | p[2]);
+    }
+
+    int i_alloc = es->i_data_size;
+    if( i_alloc <= 0 )
+        i_alloc = __MAX( es->i_data_hint + es->i_data_hint / 8,
+                         TS_DATA_MIN_ALLOC );
+    i_alloc = __MAX( i_alloc, i );
+
+    es->p_data = block_Alloc( i_alloc );
+    if( !es->p_data )
+        return false;
+    es->p_data->i_buffer = 0;
+    es->i_data_alloc = i_alloc;
+    return true;
+}
+
+/* Appends a payload to the unit being gathered, returns where it went */
+static uint8_t *GatherAppend( demux_t *p_demux, ts_pid_t *pid,
+                              const uint8_t *p, int i )
+{
+    ts_es_t *es = pid->es;
+    block_t *p_data = es->p_data;
+
+    if( (int)p_data->i_buffer + i > es->i_data_alloc )
+    {
+        /* Rare when the size is known: the unit is longer than announced */
+        const int i_alloc = __MAX( 2 * es->i_data_alloc,
+                                   (int)p_data->i_buffer + i );
+        block_t *p_grown = block_Alloc( i_alloc );
+        if( !p_grown )
+            return NULL;
+#ifdef HAVE_ARIB
+        /* Queued payloads point into the old block */
+        ARIBFlushPayloads( ARIBQueue( p_demux->p_sys, pid ) );
+#else
+        VLC_UNUSED(p_demux);
+#endif
+        memcpy( p_grown->p_buffer, p_data->p_buffer, p_data->i_buffer );
+        p_grown->i_buffer = p_data->i_buffer;
+        p_grown->i_flags = p_data->i_flags;
+        block_Release( p_data );
+        es->p_data = p_data = p_grown;
+        es->i_data_alloc = i_alloc;
+    }
+
+    uint8_t *p_dst = &p_data->p_buffer[p_data->i_buffer];
+    memcpy( p_dst, p, i );
+    p_data->i_buffer += i;
+    return p_dst;
+}
+
+static bool GatherData( demux_t *p_demux, ts_pid_t *pid, uint8_t *p )
 {
-    const uint8_t *p = p_bk->p_buffer;
     const bool b_unit_start = p[1]&0x40;
     const bool b_scrambled  = p[3]&0x80;
     const bool b_adaptation = p[3]&0x20;
@@ -2385,9 +3464,7 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
              b_payload, i_cc );
 #endif
 
-    /* For now, ignore additional error correction
-     * TODO: handle Reed-Solomon 204,188 error correction */
-    p_bk->i_buffer = TS_PACKET_SIZE_188;
+    /* The parity of 204 bytes packets was used by CorrectTSPackets() */
 
     if( p[1]&0x80 )
     {
@@ -2397,10 +3474,10 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
             pid->es->p_data->i_flags |= BLOCK_FLAG_CORRUPTED;
     }
 
-    if( p_demux->p_sys->csa )
+    if( p_demux->p_sys->csa && ( p[3]&0x80 ) )
     {
         vlc_mutex_lock( &p_demux->p_sys->csa_lock );
-        csa_Decrypt( p_demux->p_sys->csa, p_bk->p_buffer, p_demux->p_sys->i_csa_pkt_size );
+        csa_Decrypt( p_demux->p_sys->csa, p, p_demux->p_sys->i_csa_pkt_size );
         vlc_mutex_unlock( &p_demux->p_sys->csa_lock );
     }
 
@@ -2466,13 +3543,10 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
         }
     }
 
-    PCRHandle( p_demux, pid, p_bk );
+    PCRHandle( p_demux, pid, p );
 
     if( i_skip >= 188 || pid->es->id == NULL )
-    {
-        block_Release( p_bk );
         return i_ret;
-    }
 
     /* */
     if( !pid->b_scrambled != !b_scrambled )
@@ -2492,10 +3566,15 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
     }
 
     /* We have to gather it */
-    p_bk->p_buffer += i_skip;
-    p_bk->i_buffer -= i_skip;
+    uint8_t *p_payload = &p[i_skip];
+    int      i_payload = TS_PACKET_SIZE_188 - i_skip;
 
 #ifdef HAVE_ARIB
+    /* Payloads continuing a unit are descrambled once copied */
+    MULTI2  *p_queue = NULL;
+    int      i_queue_type = 0;
+    uint8_t *p_record = NULL;
+
     if ( b_scrambled ) {
         ts_psi_t *p_owner = pid->p_owner;
         for ( int i_prg = 0; i_prg < p_owner->i_prg; i_prg++ )
@@ -2504,13 +3583,34 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
             if ( p_prg->i_number == pid->i_owner_number )
             {
                 int i_pid_ecm = p_prg->i_pid_ecm;
-                if ( i_pid_ecm < 0 )
+                if ( i_pid_ecm < 0 || !p_prg->b_arib_selected )
                     break;
 
                 ts_pid_t *ecm = &p_demux->p_sys->pid[i_pid_ecm];
                 MULTI2 *descrambler = ecm->psi->arib_descrambler;
-                descrambler->decrypt(descrambler, (p[3] >> 6) & 0x03,
-                                     p_bk->p_buffer, p_bk->i_buffer);
+                const int i_type = (p[3] >> 6) & 0x03;
+                if( ecm->psi->i_arib_parity != i_type )
+                {
+                    if( ecm->psi->b_arib_key_pending )
+                        ARIBSetKey( ARIBQueue( p_demux->p_sys, pid ),
+                                    ecm->psi );
+                    ecm->psi->i_arib_parity = i_type;
+                }
+                p_record = p_demux->p_sys->p_arib_record_pkt;
+                if( b_unit_start || ( !pid->es->p_data && p_record ) )
+                {
+                    /* The PES/section header is parsed right below, or the
+                     * payload is only needed by the recording */
+                    if( descrambler->decrypt( descrambler, i_type,
+                                              p_payload, i_payload ) >= 0 &&
+                        p_record )
+                        ARIBRecordPayload( p_record, p_payload, i_payload );
+                }
+                else if( pid->es->p_data )
+                {
+                    p_queue = descrambler;
+                    i_queue_type = i_type;
+                }
                 break;
             }
         }
@@ -2519,18 +3619,14 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
 
     if( b_unit_start )
     {
-        if( pid->es->data_type == TS_ES_DATA_TABLE_SECTION && p_bk->i_buffer > 0 )
+        if( pid->es->data_type == TS_ES_DATA_TABLE_SECTION && i_payload > 0 )
         {
-            int i_pointer_field = __MIN( p_bk->p_buffer[0], p_bk->i_buffer - 1 );
-            block_t *p = block_Duplicate( p_bk );
-            if( p )
-            {
-                p->i_buffer = i_pointer_field;
-                p->p_buffer++;
-                block_ChainLastAppend( &pid->es->pp_last, p );
-            }
-            p_bk->i_buffer -= 1 + i_pointer_field;
-            p_bk->p_buffer += 1 + i_pointer_field;
+            int i_pointer_field = __MIN( p_payload[0], i_payload - 1 );
+            /* end of the previous section */
+            if( pid->es->p_data )
+                GatherAppend( p_demux, pid, &p_payload[1], i_pointer_field );
+            i_payload -= 1 + i_pointer_field;
+            p_payload += 1 + i_pointer_field;
         }
         if( pid->es->p_data )
         {
@@ -2538,52 +3634,32 @@ static bool GatherData( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
             i_ret = true;
         }
 
-        block_ChainLastAppend( &pid->es->pp_last, p_bk );
-        if( pid->es->data_type == TS_ES_DATA_PES )
-        {
-            if( p_bk->i_buffer > 6 )
-            {
-                pid->es->i_data_size = GetWBE( &p_bk->p_buffer[4] );
-                if( pid->es->i_data_size > 0 )
-                {
-                    pid->es->i_data_size += 6;
-                }
-            }
-        }
-        else if( pid->es->data_type == TS_ES_DATA_TABLE_SECTION )
-        {
-            if( p_bk->i_buffer > 3 && p_bk->p_buffer[0] != 0xff )
-            {
-                pid->es->i_data_size = 3 + (((p_bk->p_buffer[1] & 0xf) << 8) | p_bk->p_buffer[2]);
-            }
-        }
-        pid->es->i_data_gathered += p_bk->i_buffer;
-        if( pid->es->i_data_size > 0 &&
-            pid->es->i_data_gathered >= pid->es->i_data_size )
-        {
-            ParseData( p_demux, pid );
-            i_ret = true;
-        }
+        if( !GatherStart( pid->es, p_payload, i_payload ) )
+            return i_ret;
+        GatherAppend( p_demux, pid, p_payload, i_payload );
+    }
+    else if( pid->es->p_data == NULL )
+    {
+        /* msg_Dbg( p_demux, "broken packet" ); */
+        return i_ret;
     }
     else
     {
-        if( pid->es->p_data == NULL )
-        {
-            /* msg_Dbg( p_demux, "broken packet" ); */
-            block_Release( p_bk );
-        }
-        else
-        {
-            block_ChainLastAppend( &pid->es->pp_last, p_bk );
-            pid->es->i_data_gathered += p_bk->i_buffer;
+        uint8_t *p_dst = GatherAppend( p_demux, pid, p_payload, i_payload );
+#ifdef HAVE_ARIB
+        if( p_dst && p_queue )
+            ARIBQueuePayload( ARIBQueue( p_demux->p_sys, pid ), p_queue,
+                              i_queue_type, p_dst, i_payload, p_record );
+#else
+        VLC_UNUSED(p_dst);
+#endif
+    }
 
-            if( pid->es->i_data_size > 0 &&
-                pid->es->i_data_gathered >= pid->es->i_data_size )
-            {
-                ParseData( p_demux, pid );
-                i_ret = true;
-            }
-        }
+    if( pid->es->i_data_size > 0 &&
+        (int)pid->es->p_data->i_buffer >= pid->es->i_data_size )
+    {
+        ParseData( p_demux, pid );
+        i_ret = true;
     }
 
     return i_ret;
@@ -2953,16 +4029,31 @@ static char *EITConvertToUTF8( const unsigned char *psz_instring,
                                bool b_broken )
 {
 #ifdef HAVE_ARIB
-    char *psz_outstring;
-    size_t i_out;
-
-    i_out = i_length * 3;
-    psz_outstring = malloc( i_out + 1 );
-    if( !psz_outstring )
+    /* Descriptor strings are at most 255 bytes long, decode them on the
+     * stack and only allocate what the result needs */
+    char arena[ARIB_STR_MAX(255)];
+    char *psz_buffer = arena;
+    int i_out = sizeof(arena);
+
+    VLC_UNUSED(b_broken);
+    if( i_length > 255 )
+    {
+        i_out = ARIB_STR_MAX(i_length);
+        psz_buffer = malloc( i_out );
+        if( !psz_buffer )
             return NULL;
+    }
 
-    i_out = arib_str_decode( psz_instring, i_length, psz_outstring, i_out );
-    psz_outstring[i_out] = 0;
+    i_out = arib_str_decode( psz_instring, i_length, psz_buffer, i_out );
+
+    char *psz_outstring = malloc( i_out + 1 );
+    if( psz_outstring )
+    {
+        memcpy( psz_outstring, psz_buffer, i_out );
+        psz_outstring[i_out] = '\0';
+    }
+    if( psz_buffer != arena )
+        free( psz_buffer );
     return psz_outstring;
 #else
     /* Deal with no longer broken providers (no switch byte
@@ -2978,6 +4069,167 @@ static char *EITConvertToUTF8( const unsigned char *psz_instring,
 #endif
 }
 
+#if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
+/* Bounds the memory used on multiplexes carrying many services */
+#define TS_SECTIONS_MAX 65536
+
+static inline uint32_t PSISectionKey( uint8_t i_table_id, uint16_t i_extension,
+                                      uint8_t i_number )
+{
+    return ((uint32_t)i_table_id << 24) | ((uint32_t)i_extension << 8) |
+           i_number;
+}
+
+/* Returns the entry of the key, or the free one where it belongs */
+static ts_section_t *PSISectionFind( demux_sys_t *p_sys, uint32_t i_key )
+{
+    if( !p_sys->p_sections )
+        return NULL;
+
+    uint32_t i_hash = i_key * 0x9e3779b1;
+    for( int i = (i_hash ^ (i_hash >> 16)) & p_sys->i_sections_mask; ;
+         i = (i + 1) & p_sys->i_sections_mask )
+    {
+        ts_section_t *p_section = &p_sys->p_sections[i];
+        if( p_section->i_key == i_key || p_section->i_key == 0 )
+            return p_section;
+    }
+}
+
+static ts_section_t *PSISectionAdd( demux_sys_t *p_sys, uint32_t i_key )
+{
+    ts_section_t *p_section = PSISectionFind( p_sys, i_key );
+    if( p_section && p_section->i_key == i_key )
+        return p_section;
+
+    if( p_sys->i_sections >= TS_SECTIONS_MAX )
+    {
+        /* Start over, the sections will be decoded once more */
+        memset( p_sys->p_sections, 0,
+                (p_sys->i_sections_mask + 1) * sizeof(*p_sys->p_sections) );
+        p_sys->i_sections = 0;
+    }
+    else if( !p_sys->p_sections ||
+             2 * (p_sys->i_sections + 1) > p_sys->i_sections_mask + 1 )
+    {
+        /* Keep the table at most half full */
+        ts_section_t *p_old = p_sys->p_sections;
+        const int i_old = p_old ? p_sys->i_sections_mask + 1 : 0;
+        const int i_size = i_old ? 2 * i_old : 1024;
+
+        ts_section_t *p_new = calloc( i_size, sizeof(*p_new) );
+        if( !p_new )
+            return NULL;
+        p_sys->p_sections = p_new;
+        p_sys->i_sections_mask = i_size - 1;
+        for( int i = 0; i < i_old; i++ )
+        {
+            if( p_old[i].i_key )
+                *PSISectionFind( p_sys, p_old[i].i_key ) = p_old[i];
+        }
+        free( p_old );
+    }
+
+    p_section = PSISectionFind( p_sys, i_key );
+    p_section->i_key = i_key;
+    p_section->b_decoded = false;
+    p_sys->i_sections++;
+    return p_section;
+}
+
+/* The EIT and SDT sections are repeated unchanged all along, the ISDB EIT
+ * schedule alone carries 8 days of events. Such sections are dropped before
+ * dvbpsi rebuilds their table, but only once the table was sent: until then
+ * the decoder may still be missing some of them. */
+static void PSISectionGather( dvbpsi_t *handle, dvbpsi_psi_section_t *p_section )
+{
+    demux_t     *p_demux = (demux_t *)handle->p_sys;
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const uint8_t i_table_id = p_section->i_table_id;
+
+    if( p_section->b_syntax_indicator && p_section->b_current_next &&
+        ( i_table_id == 0x42 || i_table_id == 0x4e ||
+          ( i_table_id >= 0x50 && i_table_id <= 0x5f ) ) )
+    {
+        /* CRC_32 follows the payload, dvbpsi checked it already */
+        const uint32_t i_crc = GetDWBE( p_section->p_payload_end );
+        ts_section_t *p_seen =
+            PSISectionAdd( p_sys, PSISectionKey( i_table_id,
+                                                 p_section->i_extension,
+                                                 p_section->i_number ) );
+        if( p_seen )
+        {
+            const bool b_unchanged = p_seen->i_version == p_section->i_version &&
+                                     p_seen->i_crc == i_crc;
+            if( b_unchanged && p_seen->b_decoded )
+            {
+                p_sys->i_sections_skipped++;
+                dvbpsi_DeletePSISections( p_section );
+                return;
+            }
+            if( !b_unchanged )
+            {
+                p_seen->i_version = p_section->i_version;
+                p_seen->i_crc = i_crc;
+                p_seen->b_decoded = false;
+            }
+        }
+        p_sys->i_sections_decoded++;
+    }
+
+    dvbpsi_Demux( handle, p_section );
+}
+
+/* Called once dvbpsi sent a table built from the sections seen */
+static void PSISectionsDecoded( demux_sys_t *p_sys, uint8_t i_table_id,
+                                uint16_t i_extension, uint8_t i_version )
+{
+    for( int i = 0; i < 256; i++ )
+    {
+        ts_section_t *p_seen =
+            PSISectionFind( p_sys, PSISectionKey( i_table_id, i_extension, i ) );
+        if( p_seen && p_seen->i_key && p_seen->i_version == i_version )
+            p_seen->b_decoded = true;
+    }
+}
+#endif
+
+/* Sends the program guide kept for the transport stream, the EIT takes
+ * minutes to carry the whole schedule again */
+static void EPGCacheOpen( demux_t *p_demux, uint16_t i_network_id,
+                          uint16_t i_ts_id )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    if( !p_sys->b_epg_cache )
+        return;
+    if( p_sys->p_epg_cache )
+    {
+        if( p_sys->i_epg_cache_network_id == i_network_id &&
+            p_sys->i_epg_cache_ts_id == i_ts_id )
+            return;
+        vlc_epg_cache_Close( p_sys->p_epg_cache );
+    }
+
+    p_sys->p_epg_cache = vlc_epg_cache_Open( VLC_OBJECT(p_demux),
+                                             i_network_id, i_ts_id );
+    if( !p_sys->p_epg_cache )
+        return;
+    p_sys->i_epg_cache_network_id = i_network_id;
+    p_sys->i_epg_cache_ts_id = i_ts_id;
+
+    const vlc_epg_t *p_epg;
+    uint16_t i_service_id;
+    for( int i = 0;
+         (p_epg = vlc_epg_cache_Get( p_sys->p_epg_cache, i, &i_service_id ));
+         i++ )
+    {
+        if( p_epg->i_event > 0 )
+            es_out_Control( p_demux->out, ES_OUT_SET_GROUP_EPG,
+                            (int)i_service_id, p_epg );
+    }
+}
+
 static void SDTCallBack( demux_t *p_demux, dvbpsi_sdt_t *p_sdt )
 {
     demux_sys_t          *p_sys = p_demux->p_sys;
@@ -2985,6 +4237,10 @@ static void SDTCallBack( demux_t *p_demux, dvbpsi_sdt_t *p_sdt )
     dvbpsi_sdt_service_t *p_srv;
 
     msg_Dbg( p_demux, "SDTCallBack called" );
+#if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
+    PSISectionsDecoded( p_sys, p_sdt->i_table_id, p_sdt->i_extension,
+                        p_sdt->i_version );
+#endif
 
     if( sdt->psi->i_sdt_version != -1 &&
         ( !p_sdt->b_current_next ||
@@ -3112,6 +4368,12 @@ static void SDTCallBack( demux_t *p_demux, dvbpsi_sdt_t *p_sdt )
         vlc_meta_Delete( p_meta );
     }
 
+#if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
+    EPGCacheOpen( p_demux, p_sdt->i_network_id, p_sdt->i_extension );
+#else
+    EPGCacheOpen( p_demux, p_sdt->i_network_id, p_sdt->i_ts_id );
+#endif
+
     sdt->psi->i_sdt_version = p_sdt->i_version;
     dvbpsi_DeleteSDT( p_sdt );
 }
@@ -3193,6 +4455,10 @@ static void EITCallBack( demux_t *p_demux,
     vlc_epg_t *p_epg;
 
     msg_Dbg( p_demux, "EITCallBack called" );
+#if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
+    PSISectionsDecoded( p_sys, p_eit->i_table_id, p_eit->i_extension,
+                        p_eit->i_version );
+#endif
     if( !p_eit->b_current_next )
     {
         dvbpsi_DeleteEIT( p_eit );
@@ -3364,6 +4630,16 @@ static void EITCallBack( demux_t *p_demux,
                 p_sys->i_dvb_length = CLOCK_FREQ * p_epg->p_current->i_duration;
             }
         }
+        if( p_sys->p_epg_cache &&
+            p_eit->i_network_id == p_sys->i_epg_cache_network_id &&
+            p_eit->i_ts_id == p_sys->i_epg_cache_ts_id )
+            vlc_epg_cache_Update( p_sys->p_epg_cache,
+#if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
+                                  p_eit->i_extension,
+#else
+                                  p_eit->i_service_id,
+#endif
+                                  p_epg );
         es_out_Control( p_demux->out, ES_OUT_SET_GROUP_EPG,
 #if (DVBPSI_VERSION_INT >= DVBPSI_VERSION_WANTED(1,0,0))
                         p_eit->i_extension,
@@ -3728,8 +5004,8 @@ static void PMTSetupEsTeletext( demux_t *p_demux, ts_pid_t *pid,
                 p_es->id      = NULL;
                 p_es->p_data  = NULL;
                 p_es->i_data_size = 0;
-                p_es->i_data_gathered = 0;
-                p_es->pp_last = &p_es->p_data;
+                p_es->i_data_alloc = 0;
+                p_es->i_data_hint = 0;
                 p_es->data_type = TS_ES_DATA_PES;
                 p_es->p_mpeg4desc = NULL;
 
@@ -3813,8 +5089,8 @@ static void PMTSetupEsDvbSubtitle( demux_t *p_demux, ts_pid_t *pid,
                 p_es->id      = NULL;
                 p_es->p_data   = NULL;
                 p_es->i_data_size = 0;
-                p_es->i_data_gathered = 0;
-                p_es->pp_last = &p_es->p_data;
+                p_es->i_data_alloc = 0;
+                p_es->i_data_hint = 0;
                 p_es->data_type = TS_ES_DATA_PES;
                 p_es->p_mpeg4desc = NULL;
 
@@ -4210,16 +5486,15 @@ static int AttachECM( demux_t *p_demux, ts_prg_psi_t *prg, int i_pid )
         goto valid;
     }
 
-    if ( !p_sys->arib_card )
-        return 0;
-
-    if( p_sys->arib_card->get_init_status( p_sys->arib_card, &status ) < 0 )
+    if ( !p_sys->arib_cas )
         return 0;
 
     descrambler = create_multi2();
     if( !descrambler )
         return 0;
 
+    cas_worker_GetInitStatus( p_sys->arib_cas, &status );
+
     descrambler->set_system_key(descrambler, status.system_key);
     descrambler->set_init_cbc(descrambler, status.init_cbc);
     descrambler->set_round(descrambler, 4);
@@ -4254,12 +5529,17 @@ static int AttachECM( demux_t *p_demux, ts_prg_psi_t *prg, int i_pid )
 
     ecm->psi->handle = handle;
     ecm->psi->arib_descrambler = descrambler;
+    ecm->psi->b_arib_selected = false;
+    ecm->psi->i_arib_parity = -1;
+    ecm->psi->b_arib_key = false;
+    ecm->psi->b_arib_key_pending = false;
 
 valid:
     prg->i_pid_ecm = i_pid;
+    ARIBUpdateSelection( p_demux );
 
     if( ProgramIsSelected( p_demux, prg->i_number ) )
-        stream_Control( p_demux->s, STREAM_SET_PRIVATE_ID_STATE, i_pid, true );
+        SetPIDFilter( p_demux, i_pid, true );
 
     return 1;
 }
@@ -4276,10 +5556,7 @@ static void DetachECM( demux_t *p_demux, ts_prg_psi_t *prg )
         return;
 
     prg->i_pid_ecm = -1;
-
-    if( ProgramIsSelected( p_demux, prg->i_number ) )
-        stream_Control( p_demux->s, STREAM_SET_PRIVATE_ID_STATE, i_pid,
-			false );
+    ARIBUpdateSelection( p_demux );
 
     p_sys = p_demux->p_sys;
     ecm = &p_sys->pid[i_pid];
@@ -4294,6 +5571,8 @@ static void DetachECM( demux_t *p_demux, ts_prg_psi_t *prg )
         }
     }
 
+    /* Other programs may share the ECM PID, keep it until none refers to it */
+    SetPIDFilter( p_demux, i_pid, false );
     PIDClean( p_demux, ecm );
 }
 
@@ -4309,7 +5588,7 @@ static int AttachEMM( demux_t *p_demux, int i_pid )
 
     p_sys = p_demux->p_sys;
     emm = &p_sys->pid[i_pid];
-    if ( emm->b_valid )
+    if ( emm->b_valid || !p_sys->arib_cas )
         return 0;
 
     p_decoder = (emm_decoder_t *) dvbpsi_decoder_new( EMMCallBack, 1024, true,
@@ -4339,7 +5618,7 @@ static int AttachEMM( demux_t *p_demux, int i_pid )
 
     p_sys->i_pid_emm = i_pid;
 
-    stream_Control( p_demux->s, STREAM_SET_PRIVATE_ID_STATE, i_pid, true );
+    SetPIDFilter( p_demux, i_pid, true );
     return 1;
 }
 
@@ -4356,7 +5635,7 @@ static void DetachEMM( demux_t *p_demux )
     if ( i_pid < 0 )
         return;
 
-    stream_Control( p_demux->s, STREAM_SET_PRIVATE_ID_STATE, i_pid, false );
+    SetPIDFilter( p_demux, i_pid, false );
 
     PIDClean( p_demux, &p_sys->pid[i_pid] );
 
@@ -4406,6 +5685,9 @@ static void PMTCallBack( void *data, dvbpsi_pmt_t *p_pmt )
         return;
     }
 
+    /* The ES of the program are about to change */
+    SplitDrain( p_sys );
+
     ts_pid_t **pp_clean = NULL;
     int      i_clean = 0;
     /* Clean this program (remove all es) */
@@ -4452,7 +5734,7 @@ static void PMTCallBack( void *data, dvbpsi_pmt_t *p_pmt )
             msg_Dbg( p_demux, " * descriptor : CA (0x9) SysID 0x%x",
                     i_sysid );
 #ifdef HAVE_ARIB
-            if( i_sysid == 0x5 && p_sys->arib_card )
+            if( i_sysid == 0x5 && p_sys->arib_cas )
             {
                 i_pid_ecm = (((int)p_dr->p_data[2] << 8) & 0x1f00)
                              | p_dr->p_data[3];
@@ -4664,6 +5946,8 @@ static void PMTCallBack( void *data, dvbpsi_pmt_t *p_pmt )
     }
     if( i_clean )
         free( pp_clean );
+
+    PIDHotReset( p_sys );
 }
 
 static void PATCallBack( void *data, dvbpsi_pat_t *p_pat )
@@ -4687,6 +5971,8 @@ static void PATCallBack( void *data, dvbpsi_pat_t *p_pat )
     msg_Dbg( p_demux, "new PAT ts_id=%d version=%d current_next=%d",
              p_pat->i_ts_id, p_pat->i_version, p_pat->b_current_next );
 
+    SplitDrain( p_sys );
+
     /* Clean old */
     if( p_sys->i_pmt > 0 )
     {
@@ -4794,6 +6080,7 @@ static void PATCallBack( void *data, dvbpsi_pat_t *p_pat )
         prg->handle = dvbpsi_new( &dvbpsi_messages, DVBPSI_MSG_DEBUG );
         if( !prg->handle )
         {
+            PIDHotReset( p_sys );
             dvbpsi_DeletePAT( p_pat );
             return;
         }
@@ -4818,6 +6105,7 @@ static void PATCallBack( void *data, dvbpsi_pat_t *p_pat )
         }
     }
     pat->psi->i_pat_version = p_pat->i_version;
+    PIDHotReset( p_sys );
 
     dvbpsi_DeletePAT( p_pat );
 }
@@ -4852,7 +6140,7 @@ static void CATCallBack( void *data, dvbpsi_cat_t *p_cat )
             uint16_t i_sysid = ((uint16_t)p_dr->p_data[0] << 8)
                                 | p_dr->p_data[1];
             msg_Dbg( p_demux, "  * descriptor : CA (0x9) SysID 0x%x", i_sysid );
-            if( i_sysid == 0x5 && p_sys->arib_card )
+            if( i_sysid == 0x5 && p_sys->arib_cas )
             {
                 i_pid_emm = (((int)p_dr->p_data[2] << 8) & 0x1f00)
                              | p_dr->p_data[3];
@@ -4864,8 +6152,11 @@ static void CATCallBack( void *data, dvbpsi_cat_t *p_cat )
         }
     }
 
+    const int i_pid_emm_old = p_sys->i_pid_emm;
     DetachEMM( p_demux );
     AttachEMM( p_demux, i_pid_emm );
+    if( p_sys->i_pid_emm != i_pid_emm_old )
+        PIDHotReset( p_sys );
 
     cat->psi->i_cat_version = p_cat->i_version;
 
@@ -4879,7 +6170,7 @@ static void ECMCallBack( dvbpsi_t *handle, dvbpsi_psi_section_t *p_section)
 
     ecm_decoder_t *p_decoder = (ecm_decoder_t *)handle->p_decoder;
     ts_pid_t *ecm = &p_decoder->p_sys->pid[p_decoder->i_pid];
-    if ( !ecm->b_valid || !ecm->psi )
+    if ( !ecm->b_valid || !ecm->psi || !ecm->psi->b_arib_selected )
         goto out;
 
     if ( !p_section->b_current_next )
@@ -4890,24 +6181,15 @@ static void ECMCallBack( dvbpsi_t *handle, dvbpsi_psi_section_t *p_section)
           p_section->i_version == ecm->psi->i_ecm_version ) )
         goto out;
 
-    ecm->psi->i_ecm_version = p_section->i_version;
-
-    B_CAS_CARD *card = p_decoder->p_sys->arib_card;
-    B_CAS_ECM_RESULT result;
-    uint8_t *start = p_section->p_payload_start;
-    if ( card->
-         proc_ecm(card, &result, start, p_section->p_payload_end - start) < 0 )
-        goto out;
-
-    if ( result.return_code != 0x0800 && result.return_code != 0x0400 &&
-         result.return_code != 0x0200 )
+    if ( !ecm->psi->arib_descrambler )
         goto out;
 
-    MULTI2 *descrambler = ecm->psi->arib_descrambler;
-    if ( !descrambler )
-        goto out;
+    ecm->psi->i_ecm_version = p_section->i_version;
 
-    descrambler->set_scramble_key(descrambler, result.scramble_key);
+    /* The key is picked up by ARIBPollKeys() once the card answered */
+    uint8_t *start = p_section->p_payload_start;
+    cas_worker_PushECM( p_decoder->p_sys->arib_cas, p_decoder->i_pid,
+                        start, p_section->p_payload_end - start );
 
 out:
     dvbpsi_DeletePSISections(p_section);
@@ -4933,10 +6215,9 @@ static void EMMCallBack( dvbpsi_t *handle, dvbpsi_psi_section_t *p_section)
 
     emm->psi->i_emm_version = p_section->i_version;
 
-    B_CAS_CARD *card = p_decoder->p_sys->arib_card;
     uint8_t *start = p_section->p_payload_start;
-    if ( card->proc_emm(card, start, p_section->p_payload_end - start) < 0 )
-        goto out;
+    cas_worker_PushEMM( p_decoder->p_sys->arib_cas,
+                        start, p_section->p_payload_end - start );
 
 out:
     dvbpsi_DeletePSISections(p_section);
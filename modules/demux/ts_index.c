@@ -0,0 +1,595 @@
+/*****************************************************************************
+ * ts_index.c: persistent PCR/position seek index for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include <vlc_common.h>
+#include <vlc_demux.h>
+#include <vlc_fs.h>
+#include <vlc_md5.h>
+
+#include "ts_index.h"
+
+/* Packets read at once by the indexing thread */
+#define TS_INDEX_CHUNK 512
+/* Minimal PCR distance between two plain PCR entries (1s) */
+#define TS_INDEX_PCR_STEP 90000
+/* How far before the target a random access point is still used (5s) */
+#define TS_INDEX_RAP_RANGE (5 * 90000)
+
+/* Bounds of the index directory, the least recently stored indexes are
+ * removed first */
+#define TS_INDEX_DIR_SIZE_MAX (INT64_C(64) << 20)
+#define TS_INDEX_DIR_AGE_MAX  (90 * 24 * 3600)
+
+#define TS_INDEX_MAGIC "VLCTSIX1"
+#define TS_INDEX_HEADER_SIZE 80
+#define TS_INDEX_RAP_FLAG (UINT64_C(1) << 63)
+
+typedef struct
+{
+    int64_t i_pos;
+    mtime_t i_pcr;
+    bool    b_rap;
+} ts_index_entry_t;
+
+struct ts_index_t
+{
+    vlc_object_t *p_obj;
+    char         *psz_index;
+    char         *psz_url;
+
+    /* identifies the indexed file */
+    int64_t      i_size;
+    int64_t      i_mtime;
+    int          i_packet_size;
+    int          i_header;
+    int          i_pid_pcr;
+    uint8_t      video_pids[8192 / 8];
+
+    vlc_mutex_t  lock;
+    ts_index_entry_t *p_entries;
+    size_t       i_entries;
+    size_t       i_alloc;
+    bool         b_complete;
+    bool         b_dirty;
+    bool         b_stop;
+
+    /* indexing state, saved with the index to resume */
+    int64_t      i_end;
+    mtime_t      i_wrap;
+    mtime_t      i_last_raw_pcr;
+    mtime_t      i_last_pcr;       /* last PCR entry */
+
+    vlc_thread_t thread;
+    bool         b_thread;
+};
+
+static int Append( ts_index_t *p_index, int64_t i_pos, mtime_t i_pcr,
+                   bool b_rap )
+{
+    if( p_index->i_entries >= p_index->i_alloc )
+    {
+        size_t i_alloc = p_index->i_alloc ? 2 * p_index->i_alloc : 1024;
+        ts_index_entry_t *p_entries = realloc( p_index->p_entries,
+                                               i_alloc * sizeof(*p_entries) );
+        if( !p_entries )
+            return VLC_ENOMEM;
+        p_index->p_entries = p_entries;
+        p_index->i_alloc = i_alloc;
+    }
+
+    ts_index_entry_t *p_entry = &p_index->p_entries[p_index->i_entries++];
+    p_entry->i_pos = i_pos;
+    p_entry->i_pcr = i_pcr;
+    p_entry->b_rap = b_rap;
+    if( !b_rap )
+        p_index->i_last_pcr = i_pcr;
+    p_index->b_dirty = true;
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * Index file
+ *****************************************************************************/
+
+/* The index of a file lives in the user cache directory, named after the
+ * MD5 of the file path. The size and modification time of the indexed file
+ * are checked by Load(), so a modified file is indexed again and its index
+ * replaced. Prune() bounds the directory each time an index is stored. */
+static char *GetIndexPath( const char *psz_file )
+{
+    char *psz_dir = config_GetUserDir( VLC_CACHE_DIR );
+    if( !psz_dir )
+        return NULL;
+    vlc_mkdir( psz_dir, 0700 );
+
+    char *psz_index_dir;
+    if( asprintf( &psz_index_dir, "%s" DIR_SEP "tsindex", psz_dir ) == -1 )
+        psz_index_dir = NULL;
+    free( psz_dir );
+    if( !psz_index_dir )
+        return NULL;
+    vlc_mkdir( psz_index_dir, 0700 );
+
+    struct md5_s md5;
+    InitMD5( &md5 );
+    AddMD5( &md5, psz_file, strlen( psz_file ) );
+    EndMD5( &md5 );
+
+    char *psz_md5 = psz_md5_hash( &md5 );
+    char *psz_index;
+    if( !psz_md5 ||
+        asprintf( &psz_index, "%s" DIR_SEP "%s.idx", psz_index_dir,
+                  psz_md5 ) == -1 )
+        psz_index = NULL;
+    free( psz_md5 );
+    free( psz_index_dir );
+    return psz_index;
+}
+
+static void Load( ts_index_t *p_index )
+{
+    FILE *f = vlc_fopen( p_index->psz_index, "rb" );
+    if( !f )
+        return;
+
+    uint8_t header[TS_INDEX_HEADER_SIZE];
+    if( fread( header, 1, sizeof(header), f ) != sizeof(header) ||
+        memcmp( header, TS_INDEX_MAGIC, 8 ) ||
+        (int64_t)GetQWLE( &header[8] ) != p_index->i_size ||
+        (int64_t)GetQWLE( &header[16] ) != p_index->i_mtime ||
+        (int)GetDWLE( &header[24] ) != p_index->i_packet_size ||
+        (int)GetDWLE( &header[28] ) != p_index->i_header ||
+        (int)GetDWLE( &header[32] ) != p_index->i_pid_pcr )
+    {
+        msg_Dbg( p_index->p_obj, "ignoring outdated seek index %s",
+                 p_index->psz_index );
+        fclose( f );
+        return;
+    }
+
+    const bool b_complete = GetDWLE( &header[36] ) != 0;
+    const int64_t i_end = GetQWLE( &header[40] );
+    const mtime_t i_wrap = GetQWLE( &header[48] );
+    const mtime_t i_last_raw_pcr = GetQWLE( &header[56] );
+    const mtime_t i_last_pcr = GetQWLE( &header[64] );
+    const uint64_t i_count = GetQWLE( &header[72] );
+
+    for( uint64_t i = 0; i < i_count; i++ )
+    {
+        uint8_t entry[16];
+        if( fread( entry, 1, sizeof(entry), f ) != sizeof(entry) )
+            goto error;
+
+        const uint64_t i_pos = GetQWLE( &entry[0] );
+        if( Append( p_index, i_pos & ~TS_INDEX_RAP_FLAG, GetQWLE( &entry[8] ),
+                    (i_pos & TS_INDEX_RAP_FLAG) != 0 ) )
+            goto error;
+    }
+    fclose( f );
+
+    p_index->b_complete = b_complete;
+    p_index->i_end = i_end;
+    p_index->i_wrap = i_wrap;
+    p_index->i_last_raw_pcr = i_last_raw_pcr;
+    p_index->i_last_pcr = i_last_pcr;
+    p_index->b_dirty = false;
+    msg_Dbg( p_index->p_obj, "loaded seek index %s (%zu entries%s)",
+             p_index->psz_index, p_index->i_entries,
+             b_complete ? "" : ", incomplete" );
+    return;
+
+error:
+    msg_Warn( p_index->p_obj, "invalid seek index %s", p_index->psz_index );
+    fclose( f );
+    p_index->i_entries = 0;
+    p_index->i_last_pcr = -1;
+}
+
+typedef struct
+{
+    char    *psz_path;
+    time_t  i_mtime;
+    int64_t i_size;
+} ts_index_file_t;
+
+static int CompareNewer( const void *a, const void *b )
+{
+    const ts_index_file_t *p_a = a, *p_b = b;
+
+    return p_a->i_mtime < p_b->i_mtime ? 1 : p_a->i_mtime > p_b->i_mtime ? -1 : 0;
+}
+
+/* Removes the indexes stored too long ago, then the oldest ones until the
+ * directory fits its size bound */
+static void Prune( ts_index_t *p_index )
+{
+    char *psz_dir = strdup( p_index->psz_index );
+    char *psz_sep = psz_dir ? strrchr( psz_dir, DIR_SEP_CHAR ) : NULL;
+    if( !psz_sep )
+    {
+        free( psz_dir );
+        return;
+    }
+    *psz_sep = '\0';
+
+    DIR *dir = vlc_opendir( psz_dir );
+    if( !dir )
+    {
+        free( psz_dir );
+        return;
+    }
+
+    ts_index_file_t *p_files = NULL;
+    size_t i_files = 0, i_alloc = 0;
+    const char *psz_name;
+    while( ( psz_name = vlc_readdir( dir ) ) != NULL )
+    {
+        const size_t i_name = strlen( psz_name );
+        if( i_name < 4 || strcmp( &psz_name[i_name - 4], ".idx" ) )
+            continue;
+
+        if( i_files >= i_alloc )
+        {
+            const size_t i_new = i_alloc ? 2 * i_alloc : 64;
+            ts_index_file_t *p_new = realloc( p_files, i_new * sizeof(*p_new) );
+            if( !p_new )
+                break;
+            p_files = p_new;
+            i_alloc = i_new;
+        }
+
+        ts_index_file_t *p_file = &p_files[i_files];
+        struct stat st;
+        if( asprintf( &p_file->psz_path, "%s" DIR_SEP "%s", psz_dir,
+                      psz_name ) == -1 )
+            break;
+        if( vlc_stat( p_file->psz_path, &st ) )
+        {
+            free( p_file->psz_path );
+            continue;
+        }
+        p_file->i_mtime = st.st_mtime;
+        p_file->i_size = st.st_size;
+        i_files++;
+    }
+    closedir( dir );
+    free( psz_dir );
+
+    if( i_files > 0 )
+        qsort( p_files, i_files, sizeof(*p_files), CompareNewer );
+
+    const time_t i_oldest = time( NULL ) - TS_INDEX_DIR_AGE_MAX;
+    int64_t i_total = 0;
+    for( size_t i = 0; i < i_files; i++ )
+    {
+        i_total += p_files[i].i_size;
+        if( ( i_total > TS_INDEX_DIR_SIZE_MAX || p_files[i].i_mtime < i_oldest )
+         && strcmp( p_files[i].psz_path, p_index->psz_index ) )
+        {
+            msg_Dbg( p_index->p_obj, "removing seek index %s",
+                     p_files[i].psz_path );
+            vlc_unlink( p_files[i].psz_path );
+            i_total -= p_files[i].i_size;
+        }
+        free( p_files[i].psz_path );
+    }
+    free( p_files );
+}
+
+static void Save( ts_index_t *p_index )
+{
+    char *psz_tmp;
+    if( asprintf( &psz_tmp, "%s.part", p_index->psz_index ) == -1 )
+        return;
+
+    FILE *f = vlc_fopen( psz_tmp, "wb" );
+    if( !f )
+    {
+        msg_Dbg( p_index->p_obj, "cannot store the seek index into %s",
+                 psz_tmp );
+        free( psz_tmp );
+        return;
+    }
+
+    uint8_t header[TS_INDEX_HEADER_SIZE];
+    memcpy( header, TS_INDEX_MAGIC, 8 );
+    SetQWLE( &header[8], p_index->i_size );
+    SetQWLE( &header[16], p_index->i_mtime );
+    SetDWLE( &header[24], p_index->i_packet_size );
+    SetDWLE( &header[28], p_index->i_header );
+    SetDWLE( &header[32], p_index->i_pid_pcr );
+    SetDWLE( &header[36], p_index->b_complete );
+    SetQWLE( &header[40], p_index->i_end );
+    SetQWLE( &header[48], p_index->i_wrap );
+    SetQWLE( &header[56], p_index->i_last_raw_pcr );
+    SetQWLE( &header[64], p_index->i_last_pcr );
+    SetQWLE( &header[72], p_index->i_entries );
+    bool b_error = fwrite( header, 1, sizeof(header), f ) != sizeof(header);
+
+    for( size_t i = 0; i < p_index->i_entries && !b_error; i++ )
+    {
+        const ts_index_entry_t *p_entry = &p_index->p_entries[i];
+        uint8_t entry[16];
+
+        SetQWLE( &entry[0], p_entry->i_pos |
+                            (p_entry->b_rap ? TS_INDEX_RAP_FLAG : 0) );
+        SetQWLE( &entry[8], p_entry->i_pcr );
+        b_error = fwrite( entry, 1, sizeof(entry), f ) != sizeof(entry);
+    }
+
+    if( fclose( f ) || b_error ||
+        vlc_rename( psz_tmp, p_index->psz_index ) )
+    {
+        msg_Warn( p_index->p_obj, "cannot store the seek index into %s",
+                  p_index->psz_index );
+        vlc_unlink( psz_tmp );
+    }
+    else
+        Prune( p_index );
+    free( psz_tmp );
+}
+
+/*****************************************************************************
+ * Indexing thread
+ *****************************************************************************/
+static mtime_t GetPCR( const uint8_t *p )
+{
+    if( !( p[3]&0x20 ) || p[4] < 7 || !( p[5]&0x10 ) )
+        return -1;
+
+    /* PCR is 33 bits */
+    return ( (mtime_t)p[6] << 25 ) | ( (mtime_t)p[7] << 17 ) |
+           ( (mtime_t)p[8] << 9 ) | ( (mtime_t)p[9] << 1 ) |
+           ( (mtime_t)p[10] >> 7 );
+}
+
+/* Indexes the packets of a chunk starting at i_pos, returns the number of
+ * bytes processed, which is less than i_buffer if synchronization was lost */
+static size_t IndexChunk( ts_index_t *p_index, const uint8_t *p_buffer,
+                          size_t i_buffer, int64_t i_pos )
+{
+    const size_t i_size = p_index->i_packet_size;
+    size_t i_offset;
+
+    for( i_offset = 0; i_offset + i_size <= i_buffer; i_offset += i_size )
+    {
+        const uint8_t *p = &p_buffer[i_offset + p_index->i_header];
+
+        if( p[0] != 0x47 )
+        {
+            /* Skip to the next sync byte, the caller seeks there */
+            const uint8_t *p_sync = memchr( &p[1], 0x47,
+                                            &p_buffer[i_buffer] - &p[1] );
+            if( !p_sync )
+                return i_offset + 1;
+            return p_sync - p_buffer - p_index->i_header;
+        }
+
+        const int i_pid = ((p[1]&0x1f)<<8)|p[2];
+        if( i_pid == p_index->i_pid_pcr )
+        {
+            const mtime_t i_raw_pcr = GetPCR( p );
+            if( i_raw_pcr >= 0 )
+            {
+                /* Only large leaps back are wrap arounds */
+                if( p_index->i_last_raw_pcr >= 0 &&
+                    i_raw_pcr + INT64_C(0x100000000) < p_index->i_last_raw_pcr )
+                    p_index->i_wrap += 0x1FFFFFFFF;
+                p_index->i_last_raw_pcr = i_raw_pcr;
+
+                /* Entries are kept sorted: nothing is indexed after a
+                 * discontinuity until the PCR gets past the last entry */
+                const mtime_t i_pcr = i_raw_pcr + p_index->i_wrap;
+                if( p_index->i_last_pcr < 0 ||
+                    i_pcr - p_index->i_last_pcr >= TS_INDEX_PCR_STEP )
+                    Append( p_index, i_pos + i_offset, i_pcr, false );
+            }
+        }
+
+        /* Random access point: video payload start flagged in the
+         * adaptation field, the payload may be scrambled */
+        if( ( p[1]&0x40 ) && ( p[3]&0x20 ) && p[4] > 0 && ( p[5]&0x40 ) &&
+            ( p_index->video_pids[i_pid >> 3] & (1 << (i_pid & 7)) ) &&
+            p_index->i_last_pcr >= 0 &&
+            p_index->i_last_raw_pcr + p_index->i_wrap >= p_index->i_last_pcr )
+            Append( p_index, i_pos + i_offset,
+                    p_index->i_last_raw_pcr + p_index->i_wrap, true );
+    }
+    return i_offset;
+}
+
+static void *Run( void *data )
+{
+    ts_index_t *p_index = data;
+    const size_t i_chunk = TS_INDEX_CHUNK * p_index->i_packet_size;
+
+    uint8_t *p_buffer = malloc( i_chunk );
+    if( !p_buffer )
+        return NULL;
+
+    stream_t *s = stream_UrlNew( p_index->p_obj, p_index->psz_url );
+    if( !s )
+    {
+        free( p_buffer );
+        return NULL;
+    }
+
+    /* Only this thread modifies the indexing state */
+    int64_t i_pos = p_index->i_end;
+    if( stream_Seek( s, i_pos ) )
+        goto end;
+
+    msg_Dbg( p_index->p_obj, "indexing from %"PRId64, i_pos );
+    for( ;; )
+    {
+        const int i_read = stream_Read( s, p_buffer, i_chunk );
+
+        vlc_mutex_lock( &p_index->lock );
+        if( p_index->b_stop )
+        {
+            vlc_mutex_unlock( &p_index->lock );
+            break;
+        }
+        if( i_read < p_index->i_packet_size )
+        {
+            p_index->b_complete = true;
+            p_index->b_dirty = true;
+            vlc_mutex_unlock( &p_index->lock );
+            msg_Dbg( p_index->p_obj, "indexing completed (%zu entries)",
+                     p_index->i_entries );
+            break;
+        }
+
+        const size_t i_done = IndexChunk( p_index, p_buffer, i_read, i_pos );
+        i_pos += i_done;
+        p_index->i_end = i_pos;
+        vlc_mutex_unlock( &p_index->lock );
+
+        if( i_done != (size_t)i_read && stream_Seek( s, i_pos ) )
+            break;
+    }
+
+end:
+    stream_Delete( s );
+    free( p_buffer );
+    return NULL;
+}
+
+/*****************************************************************************
+ * API
+ *****************************************************************************/
+ts_index_t *ts_index_New( demux_t *p_demux, int i_packet_size,
+                          int i_packet_header_size, int i_pid_pcr,
+                          const uint16_t *pi_video_pid, int i_video_pid )
+{
+    struct stat st;
+
+    if( !p_demux->psz_file || vlc_stat( p_demux->psz_file, &st ) )
+        return NULL;
+
+    ts_index_t *p_index = calloc( 1, sizeof(*p_index) );
+    if( !p_index )
+        return NULL;
+
+    p_index->psz_index = GetIndexPath( p_demux->psz_file );
+    if( asprintf( &p_index->psz_url, "%s://%s", p_demux->psz_access,
+                  p_demux->psz_location ) == -1 )
+        p_index->psz_url = NULL;
+    if( !p_index->psz_index || !p_index->psz_url )
+    {
+        free( p_index->psz_index );
+        free( p_index->psz_url );
+        free( p_index );
+        return NULL;
+    }
+
+    p_index->p_obj = VLC_OBJECT(p_demux);
+    p_index->i_size = st.st_size;
+    p_index->i_mtime = st.st_mtime;
+    p_index->i_packet_size = i_packet_size;
+    p_index->i_header = i_packet_header_size;
+    p_index->i_pid_pcr = i_pid_pcr;
+    for( int i = 0; i < i_video_pid; i++ )
+        p_index->video_pids[pi_video_pid[i] >> 3] |= 1 << (pi_video_pid[i] & 7);
+
+    vlc_mutex_init( &p_index->lock );
+    p_index->i_last_raw_pcr = -1;
+    p_index->i_last_pcr = -1;
+
+    Load( p_index );
+
+    if( !p_index->b_complete )
+        p_index->b_thread = !vlc_clone( &p_index->thread, Run, p_index,
+                                        VLC_THREAD_PRIORITY_LOW );
+    return p_index;
+}
+
+void ts_index_Delete( ts_index_t *p_index )
+{
+    if( p_index->b_thread )
+    {
+        vlc_mutex_lock( &p_index->lock );
+        p_index->b_stop = true;
+        vlc_mutex_unlock( &p_index->lock );
+        vlc_join( p_index->thread, NULL );
+    }
+
+    if( p_index->b_dirty )
+        Save( p_index );
+
+    vlc_mutex_destroy( &p_index->lock );
+    free( p_index->p_entries );
+    free( p_index->psz_index );
+    free( p_index->psz_url );
+    free( p_index );
+}
+
+int ts_index_Lookup( ts_index_t *p_index, mtime_t i_pcr,
+                     int64_t *pi_pos, mtime_t *pi_pcr )
+{
+    int i_ret = VLC_EGENERIC;
+
+    vlc_mutex_lock( &p_index->lock );
+
+    const ts_index_entry_t *p_entries = p_index->p_entries;
+    size_t i_entries = p_index->i_entries;
+
+    /* Past the indexed part, the next entry is unknown yet */
+    if( i_entries == 0 || p_entries[0].i_pcr > i_pcr ||
+        ( !p_index->b_complete && p_index->i_last_pcr < i_pcr ) )
+        goto end;
+
+    /* Last entry at or before the target */
+    size_t i_low = 0, i_high = i_entries;
+    while( i_high - i_low > 1 )
+    {
+        const size_t i_mid = i_low + (i_high - i_low) / 2;
+        if( p_entries[i_mid].i_pcr <= i_pcr )
+            i_low = i_mid;
+        else
+            i_high = i_mid;
+    }
+
+    const ts_index_entry_t *p_found = &p_entries[i_low];
+    for( size_t i = i_low + 1; i-- > 0; )
+    {
+        if( i_pcr - p_entries[i].i_pcr > TS_INDEX_RAP_RANGE )
+            break;
+        if( p_entries[i].b_rap )
+        {
+            p_found = &p_entries[i];
+            break;
+        }
+    }
+
+    *pi_pos = p_found->i_pos;
+    *pi_pcr = p_found->i_pcr;
+    i_ret = VLC_SUCCESS;
+end:
+    vlc_mutex_unlock( &p_index->lock );
+    return i_ret;
+}
@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * ts_index.h: persistent PCR/position seek index for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _TS_INDEX_H
+#define _TS_INDEX_H 1
+
+/**
+ * Index of the PCR and of the random access points (video packets with the
+ * random_access_indicator set) of a TS file, stored in the user cache
+ * directory. Whatever is not indexed yet is read by a low priority thread
+ * through a stream of its own; an interrupted pass resumes where it stopped
+ * the next time the file is opened.
+ *
+ * PCR are in 90kHz units and adjusted for wrap arounds the same way as
+ * AdjustPCRWrapAround() does, starting from the first PCR of the file.
+ */
+typedef struct ts_index_t ts_index_t;
+
+ts_index_t *ts_index_New( demux_t *, int i_packet_size,
+                          int i_packet_header_size, int i_pid_pcr,
+                          const uint16_t *pi_video_pid, int i_video_pid );
+void        ts_index_Delete( ts_index_t * );
+
+/* Finds where to resume to reach a PCR: a random access point at most a few
+ * seconds before it when there is one, or the last indexed PCR before it.
+ * Fails if that part of the file is not indexed yet. */
+int ts_index_Lookup( ts_index_t *, mtime_t i_pcr,
+                     int64_t *pi_pos, mtime_t *pi_pcr );
+
+#endif /* _TS_INDEX_H */
@@ -0,0 +1,224 @@
+/*****************************************************************************
+ * ts_rs.c: Reed-Solomon (204,188) error correction for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <vlc_common.h>
+
+#include "ts_rs.h"
+
+#define RS_PARITY 16    /* 2t */
+#define RS_POLY   0x11d
+
+struct ts_rs_t
+{
+    uint8_t  exp[512];  /* doubled, so that log sums need no modulo */
+    uint8_t  log[256];
+    /* x^16 mod g times each byte, as coefficients x^15..x^8 and x^7..x^0,
+     * the highest degree in the most significant byte */
+    uint64_t mod_hi[256];
+    uint64_t mod_lo[256];
+};
+
+static inline uint8_t Mul( const ts_rs_t *rs, uint8_t a, uint8_t b )
+{
+    if( a == 0 || b == 0 )
+        return 0;
+    return rs->exp[rs->log[a] + rs->log[b]];
+}
+
+ts_rs_t *ts_rs_New( void )
+{
+    ts_rs_t *rs = malloc( sizeof(*rs) );
+    if( !rs )
+        return NULL;
+
+    unsigned x = 1;
+    for( int i = 0; i < 255; i++ )
+    {
+        rs->exp[i] = rs->exp[i + 255] = x;
+        rs->log[x] = i;
+        x <<= 1;
+        if( x & 0x100 )
+            x ^= RS_POLY;
+    }
+    rs->exp[510] = rs->exp[511] = rs->exp[0];
+    rs->log[0] = 0; /* unused */
+
+    /* g(x) = (x + a^0)(x + a^1)...(x + a^15), g[i] of x^i */
+    uint8_t g[RS_PARITY + 1] = { 1 };
+    for( int i = 0; i < RS_PARITY; i++ )
+    {
+        for( int j = i + 1; j > 0; j-- )
+            g[j] = g[j - 1] ^ Mul( rs, g[j], rs->exp[i] );
+        g[0] = Mul( rs, g[0], rs->exp[i] );
+    }
+
+    /* x^16 = g[15]x^15 + ... + g[0] modulo g */
+    for( int b = 0; b < 256; b++ )
+    {
+        uint64_t hi = 0, lo = 0;
+        for( int i = 0; i < 8; i++ )
+        {
+            hi |= (uint64_t)Mul( rs, b, g[8 + i] ) << (8 * i);
+            lo |= (uint64_t)Mul( rs, b, g[i] ) << (8 * i);
+        }
+        rs->mod_hi[b] = hi;
+        rs->mod_lo[b] = lo;
+    }
+    return rs;
+}
+
+void ts_rs_Delete( ts_rs_t *rs )
+{
+    free( rs );
+}
+
+/* Remainder of the division of the bytes, highest degree first, by g.
+ * The 16 parity bytes are kept in two 64-bit words, so that an intact
+ * packet costs one table lookup per byte and no syndrome computation. */
+static void Remainder( const ts_rs_t *rs, const uint8_t *p, size_t i,
+                       uint64_t *p_hi, uint64_t *p_lo )
+{
+    uint64_t hi = 0, lo = 0;
+
+    while( i-- > 0 )
+    {
+        const uint8_t fb = hi >> 56;
+        hi = (hi << 8) | (lo >> 56);
+        lo = (lo << 8) | *p++;
+        hi ^= rs->mod_hi[fb];
+        lo ^= rs->mod_lo[fb];
+    }
+    *p_hi = hi;
+    *p_lo = lo;
+}
+
+int ts_rs_Correct( const ts_rs_t *rs, uint8_t *p )
+{
+    uint64_t hi, lo;
+
+    Remainder( rs, p, TS_RS_PACKET_SIZE, &hi, &lo );
+    if( hi == 0 && lo == 0 )
+        return 0;
+
+    /* Syndromes: the remainder at the roots of g, a^0..a^15 */
+    uint8_t r[RS_PARITY];
+    for( int i = 0; i < 8; i++ )
+    {
+        r[i] = lo >> (8 * i);
+        r[8 + i] = hi >> (8 * i);
+    }
+    uint8_t s[RS_PARITY];
+    for( int j = 0; j < RS_PARITY; j++ )
+    {
+        uint8_t v = 0;
+        for( int i = RS_PARITY - 1; i >= 0; i-- )
+            v = Mul( rs, v, rs->exp[j] ) ^ r[i];
+        s[j] = v;
+    }
+
+    /* Berlekamp-Massey: error locator lambda */
+    uint8_t lambda[RS_PARITY + 1] = { 1 }, prev[RS_PARITY + 1] = { 1 };
+    int l = 0, m = 1;
+    uint8_t b = 1;
+    for( int n = 0; n < RS_PARITY; n++ )
+    {
+        uint8_t d = s[n];
+        for( int i = 1; i <= l; i++ )
+            d ^= Mul( rs, lambda[i], s[n - i] );
+        if( d == 0 )
+        {
+            m++;
+            continue;
+        }
+
+        const uint8_t coef = rs->exp[rs->log[d] + 255 - rs->log[b]];
+        uint8_t t[RS_PARITY + 1];
+        memcpy( t, lambda, sizeof(t) );
+        for( int i = 0; i + m <= RS_PARITY; i++ )
+            lambda[i + m] ^= Mul( rs, coef, prev[i] );
+        if( 2 * l <= n )
+        {
+            l = n + 1 - l;
+            memcpy( prev, t, sizeof(prev) );
+            b = d;
+            m = 1;
+        }
+        else
+            m++;
+    }
+    if( l > RS_PARITY / 2 )
+        return -1;
+
+    /* Evaluator omega = s * lambda mod x^16 */
+    uint8_t omega[RS_PARITY];
+    for( int i = 0; i < RS_PARITY; i++ )
+    {
+        uint8_t v = 0;
+        for( int j = 0; j <= i && j <= l; j++ )
+            v ^= Mul( rs, lambda[j], s[i - j] );
+        omega[i] = v;
+    }
+
+    /* Chien search over the 204 positions of the shortened code: byte k
+     * holds the coefficient of x^(203-k), its locator is a^(203-k) */
+    int pi_pos[RS_PARITY / 2];
+    uint8_t pi_val[RS_PARITY / 2];
+    int i_found = 0;
+    for( int k = 0; k < TS_RS_PACKET_SIZE; k++ )
+    {
+        const int i_deg = TS_RS_PACKET_SIZE - 1 - k;
+        const int i_inv = (255 - i_deg) % 255;   /* log of X^-1 */
+
+        uint8_t v = 0;
+        for( int i = l; i >= 0; i-- )
+            v = Mul( rs, v, rs->exp[i_inv] ) ^ lambda[i];
+        if( v != 0 )
+            continue;
+        if( i_found == l )
+            return -1;
+
+        /* Forney, first root a^0: e = X * omega(X^-1) / lambda'(X^-1) */
+        uint8_t num = 0, den = 0;
+        for( int i = RS_PARITY - 1; i >= 0; i-- )
+            num = Mul( rs, num, rs->exp[i_inv] ) ^ omega[i];
+        for( int i = 1; i <= l; i += 2 ) /* odd terms only in GF(2^n) */
+            den ^= Mul( rs, lambda[i], rs->exp[(i_inv * (i - 1)) % 255] );
+        if( den == 0 )
+            return -1;
+
+        pi_pos[i_found] = k;
+        pi_val[i_found] = Mul( rs, rs->exp[i_deg],
+                               rs->exp[rs->log[num] + 255 - rs->log[den]] );
+        if( num == 0 )
+            pi_val[i_found] = 0;
+        i_found++;
+    }
+    /* Roots outside the packet: more errors than the code can tell */
+    if( i_found != l )
+        return -1;
+
+    for( int i = 0; i < i_found; i++ )
+        p[pi_pos[i]] ^= pi_val[i];
+    return i_found;
+}
@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * ts_rs.h: Reed-Solomon (204,188) error correction for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _TS_RS_H
+#define _TS_RS_H 1
+
+/**
+ * Decoder of the RS(204,188, t=8) code of 204 bytes packets, shortened from
+ * RS(255,239) over GF(256) with the polynomial x^8+x^4+x^3+x^2+1. The 16
+ * parity bytes follow the 188 bytes of the packet, as ISDB-T sends them.
+ *
+ * Intact packets are told apart by dividing them by the generator, 8 bytes
+ * of remainder at a time with a 256 entries table. Only damaged ones go
+ * through the syndromes, Berlekamp-Massey, Chien search and Forney.
+ */
+typedef struct ts_rs_t ts_rs_t;
+
+#define TS_RS_PACKET_SIZE 204
+
+ts_rs_t *ts_rs_New( void );
+void     ts_rs_Delete( ts_rs_t * );
+
+/**
+ * Repairs a 204 bytes packet in place.
+ * \return the number of bytes repaired (0 if it was intact), or -1 if it
+ * has too many errors, in which case it is left untouched
+ */
+int ts_rs_Correct( const ts_rs_t *, uint8_t *p_packet );
+
+#endif /* _TS_RS_H */
@@ -0,0 +1,141 @@
+/*****************************************************************************
+ * ts_sync.c: TS sync byte search for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+
+#include <vlc_common.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "ts_sync.h"
+
+#define TS_SYNC_WORDS (TS_SYNC_WINDOW / 64)
+
+/* Sets the bits of the positions of the sync bytes */
+static void BuildBitmap( uint64_t *p_bits, const uint8_t *p, size_t i_buffer )
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i sync = _mm_set1_epi8( 0x47 );
+
+    for( ; i + 64 <= i_buffer; i += 64 )
+    {
+        const __m128i *v = (const __m128i *)&p[i];
+        uint64_t m0 = _mm_movemask_epi8(
+                _mm_cmpeq_epi8( _mm_loadu_si128( &v[0] ), sync ) );
+        uint64_t m1 = _mm_movemask_epi8(
+                _mm_cmpeq_epi8( _mm_loadu_si128( &v[1] ), sync ) );
+        uint64_t m2 = _mm_movemask_epi8(
+                _mm_cmpeq_epi8( _mm_loadu_si128( &v[2] ), sync ) );
+        uint64_t m3 = _mm_movemask_epi8(
+                _mm_cmpeq_epi8( _mm_loadu_si128( &v[3] ), sync ) );
+        p_bits[i / 64] = m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+    }
+#endif
+    for( ; i < i_buffer; i += 64 )
+    {
+        const size_t i_end = __MIN( i + 64, i_buffer );
+        uint64_t m = 0;
+
+        for( size_t j = i; j < i_end; j++ )
+            m |= (uint64_t)(p[j] == 0x47) << (j - i);
+        p_bits[i / 64] = m;
+    }
+}
+
+/* 64 bits of the bitmap starting at any position, zeros past its end */
+static inline uint64_t GetBits( const uint64_t *p_bits, size_t i_words,
+                                size_t i_pos )
+{
+    const size_t q = i_pos / 64, r = i_pos % 64;
+    uint64_t v = 0;
+
+    if( q < i_words )
+        v = p_bits[q] >> r;
+    if( r > 0 && q + 1 < i_words )
+        v |= p_bits[q + 1] << (64 - r);
+    return v;
+}
+
+static inline unsigned ctz64( uint64_t v )
+{
+    return (uint32_t)v ? ctz( (uint32_t)v ) : 32 + ctz( v >> 32 );
+}
+
+int ts_sync_Find( const uint8_t *p, size_t i_buffer, size_t i_max,
+                  const unsigned *pi_size, unsigned i_sizes,
+                  unsigned i_lock, unsigned *pi_found )
+{
+    uint64_t p_bits[TS_SYNC_WORDS];
+
+    assert( i_lock > 0 );
+    i_buffer = __MIN( i_buffer, TS_SYNC_WINDOW );
+    if( i_buffer == 0 )
+        return -1;
+
+    const size_t i_words = (i_buffer + 63) / 64;
+    BuildBitmap( p_bits, p, i_buffer );
+
+    /* The runs of each size which fit in the buffer start before i_end */
+    size_t pi_end[i_sizes];
+    size_t i_last = 0;
+    for( unsigned i = 0; i < i_sizes; i++ )
+    {
+        const size_t i_span = (size_t)(i_lock - 1) * pi_size[i];
+        pi_end[i] = i_span < i_buffer ? __MIN( i_buffer - i_span, i_max ) : 0;
+        i_last = __MAX( i_last, pi_end[i] );
+    }
+
+    for( size_t w = 0; w * 64 < i_last; w++ )
+    {
+        int i_best = -1;
+
+        for( unsigned i = 0; i < i_sizes; i++ )
+        {
+            if( w * 64 >= pi_end[i] )
+                continue;
+
+            uint64_t v = p_bits[w];
+            for( unsigned k = 1; k < i_lock && v; k++ )
+                v &= GetBits( p_bits, i_words, w * 64 + k * pi_size[i] );
+            if( pi_end[i] - w * 64 < 64 )
+                v &= (UINT64_C(1) << (pi_end[i] - w * 64)) - 1;
+            if( !v )
+                continue;
+
+            const int i_pos = w * 64 + ctz64( v );
+            if( i_best < 0 || i_pos < i_best )
+            {
+                i_best = i_pos;
+                *pi_found = i;
+            }
+        }
+        if( i_best >= 0 )
+            return i_best;
+    }
+    return -1;
+}
@@ -0,0 +1,43 @@
+/*****************************************************************************
+ * ts_sync.h: TS sync byte search for the TS demuxer
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef _TS_SYNC_H
+#define _TS_SYNC_H 1
+
+/* Largest buffer ts_sync_Find() looks into at once */
+#define TS_SYNC_WINDOW 32768
+
+/**
+ * Finds where i_lock sync bytes (0x47) first follow each other every packet
+ * size, for several packet sizes at once. The sync bytes of the whole buffer
+ * are first gathered into a bitmap with vector compares, the runs are then
+ * found by combining shifted copies of the bitmap, 64 positions at a time.
+ *
+ * \param p buffer, at most TS_SYNC_WINDOW bytes are looked at
+ * \param i_max the run has to start before this offset
+ * \param pi_size packet sizes, in order of preference for a same offset
+ * \param pi_found set to the index of the packet size of the run
+ * \return offset of the first sync byte of the run, or -1 if there is none
+ */
+int ts_sync_Find( const uint8_t *p, size_t i_buffer, size_t i_max,
+                  const unsigned *pi_size, unsigned i_sizes,
+                  unsigned i_lock, unsigned *pi_found );
+
+#endif /* _TS_SYNC_H */
@@ -918,7 +918,7 @@
 
         if (p_item) {
             if (p_item->i_children == -1)
-                libvlc_MetaRequest(p_intf->p_libvlc, p_item->p_input, META_REQUEST_OPTION_NONE);
+                libvlc_MetaRequest(p_intf->p_libvlc, p_item->p_input, META_REQUEST_OPTION_PRIORITY);
             else
                 msg_Dbg(p_intf, "preparsing nodes not implemented");
         }
@@ -572,6 +572,8 @@ InputStatsPanel::InputStatsPanel( QWidget *parent ): QWidget( parent )
                            "0", input, "kb/s" );
     input_bitrate_graph = new QTreeWidgetItem();
     input_bitrate_stat->addChild( input_bitrate_graph );
+    CREATE_AND_ADD_TO_CAT( read_lost_stat, qtr("Lost while reading"),
+                           "0", input, "" );
     CREATE_AND_ADD_TO_CAT( demuxed_stat, qtr("Demuxed data size"), "0", input, "KiB") ;
     CREATE_AND_ADD_TO_CAT( stream_bitrate_stat, qtr("Content bitrate"),
                            "0", input, "kb/s" );
@@ -648,6 +650,7 @@ void InputStatsPanel::update( input_item_t *p_item )
 
     UPDATE_INT( read_media_stat, (p_item->p_stats->i_read_bytes / 1024 ) );
     UPDATE_FLOAT( input_bitrate_stat,  "%6.0f", (float)(p_item->p_stats->f_input_bitrate *  8000 ));
+    UPDATE_INT( read_lost_stat,      p_item->p_stats->i_read_discontinuity );
     UPDATE_INT( demuxed_stat,    (p_item->p_stats->i_demux_read_bytes / 1024 ) );
     UPDATE_FLOAT( stream_bitrate_stat, "%6.0f", (float)(p_item->p_stats->f_demux_bitrate *  8000 ));
     UPDATE_INT( corrupted_stat,      p_item->p_stats->i_demux_corrupted );
@@ -120,6 +120,7 @@ private:
     QTreeWidgetItem *read_media_stat;
     QTreeWidgetItem *input_bitrate_stat;
     QTreeWidgetItem *input_bitrate_graph;
+    QTreeWidgetItem *read_lost_stat;
     QTreeWidgetItem *demuxed_stat;
     QTreeWidgetItem *stream_bitrate_stat;
     QTreeWidgetItem *corrupted_stat;
@@ -190,6 +190,9 @@ static int vlclua_input_item_stats( lua_State *L )
         STATS_INT( read_bytes )
         STATS_FLOAT( input_bitrate )
         STATS_FLOAT( average_input_bitrate )
+        STATS_INT( read_discontinuity )
+        STATS_INT( prefetch_level )
+        STATS_INT( prefetch_stalls )
         STATS_INT( demux_read_packets )
         STATS_INT( demux_read_bytes )
         STATS_FLOAT( demux_bitrate )
@@ -28,8 +28,28 @@
 
 #include <vlc_common.h>
 
+#include <vlc_cpu.h>
+
 #include "csa.h"
 
+/* The batch descrambler handles one packet per bit of its words: 64 bits, or
+ * the width of the vector registers, selected at runtime through vlc_CPU() */
+#if defined(HAVE_SSE2_INTRINSICS) && (VLC_GCC_VERSION(4, 9) || defined(__clang__))
+# define CSA_HAVE_SSE2 1
+# define CSA_HAVE_AVX2 1
+# define CSA_TARGET_SSE2 __attribute__ ((__target__ ("sse2")))
+# define CSA_TARGET_AVX2 __attribute__ ((__target__ ("avx2")))
+# define CSA_BATCH_MAX   256
+#else
+# define CSA_BATCH_MAX   64
+#endif
+
+#define CSA_SIMD_SSE2   (0x0001)
+#define CSA_SIMD_AVX2   (0x0002)
+
+/* Below this many scrambled packets, they are descrambled one by one */
+#define CSA_BATCH_MIN   2
+
 struct csa_t
 {
     /* odd and even keys */
@@ -47,6 +67,12 @@ struct csa_t
     int     p, q, r;
 
     bool    use_odd;
+
+    /* CSA_SIMD_* kernels the CPU supports */
+    unsigned simd;
+
+    /* stream cypher output of a batch, per packet */
+    uint8_t batch_stream[CSA_BATCH_MAX][184];
 };
 
 static void csa_ComputeKey( uint8_t kk[57], uint8_t ck[8] );
@@ -56,12 +82,34 @@ static void csa_StreamCypher( csa_t *c, int b_init, uint8_t *ck, uint8_t *sb, ui
 static void csa_BlockDecypher( uint8_t kk[57], uint8_t ib[8], uint8_t bd[8] );
 static void csa_BlockCypher( uint8_t kk[57], uint8_t bd[8], uint8_t ib[8] );
 
+static void csa_DecryptLanes64( csa_t *, uint8_t **pp_pkt, int i_pkt, int i_pkt_size );
+#if defined(CSA_HAVE_SSE2)
+CSA_TARGET_SSE2
+static void csa_DecryptLanes128( csa_t *, uint8_t **pp_pkt, int i_pkt, int i_pkt_size );
+#endif
+#if defined(CSA_HAVE_AVX2)
+CSA_TARGET_AVX2
+static void csa_DecryptLanes256( csa_t *, uint8_t **pp_pkt, int i_pkt, int i_pkt_size );
+#endif
+
 /*****************************************************************************
  * csa_New:
  *****************************************************************************/
 csa_t *csa_New( void )
 {
-    return calloc( 1, sizeof( csa_t ) );
+    csa_t *c = calloc( 1, sizeof( csa_t ) );
+    if( !c )
+        return NULL;
+
+#if defined(CSA_HAVE_SSE2)
+    if( vlc_CPU_SSE2() )
+        c->simd |= CSA_SIMD_SSE2;
+#endif
+#if defined(CSA_HAVE_AVX2)
+    if( vlc_CPU_AVX2() )
+        c->simd |= CSA_SIMD_AVX2;
+#endif
+    return c;
 }
 
 /*****************************************************************************
@@ -224,6 +272,55 @@ void csa_Decrypt( csa_t *c, uint8_t *pkt, int i_pkt_size )
     }
 }
 
+/*****************************************************************************
+ * csa_DecryptBatch:
+ *****************************************************************************
+ * Descrambles a set of packets at once, as many of them as the bits of the
+ * widest word the CPU handles share each pass of the bitsliced stream cypher.
+ *****************************************************************************/
+void csa_DecryptBatch( csa_t *c, uint8_t **pp_pkt, int i_pkt, int i_pkt_size )
+{
+    void (*pf_lanes)( csa_t *, uint8_t **, int, int ) = csa_DecryptLanes64;
+    int i_batch = 64;
+    uint8_t *lanes[CSA_BATCH_MAX];
+    int i_lanes = 0;
+
+#if defined(CSA_HAVE_SSE2)
+    if( c->simd & CSA_SIMD_SSE2 )
+    {
+        pf_lanes = csa_DecryptLanes128;
+        i_batch = 128;
+    }
+#endif
+#if defined(CSA_HAVE_AVX2)
+    if( c->simd & CSA_SIMD_AVX2 )
+    {
+        pf_lanes = csa_DecryptLanes256;
+        i_batch = 256;
+    }
+#endif
+
+    for( int i = 0; i < i_pkt; i++ )
+    {
+        /* only scrambled packets take a lane */
+        if( (pp_pkt[i][3]&0x80) == 0 )
+            continue;
+
+        lanes[i_lanes++] = pp_pkt[i];
+        if( i_lanes == i_batch )
+        {
+            pf_lanes( c, lanes, i_lanes, i_pkt_size );
+            i_lanes = 0;
+        }
+    }
+
+    if( i_lanes >= CSA_BATCH_MIN )
+        pf_lanes( c, lanes, i_lanes, i_pkt_size );
+    else
+        for( int i = 0; i < i_lanes; i++ )
+            csa_Decrypt( c, lanes[i], i_pkt_size );
+}
+
 /*****************************************************************************
  * csa_Encrypt:
  *****************************************************************************/
@@ -610,3 +707,54 @@ static void csa_BlockCypher( uint8_t kk[57], uint8_t bd[8], uint8_t ib[8] )
     }
 }
 
+
+/*****************************************************************************
+ * Batch descrambling
+ *****************************************************************************
+ * The stream cypher is bitsliced: every bit of its state is a word whose bit
+ * i belongs to the packet i of the batch, so that all the packets are
+ * clocked at once with logical operations only. Once the stream is known,
+ * the blocks of a packet no longer depend on each other for the block
+ * cypher.
+ *
+ * The kernels only differ by the width of the words, see csa_batch.h.
+ *****************************************************************************/
+#define CSA_NAME( name )            CSA_NAME_( name, CSA_WIDTH )
+#define CSA_NAME_( name, width )    CSA_NAME__( name, width )
+#define CSA_NAME__( name, width )   name##width
+
+/* Swaps the rows and the columns of a 8x8 bits matrix, one byte per row */
+static inline uint64_t csa_Transpose8( uint64_t x )
+{
+    uint64_t t;
+
+    t = ( x ^ ( x >> 7 ) ) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ ( t << 7 );
+    t = ( x ^ ( x >> 14 ) ) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ ( t << 14 );
+    t = ( x ^ ( x >> 28 ) ) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ ( t << 28 );
+    return x;
+}
+
+#define CSA_WIDTH  64
+#define CSA_TARGET
+#include "csa_batch.h"
+#undef CSA_TARGET
+#undef CSA_WIDTH
+
+#if defined(CSA_HAVE_SSE2)
+# define CSA_WIDTH  128
+# define CSA_TARGET CSA_TARGET_SSE2
+# include "csa_batch.h"
+# undef CSA_TARGET
+# undef CSA_WIDTH
+#endif
+
+#if defined(CSA_HAVE_AVX2)
+# define CSA_WIDTH  256
+# define CSA_TARGET CSA_TARGET_AVX2
+# include "csa_batch.h"
+# undef CSA_TARGET
+# undef CSA_WIDTH
+#endif
@@ -0,0 +1,609 @@
+/*****************************************************************************
+ * csa_batch.h: bitsliced CSA descrambler for one word width
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Included by csa.c once per kernel, with CSA_WIDTH the bits of a word,
+ * that is the number of packets of a batch, and CSA_TARGET the attribute
+ * enabling the instructions the word needs. Defines
+ * csa_DecryptLanes<CSA_WIDTH>(). */
+
+#define csa_word_t          CSA_NAME( csa_word )
+#define csa_lanes_t         CSA_NAME( csa_lanes )
+#define csa_bs_t            CSA_NAME( csa_bs )
+#define csa_bytes_t         CSA_NAME( csa_bytes )
+#define csa_BsSbox1         CSA_NAME( csa_BsSbox1_ )
+#define csa_BsSbox2         CSA_NAME( csa_BsSbox2_ )
+#define csa_BsSbox3         CSA_NAME( csa_BsSbox3_ )
+#define csa_BsSbox4         CSA_NAME( csa_BsSbox4_ )
+#define csa_BsSbox5         CSA_NAME( csa_BsSbox5_ )
+#define csa_BsSbox6         CSA_NAME( csa_BsSbox6_ )
+#define csa_BsSbox7         CSA_NAME( csa_BsSbox7_ )
+#define csa_BsInit          CSA_NAME( csa_BsInit )
+#define csa_BsStreamCypher  CSA_NAME( csa_BsStreamCypher )
+#define csa_BlockDecypherN  CSA_NAME( csa_BlockDecypherN )
+#define csa_DecryptBlocks   CSA_NAME( csa_DecryptBlocks )
+#define csa_DecryptLanes    CSA_NAME( csa_DecryptLanes )
+
+#if CSA_WIDTH == 64
+typedef uint64_t csa_word_t;
+#else
+typedef uint64_t csa_word_t __attribute__((vector_size(CSA_WIDTH / 8)));
+#endif
+#define CSA_BATCH       (8 * sizeof(csa_word_t))
+#define CSA_WORD_U64    (sizeof(csa_word_t) / 8)
+
+typedef union
+{
+    csa_word_t w;
+    uint64_t   u[CSA_WORD_U64];
+} csa_lanes_t;
+
+/* A and B shift by one nibble per clock, down a window of spare nibbles
+ * that is moved back every 8 bytes */
+#define CSA_BS_CLOCKS 32
+
+typedef struct
+{
+    csa_word_t A[CSA_BS_CLOCKS + 10][4];
+    csa_word_t B[CSA_BS_CLOCKS + 10][4];
+    csa_word_t X[4], Y[4], Z[4];
+    csa_word_t D[4], E[4], F[4];
+    csa_word_t p, q, r;
+} csa_bs_t;
+
+/* s-boxes 1 to 7 from their algebraic normal form, x[4] being the most
+ * significant bit of the index, o1 and o0 the bits of the output */
+CSA_TARGET
+static inline void csa_BsSbox1( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x10 = x[1] & x[0];
+    const csa_word_t x20 = x[2] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x30 = x[3] & x[0];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x40 = x[4] & x[0];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x320 = x32 & x[0];
+    const csa_word_t x321 = x32 & x[1];
+    const csa_word_t x410 = x41 & x[0];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x431 = x43 & x[1];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4310 = x431 & x[0];
+    const csa_word_t x4320 = x432 & x[0];
+    const csa_word_t x4321 = x432 & x[1];
+    *o1 = ~(x[0] ^ x[1] ^ x10 ^ x20 ^ x21 ^ x30 ^ x31 ^ x32 ^ x320 ^ x321 ^ x[4] ^ x410 ^ x42 ^ x421 ^ x43 ^ x431 ^ x4310 ^ x432 ^ x4321);
+    *o0 = x[1] ^ x20 ^ x[3] ^ x30 ^ x310 ^ x40 ^ x43 ^ x431 ^ x432 ^ x4320;
+}
+
+CSA_TARGET
+static inline void csa_BsSbox2( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x20 = x[2] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x210 = x21 & x[0];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x320 = x32 & x[0];
+    const csa_word_t x410 = x41 & x[0];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x430 = x43 & x[0];
+    const csa_word_t x431 = x43 & x[1];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4310 = x431 & x[0];
+    const csa_word_t x4320 = x432 & x[0];
+    *o1 = ~(x[0] ^ x[1] ^ x20 ^ x21 ^ x210 ^ x[3] ^ x421 ^ x430 ^ x431 ^ x4310 ^ x432);
+    *o0 = ~(x[1] ^ x[2] ^ x20 ^ x310 ^ x320 ^ x410 ^ x42 ^ x43 ^ x4310 ^ x4320);
+}
+
+CSA_TARGET
+static inline void csa_BsSbox3( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x10 = x[1] & x[0];
+    const csa_word_t x20 = x[2] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x30 = x[3] & x[0];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x210 = x21 & x[0];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x321 = x32 & x[1];
+    const csa_word_t x410 = x41 & x[0];
+    const csa_word_t x420 = x42 & x[0];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x430 = x43 & x[0];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4210 = x421 & x[0];
+    const csa_word_t x4321 = x432 & x[1];
+    *o1 = ~(x[0] ^ x[1] ^ x20 ^ x21 ^ x210 ^ x[3] ^ x30 ^ x31 ^ x310 ^ x32 ^ x321 ^ x[4] ^ x41 ^ x410 ^ x42 ^ x420 ^ x421 ^ x4210 ^ x430 ^ x432 ^ x4321);
+    *o0 = x[1] ^ x10 ^ x20 ^ x[3] ^ x[4];
+}
+
+CSA_TARGET
+static inline void csa_BsSbox4( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x10 = x[1] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x30 = x[3] & x[0];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x40 = x[4] & x[0];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x210 = x21 & x[0];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x321 = x32 & x[1];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x430 = x43 & x[0];
+    const csa_word_t x431 = x43 & x[1];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4210 = x421 & x[0];
+    const csa_word_t x4310 = x431 & x[0];
+    const csa_word_t x4321 = x432 & x[1];
+    *o1 = ~(x[0] ^ x10 ^ x[2] ^ x210 ^ x[3] ^ x321 ^ x[4] ^ x40 ^ x41 ^ x4210 ^ x43 ^ x430 ^ x4310 ^ x432 ^ x4321);
+    *o0 = ~(x[1] ^ x10 ^ x[2] ^ x30 ^ x310 ^ x32 ^ x40 ^ x41 ^ x4210 ^ x43 ^ x430 ^ x4310 ^ x432 ^ x4321);
+}
+
+CSA_TARGET
+static inline void csa_BsSbox5( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x10 = x[1] & x[0];
+    const csa_word_t x20 = x[2] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x30 = x[3] & x[0];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x40 = x[4] & x[0];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x210 = x21 & x[0];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x320 = x32 & x[0];
+    const csa_word_t x321 = x32 & x[1];
+    const csa_word_t x420 = x42 & x[0];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x430 = x43 & x[0];
+    const csa_word_t x431 = x43 & x[1];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4210 = x421 & x[0];
+    const csa_word_t x4310 = x431 & x[0];
+    const csa_word_t x4320 = x432 & x[0];
+    const csa_word_t x4321 = x432 & x[1];
+    *o1 = ~(x[0] ^ x[1] ^ x10 ^ x20 ^ x21 ^ x210 ^ x[3] ^ x30 ^ x310 ^ x320 ^ x321 ^ x40 ^ x41 ^ x42 ^ x421 ^ x4210 ^ x430 ^ x431 ^ x4320 ^ x4321);
+    *o0 = x10 ^ x[2] ^ x20 ^ x210 ^ x30 ^ x31 ^ x320 ^ x40 ^ x42 ^ x420 ^ x421 ^ x4210 ^ x43 ^ x430 ^ x431 ^ x4310;
+}
+
+CSA_TARGET
+static inline void csa_BsSbox6( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x20 = x[2] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x210 = x21 & x[0];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x320 = x32 & x[0];
+    const csa_word_t x321 = x32 & x[1];
+    const csa_word_t x410 = x41 & x[0];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x430 = x43 & x[0];
+    const csa_word_t x431 = x43 & x[1];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4210 = x421 & x[0];
+    const csa_word_t x4310 = x431 & x[0];
+    const csa_word_t x4321 = x432 & x[1];
+    *o1 = x[1] ^ x20 ^ x310 ^ x32 ^ x320 ^ x[4] ^ x410 ^ x430;
+    *o0 = x[0] ^ x[2] ^ x21 ^ x210 ^ x31 ^ x32 ^ x321 ^ x410 ^ x421 ^ x4210 ^ x4310 ^ x4321;
+}
+
+CSA_TARGET
+static inline void csa_BsSbox7( const csa_word_t x[5], csa_word_t *o1, csa_word_t *o0 )
+{
+    const csa_word_t x10 = x[1] & x[0];
+    const csa_word_t x21 = x[2] & x[1];
+    const csa_word_t x31 = x[3] & x[1];
+    const csa_word_t x32 = x[3] & x[2];
+    const csa_word_t x40 = x[4] & x[0];
+    const csa_word_t x41 = x[4] & x[1];
+    const csa_word_t x42 = x[4] & x[2];
+    const csa_word_t x43 = x[4] & x[3];
+    const csa_word_t x210 = x21 & x[0];
+    const csa_word_t x310 = x31 & x[0];
+    const csa_word_t x410 = x41 & x[0];
+    const csa_word_t x421 = x42 & x[1];
+    const csa_word_t x431 = x43 & x[1];
+    const csa_word_t x432 = x43 & x[2];
+    const csa_word_t x4210 = x421 & x[0];
+    const csa_word_t x4310 = x431 & x[0];
+    const csa_word_t x4321 = x432 & x[1];
+    *o1 = x[0] ^ x[1] ^ x10 ^ x[2] ^ x[3] ^ x310 ^ x40 ^ x410 ^ x42 ^ x421 ^ x4210 ^ x4310 ^ x4321;
+    *o0 = x[0] ^ x10 ^ x[2] ^ x21 ^ x210 ^ x[3] ^ x32 ^ x[4] ^ x431 ^ x4310;
+}
+
+CSA_TARGET
+static void csa_BsInit( csa_bs_t *s, const csa_t *c, csa_word_t odd, csa_word_t even )
+{
+    memset( s, 0, sizeof(*s) );
+
+    /* every packet loads the key it is scrambled with */
+    for( int i = 0; i < 8; i++ )
+    {
+        for( int b = 0; b < 4; b++ )
+        {
+            const int o = 4 * ( 1 - (i & 1) ) + b;
+
+            s->A[i][b] = ( odd & -(uint64_t)( ( c->o_ck[i/2] >> o ) & 1 ) ) |
+                         ( even & -(uint64_t)( ( c->e_ck[i/2] >> o ) & 1 ) );
+            s->B[i][b] = ( odd & -(uint64_t)( ( c->o_ck[4+i/2] >> o ) & 1 ) ) |
+                         ( even & -(uint64_t)( ( c->e_ck[4+i/2] >> o ) & 1 ) );
+        }
+    }
+}
+
+/* Produces 8 bytes, as bits [byte][bit], from the stream cypher like
+ * csa_StreamCypher(). The init takes the bits of the first block in sb. */
+CSA_TARGET
+static void csa_BsStreamCypher( csa_bs_t *s, const csa_lanes_t sb[8][8],
+                                csa_lanes_t cb[8][8] )
+{
+    int o = CSA_BS_CLOCKS;
+#define A( k ) s->A[o + (k) - 1]
+#define B( k ) s->B[o + (k) - 1]
+
+    memcpy( &A( 1 ), &s->A[0], 10 * sizeof(s->A[0]) );
+    memcpy( &B( 1 ), &s->B[0], 10 * sizeof(s->B[0]) );
+
+    for( int i = 0; i < 8; i++ )
+    {
+        for( int j = 0; j < 4; j++ )
+        {
+            csa_word_t x[5], s1[7], s0[7];
+
+            x[4] = A(4)[0]; x[3] = A(1)[2]; x[2] = A(6)[1]; x[1] = A(7)[3]; x[0] = A(9)[0];
+            csa_BsSbox1( x, &s1[0], &s0[0] );
+            x[4] = A(2)[1]; x[3] = A(3)[2]; x[2] = A(6)[3]; x[1] = A(7)[0]; x[0] = A(9)[1];
+            csa_BsSbox2( x, &s1[1], &s0[1] );
+            x[4] = A(1)[3]; x[3] = A(2)[0]; x[2] = A(5)[1]; x[1] = A(5)[3]; x[0] = A(6)[2];
+            csa_BsSbox3( x, &s1[2], &s0[2] );
+            x[4] = A(3)[3]; x[3] = A(1)[1]; x[2] = A(2)[3]; x[1] = A(4)[2]; x[0] = A(8)[0];
+            csa_BsSbox4( x, &s1[3], &s0[3] );
+            x[4] = A(5)[2]; x[3] = A(4)[3]; x[2] = A(6)[0]; x[1] = A(8)[1]; x[0] = A(9)[2];
+            csa_BsSbox5( x, &s1[4], &s0[4] );
+            x[4] = A(3)[1]; x[3] = A(4)[1]; x[2] = A(5)[0]; x[1] = A(7)[2]; x[0] = A(9)[3];
+            csa_BsSbox6( x, &s1[5], &s0[5] );
+            x[4] = A(2)[2]; x[3] = A(3)[0]; x[2] = A(7)[1]; x[1] = A(8)[2]; x[0] = A(8)[3];
+            csa_BsSbox7( x, &s1[6], &s0[6] );
+
+            /* use 4x4 xor to produce extra nibble for T3 */
+            const csa_word_t extra_B[4] =
+            {
+                B(9)[2] ^ B(6)[3] ^ B(3)[1] ^ B(8)[0],
+                B(5)[3] ^ B(8)[2] ^ B(4)[0] ^ B(5)[1],
+                B(6)[0] ^ B(8)[1] ^ B(3)[3] ^ B(4)[2],
+                B(3)[0] ^ B(6)[1] ^ B(7)[2] ^ B(9)[3],
+            };
+
+            /* T1 and T2, the input nibbles only during the init */
+            csa_word_t next_A1[4], next_B1[4];
+            for( int b = 0; b < 4; b++ )
+            {
+                next_A1[b] = A(10)[b] ^ s->X[b];
+                next_B1[b] = B(7)[b] ^ B(10)[b] ^ s->Y[b];
+                if( sb )
+                {
+                    next_A1[b] ^= s->D[b] ^ sb[i][(j % 2 ? 0 : 4) + b].w;
+                    next_B1[b] ^= sb[i][(j % 2 ? 4 : 0) + b].w;
+                }
+            }
+
+            /* if p=1, rotate left */
+            const csa_word_t b3 = next_B1[3];
+            next_B1[3] ^= s->p & ( next_B1[3] ^ next_B1[2] );
+            next_B1[2] ^= s->p & ( next_B1[2] ^ next_B1[1] );
+            next_B1[1] ^= s->p & ( next_B1[1] ^ next_B1[0] );
+            next_B1[0] ^= s->p & ( next_B1[0] ^ b3 );
+
+            /* T4 = sum, carry of Z + E + r, kept if q=1 */
+            csa_word_t sum[4], carry = s->r;
+            for( int b = 0; b < 4; b++ )
+            {
+                const csa_word_t ze = s->Z[b] ^ s->E[b];
+                sum[b] = ze ^ carry;
+                carry = ( s->Z[b] & s->E[b] ) | ( carry & ze );
+            }
+            s->r ^= s->q & ( carry ^ s->r );
+
+            for( int b = 0; b < 4; b++ )
+            {
+                /* T3 = xor all inputs */
+                s->D[b] = s->E[b] ^ s->Z[b] ^ extra_B[b];
+
+                const csa_word_t next_E = s->F[b];
+                s->F[b] = s->E[b] ^ ( s->q & ( sum[b] ^ s->E[b] ) );
+                s->E[b] = next_E;
+            }
+
+            o--;
+            memcpy( A( 1 ), next_A1, sizeof(next_A1) );
+            memcpy( B( 1 ), next_B1, sizeof(next_B1) );
+
+            s->X[0] = s1[0]; s->X[1] = s1[1]; s->X[2] = s0[2]; s->X[3] = s0[3];
+            s->Y[0] = s1[2]; s->Y[1] = s1[3]; s->Y[2] = s0[4]; s->Y[3] = s0[5];
+            s->Z[0] = s1[4]; s->Z[1] = s1[5]; s->Z[2] = s0[0]; s->Z[3] = s0[1];
+            s->p = s1[6];
+            s->q = s0[6];
+
+            /* 2 output bits are a function of the 4 bits of D */
+            if( cb )
+            {
+                cb[i][7-2*j].w = s->D[2] ^ s->D[3];
+                cb[i][6-2*j].w = s->D[0] ^ s->D[1];
+            }
+        }
+    }
+#undef A
+#undef B
+}
+
+/* Runs csa_BlockDecypher() on CSA_BLOCKS blocks at once, held as [byte][block]
+ * so that the lookups of the different blocks can overlap */
+#define CSA_BLOCKS sizeof(csa_word_t)
+
+typedef union
+{
+    csa_word_t w;
+    uint8_t    b[CSA_BLOCKS];
+} csa_bytes_t;
+
+CSA_TARGET
+static void csa_BlockDecypherN( const uint8_t kk[57], csa_bytes_t ib[8] )
+{
+    csa_word_t R1 = ib[0].w, R2 = ib[1].w, R3 = ib[2].w, R4 = ib[3].w,
+               R5 = ib[4].w, R6 = ib[5].w, R7 = ib[6].w, R8 = ib[7].w;
+
+    // loop over kk[56]..kk[1]
+    for( int i = 56; i > 0; i-- )
+    {
+        csa_bytes_t in, sbox_out, perm_out;
+
+        in.w = R7 ^ ( UINT64_C(0x0101010101010101) * kk[i] );
+        for( unsigned b = 0; b < CSA_BLOCKS; b++ )
+        {
+            sbox_out.b[b] = block_sbox[in.b[b]];
+            perm_out.b[b] = block_perm[sbox_out.b[b]];
+        }
+
+        const csa_word_t next_R8 = R7;
+        const csa_word_t t = R8 ^ sbox_out.w;
+        R7 = R6 ^ perm_out.w;
+        R6 = R5;
+        R5 = R4 ^ t;
+        R4 = R3 ^ t;
+        R3 = R2 ^ t;
+        R2 = R1;
+        R1 = t;
+        R8 = next_R8;
+    }
+
+    ib[0].w = R1; ib[1].w = R2; ib[2].w = R3; ib[3].w = R4;
+    ib[4].w = R5; ib[5].w = R6; ib[6].w = R7; ib[7].w = R8;
+}
+
+/* Decyphers blocks holding the input of the block cypher, in the order of the
+ * packets: the next block of a packet has to be read before it is itself
+ * decyphered */
+CSA_TARGET
+static void csa_DecryptBlocks( const uint8_t kk[57], uint8_t **blocks,
+                               const bool *b_last, int i_blocks )
+{
+    csa_bytes_t rows[8];
+
+    memset( rows, 0, sizeof(rows) );
+    for( int i = 0; i < i_blocks; i++ )
+        for( int j = 0; j < 8; j++ )
+            rows[j].b[i] = blocks[i][j];
+
+    csa_BlockDecypherN( kk, rows );
+
+    for( int i = 0; i < i_blocks; i++ )
+        for( int j = 0; j < 8; j++ )
+            blocks[i][j] = rows[j].b[i] ^ ( b_last[i] ? 0 : blocks[i][8+j] );
+}
+
+/* Descrambles up to CSA_BATCH packets whose scrambling control is set */
+CSA_TARGET
+static void csa_DecryptLanes( csa_t *c, uint8_t **pp_pkt, int i_pkt, int i_pkt_size )
+{
+    uint8_t    *kk[CSA_BATCH];
+    int         hdr[CSA_BATCH];
+    csa_lanes_t odd, even;
+    int         i_streams = 0;
+    bool        b_lanes = false;
+
+    memset( &odd, 0, sizeof(odd) );
+    memset( &even, 0, sizeof(even) );
+
+    for( int l = 0; l < i_pkt; l++ )
+    {
+        uint8_t *pkt = pp_pkt[l];
+        csa_lanes_t *key = pkt[3]&0x40 ? &odd : &even;
+
+        kk[l] = pkt[3]&0x40 ? c->o_kk : c->e_kk;
+
+        /* clear transport scrambling control */
+        pkt[3] &= 0x3f;
+
+        hdr[l] = 4;
+        if( pkt[3]&0x20 )
+        {
+            /* skip adaption field */
+            hdr[l] += pkt[4] + 1;
+        }
+
+        if( 188 - hdr[l] < 8 || i_pkt_size - hdr[l] <= 0 )
+        {
+            hdr[l] = -1;
+            continue;
+        }
+
+        /* stream blocks: one per block but the first, and the residue */
+        const int n = (i_pkt_size - hdr[l]) / 8;
+        const int i_residue = (i_pkt_size - hdr[l]) % 8;
+        const int i_stream = ( n > 0 ? n - 1 : 0 ) + ( i_residue > 0 );
+        if( i_stream > i_streams )
+            i_streams = i_stream;
+
+        key->u[l / 64] |= UINT64_C(1) << (l % 64);
+        b_lanes = true;
+    }
+    if( !b_lanes )
+        return;
+
+    /* init with the first block of every packet */
+    csa_lanes_t bits[8][8];
+    csa_bs_t bs;
+
+    memset( bits, 0, sizeof(bits) );
+    for( int g = 0; g < (i_pkt + 7) / 8; g++ )
+    {
+        for( int i = 0; i < 8; i++ )
+        {
+            uint64_t x = 0;
+            for( int l = 8 * g; l < 8 * g + 8 && l < i_pkt; l++ )
+                if( hdr[l] >= 0 )
+                    x |= (uint64_t)pp_pkt[l][hdr[l] + i] << ( 8 * (l % 8) );
+
+            x = csa_Transpose8( x );
+            for( int b = 0; b < 8; b++ )
+                bits[i][b].u[g / 8] |= ( ( x >> (8 * b) ) & 0xff ) << ( 8 * (g % 8) );
+        }
+    }
+
+    csa_BsInit( &bs, c, odd.w, even.w );
+    csa_BsStreamCypher( &bs, bits, NULL );
+
+    for( int k = 0; k < i_streams; k++ )
+    {
+        csa_BsStreamCypher( &bs, NULL, bits );
+
+        for( int g = 0; g < (i_pkt + 7) / 8; g++ )
+        {
+            for( int i = 0; i < 8; i++ )
+            {
+                uint64_t x = 0;
+                for( int b = 0; b < 8; b++ )
+                    x |= ( ( bits[i][b].u[g / 8] >> ( 8 * (g % 8) ) ) & 0xff ) << ( 8 * b );
+
+                x = csa_Transpose8( x );
+                for( int l = 8 * g; l < 8 * g + 8 && l < i_pkt; l++ )
+                    c->batch_stream[l][8 * k + i] = x >> ( 8 * (l % 8) );
+            }
+        }
+    }
+
+    /* Xor the stream in place, each block is now the input of the block
+     * cypher for the previous one: the blocks no longer depend on each
+     * other and are decyphered CSA_BLOCKS at a time */
+    for( int l = 0; l < i_pkt; l++ )
+    {
+        if( hdr[l] < 0 )
+            continue;
+
+        uint8_t *pkt = &pp_pkt[l][hdr[l]];
+        const uint8_t *stream = c->batch_stream[l];
+        const int n = (i_pkt_size - hdr[l]) / 8;
+        const int i_residue = (i_pkt_size - hdr[l]) % 8;
+
+        for( int j = 8; j < 8 * n; j++ )
+            pkt[j] ^= stream[j - 8];
+
+        if( i_residue > 0 )
+        {
+            stream += n > 0 ? 8 * (n - 1) : 0;
+            for( int j = 0; j < i_residue; j++ )
+                pkt[8*n+j] ^= stream[j];
+        }
+    }
+
+    for( int i_odd = 0; i_odd < 2; i_odd++ )
+    {
+        uint8_t *kk_batch = i_odd ? c->o_kk : c->e_kk;
+        uint8_t *blocks[CSA_BLOCKS];
+        bool     b_last[CSA_BLOCKS];
+        int      i_blocks = 0;
+
+        for( int l = 0; l < i_pkt; l++ )
+        {
+            if( hdr[l] < 0 || kk[l] != kk_batch )
+                continue;
+
+            const int n = (i_pkt_size - hdr[l]) / 8;
+            for( int i = 0; i < n; i++ )
+            {
+                blocks[i_blocks] = &pp_pkt[l][hdr[l] + 8 * i];
+                b_last[i_blocks] = i == n - 1;
+                if( ++i_blocks == CSA_BLOCKS )
+                {
+                    csa_DecryptBlocks( kk_batch, blocks, b_last, i_blocks );
+                    i_blocks = 0;
+                }
+            }
+        }
+        if( i_blocks > 0 )
+            csa_DecryptBlocks( kk_batch, blocks, b_last, i_blocks );
+    }
+}
+
+#undef CSA_BATCH
+#undef CSA_WORD_U64
+#undef CSA_BS_CLOCKS
+#undef CSA_BLOCKS
+
+#undef csa_word_t
+#undef csa_lanes_t
+#undef csa_bs_t
+#undef csa_bytes_t
+#undef csa_BsSbox1
+#undef csa_BsSbox2
+#undef csa_BsSbox3
+#undef csa_BsSbox4
+#undef csa_BsSbox5
+#undef csa_BsSbox6
+#undef csa_BsSbox7
+#undef csa_BsInit
+#undef csa_BsStreamCypher
+#undef csa_BlockDecypherN
+#undef csa_DecryptBlocks
+#undef csa_DecryptLanes
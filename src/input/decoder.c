@@ -759,8 +759,8 @@ static decoder_t * CreateDecoder( vlc_object_t *p_parent,
     p_owner->p_packetizer = NULL;
     p_owner->b_packetizer = b_packetizer;
 
-    /* decoder fifo */
-    p_owner->p_fifo = block_FifoNew();
+    /* decoder fifo, fed by one thread at a time */
+    p_owner->p_fifo = block_FifoNewSPSC();
     if( unlikely(p_owner->p_fifo == NULL) )
     {
         free( p_owner );
@@ -1274,8 +1274,9 @@ static void EsOutProgramEpg( es_out_t *out, int i_group, const vlc_epg_t *p_epg
     epg = *p_epg;
     epg.psz_name = psz_cat;
 
-    input_item_SetEpg( p_item, &epg );
-    input_SendEventMetaEpg( p_sys->p_input );
+    /* Repeated tables usually leave it unchanged */
+    if( input_item_SetEpg( p_item, &epg ) )
+        input_SendEventMetaEpg( p_sys->p_input );
 
     /* Update now playing */
     free( p_pgrm->psz_now_playing );
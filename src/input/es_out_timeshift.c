@@ -31,11 +31,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
 #if defined (_WIN32)
 #  include <direct.h>
 #endif
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+#   include <sys/mman.h>
+#endif
 
 #include <vlc_common.h>
 #include <vlc_fs.h>
@@ -83,7 +87,8 @@ typedef struct attribute_packed
 {
     es_out_id_t *p_es;
     block_t *p_block;
-    int     i_offset;  /* We do not use file > INT_MAX */
+    uint64_t i_offset;  /* In the data of the storage, never wraps */
+    size_t   i_size;    /* Stored bytes, header included */
 } ts_cmd_send_t;
 
 typedef struct attribute_packed
@@ -150,24 +155,63 @@ typedef struct attribute_packed
     } u;
 } ts_cmd_t;
 
-typedef struct ts_storage_t ts_storage_t;
-struct ts_storage_t
+/* Growable ring of elements numbered from the first one ever pushed, so that
+ * numbers stay valid while the oldest elements are dropped */
+typedef struct
 {
-    ts_storage_t *p_next;
+    uint8_t  *p_data;
+    size_t   i_size;    /* Size of an element */
+    size_t   i_max;     /* Power of 2 */
+    uint64_t i_first;
+    uint64_t i_last;    /* Number of the next element */
+} ts_ring_t;
+
+/* Header of the blocks in the storage */
+typedef struct
+{
+    size_t   i_buffer;
+    uint32_t i_flags;
+    unsigned i_nb_samples;
+    mtime_t  i_pts;
+    mtime_t  i_dts;
+    mtime_t  i_length;
+} ts_block_header_t;
+
+/* Seek point */
+typedef struct
+{
+    mtime_t  i_time;    /* From ES_OUT_SET_TIMES */
+    uint64_t i_cmd;
+} ts_index_t;
 
-    /* */
-    char    *psz_file;  /* Filename */
-    size_t  i_file_max; /* Max size in bytes */
-    int64_t i_file_size;/* Current size in bytes */
-    FILE    *p_filew;   /* FILE handle for data writing */
-    FILE    *p_filer;   /* FILE handle for data reading */
+typedef struct
+{
+    /* Block data, in a temporary file allocated and mapped at once. Once it
+     * is full, the oldest data is overwritten in place. Without mmap, the
+     * file is read and written at the same offsets instead. */
+#ifdef HAVE_MMAP
+    uint8_t  *p_data;
+#else
+    int      fd;
+    char     *psz_file;     /* To remove once closed, if not done yet */
+#endif
+    uint64_t i_data_max;
+    uint64_t i_data_r;      /* Oldest stored byte */
+    uint64_t i_data_w;      /* Next byte to write */
 
-    /* */
-    int      i_cmd_r;
-    int      i_cmd_w;
-    int      i_cmd_max;
-    ts_cmd_t *p_cmd;
-};
+    /* Commands, kept after being played as long as their data is stored */
+    ts_ring_t cmd;
+    uint64_t  i_cmd_r;      /* Next command to play */
+    uint64_t  i_cmd_played; /* All commands before it were played once */
+    uint64_t  i_cmd_data;   /* Oldest command whose data is stored */
+    uint64_t  i_cmd_barrier;/* No seeking back before it */
+
+    /* Commands that cannot be played twice, not played yet (uint64_t) */
+    ts_ring_t state;
+
+    /* Seek points by increasing time (ts_index_t) */
+    ts_ring_t index;
+} ts_storage_t;
 
 typedef struct
 {
@@ -195,8 +239,12 @@ typedef struct
     mtime_t        i_buffering_delay;
 
     /* */
-    ts_storage_t   *p_storage_r;
-    ts_storage_t   *p_storage_w;
+    ts_storage_t   *p_storage;
+    bool           b_storage_error;
+
+    /* Pending jump within the storage */
+    bool           b_seek;
+    uint64_t       i_seek_cmd;
 
     mtime_t        i_cmd_delay;
 
@@ -213,8 +261,9 @@ struct es_out_sys_t
 	es_out_t       *p_out;
 
     /* Configuration */
-    int64_t        i_tmp_size_max;    /* Maximal temporary file size in byte */
+    int64_t        i_tmp_size_max;    /* Size of the timeshift buffer in byte */
     char           *psz_tmp_path;     /* Path for temporary files */
+    bool           b_always;          /* Timeshift live streams from the start */
 
     /* Lock for all following fields */
     vlc_mutex_t    lock;
@@ -241,28 +290,39 @@ static int          Control( es_out_t *, int i_query, va_list );
 static void         Destroy( es_out_t * );
 
 static int          TsStart( es_out_t * );
+static void         TsAutoStart( es_out_t * );
 static void         TsAutoStop( es_out_t * );
 
 static void         TsStop( ts_thread_t * );
 static void         TsPushCmd( ts_thread_t *, ts_cmd_t * );
-static int          TsPopCmdLocked( ts_thread_t *, ts_cmd_t *, bool b_flush );
+static int          TsPopCmdLocked( ts_thread_t *, ts_cmd_t * );
+static bool         TsSeekLocked( ts_thread_t * );
 static bool         TsHasCmd( ts_thread_t * );
 static bool         TsIsUnused( ts_thread_t * );
 static int          TsChangePause( ts_thread_t *, bool b_source_paused, bool b_paused, mtime_t i_date );
 static int          TsChangeRate( ts_thread_t *, int i_src_rate, int i_rate );
+static int          TsSeek( ts_thread_t *, mtime_t i_time );
 
 static void         *TsRun( void * );
 
 static ts_storage_t *TsStorageNew( const char *psz_path, int64_t i_tmp_size_max );
 static void         TsStorageDelete( ts_storage_t * );
-static void         TsStoragePack( ts_storage_t *p_storage );
-static bool         TsStorageIsFull( ts_storage_t *, const ts_cmd_t *p_cmd );
 static bool         TsStorageIsEmpty( ts_storage_t * );
-static void         TsStoragePushCmd( ts_storage_t *, const ts_cmd_t *p_cmd, bool b_flush );
-static void         TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd, bool b_flush );
+static void         TsStoragePushCmd( ts_storage_t *, const ts_cmd_t *p_cmd );
+static int          TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd );
+static int          TsStoragePopState( ts_storage_t *, uint64_t i_before, ts_cmd_t *p_cmd );
+static uint64_t     TsStorageSeekable( ts_storage_t * );
+static int          TsStorageFind( ts_storage_t *, mtime_t i_time, uint64_t *pi_cmd );
+static void         TsStorageTrim( ts_storage_t * );
+
+static void         TsRingInit( ts_ring_t *, size_t i_size );
+static void         *TsRingAt( const ts_ring_t *, uint64_t i );
+static void         *TsRingPush( ts_ring_t * );
 
 static void CmdClean( ts_cmd_t * );
 static void cmd_cleanup_routine( void *p ) { CmdClean( p ); }
+static void CmdExecute( es_out_t *, ts_cmd_t * );
+static bool CmdIsReplayable( const ts_cmd_t * );
 
 static int  CmdInitAdd    ( ts_cmd_t *, es_out_id_t *, const es_format_t *, bool b_copy );
 static void CmdInitSend   ( ts_cmd_t *, es_out_id_t *, block_t * );
@@ -282,7 +342,7 @@ static int  CmdExecuteControl( es_out_t *, ts_cmd_t * );
 
 /* File helpers */
 static char *GetTmpPath( char *psz_path );
-static FILE *GetTmpFile( char **ppsz_file, const char *psz_path );
+static int  GetTmpFile( char **ppsz_file, const char *psz_path );
 
 /*****************************************************************************
  * input_EsOutTimeshiftNew:
@@ -324,17 +384,19 @@ es_out_t *input_EsOutTimeshiftNew( input_thread_t *p_input, es_out_t *p_next_out
     TAB_INIT( p_sys->i_es, p_sys->pp_es );
 
     /* */
-    const int i_tmp_size_max = var_CreateGetInteger( p_input, "input-timeshift-granularity" );
-    if( i_tmp_size_max < 0 )
-        p_sys->i_tmp_size_max = 50*1024*1024;
-    else
-        p_sys->i_tmp_size_max = __MAX( i_tmp_size_max, 1*1024*1024 );
+    const int64_t i_tmp_size_max = var_CreateGetInteger( p_input, "input-timeshift-size" );
+    p_sys->i_tmp_size_max = __MAX( i_tmp_size_max, 1 ) * 1024*1024;
+#if SIZE_MAX <= UINT32_MAX
+    /* It must be mapped as a whole */
+    p_sys->i_tmp_size_max = __MIN( p_sys->i_tmp_size_max, SIZE_MAX / 4 );
+#endif
+    p_sys->b_always = var_CreateGetBool( p_input, "input-timeshift-always" );
 
     char *psz_tmp_path = var_CreateGetNonEmptyString( p_input, "input-timeshift-path" );
     p_sys->psz_tmp_path = GetTmpPath( psz_tmp_path );
 
-    msg_Dbg( p_input, "using timeshift granularity of %d MiB, in path '%s'",
-             (int)p_sys->i_tmp_size_max/(1024*1024), p_sys->psz_tmp_path );
+    msg_Dbg( p_input, "using a timeshift buffer of %"PRId64" MiB, in path '%s'",
+             p_sys->i_tmp_size_max/(1024*1024), p_sys->psz_tmp_path );
 
 #if 0
 #define S(t) msg_Err( p_input, "SIZEOF("#t")=%d", sizeof(t) )
@@ -412,6 +474,7 @@ static int Send( es_out_t *p_out, es_out_id_t *p_es, block_t *p_block )
     vlc_mutex_lock( &p_sys->lock );
 
     TsAutoStop( p_out );
+    TsAutoStart( p_out );
 
     CmdInitSend( &cmd, p_es, p_block );
     if( p_sys->b_delayed )
@@ -556,6 +619,14 @@ static int ControlLockedSetTime( es_out_t *p_out, mtime_t i_date )
 {
     es_out_sys_t *p_sys = p_out->p_sys;
 
+    /* Jump within the stored data */
+    if( i_date >= 0 )
+    {
+        if( !p_sys->b_delayed )
+            return VLC_EGENERIC;
+        return TsSeek( p_sys->p_ts, i_date );
+    }
+
     if( !p_sys->b_delayed )
         return es_out_SetTime( p_sys->p_out, i_date );
 
@@ -754,8 +825,9 @@ static int TsStart( es_out_t *p_out )
     p_ts->i_rate_delay = 0;
     p_ts->i_buffering_delay = 0;
     p_ts->i_cmd_delay = 0;
-    p_ts->p_storage_r = NULL;
-    p_ts->p_storage_w = NULL;
+    p_ts->p_storage = NULL;
+    p_ts->b_storage_error = false;
+    p_ts->b_seek = false;
 
     p_sys->b_delayed = true;
     if( vlc_clone( &p_ts->thread, TsRun, p_ts, VLC_THREAD_PRIORITY_INPUT ) )
@@ -770,11 +842,22 @@ static int TsStart( es_out_t *p_out )
 
     return VLC_SUCCESS;
 }
+static void TsAutoStart( es_out_t *p_out )
+{
+    es_out_sys_t *p_sys = p_out->p_sys;
+
+    if( !p_sys->b_always || p_sys->b_delayed ||
+        p_sys->p_input->p->b_can_pace_control )
+        return;
+
+    if( TsStart( p_out ) )
+        p_sys->b_always = false;
+}
 static void TsAutoStop( es_out_t *p_out )
 {
     es_out_sys_t *p_sys = p_out->p_sys;
 
-    if( !p_sys->b_delayed || !TsIsUnused( p_sys->p_ts ) )
+    if( !p_sys->b_delayed || p_sys->b_always || !TsIsUnused( p_sys->p_ts ) )
         return;
 
     msg_Warn( p_sys->p_input, "es out timeshift: auto stop" );
@@ -788,18 +871,8 @@ static void TsStop( ts_thread_t *p_ts )
     vlc_join( p_ts->thread, NULL );
 
     vlc_mutex_lock( &p_ts->lock );
-    for( ;; )
-    {
-        ts_cmd_t cmd;
-
-        if( TsPopCmdLocked( p_ts, &cmd, true ) )
-            break;
-
-        CmdClean( &cmd );
-    }
-    assert( !p_ts->p_storage_r || !p_ts->p_storage_r->p_next );
-    if( p_ts->p_storage_r )
-        TsStorageDelete( p_ts->p_storage_r );
+    if( p_ts->p_storage )
+        TsStorageDelete( p_ts->p_storage );
     vlc_mutex_unlock( &p_ts->lock );
 
     TsDestroy( p_ts );
@@ -808,64 +881,100 @@ static void TsPushCmd( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
 {
     vlc_mutex_lock( &p_ts->lock );
 
-    if( !p_ts->p_storage_w || TsStorageIsFull( p_ts->p_storage_w, p_cmd ) )
+    if( !p_ts->p_storage && !p_ts->b_storage_error )
     {
-        ts_storage_t *p_storage = TsStorageNew( p_ts->psz_tmp_path, p_ts->i_tmp_size_max );
-
-        if( !p_storage )
+        p_ts->p_storage = TsStorageNew( p_ts->psz_tmp_path, p_ts->i_tmp_size_max );
+        if( !p_ts->p_storage )
         {
-            CmdClean( p_cmd );
-            vlc_mutex_unlock( &p_ts->lock );
-            /* TODO warn the user (but only once) */
-            return;
-        }
-
-        if( !p_ts->p_storage_w )
-        {
-            p_ts->p_storage_r = p_ts->p_storage_w = p_storage;
-        }
-        else
-        {
-            TsStoragePack( p_ts->p_storage_w );
-            p_ts->p_storage_w->p_next = p_storage;
-            p_ts->p_storage_w = p_storage;
+            msg_Err( p_ts->p_input, "cannot create the timeshift buffer in %s",
+                     p_ts->psz_tmp_path );
+            p_ts->b_storage_error = true;
         }
     }
+    if( !p_ts->p_storage )
+    {
+        CmdClean( p_cmd );
+        vlc_mutex_unlock( &p_ts->lock );
+        return;
+    }
+
+    ts_storage_t *p_storage = p_ts->p_storage;
+    TsStoragePushCmd( p_storage, p_cmd );
 
-    /* TODO return error and warn the user (but only once) */
-    TsStoragePushCmd( p_ts->p_storage_w, p_cmd, p_ts->p_storage_r == p_ts->p_storage_w );
+    /* Data not played yet was overwritten, resume with what is left */
+    if( p_storage->i_cmd_data > p_storage->i_cmd_r && !p_ts->b_seek )
+    {
+        msg_Warn( p_ts->p_input, "timeshift buffer full, dropping the oldest data" );
+        p_ts->b_seek = true;
+        p_ts->i_seek_cmd = p_storage->i_cmd_data;
+    }
 
     vlc_cond_signal( &p_ts->wait );
 
     vlc_mutex_unlock( &p_ts->lock );
 }
-static int TsPopCmdLocked( ts_thread_t *p_ts, ts_cmd_t *p_cmd, bool b_flush )
+static int TsPopCmdLocked( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
 {
     vlc_assert_locked( &p_ts->lock );
 
-    if( TsStorageIsEmpty( p_ts->p_storage_r ) )
+    if( TsStorageIsEmpty( p_ts->p_storage ) )
         return VLC_EGENERIC;
 
-    TsStoragePopCmd( p_ts->p_storage_r, p_cmd, b_flush );
+    const int i_ret = TsStoragePopCmd( p_ts->p_storage, p_cmd );
+    TsStorageTrim( p_ts->p_storage );
+    return i_ret;
+}
+/* Moves the playback to the command chosen by TsSeek() or by TsPushCmd() */
+static bool TsSeekLocked( ts_thread_t *p_ts )
+{
+    ts_storage_t *p_storage = p_ts->p_storage;
 
-    while( p_ts->p_storage_r && TsStorageIsEmpty( p_ts->p_storage_r ) )
-    {
-        ts_storage_t *p_next = p_ts->p_storage_r->p_next;
-        if( !p_next )
-            break;
+    vlc_assert_locked( &p_ts->lock );
 
-        TsStorageDelete( p_ts->p_storage_r );
-        p_ts->p_storage_r = p_next;
-    }
+    if( !p_ts->b_seek )
+        return false;
+    p_ts->b_seek = false;
 
-    return VLC_SUCCESS;
+    const uint64_t i_cmd = __MIN( __MAX( p_ts->i_seek_cmd,
+                                         TsStorageSeekable( p_storage ) ),
+                                  p_storage->cmd.i_last );
+
+    /* Restart the decoders and the clock */
+    es_out_SetTime( p_ts->p_out, -1 );
+
+    /* Only the commands that do not change the state are skipped */
+    ts_cmd_t cmd;
+    while( !TsStoragePopState( p_storage, i_cmd, &cmd ) )
+        CmdExecute( p_ts->p_out, &cmd );
+
+    p_storage->i_cmd_r = i_cmd;
+    p_storage->i_cmd_played = __MAX( p_storage->i_cmd_played, i_cmd );
+    TsStorageTrim( p_storage );
+
+    /* Play the new position right away */
+    const mtime_t i_now = mdate();
+    if( i_cmd < p_storage->cmd.i_last )
+    {
+        const ts_cmd_t *p_next = TsRingAt( &p_storage->cmd, i_cmd );
+        p_ts->i_cmd_delay = i_now - p_next->i_date;
+    }
+    else
+    {
+        p_ts->i_cmd_delay = 0;
+    }
+    p_ts->i_rate_date = -1;
+    p_ts->i_rate_delay = 0;
+    p_ts->i_buffering_delay = 0;
+    if( p_ts->b_paused )
+        p_ts->i_pause_date = i_now;
+    return true;
 }
 static bool TsHasCmd( ts_thread_t *p_ts )
 {
     bool b_cmd;
 
     vlc_mutex_lock( &p_ts->lock );
-    b_cmd =  TsStorageIsEmpty( p_ts->p_storage_r );
+    b_cmd =  TsStorageIsEmpty( p_ts->p_storage );
     vlc_mutex_unlock( &p_ts->lock );
 
     return b_cmd;
@@ -877,7 +986,7 @@ static bool TsIsUnused( ts_thread_t *p_ts )
     vlc_mutex_lock( &p_ts->lock );
     b_unused = !p_ts->b_paused &&
                p_ts->i_rate == p_ts->i_rate_source &&
-               TsStorageIsEmpty( p_ts->p_storage_r );
+               TsStorageIsEmpty( p_ts->p_storage );
     vlc_mutex_unlock( &p_ts->lock );
 
     return b_unused;
@@ -931,6 +1040,24 @@ static int TsChangeRate( ts_thread_t *p_ts, int i_src_rate, int i_rate )
 
     return i_ret;
 }
+static int TsSeek( ts_thread_t *p_ts, mtime_t i_time )
+{
+    uint64_t i_cmd;
+    int i_ret = VLC_EGENERIC;
+
+    vlc_mutex_lock( &p_ts->lock );
+    if( p_ts->p_storage &&
+        !TsStorageFind( p_ts->p_storage, i_time, &i_cmd ) )
+    {
+        p_ts->b_seek = true;
+        p_ts->i_seek_cmd = i_cmd;
+        vlc_cond_signal( &p_ts->wait );
+        i_ret = VLC_SUCCESS;
+    }
+    vlc_mutex_unlock( &p_ts->lock );
+
+    return i_ret;
+}
 
 static void *TsRun( void *p_data )
 {
@@ -952,10 +1079,18 @@ static void *TsRun( void *p_data )
             const int canc = vlc_savecancel();
             b_buffering = es_out_GetBuffering( p_ts->p_out );
 
-            if( ( !p_ts->b_paused || b_buffering ) && !TsPopCmdLocked( p_ts, &cmd, false ) )
+            if( !p_ts->b_paused || b_buffering )
             {
-                vlc_restorecancel( canc );
-                break;
+                if( TsSeekLocked( p_ts ) )
+                {
+                    i_buffering_date = -1;
+                    b_buffering = es_out_GetBuffering( p_ts->p_out );
+                }
+                if( !TsPopCmdLocked( p_ts, &cmd ) )
+                {
+                    vlc_restorecancel( canc );
+                    break;
+                }
             }
             vlc_restorecancel( canc );
 
@@ -1023,27 +1158,7 @@ static void *TsRun( void *p_data )
 
         /* Execute the command  */
         const int canc = vlc_savecancel();
-        switch( cmd.i_type )
-        {
-        case C_ADD:
-            CmdExecuteAdd( p_ts->p_out, &cmd );
-            CmdCleanAdd( &cmd );
-            break;
-        case C_SEND:
-            CmdExecuteSend( p_ts->p_out, &cmd );
-            CmdCleanSend( &cmd );
-            break;
-        case C_CONTROL:
-            CmdExecuteControl( p_ts->p_out, &cmd );
-            CmdCleanControl( &cmd );
-            break;
-        case C_DEL:
-            CmdExecuteDel( p_ts->p_out, &cmd );
-            break;
-        default:
-            assert(0);
-            break;
-        }
+        CmdExecute( p_ts->p_out, &cmd );
         vlc_restorecancel( canc );
     }
 
@@ -1053,159 +1168,449 @@ static void *TsRun( void *p_data )
 /*****************************************************************************
  *
  *****************************************************************************/
+static void TsRingInit( ts_ring_t *p_ring, size_t i_size )
+{
+    p_ring->p_data = NULL;
+    p_ring->i_size = i_size;
+    p_ring->i_max = 0;
+    p_ring->i_first = 0;
+    p_ring->i_last = 0;
+}
+static void *TsRingAt( const ts_ring_t *p_ring, uint64_t i )
+{
+    assert( i >= p_ring->i_first && i < p_ring->i_last );
+    return &p_ring->p_data[(i & (p_ring->i_max - 1)) * p_ring->i_size];
+}
+static void *TsRingPush( ts_ring_t *p_ring )
+{
+    if( p_ring->i_last - p_ring->i_first >= p_ring->i_max )
+    {
+        const size_t i_max = p_ring->i_max > 0 ? 2 * p_ring->i_max : 1024;
+        uint8_t *p_data = malloc( i_max * p_ring->i_size );
+        if( !p_data )
+            return NULL;
+
+        for( uint64_t i = p_ring->i_first; i < p_ring->i_last; i++ )
+            memcpy( &p_data[(i & (i_max - 1)) * p_ring->i_size],
+                    TsRingAt( p_ring, i ), p_ring->i_size );
+        free( p_ring->p_data );
+        p_ring->p_data = p_data;
+        p_ring->i_max = i_max;
+    }
+    p_ring->i_last++;
+    return TsRingAt( p_ring, p_ring->i_last - 1 );
+}
+
 static ts_storage_t *TsStorageNew( const char *psz_tmp_path, int64_t i_tmp_size_max )
 {
     ts_storage_t *p_storage = calloc( 1, sizeof(ts_storage_t) );
     if( !p_storage )
         return NULL;
 
-    /* */
-    p_storage->p_next = NULL;
-
-    /* */
-    p_storage->i_file_max = i_tmp_size_max;
-    p_storage->i_file_size = 0;
-    p_storage->p_filew = GetTmpFile( &p_storage->psz_file, psz_tmp_path );
-    if( p_storage->psz_file )
-        p_storage->p_filer = vlc_fopen( p_storage->psz_file, "rb" );
-
-    /* */
-    p_storage->i_cmd_w = 0;
-    p_storage->i_cmd_r = 0;
-    p_storage->i_cmd_max = 30000;
-    p_storage->p_cmd = malloc( p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) );
-    //fprintf( stderr, "\nSTORAGE name=%s size=%d KiB\n", p_storage->psz_file, p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) /1024 );
-
-    if( !p_storage->p_cmd || !p_storage->p_filew || !p_storage->p_filer )
+    /* With mmap, the whole buffer is allocated at once */
+    p_storage->i_data_max = i_tmp_size_max;
+#ifdef HAVE_MMAP
+    char *psz_file;
+    const int fd = GetTmpFile( &psz_file, psz_tmp_path );
+    if( fd < 0 )
+        goto error;
+    if( ftruncate( fd, i_tmp_size_max ) )
+        p_storage->p_data = MAP_FAILED;
+    else
+        p_storage->p_data = mmap( NULL, i_tmp_size_max, PROT_READ|PROT_WRITE,
+                                  MAP_SHARED, fd, 0 );
+    close( fd );
+    if( psz_file )
     {
-        TsStorageDelete( p_storage );
-        return NULL;
+        vlc_unlink( psz_file );
+        free( psz_file );
     }
+    if( p_storage->p_data == MAP_FAILED )
+        goto error;
+#else
+    /* The file grows as it is written, up to i_data_max */
+    p_storage->fd = GetTmpFile( &p_storage->psz_file, psz_tmp_path );
+    if( p_storage->fd < 0 )
+        goto error;
+#endif
+
+    TsRingInit( &p_storage->cmd, sizeof(ts_cmd_t) );
+    TsRingInit( &p_storage->state, sizeof(uint64_t) );
+    TsRingInit( &p_storage->index, sizeof(ts_index_t) );
     return p_storage;
+
+error:
+    free( p_storage );
+    return NULL;
 }
 static void TsStorageDelete( ts_storage_t *p_storage )
 {
-    while( p_storage->i_cmd_r < p_storage->i_cmd_w )
-    {
-        ts_cmd_t cmd;
-
-        TsStoragePopCmd( p_storage, &cmd, true );
-
-        CmdClean( &cmd );
-    }
-    free( p_storage->p_cmd );
+    /* The commands played gave their resources away */
+    for( uint64_t i = p_storage->i_cmd_played; i < p_storage->cmd.i_last; i++ )
+        CmdClean( TsRingAt( &p_storage->cmd, i ) );
 
-    if( p_storage->p_filer )
-        fclose( p_storage->p_filer );
-    if( p_storage->p_filew )
-        fclose( p_storage->p_filew );
+    free( p_storage->cmd.p_data );
+    free( p_storage->state.p_data );
+    free( p_storage->index.p_data );
 
+#ifdef HAVE_MMAP
+    munmap( p_storage->p_data, p_storage->i_data_max );
+#else
+    close( p_storage->fd );
     if( p_storage->psz_file )
     {
         vlc_unlink( p_storage->psz_file );
         free( p_storage->psz_file );
     }
-
+#endif
     free( p_storage );
 }
-static void TsStoragePack( ts_storage_t *p_storage )
+static bool TsStorageIsEmpty( ts_storage_t *p_storage )
 {
-    /* Try to release a bit of memory */
-    if( p_storage->i_cmd_w >= p_storage->i_cmd_max )
-        return;
+    return !p_storage || p_storage->i_cmd_r >= p_storage->cmd.i_last;
+}
+#ifndef HAVE_MMAP
+/* All accesses are done with p_ts->lock held, the file offset is not shared */
+static int TsStorageFileWrite( ts_storage_t *p_storage, uint64_t i_pos,
+                               const uint8_t *p_src, size_t i_size )
+{
+    if( lseek( p_storage->fd, i_pos, SEEK_SET ) != (off_t)i_pos )
+        return VLC_EGENERIC;
+    while( i_size > 0 )
+    {
+        const ssize_t i_ret = write( p_storage->fd, p_src, i_size );
+        if( i_ret < 0 && errno == EINTR )
+            continue;
+        if( i_ret <= 0 )
+            return VLC_EGENERIC;
+        p_src += i_ret;
+        i_size -= i_ret;
+    }
+    return VLC_SUCCESS;
+}
+static int TsStorageFileRead( ts_storage_t *p_storage, uint64_t i_pos,
+                              uint8_t *p_dst, size_t i_size )
+{
+    if( lseek( p_storage->fd, i_pos, SEEK_SET ) != (off_t)i_pos )
+        return VLC_EGENERIC;
+    while( i_size > 0 )
+    {
+        const ssize_t i_ret = read( p_storage->fd, p_dst, i_size );
+        if( i_ret < 0 && errno == EINTR )
+            continue;
+        if( i_ret <= 0 )
+            return VLC_EGENERIC;
+        p_dst += i_ret;
+        i_size -= i_ret;
+    }
+    return VLC_SUCCESS;
+}
+#endif
+static void TsStorageWrite( ts_storage_t *p_storage, const void *p_src, size_t i_size )
+{
+    const size_t i_pos = p_storage->i_data_w % p_storage->i_data_max;
+    const size_t i_part = __MIN( i_size, p_storage->i_data_max - i_pos );
 
-    p_storage->i_cmd_max = __MAX( p_storage->i_cmd_w, 1 );
+#ifdef HAVE_MMAP
+    memcpy( &p_storage->p_data[i_pos], p_src, i_part );
+    memcpy( p_storage->p_data, (const uint8_t *)p_src + i_part, i_size - i_part );
+#else
+    /* A failed write is found out by TsStorageReadBlock() */
+    if( !TsStorageFileWrite( p_storage, i_pos, p_src, i_part ) )
+        TsStorageFileWrite( p_storage, 0, (const uint8_t *)p_src + i_part,
+                            i_size - i_part );
+#endif
+    p_storage->i_data_w += i_size;
+}
+static int TsStorageRead( ts_storage_t *p_storage, uint64_t i_offset,
+                          void *p_dst, size_t i_size )
+{
+    const size_t i_pos = i_offset % p_storage->i_data_max;
+    const size_t i_part = __MIN( i_size, p_storage->i_data_max - i_pos );
 
-    ts_cmd_t *p_new = realloc( p_storage->p_cmd, p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) );
-    if( p_new )
-        p_storage->p_cmd = p_new;
+#ifdef HAVE_MMAP
+    memcpy( p_dst, &p_storage->p_data[i_pos], i_part );
+    memcpy( (uint8_t *)p_dst + i_part, p_storage->p_data, i_size - i_part );
+    return VLC_SUCCESS;
+#else
+    if( TsStorageFileRead( p_storage, i_pos, p_dst, i_part ) )
+        return VLC_EGENERIC;
+    return TsStorageFileRead( p_storage, 0, (uint8_t *)p_dst + i_part,
+                              i_size - i_part );
+#endif
 }
-static bool TsStorageIsFull( ts_storage_t *p_storage, const ts_cmd_t *p_cmd )
+/* Seek points follow the ES_OUT_SET_TIMES of the input, which only grow
+ * between discontinuities */
+static void TsStorageIndex( ts_storage_t *p_storage, mtime_t i_time, uint64_t i_cmd )
 {
-    if( p_cmd && p_cmd->i_type == C_SEND && p_storage->i_cmd_w > 0 )
+    ts_ring_t *p_index = &p_storage->index;
+
+    if( p_index->i_last > p_index->i_first )
     {
-        size_t i_size = sizeof(*p_cmd->u.send.p_block) + p_cmd->u.send.p_block->i_buffer;
+        const ts_index_t *p_last = TsRingAt( p_index, p_index->i_last - 1 );
 
-        if( p_storage->i_file_size + i_size >= p_storage->i_file_max )
-            return true;
+        if( i_time == p_last->i_time )
+            return;
+        if( i_time < p_last->i_time )
+            p_index->i_first = p_index->i_last;
+    }
+
+    ts_index_t *p_entry = TsRingPush( p_index );
+    if( p_entry )
+    {
+        p_entry->i_time = i_time;
+        p_entry->i_cmd = i_cmd;
     }
-    return p_storage->i_cmd_w >= p_storage->i_cmd_max;
-}
-static bool TsStorageIsEmpty( ts_storage_t *p_storage )
-{
-    return !p_storage || p_storage->i_cmd_r >= p_storage->i_cmd_w;
 }
-static void TsStoragePushCmd( ts_storage_t *p_storage, const ts_cmd_t *p_cmd, bool b_flush )
+static void TsStoragePushCmd( ts_storage_t *p_storage, const ts_cmd_t *p_cmd )
 {
     ts_cmd_t cmd = *p_cmd;
+    const bool b_replayable = CmdIsReplayable( &cmd );
+
+    if( cmd.i_type == C_SEND &&
+        sizeof(ts_block_header_t) + cmd.u.send.p_block->i_buffer > p_storage->i_data_max )
+    {
+        CmdClean( &cmd );
+        return;
+    }
 
-    assert( !TsStorageIsFull( p_storage, p_cmd ) );
+    const uint64_t i_cmd = p_storage->cmd.i_last;
+    ts_cmd_t *p_stored = TsRingPush( &p_storage->cmd );
+    if( !p_stored )
+    {
+        CmdClean( &cmd );
+        return;
+    }
+    if( !b_replayable )
+    {
+        uint64_t *pi_state = TsRingPush( &p_storage->state );
+        if( !pi_state )
+        {
+            p_storage->cmd.i_last--;
+            CmdClean( &cmd );
+            return;
+        }
+        *pi_state = i_cmd;
+    }
 
     if( cmd.i_type == C_SEND )
     {
         block_t *p_block = cmd.u.send.p_block;
+        const ts_block_header_t header = {
+            .i_buffer     = p_block->i_buffer,
+            .i_flags      = p_block->i_flags,
+            .i_nb_samples = p_block->i_nb_samples,
+            .i_pts        = p_block->i_pts,
+            .i_dts        = p_block->i_dts,
+            .i_length     = p_block->i_length,
+        };
+        const size_t i_size = sizeof(header) + p_block->i_buffer;
+
+        /* Overwrite the oldest data, played or not */
+        while( p_storage->i_data_w + i_size - p_storage->i_data_r > p_storage->i_data_max )
+        {
+            assert( p_storage->i_cmd_data < i_cmd );
+            const ts_cmd_t *p_old = TsRingAt( &p_storage->cmd, p_storage->i_cmd_data++ );
+
+            if( p_old->i_type == C_SEND )
+                p_storage->i_data_r = p_old->u.send.i_offset + p_old->u.send.i_size;
+        }
 
         cmd.u.send.p_block = NULL;
-        cmd.u.send.i_offset = ftell( p_storage->p_filew );
+        cmd.u.send.i_offset = p_storage->i_data_w;
+        cmd.u.send.i_size = i_size;
+        TsStorageWrite( p_storage, &header, sizeof(header) );
+        TsStorageWrite( p_storage, p_block->p_buffer, p_block->i_buffer );
+        block_Release( p_block );
+    }
+    else if( cmd.i_type == C_CONTROL &&
+             cmd.u.control.i_query == ES_OUT_SET_TIMES &&
+             cmd.u.control.u.times.i_time >= 0 )
+    {
+        TsStorageIndex( p_storage, cmd.u.control.u.times.i_time, i_cmd );
+    }
+    *p_stored = cmd;
+}
+static block_t *TsStorageReadBlock( ts_storage_t *p_storage, const ts_cmd_t *p_cmd )
+{
+    ts_block_header_t header;
+
+    if( p_cmd->u.send.i_offset < p_storage->i_data_r )
+        return NULL;
+
+    if( TsStorageRead( p_storage, p_cmd->u.send.i_offset, &header, sizeof(header) ) ||
+        sizeof(header) + header.i_buffer != p_cmd->u.send.i_size )
+        return NULL;
+
+    block_t *p_block = block_Alloc( header.i_buffer );
+    if( !p_block )
+        return NULL;
 
-        if( fwrite( p_block, sizeof(*p_block), 1, p_storage->p_filew ) != 1 )
+    p_block->i_flags      = header.i_flags;
+    p_block->i_nb_samples = header.i_nb_samples;
+    p_block->i_pts        = header.i_pts;
+    p_block->i_dts        = header.i_dts;
+    p_block->i_length     = header.i_length;
+    if( TsStorageRead( p_storage, p_cmd->u.send.i_offset + sizeof(header),
+                       p_block->p_buffer, header.i_buffer ) )
+    {
+        block_Release( p_block );
+        return NULL;
+    }
+    return p_block;
+}
+/* Takes the next command to play. Once played, the commands changing the
+ * state are skipped, the others played again when seeking back. */
+static int TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd )
+{
+    while( !TsStorageIsEmpty( p_storage ) )
+    {
+        const uint64_t i_cmd = p_storage->i_cmd_r++;
+        const ts_cmd_t *p_stored = TsRingAt( &p_storage->cmd, i_cmd );
+
+        if( i_cmd < p_storage->i_cmd_played )
         {
-            block_Release( p_block );
-            return;
+            if( !CmdIsReplayable( p_stored ) )
+                continue;
         }
-        p_storage->i_file_size += sizeof(*p_block);
-        if( p_block->i_buffer > 0 )
+        else
         {
-            if( fwrite( p_block->p_buffer, p_block->i_buffer, 1, p_storage->p_filew ) != 1 )
+            p_storage->i_cmd_played = i_cmd + 1;
+            if( !CmdIsReplayable( p_stored ) )
             {
-                block_Release( p_block );
-                return;
+                ts_cmd_t cmd;
+                const int i_ret = TsStoragePopState( p_storage, i_cmd + 1, &cmd );
+
+                assert( !i_ret );
+                VLC_UNUSED( i_ret );
+                *p_cmd = cmd;
+                return VLC_SUCCESS;
             }
         }
-        p_storage->i_file_size += p_block->i_buffer;
-        block_Release( p_block );
 
-        if( b_flush )
-            fflush( p_storage->p_filew );
+        *p_cmd = *p_stored;
+        if( p_cmd->i_type == C_SEND )
+            p_cmd->u.send.p_block = TsStorageReadBlock( p_storage, p_stored );
+        return VLC_SUCCESS;
     }
-    p_storage->p_cmd[p_storage->i_cmd_w++] = cmd;
+    return VLC_EGENERIC;
 }
-static void TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd, bool b_flush )
+/* Takes the next command changing the state if it comes before i_before */
+static int TsStoragePopState( ts_storage_t *p_storage, uint64_t i_before, ts_cmd_t *p_cmd )
 {
-    assert( !TsStorageIsEmpty( p_storage ) );
+    ts_ring_t *p_state = &p_storage->state;
 
-    *p_cmd = p_storage->p_cmd[p_storage->i_cmd_r++];
-    if( p_cmd->i_type == C_SEND )
+    if( p_state->i_first >= p_state->i_last )
+        return VLC_EGENERIC;
+
+    const uint64_t i_cmd = *(uint64_t *)TsRingAt( p_state, p_state->i_first );
+    if( i_cmd >= i_before )
+        return VLC_EGENERIC;
+    p_state->i_first++;
+
+    *p_cmd = *(ts_cmd_t *)TsRingAt( &p_storage->cmd, i_cmd );
+
+    /* The ES or the group are gone, their commands cannot be played again */
+    if( p_cmd->i_type == C_DEL ||
+        ( p_cmd->i_type == C_CONTROL && p_cmd->u.control.i_query == ES_OUT_DEL_GROUP ) )
+        p_storage->i_cmd_barrier = i_cmd + 1;
+    return VLC_SUCCESS;
+}
+/* First command one can seek to */
+static uint64_t TsStorageSeekable( ts_storage_t *p_storage )
+{
+    return __MAX( p_storage->i_cmd_data, p_storage->i_cmd_barrier );
+}
+/* Finds the last seek point at or before i_time, by bisection */
+static int TsStorageFind( ts_storage_t *p_storage, mtime_t i_time, uint64_t *pi_cmd )
+{
+    ts_ring_t *p_index = &p_storage->index;
+
+    TsStorageTrim( p_storage );
+    if( p_index->i_first >= p_index->i_last )
+        return VLC_EGENERIC;
+
+    uint64_t i_low = p_index->i_first;
+    uint64_t i_high = p_index->i_last;
+    while( i_high - i_low > 1 )
     {
-        block_t block;
+        const uint64_t i_mid = i_low + ( i_high - i_low ) / 2;
+        const ts_index_t *p_entry = TsRingAt( p_index, i_mid );
 
-        if( !b_flush &&
-            !fseek( p_storage->p_filer, p_cmd->u.send.i_offset, SEEK_SET ) &&
-            fread( &block, sizeof(block), 1, p_storage->p_filer ) == 1 )
-        {
-            block_t *p_block = block_Alloc( block.i_buffer );
-            if( p_block )
-            {
-                p_block->i_dts      = block.i_dts;
-                p_block->i_pts      = block.i_pts;
-                p_block->i_flags    = block.i_flags;
-                p_block->i_length   = block.i_length;
-                p_block->i_nb_samples = block.i_nb_samples;
-                p_block->i_buffer = fread( p_block->p_buffer, 1, block.i_buffer, p_storage->p_filer );
-            }
-            p_cmd->u.send.p_block = p_block;
-        }
+        if( p_entry->i_time <= i_time )
+            i_low = i_mid;
         else
-        {
-            //perror( "TsStoragePopCmd" );
-            p_cmd->u.send.p_block = block_Alloc( 1 );
-        }
+            i_high = i_mid;
     }
+
+    *pi_cmd = ((const ts_index_t *)TsRingAt( p_index, i_low ))->i_cmd;
+    return VLC_SUCCESS;
+}
+/* Forgets the commands that can neither be played nor sought to anymore */
+static void TsStorageTrim( ts_storage_t *p_storage )
+{
+    ts_ring_t *p_index = &p_storage->index;
+    const uint64_t i_first = __MIN( p_storage->i_cmd_r, p_storage->i_cmd_data );
+    const uint64_t i_seekable = TsStorageSeekable( p_storage );
+
+    if( p_storage->cmd.i_first < i_first )
+        p_storage->cmd.i_first = i_first;
+
+    while( p_index->i_first < p_index->i_last &&
+           ((const ts_index_t *)TsRingAt( p_index, p_index->i_first ))->i_cmd < i_seekable )
+        p_index->i_first++;
 }
 
 /*****************************************************************************
  *
  *****************************************************************************/
+static void CmdExecute( es_out_t *p_out, ts_cmd_t *p_cmd )
+{
+    switch( p_cmd->i_type )
+    {
+    case C_ADD:
+        CmdExecuteAdd( p_out, p_cmd );
+        CmdCleanAdd( p_cmd );
+        break;
+    case C_SEND:
+        CmdExecuteSend( p_out, p_cmd );
+        CmdCleanSend( p_cmd );
+        break;
+    case C_CONTROL:
+        CmdExecuteControl( p_out, p_cmd );
+        CmdCleanControl( p_cmd );
+        break;
+    case C_DEL:
+        CmdExecuteDel( p_out, p_cmd );
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+/* Commands that only carry data or timing, which can be played again after
+ * seeking back, or skipped when seeking forward */
+static bool CmdIsReplayable( const ts_cmd_t *p_cmd )
+{
+    if( p_cmd->i_type == C_SEND )
+        return true;
+    if( p_cmd->i_type != C_CONTROL )
+        return false;
+
+    switch( p_cmd->u.control.i_query )
+    {
+    case ES_OUT_SET_PCR:
+    case ES_OUT_SET_GROUP_PCR:
+    case ES_OUT_RESET_PCR:
+    case ES_OUT_SET_NEXT_DISPLAY_TIME:
+    case ES_OUT_SET_TIMES:
+    case ES_OUT_SET_JITTER:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static void CmdClean( ts_cmd_t *p_cmd )
 {
     switch( p_cmd->i_type )
@@ -1586,29 +1991,22 @@ static char *GetTmpPath( char *psz_path )
     return psz_path;
 }
 
-static FILE *GetTmpFile( char **ppsz_file, const char *psz_path )
+/* The file is removed at once, it does not outlive the descriptor. Where
+ * open files cannot be removed, its name is returned in *ppsz_file instead,
+ * NULL otherwise. */
+static int GetTmpFile( char **ppsz_file, const char *psz_path )
 {
     char *psz_name;
-    int fd;
-    FILE *f;
 
-    /* */
     *ppsz_file = NULL;
     if( asprintf( &psz_name, "%s"DIR_SEP"vlc-timeshift.XXXXXX", psz_path ) < 0 )
-        return NULL;
+        return -1;
 
-    /* */
-    fd = vlc_mkstemp( psz_name );
-    *ppsz_file = psz_name;
-
-    if( fd < 0 )
-        return NULL;
-
-    /* */
-    f = fdopen( fd, "w+b" );
-    if( !f )
-        close( fd );
+    const int fd = vlc_mkstemp( psz_name );
+    if( fd >= 0 && vlc_unlink( psz_name ) )
+        *ppsz_file = psz_name;
+    else
+        free( psz_name );
 
-    return f;
+    return fd;
 }
-
@@ -30,6 +30,7 @@
 #endif
 
 #include <vlc_common.h>
+#include <vlc_atomic.h>
 
 #include <limits.h>
 #include <assert.h>
@@ -176,15 +177,33 @@ int input_Read( vlc_object_t *p_parent, input_item_t *p_item )
     return VLC_SUCCESS;
 }
 
+typedef struct
+{
+    input_thread_t *p_input;
+    atomic_bool     b_over;     /* Set by the timer or by the end of Init() */
+} preparse_timeout_t;
+
+static void PreparseTimeout( void *data )
+{
+    preparse_timeout_t *p_timeout = data;
+
+    /* Too late once the preparsing is over */
+    if( !atomic_exchange( &p_timeout->b_over, true ) )
+        ObjectKillChildrens( VLC_OBJECT(p_timeout->p_input) );
+}
+
 /**
  * Initialize an input and initialize it to preparse the item
  * This function is blocking. It will only accept parsing regular files.
  *
  * \param p_parent a vlc_object_t
  * \param p_item an input item
- * \return VLC_SUCCESS or an error
+ * \param i_timeout delay after which the access and demuxers are
+ *                  interrupted, or 0 to wait until they are done
+ * \return VLC_SUCCESS, VLC_ETIMEOUT if interrupted, or an error
  */
-int input_Preparse( vlc_object_t *p_parent, input_item_t *p_item )
+int input_Preparse( vlc_object_t *p_parent, input_item_t *p_item,
+                    mtime_t i_timeout )
 {
     input_thread_t *p_input;
 
@@ -193,12 +212,33 @@ int input_Preparse( vlc_object_t *p_parent, input_item_t *p_item )
     if( !p_input )
         return VLC_EGENERIC;
 
-    if( !Init( p_input ) )
+    preparse_timeout_t timeout = { .p_input = p_input };
+    vlc_timer_t timer;
+
+    atomic_init( &timeout.b_over, false );
+    const bool b_timer = i_timeout > 0
+                      && !vlc_timer_create( &timer, PreparseTimeout, &timeout );
+    if( b_timer )
+        vlc_timer_schedule( timer, false, i_timeout, 0 );
+
+    const bool b_init = !Init( p_input );
+
+    /* Whichever of the timer and Init() is over first decides the result,
+     * the timer cannot interrupt End() nor report a timeout afterwards */
+    const bool b_expired = atomic_exchange( &timeout.b_over, true );
+    if( b_timer )
+        vlc_timer_schedule( timer, false, 0, 0 );
+
+    if( b_init )
         End( p_input );
 
+    /* This waits for the timer callback if it is running */
+    if( b_timer )
+        vlc_timer_destroy( timer );
+
     vlc_object_release( p_input );
 
-    return VLC_SUCCESS;
+    return b_expired ? VLC_ETIMEOUT : VLC_SUCCESS;
 }
 
 /**
@@ -827,6 +867,9 @@ static void InitStatistics( input_thread_t * p_input )
     {
         INIT_COUNTER( read_bytes, COUNTER );
         INIT_COUNTER( read_packets, COUNTER );
+        INIT_COUNTER( read_discontinuity, COUNTER );
+        INIT_COUNTER( prefetch_level, LAST );
+        INIT_COUNTER( prefetch_stalls, COUNTER );
         INIT_COUNTER( demux_read, COUNTER );
         INIT_COUNTER( input_bitrate, DERIVATIVE );
         INIT_COUNTER( demux_bitrate, DERIVATIVE );
@@ -1306,6 +1349,9 @@ error:
                                p_input->p->counters.p_##c = NULL; } while(0)
         EXIT_COUNTER( read_bytes );
         EXIT_COUNTER( read_packets );
+        EXIT_COUNTER( read_discontinuity );
+        EXIT_COUNTER( prefetch_level );
+        EXIT_COUNTER( prefetch_stalls );
         EXIT_COUNTER( demux_read );
         EXIT_COUNTER( input_bitrate );
         EXIT_COUNTER( demux_bitrate );
@@ -1377,6 +1423,9 @@ static void End( input_thread_t * p_input )
             stats_ComputeInputStats( p_input, p_input->p->p_item->p_stats );
             CL_CO( read_bytes );
             CL_CO( read_packets );
+            CL_CO( read_discontinuity );
+            CL_CO( prefetch_level );
+            CL_CO( prefetch_stalls );
             CL_CO( demux_read );
             CL_CO( input_bitrate );
             CL_CO( demux_bitrate );
@@ -1706,6 +1755,14 @@ static bool Control( input_thread_t *p_input,
             if( i_time < 0 )
                 i_time = 0;
 
+            /* Live streams: jump within the timeshift buffer */
+            if( !p_input->p->b_can_pace_control &&
+                !es_out_SetTime( p_input->p->p_es_out, i_time ) )
+            {
+                b_force_update = true;
+                break;
+            }
+
             /* Reset the decoders states and clock sync (before calling the demuxer */
             es_out_SetTime( p_input->p->p_es_out, -1 );
 
@@ -685,7 +685,49 @@ void input_item_MergeInfos( input_item_t *p_item, info_category_t *p_cat )
 }
 
 #define EPG_DEBUG
-void input_item_SetEpg( input_item_t *p_item, const vlc_epg_t *p_update )
+#ifdef EPG_DEBUG
+typedef struct
+{
+    input_item_t *p_item;
+    const char   *psz_cat;
+} epg_info_t;
+
+static void InputItemEpgChanged( void *p_data, const vlc_epg_event_t *p_evt,
+                                 bool b_removed )
+{
+    epg_info_t *p_info = p_data;
+    input_item_t *p_item = p_info->p_item;
+    time_t t_start = (time_t)p_evt->i_start;
+    struct tm tm_start;
+    char psz_start[128];
+
+    vlc_assert_locked( &p_item->lock );
+
+    localtime_r( &t_start, &tm_start );
+
+    snprintf( psz_start, sizeof(psz_start), "%4.4d-%2.2d-%2.2d %2.2d:%2.2d:%2.2d",
+              1900 + tm_start.tm_year, 1 + tm_start.tm_mon, tm_start.tm_mday,
+              tm_start.tm_hour, tm_start.tm_min, tm_start.tm_sec );
+    if( b_removed )
+    {
+        info_category_t *p_cat = InputItemFindCat( p_item, NULL, p_info->psz_cat );
+        if( p_cat )
+            info_category_DeleteInfo( p_cat, psz_start );
+    }
+    else if( p_evt->psz_short_description || p_evt->psz_description )
+        InputItemAddInfo( p_item, p_info->psz_cat, psz_start, "%s (%2.2d:%2.2d) - %s %s",
+                          p_evt->psz_name,
+                          p_evt->i_duration/60/60, (p_evt->i_duration/60)%60,
+                          p_evt->psz_short_description ? p_evt->psz_short_description : "" ,
+                          p_evt->psz_description ? p_evt->psz_description : "" );
+    else
+        InputItemAddInfo( p_item, p_info->psz_cat, psz_start, "%s (%2.2d:%2.2d)",
+                          p_evt->psz_name,
+                          p_evt->i_duration/60/60, (p_evt->i_duration/60)%60 );
+}
+#endif
+
+bool input_item_SetEpg( input_item_t *p_item, const vlc_epg_t *p_update )
 {
     vlc_mutex_lock( &p_item->lock );
 
@@ -711,55 +753,49 @@ void input_item_SetEpg( input_item_t *p_item, const vlc_epg_t *p_update )
         if( p_epg )
             TAB_APPEND( p_item->i_epg, p_item->pp_epg, p_epg );
     }
-    if( p_epg )
-        vlc_epg_Merge( p_epg, p_update );
-
-    vlc_mutex_unlock( &p_item->lock );
-
     if( !p_epg )
-        return;
+    {
+        vlc_mutex_unlock( &p_item->lock );
+        return false;
+    }
 
+    size_t i_changes;
 #ifdef EPG_DEBUG
+    /* Only the infos of the events which changed are updated, unless the
+     * whole category was removed meanwhile */
+    epg_info_t info = { .p_item = p_item, .psz_cat = NULL };
     char *psz_epg;
     if( asprintf( &psz_epg, "EPG %s", p_epg->psz_name ? p_epg->psz_name : "unknown" ) < 0 )
-        goto signal;
+        psz_epg = NULL;
 
-    input_item_DelInfo( p_item, psz_epg, NULL );
-
-    vlc_mutex_lock( &p_item->lock );
-    for( int i = 0; i < p_epg->i_event; i++ )
+    if( psz_epg && InputItemFindCat( p_item, NULL, psz_epg ) )
     {
-        const vlc_epg_event_t *p_evt = p_epg->pp_event[i];
-        time_t t_start = (time_t)p_evt->i_start;
-        struct tm tm_start;
-        char psz_start[128];
-
-        localtime_r( &t_start, &tm_start );
-
-        snprintf( psz_start, sizeof(psz_start), "%4.4d-%2.2d-%2.2d %2.2d:%2.2d:%2.2d",
-                  1900 + tm_start.tm_year, 1 + tm_start.tm_mon, tm_start.tm_mday,
-                  tm_start.tm_hour, tm_start.tm_min, tm_start.tm_sec );
-        if( p_evt->psz_short_description || p_evt->psz_description )
-            InputItemAddInfo( p_item, psz_epg, psz_start, "%s (%2.2d:%2.2d) - %s %s",
-                              p_evt->psz_name,
-                              p_evt->i_duration/60/60, (p_evt->i_duration/60)%60,
-                              p_evt->psz_short_description ? p_evt->psz_short_description : "" ,
-                              p_evt->psz_description ? p_evt->psz_description : "" );
-        else
-            InputItemAddInfo( p_item, psz_epg, psz_start, "%s (%2.2d:%2.2d)",
-                              p_evt->psz_name,
-                              p_evt->i_duration/60/60, (p_evt->i_duration/60)%60 );
+        info.psz_cat = psz_epg;
+        i_changes = vlc_epg_MergeChanges( p_epg, p_update,
+                                          InputItemEpgChanged, &info );
+    }
+    else
+    {
+        i_changes = vlc_epg_MergeChanges( p_epg, p_update, NULL, NULL );
+        info.psz_cat = psz_epg;
+        for( int i = 0; psz_epg && i < p_epg->i_event; i++ )
+            InputItemEpgChanged( &info, p_epg->pp_event[i], false );
+        if( psz_epg && p_epg->i_event > 0 )
+            i_changes++;
     }
-    vlc_mutex_unlock( &p_item->lock );
     free( psz_epg );
-signal:
+#else
+    i_changes = vlc_epg_MergeChanges( p_epg, p_update, NULL, NULL );
 #endif
 
-    if( p_epg->i_event > 0 )
+    vlc_mutex_unlock( &p_item->lock );
+
+    if( i_changes > 0 && p_epg->i_event > 0 )
     {
         vlc_event_t event = { .type = vlc_InputItemInfoChanged, };
         vlc_event_send( &p_item->event_manager, &event );
     }
+    return i_changes > 0;
 }
 
 void input_item_SetEpgOffline( input_item_t *p_item )
@@ -43,7 +43,7 @@
 
 /* TODO:
  *  - tune the 2 methods (block/stream)
- *  - compute cost for seek
+ *  - compute cost for seek (done for the prefetch method only)
  *  - improve stream mode seeking with closest segments
  *  - ...
  */
@@ -56,6 +56,8 @@
  *  - using directly the access (only indirection for peeking).
  *      This method is known to introduce much less latency.
  *      It should probably defaulted (instead of the stream method (2)).
+ *  - using pf_read from a thread (when input-prefetch-size is set)
+ *      One ring buffer filled ahead of the reading position
  */
 
 /* How many tracks we have, currently only used for stream mode */
@@ -95,6 +97,20 @@
 #define STREAM_READ_ATONCE 1024
 #define STREAM_CACHE_TRACK_SIZE (STREAM_CACHE_SIZE/STREAM_CACHE_TRACK)
 
+/* Method3: for pf_read, when a prefetch window is configured
+ *  - A thread owns the access, it reads ahead of i_pos into a ring buffer
+ *    until the window is full, so that a slow read only stalls the
+ *    demuxer when the access cannot keep up on average.
+ *  - The ring is a quarter larger than the window, the data behind i_pos
+ *    stay there until overwritten and serve the short backward seeks.
+ *  - Forward seeks beyond the buffered data are skipped by reading when
+ *    it is estimated cheaper than seeking, from the measured throughput
+ *    and seek durations, otherwise the pending read is discarded and the
+ *    thread seeks the access.
+ */
+#define STREAM_PREFETCH_MIN_SIZE (1024*1024)
+#define STREAM_PREFETCH_READ_SIZE (32*1024)
+
 typedef struct
 {
     int64_t i_date;
@@ -116,7 +132,8 @@ typedef struct
 typedef enum
 {
     STREAM_METHOD_BLOCK,
-    STREAM_METHOD_STREAM
+    STREAM_METHOD_STREAM,
+    STREAM_METHOD_PREFETCH
 } stream_read_method_t;
 
 struct stream_sys_t
@@ -156,6 +173,33 @@ struct stream_sys_t
 
     } stream;
 
+    /* Method 3: for pf_read, from a thread */
+    struct
+    {
+        vlc_thread_t thread;
+        vlc_mutex_t  lock;
+        vlc_cond_t   wait_data;  /* Data added, seek done or EOF */
+        vlc_cond_t   wait_space; /* Data consumed, seek requested or exit */
+        vlc_mutex_t  access_lock; /* Held while the access is used */
+
+        uint8_t  *p_buffer;
+        size_t    i_size;       /* Ring size */
+        size_t    i_window;     /* Data to keep ahead of i_pos */
+        size_t    i_wanted;     /* Data the reader waits for ahead of i_pos */
+        uint64_t  i_start;      /* Offset of the oldest data in the ring */
+        uint64_t  i_end;        /* Offset of the end of the data */
+        unsigned  i_generation; /* Changes when the ring is reset */
+        uint64_t  i_access_size; /* As of the last read */
+
+        bool      b_can_seek;
+        bool      b_seek;       /* The access must be seeked to i_end */
+        int       i_seek_ret;
+        bool      b_eof;
+        bool      b_exit;
+
+        uint64_t  i_level;      /* Last fill level sent to the stats */
+    } prefetch;
+
     /* Peek temporary buffer */
     unsigned int i_peek;
     uint8_t *p_peek;
@@ -197,6 +241,14 @@ static int  AStreamSeekStream( stream_t *s, uint64_t i_pos );
 static void AStreamPrebufferStream( stream_t *s );
 static int  AReadStream( stream_t *s, void *p_read, unsigned int i_read );
 
+/* Method 3 */
+static int  AStreamReadPrefetch( stream_t *s, void *p_read, unsigned int i_read );
+static int  AStreamPeekPrefetch( stream_t *s, const uint8_t **pp_peek, unsigned int i_read );
+static int  AStreamSeekPrefetch( stream_t *s, uint64_t i_pos );
+static int  AStreamStartPrefetch( stream_t *s );
+static void AStreamStopPrefetch( stream_t *s );
+static void AStreamResetPrefetch( stream_t *s, uint64_t i_pos );
+
 /* Common */
 static int AStreamControl( stream_t *s, int i_query, va_list );
 static void AStreamDestroy( stream_t *s );
@@ -294,6 +346,10 @@ stream_t *stream_AccessNew( access_t *p_access, char **ppsz_list )
     p_sys->p_access = p_access;
     if( p_access->pf_block )
         p_sys->method = STREAM_METHOD_BLOCK;
+    else if( s->p_input && !s->p_input->b_preparsing &&
+             !( ppsz_list && ppsz_list[0] ) &&
+             var_InheritInteger( s, "input-prefetch-size" ) > 0 )
+        p_sys->method = STREAM_METHOD_PREFETCH;
     else
         p_sys->method = STREAM_METHOD_STREAM;
 
@@ -385,6 +441,23 @@ stream_t *stream_AccessNew( access_t *p_access, char **ppsz_list )
             goto error;
         }
     }
+    else if( p_sys->method == STREAM_METHOD_PREFETCH )
+    {
+        msg_Dbg( s, "Using prefetch method for AStream*" );
+        s->pf_read = AStreamReadPrefetch;
+        s->pf_peek = AStreamPeekPrefetch;
+
+        if( AStreamStartPrefetch( s ) )
+            goto error;
+
+        const uint8_t *p_peek;
+        if( AStreamPeekPrefetch( s, &p_peek, STREAM_CACHE_PREBUFFER_SIZE ) <= 0 )
+        {
+            msg_Err( s, "cannot pre fill buffer" );
+            AStreamStopPrefetch( s );
+            goto error;
+        }
+    }
     else
     {
         int i;
@@ -430,14 +503,9 @@ stream_t *stream_AccessNew( access_t *p_access, char **ppsz_list )
     return s;
 
 error:
-    if( p_sys->method == STREAM_METHOD_BLOCK )
-    {
-        /* Nothing yet */
-    }
-    else
-    {
+    if( p_sys->method == STREAM_METHOD_STREAM )
         free( p_sys->stream.p_buffer );
-    }
+    free( p_sys->p_peek );
     while( p_sys->i_list > 0 )
         free( p_sys->list[--(p_sys->i_list)] );
     free( p_sys->list );
@@ -456,6 +524,8 @@ static void AStreamDestroy( stream_t *s )
 
     if( p_sys->method == STREAM_METHOD_BLOCK )
         block_ChainRelease( p_sys->block.p_first );
+    else if( p_sys->method == STREAM_METHOD_PREFETCH )
+        AStreamStopPrefetch( s );
     else
         free( p_sys->stream.p_buffer );
 
@@ -483,6 +553,12 @@ static void AStreamControlReset( stream_t *s )
 {
     stream_sys_t *p_sys = s->p_sys;
 
+    if( p_sys->method == STREAM_METHOD_PREFETCH )
+    {
+        AStreamResetPrefetch( s, p_sys->p_access->info.i_pos );
+        return;
+    }
+
     p_sys->i_pos = p_sys->p_access->info.i_pos;
 
     if( p_sys->method == STREAM_METHOD_BLOCK )
@@ -530,6 +606,16 @@ static void AStreamControlUpdate( stream_t *s )
 {
     stream_sys_t *p_sys = s->p_sys;
 
+    if( p_sys->method == STREAM_METHOD_PREFETCH )
+    {
+        /* The access is ahead of us, only retry after an EOF */
+        vlc_mutex_lock( &p_sys->prefetch.lock );
+        p_sys->prefetch.b_eof = false;
+        vlc_cond_signal( &p_sys->prefetch.wait_space );
+        vlc_mutex_unlock( &p_sys->prefetch.lock );
+        return;
+    }
+
     p_sys->i_pos = p_sys->p_access->info.i_pos;
 
     if( p_sys->i_list )
@@ -548,7 +634,7 @@ static void AStreamControlUpdate( stream_t *s )
 /****************************************************************************
  * AStreamControl:
  ****************************************************************************/
-static int AStreamControl( stream_t *s, int i_query, va_list args )
+static int AStreamVaControl( stream_t *s, int i_query, va_list args )
 {
     stream_sys_t *p_sys = s->p_sys;
     access_t     *p_access = p_sys->p_access;
@@ -570,6 +656,7 @@ static int AStreamControl( stream_t *s, int i_query, va_list args )
     static_control_match(SET_PRIVATE_ID_STATE);
     static_control_match(SET_PRIVATE_ID_CA);
     static_control_match(GET_PRIVATE_ID_STATE);
+    static_control_match(IS_TUNER);
 
     switch( i_query )
     {
@@ -588,6 +675,7 @@ static int AStreamControl( stream_t *s, int i_query, va_list args )
         case STREAM_SET_PRIVATE_ID_STATE:
         case STREAM_SET_PRIVATE_ID_CA:
         case STREAM_GET_PRIVATE_ID_STATE:
+        case STREAM_IS_TUNER:
             return access_vaControl( p_access, i_query, args );
 
         case STREAM_GET_SIZE:
@@ -601,6 +689,13 @@ static int AStreamControl( stream_t *s, int i_query, va_list args )
                     *pi_64 += s->p_sys->list[i]->i_size;
                 break;
             }
+            if( p_sys->method == STREAM_METHOD_PREFETCH )
+            {
+                vlc_mutex_lock( &p_sys->prefetch.lock );
+                *pi_64 = p_sys->prefetch.i_access_size;
+                vlc_mutex_unlock( &p_sys->prefetch.lock );
+                break;
+            }
             *pi_64 = access_GetSize( p_access );
             break;
         }
@@ -618,6 +713,8 @@ static int AStreamControl( stream_t *s, int i_query, va_list args )
                 return AStreamSeekBlock( s, offset );
             case STREAM_METHOD_STREAM:
                 return AStreamSeekStream( s, offset );
+            case STREAM_METHOD_PREFETCH:
+                return AStreamSeekPrefetch( s, offset );
             default:
                 assert(0);
                 return VLC_EGENERIC;
@@ -645,6 +742,31 @@ static int AStreamControl( stream_t *s, int i_query, va_list args )
     return VLC_SUCCESS;
 }
 
+static int AStreamControl( stream_t *s, int i_query, va_list args )
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    if( p_sys->method != STREAM_METHOD_PREFETCH )
+        return AStreamVaControl( s, i_query, args );
+
+    switch( i_query )
+    {
+        case STREAM_GET_SIZE:
+        case STREAM_GET_POSITION:
+        case STREAM_SET_POSITION:
+        case STREAM_UPDATE_SIZE:
+            return AStreamVaControl( s, i_query, args );
+        default:
+        {
+            /* The prefetch thread may be using the access */
+            vlc_mutex_lock( &p_sys->prefetch.access_lock );
+            int i_ret = AStreamVaControl( s, i_query, args );
+            vlc_mutex_unlock( &p_sys->prefetch.access_lock );
+            return i_ret;
+        }
+    }
+}
+
 /****************************************************************************
  * Method 1:
  ****************************************************************************/
@@ -1458,6 +1580,408 @@ static void AStreamPrebufferStream( stream_t *s )
     }
 }
 
+/****************************************************************************
+ * Method 3:
+ ****************************************************************************/
+static uint64_t AStreamPrefetchLevel( stream_sys_t *p_sys )
+{
+    if( p_sys->prefetch.i_end <= p_sys->i_pos )
+        return 0;
+    return p_sys->prefetch.i_end - p_sys->i_pos;
+}
+
+/* Sends the fill level to the input stats when it changed enough */
+static void AStreamPrefetchStats( stream_t *s, bool b_stall )
+{
+    stream_sys_t *p_sys = s->p_sys;
+    input_thread_t *p_input = s->p_input;
+    const uint64_t i_level = AStreamPrefetchLevel( p_sys );
+
+    if( !b_stall && i_level / STREAM_PREFETCH_READ_SIZE ==
+                    p_sys->prefetch.i_level / STREAM_PREFETCH_READ_SIZE )
+        return;
+    p_sys->prefetch.i_level = i_level;
+
+    vlc_mutex_lock( &p_input->p->counters.counters_lock );
+    stats_Update( p_input->p->counters.p_prefetch_level, i_level, NULL );
+    if( b_stall )
+        stats_Update( p_input->p->counters.p_prefetch_stalls, 1, NULL );
+    vlc_mutex_unlock( &p_input->p->counters.counters_lock );
+}
+
+/* Waits for the prefetch thread, with the lock held */
+static void AStreamWaitPrefetch( stream_t *s, size_t i_wanted )
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    p_sys->prefetch.i_wanted = i_wanted;
+    vlc_cond_signal( &p_sys->prefetch.wait_space );
+
+    /* Waiting for the first data after a seek is not a stall */
+    if( !p_sys->prefetch.b_seek &&
+        p_sys->prefetch.i_start < p_sys->prefetch.i_end )
+        AStreamPrefetchStats( s, true );
+
+    mutex_cleanup_push( &p_sys->prefetch.lock );
+    vlc_cond_wait( &p_sys->prefetch.wait_data, &p_sys->prefetch.lock );
+    vlc_cleanup_pop();
+}
+
+/* Lets the thread read again once the end was reached, as the access may
+ * have grown since (a file being recorded), once per call like
+ * AStreamRefillStream() does. Returns false if it was already retried, or
+ * if the end comes from a failed seek: the access is not where the
+ * buffered data ends. */
+static bool AStreamRetryPrefetch( stream_sys_t *p_sys, bool *pb_retry )
+{
+    if( !*pb_retry || p_sys->prefetch.i_seek_ret != VLC_SUCCESS )
+        return false;
+
+    *pb_retry = false;
+    p_sys->prefetch.b_eof = false;
+    return true;
+}
+
+static void *AStreamPrefetchThread( void *data )
+{
+    stream_t *s = data;
+    stream_sys_t *p_sys = s->p_sys;
+    const size_t i_size = p_sys->prefetch.i_size;
+
+    vlc_mutex_lock( &p_sys->prefetch.lock );
+    while( !p_sys->prefetch.b_exit )
+    {
+        const unsigned i_generation = p_sys->prefetch.i_generation;
+        const uint64_t i_end = p_sys->prefetch.i_end;
+
+        if( p_sys->prefetch.b_seek )
+        {
+            vlc_mutex_unlock( &p_sys->prefetch.lock );
+
+            vlc_mutex_lock( &p_sys->prefetch.access_lock );
+            const mtime_t i_start = mdate();
+            const int i_ret = ASeek( s, i_end );
+            const mtime_t i_duration = mdate() - i_start;
+            vlc_mutex_unlock( &p_sys->prefetch.access_lock );
+
+            vlc_mutex_lock( &p_sys->prefetch.lock );
+            p_sys->stat.i_seek_count++;
+            p_sys->stat.i_seek_time += i_duration;
+            if( i_generation == p_sys->prefetch.i_generation )
+            {
+                p_sys->prefetch.b_seek = false;
+                p_sys->prefetch.i_seek_ret = i_ret;
+                p_sys->prefetch.b_eof = i_ret != VLC_SUCCESS;
+                vlc_cond_broadcast( &p_sys->prefetch.wait_data );
+            }
+            continue;
+        }
+
+        /* Fill the window, or more when the reader asks for it */
+        const size_t i_ahead = AStreamPrefetchLevel( p_sys );
+        const size_t i_target = __MAX( p_sys->prefetch.i_window,
+                                       p_sys->prefetch.i_wanted );
+        if( p_sys->prefetch.b_eof ||
+            ( i_end >= p_sys->i_pos && i_ahead >= i_target ) )
+        {
+            vlc_cond_wait( &p_sys->prefetch.wait_space,
+                           &p_sys->prefetch.lock );
+            continue;
+        }
+
+        /* Never overwrite the data between i_pos and i_end, and forget
+         * about the old data which is going to be overwritten */
+        const size_t i_off = i_end % i_size;
+        size_t i_read = __MIN( i_size - i_ahead, i_size - i_off );
+        i_read = __MIN( i_read, STREAM_PREFETCH_READ_SIZE );
+        if( i_end + i_read > p_sys->prefetch.i_start + i_size )
+            p_sys->prefetch.i_start = i_end + i_read - i_size;
+        vlc_mutex_unlock( &p_sys->prefetch.lock );
+
+        vlc_mutex_lock( &p_sys->prefetch.access_lock );
+        const mtime_t i_start = mdate();
+        int i_ret = AReadStream( s, &p_sys->prefetch.p_buffer[i_off], i_read );
+        const mtime_t i_duration = mdate() - i_start;
+        const uint64_t i_access_size = access_GetSize( p_sys->p_access );
+        vlc_mutex_unlock( &p_sys->prefetch.access_lock );
+
+        if( !vlc_object_alive( s ) )
+            i_ret = 0;
+
+        vlc_mutex_lock( &p_sys->prefetch.lock );
+        p_sys->prefetch.i_access_size = i_access_size;
+        if( i_generation != p_sys->prefetch.i_generation )
+            continue; /* Seeked in the meantime, drop the data */
+        if( i_ret < 0 )
+            continue;
+        if( i_ret == 0 )
+            p_sys->prefetch.b_eof = true;
+
+        p_sys->prefetch.i_end += i_ret;
+        p_sys->stat.i_bytes += i_ret;
+        p_sys->stat.i_read_time += i_duration;
+        p_sys->stat.i_read_count++;
+        AStreamPrefetchStats( s, false );
+        vlc_cond_broadcast( &p_sys->prefetch.wait_data );
+    }
+    vlc_mutex_unlock( &p_sys->prefetch.lock );
+    return NULL;
+}
+
+static int AStreamStartPrefetch( stream_t *s )
+{
+    stream_sys_t *p_sys = s->p_sys;
+    access_t *p_access = p_sys->p_access;
+
+    size_t i_window = var_InheritInteger( s, "input-prefetch-size" ) * 1024;
+    i_window = VLC_CLIP( i_window, STREAM_PREFETCH_MIN_SIZE, SIZE_MAX / 2 );
+
+    p_sys->prefetch.i_window = i_window;
+    p_sys->prefetch.i_size = i_window + i_window / 4;
+    p_sys->prefetch.p_buffer = malloc( p_sys->prefetch.i_size );
+    if( !p_sys->prefetch.p_buffer )
+        return VLC_ENOMEM;
+
+    access_Control( p_access, ACCESS_CAN_SEEK, &p_sys->prefetch.b_can_seek );
+    p_sys->prefetch.i_access_size = access_GetSize( p_access );
+    p_sys->prefetch.i_wanted = 0;
+    p_sys->prefetch.i_start = p_sys->i_pos;
+    p_sys->prefetch.i_end = p_sys->i_pos;
+    p_sys->prefetch.i_generation = 0;
+    p_sys->prefetch.b_seek = false;
+    p_sys->prefetch.i_seek_ret = VLC_SUCCESS;
+    p_sys->prefetch.b_eof = false;
+    p_sys->prefetch.b_exit = false;
+    p_sys->prefetch.i_level = 0;
+
+    vlc_mutex_init( &p_sys->prefetch.lock );
+    vlc_cond_init( &p_sys->prefetch.wait_data );
+    vlc_cond_init( &p_sys->prefetch.wait_space );
+    vlc_mutex_init( &p_sys->prefetch.access_lock );
+
+    if( vlc_clone( &p_sys->prefetch.thread, AStreamPrefetchThread, s,
+                   VLC_THREAD_PRIORITY_INPUT ) )
+    {
+        vlc_mutex_destroy( &p_sys->prefetch.access_lock );
+        vlc_cond_destroy( &p_sys->prefetch.wait_space );
+        vlc_cond_destroy( &p_sys->prefetch.wait_data );
+        vlc_mutex_destroy( &p_sys->prefetch.lock );
+        free( p_sys->prefetch.p_buffer );
+        return VLC_EGENERIC;
+    }
+
+    msg_Dbg( s, "prefetching %zu KiB ahead", i_window / 1024 );
+    return VLC_SUCCESS;
+}
+
+static void AStreamStopPrefetch( stream_t *s )
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    /* A pending read cannot be interrupted, but it returns once the
+     * access is killed */
+    vlc_mutex_lock( &p_sys->prefetch.lock );
+    p_sys->prefetch.b_exit = true;
+    vlc_cond_signal( &p_sys->prefetch.wait_space );
+    vlc_mutex_unlock( &p_sys->prefetch.lock );
+    vlc_join( p_sys->prefetch.thread, NULL );
+
+    msg_Dbg( s, "prefetch: %"PRIu64" bytes in %"PRIu64" reads, %u seeks",
+             p_sys->stat.i_bytes, p_sys->stat.i_read_count,
+             p_sys->stat.i_seek_count );
+
+    vlc_mutex_destroy( &p_sys->prefetch.access_lock );
+    vlc_cond_destroy( &p_sys->prefetch.wait_space );
+    vlc_cond_destroy( &p_sys->prefetch.wait_data );
+    vlc_mutex_destroy( &p_sys->prefetch.lock );
+    free( p_sys->prefetch.p_buffer );
+}
+
+/* Drops the buffered data, the next data will come from i_pos */
+static void AStreamResetPrefetch( stream_t *s, uint64_t i_pos )
+{
+    stream_sys_t *p_sys = s->p_sys;
+
+    vlc_mutex_lock( &p_sys->prefetch.lock );
+    p_sys->i_pos = i_pos;
+    p_sys->prefetch.i_start = i_pos;
+    p_sys->prefetch.i_end = i_pos;
+    p_sys->prefetch.i_generation++;
+    p_sys->prefetch.b_seek = false;
+    p_sys->prefetch.i_seek_ret = VLC_SUCCESS;
+    p_sys->prefetch.b_eof = false;
+    vlc_cond_signal( &p_sys->prefetch.wait_space );
+    vlc_mutex_unlock( &p_sys->prefetch.lock );
+}
+
+/* Returns how far beyond the buffered data reading is cheaper than
+ * seeking, with the lock held */
+static uint64_t AStreamPrefetchSkipThreshold( stream_sys_t *p_sys )
+{
+    if( !p_sys->prefetch.b_can_seek )
+        return UINT64_MAX;
+
+    /* Until something is measured */
+    if( p_sys->stat.i_seek_count == 0 || p_sys->stat.i_read_time == 0 )
+        return p_sys->stat.b_fastseek ? 128 : 3 * STREAM_PREFETCH_READ_SIZE;
+
+    /* What could have been read during an average seek */
+    const uint64_t i_seek_time = p_sys->stat.i_seek_time /
+                                 p_sys->stat.i_seek_count;
+    const double f_byterate = (double)p_sys->stat.i_bytes /
+                              p_sys->stat.i_read_time;
+    return __MIN( f_byterate * i_seek_time, p_sys->prefetch.i_window );
+}
+
+static int AStreamSeekPrefetch( stream_t *s, uint64_t i_pos )
+{
+    stream_sys_t *p_sys = s->p_sys;
+    int i_ret = VLC_SUCCESS;
+
+    vlc_mutex_lock( &p_sys->prefetch.lock );
+    if( i_pos < p_sys->prefetch.i_start && !p_sys->prefetch.b_can_seek )
+    {
+        vlc_mutex_unlock( &p_sys->prefetch.lock );
+        msg_Warn( s, "AStreamSeekPrefetch: can't seek" );
+        return VLC_EGENERIC;
+    }
+
+    if( i_pos >= p_sys->prefetch.i_start &&
+        ( i_pos <= p_sys->prefetch.i_end ||
+          ( !p_sys->prefetch.b_eof && i_pos - p_sys->prefetch.i_end <=
+            AStreamPrefetchSkipThreshold( p_sys ) ) ) )
+    {
+        /* In the buffer, or the thread will read up to it */
+        p_sys->i_pos = i_pos;
+        p_sys->prefetch.i_wanted = 0;
+        vlc_cond_signal( &p_sys->prefetch.wait_space );
+    }
+    else
+    {
+        /* Cancel the prefetch and let the thread seek the access */
+        p_sys->i_pos = i_pos;
+        p_sys->prefetch.i_start = i_pos;
+        p_sys->prefetch.i_end = i_pos;
+        p_sys->prefetch.i_wanted = 0;
+        p_sys->prefetch.i_generation++;
+        p_sys->prefetch.b_seek = true;
+        p_sys->prefetch.b_eof = false;
+        vlc_cond_signal( &p_sys->prefetch.wait_space );
+
+        while( p_sys->prefetch.b_seek )
+            AStreamWaitPrefetch( s, 0 );
+        i_ret = p_sys->prefetch.i_seek_ret;
+    }
+    AStreamPrefetchStats( s, false );
+    vlc_mutex_unlock( &p_sys->prefetch.lock );
+
+    return i_ret;
+}
+
+static int AStreamReadPrefetch( stream_t *s, void *p_read, unsigned int i_read )
+{
+    stream_sys_t *p_sys = s->p_sys;
+    uint8_t *p_data = p_read;
+    unsigned int i_data = 0;
+
+    if( !p_read )
+    {
+        /* Large skips are seeks */
+        vlc_mutex_lock( &p_sys->prefetch.lock );
+        const uint64_t i_pos = p_sys->i_pos + i_read;
+        const bool b_seek = p_sys->prefetch.b_can_seek &&
+            i_pos > p_sys->prefetch.i_end +
+                    AStreamPrefetchSkipThreshold( p_sys );
+        vlc_mutex_unlock( &p_sys->prefetch.lock );
+
+        if( b_seek )
+            return AStreamSeekPrefetch( s, i_pos ) ? 0 : (int)i_read;
+    }
+
+    bool b_retry = true;
+    vlc_mutex_lock( &p_sys->prefetch.lock );
+    while( i_data < i_read )
+    {
+        const uint64_t i_level = AStreamPrefetchLevel( p_sys );
+        if( i_level == 0 )
+        {
+            if( p_sys->prefetch.b_eof && !AStreamRetryPrefetch( p_sys,
+                                                                &b_retry ) )
+                break;
+            AStreamWaitPrefetch( s, __MIN( i_read - i_data,
+                                           p_sys->prefetch.i_size / 2 ) );
+            continue;
+        }
+
+        const size_t i_off = p_sys->i_pos % p_sys->prefetch.i_size;
+        size_t i_copy = __MIN( i_level, p_sys->prefetch.i_size - i_off );
+        i_copy = __MIN( i_copy, i_read - i_data );
+
+        if( p_data )
+        {
+            memcpy( p_data, &p_sys->prefetch.p_buffer[i_off], i_copy );
+            p_data += i_copy;
+        }
+        i_data += i_copy;
+        p_sys->i_pos += i_copy;
+    }
+    p_sys->prefetch.i_wanted = 0;
+    vlc_cond_signal( &p_sys->prefetch.wait_space );
+    AStreamPrefetchStats( s, false );
+    vlc_mutex_unlock( &p_sys->prefetch.lock );
+
+    return i_data;
+}
+
+static int AStreamPeekPrefetch( stream_t *s, const uint8_t **pp_peek, unsigned int i_read )
+{
+    stream_sys_t *p_sys = s->p_sys;
+    const size_t i_size = p_sys->prefetch.i_size;
+
+    /* Avoid problem, but that should *never* happen */
+    if( i_read > i_size / 2 )
+        i_read = i_size / 2;
+
+    bool b_retry = true;
+    vlc_mutex_lock( &p_sys->prefetch.lock );
+    while( AStreamPrefetchLevel( p_sys ) < i_read &&
+           ( !p_sys->prefetch.b_eof ||
+             AStreamRetryPrefetch( p_sys, &b_retry ) ) )
+        AStreamWaitPrefetch( s, i_read );
+    p_sys->prefetch.i_wanted = 0;
+
+    const uint64_t i_level = AStreamPrefetchLevel( p_sys );
+    if( i_level < i_read )
+        i_read = i_level;
+    vlc_mutex_unlock( &p_sys->prefetch.lock );
+
+    /* The thread does not write between i_pos and i_end */
+    const size_t i_off = p_sys->i_pos % i_size;
+    if( i_off + i_read <= i_size )
+    {
+        *pp_peek = &p_sys->prefetch.p_buffer[i_off];
+        return i_read;
+    }
+
+    if( p_sys->i_peek < i_read )
+    {
+        p_sys->p_peek = realloc_or_free( p_sys->p_peek, i_read );
+        if( !p_sys->p_peek )
+        {
+            p_sys->i_peek = 0;
+            return 0;
+        }
+        p_sys->i_peek = i_read;
+    }
+
+    memcpy( p_sys->p_peek, &p_sys->prefetch.p_buffer[i_off], i_size - i_off );
+    memcpy( &p_sys->p_peek[i_size - i_off], &p_sys->prefetch.p_buffer[0],
+            i_read - (i_size - i_off) );
+
+    *pp_peek = p_sys->p_peek;
+    return i_read;
+}
+
 /****************************************************************************
  * stream_ReadLine:
  ****************************************************************************/
@@ -1735,6 +2259,9 @@ static block_t *AReadBlock( stream_t *s, bool *pb_eof )
             stats_Update( p_input->p->counters.p_input_bitrate,
                           total, NULL );
             stats_Update( p_input->p->counters.p_read_packets, 1, NULL );
+            if( p_block->i_flags & BLOCK_FLAG_DISCONTINUITY )
+                stats_Update( p_input->p->counters.p_read_discontinuity, 1,
+                              NULL );
             vlc_mutex_unlock( &p_input->p->counters.counters_lock );
         }
         return p_block;
@@ -1775,6 +2302,9 @@ static block_t *AReadBlock( stream_t *s, bool *pb_eof )
                           p_block->i_buffer, &total );
             stats_Update( p_input->p->counters.p_input_bitrate, total, NULL );
             stats_Update( p_input->p->counters.p_read_packets, 1 , NULL);
+            if( p_block->i_flags & BLOCK_FLAG_DISCONTINUITY )
+                stats_Update( p_input->p->counters.p_read_discontinuity, 1,
+                              NULL );
             vlc_mutex_unlock( &p_input->p->counters.counters_lock );
         }
     }
@@ -313,6 +313,7 @@ static int DStreamControl( stream_t *s, int i_query, va_list args )
         case STREAM_SET_PRIVATE_ID_STATE:
         case STREAM_SET_PRIVATE_ID_CA:
         case STREAM_GET_PRIVATE_ID_STATE:
+        case STREAM_IS_TUNER:
             return VLC_EGENERIC;
 
         default:
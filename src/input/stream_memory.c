@@ -134,6 +134,7 @@ static int Control( stream_t *s, int i_query, va_list args )
         case STREAM_GET_SIGNAL:
         case STREAM_SET_TITLE:
         case STREAM_SET_SEEKPOINT:
+        case STREAM_IS_TUNER:
             return VLC_EGENERIC;
 
         case STREAM_SET_PAUSE_STATE:
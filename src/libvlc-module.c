@@ -675,10 +675,22 @@ static const char *const ppsz_prefres[] = {
 #define INPUT_TIMESHIFT_PATH_LONGTEXT N_( \
     "Directory used to store the timeshift temporary files." )
 
-#define INPUT_TIMESHIFT_GRANULARITY_TEXT N_("Timeshift granularity")
-#define INPUT_TIMESHIFT_GRANULARITY_LONGTEXT N_( \
-    "This is the maximum size in bytes of the temporary files " \
-    "that will be used to store the timeshifted streams." )
+#define INPUT_TIMESHIFT_SIZE_TEXT N_("Timeshift buffer size (MiB)")
+#define INPUT_TIMESHIFT_SIZE_LONGTEXT N_( \
+    "Size of the temporary file that stores the timeshifted streams. " \
+    "It is allocated at once, and the oldest data is overwritten when " \
+    "it is full." )
+
+#define INPUT_TIMESHIFT_ALWAYS_TEXT N_("Always timeshift live streams")
+#define INPUT_TIMESHIFT_ALWAYS_LONGTEXT N_( \
+    "Store live streams in the timeshift buffer from the start, so that " \
+    "one can jump back in time without pausing first." )
+
+#define INPUT_PREFETCH_SIZE_TEXT N_("Read ahead size (KiB)")
+#define INPUT_PREFETCH_SIZE_LONGTEXT N_( \
+    "Amount of data read ahead of the demuxer by a separate thread, " \
+    "so that slow network reads do not stall the playback. " \
+    "0 reads the data on demand." )
 
 #define INPUT_TITLE_FORMAT_TEXT N_( "Change title according to current media" )
 #define INPUT_TITLE_FORMAT_LONGTEXT N_( "This option allows you to set the title according to what's being played<br>"  \
@@ -1113,6 +1125,15 @@ static const char *const ppsz_prefres[] = {
     "Automatically preparse files added to the playlist " \
     "(to retrieve some metadata)." )
 
+#define PREPARSE_THREADS_TEXT N_( "Preparsing threads" )
+#define PREPARSE_THREADS_LONGTEXT N_( \
+    "Maximum number of files preparsed at the same time." )
+
+#define PREPARSE_TIMEOUT_TEXT N_( "Preparsing timeout (ms)" )
+#define PREPARSE_TIMEOUT_LONGTEXT N_( \
+    "Preparsing of a file is interrupted after this delay, " \
+    "0 waits until it is done." )
+
 #define METADATA_NETWORK_TEXT N_( "Allow metadata network access" )
 
 #define SD_TEXT N_( "Services discovery modules")
@@ -1854,8 +1875,16 @@ vlc_module_begin ()
 
     add_string( "input-timeshift-path", NULL, INPUT_TIMESHIFT_PATH_TEXT,
                 INPUT_TIMESHIFT_PATH_LONGTEXT, true )
-    add_integer( "input-timeshift-granularity", -1, INPUT_TIMESHIFT_GRANULARITY_TEXT,
-                 INPUT_TIMESHIFT_GRANULARITY_LONGTEXT, true )
+    add_obsolete_integer( "input-timeshift-granularity" ) /* since 2.2.0 */
+    add_integer( "input-timeshift-size", 1024, INPUT_TIMESHIFT_SIZE_TEXT,
+                 INPUT_TIMESHIFT_SIZE_LONGTEXT, true )
+    add_bool( "input-timeshift-always", false, INPUT_TIMESHIFT_ALWAYS_TEXT,
+              INPUT_TIMESHIFT_ALWAYS_LONGTEXT, true )
+
+    add_integer( "input-prefetch-size", 0, INPUT_PREFETCH_SIZE_TEXT,
+                 INPUT_PREFETCH_SIZE_LONGTEXT, true )
+        change_integer_range( 0, 1024 * 1024 )
+        change_safe()
 
     add_string( "input-title-format", "$Z", INPUT_TITLE_FORMAT_TEXT, INPUT_TITLE_FORMAT_LONGTEXT, false );
 
@@ -2028,6 +2057,12 @@ vlc_module_begin ()
 
     add_bool( "auto-preparse", true, PREPARSE_TEXT,
               PREPARSE_LONGTEXT, false )
+    add_integer( "preparse-threads", 4, PREPARSE_THREADS_TEXT,
+                 PREPARSE_THREADS_LONGTEXT, true )
+        change_integer_range( 1, 32 )
+    add_integer( "preparse-timeout", 5000, PREPARSE_TIMEOUT_TEXT,
+                 PREPARSE_TIMEOUT_LONGTEXT, true )
+        change_integer_range( 0, 3600000 )
 
     add_obsolete_integer( "album-art" )
     add_bool( "metadata-network-access", false, METADATA_NETWORK_TEXT,
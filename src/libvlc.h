@@ -194,6 +194,7 @@ void var_OptionParse (vlc_object_t *, const char *, bool trusted);
  */
 enum
 {
+    STATS_LAST,
     STATS_COUNTER,
     STATS_DERIVATIVE,
 };
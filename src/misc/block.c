@@ -37,6 +37,7 @@
 #include <vlc_common.h>
 #include <vlc_block.h>
 #include <vlc_fs.h>
+#include <vlc_atomic.h>
 
 /**
  * @section Block handling functions.
@@ -97,14 +98,6 @@ void block_Init( block_t *restrict b, void *buf, size_t size )
 #endif
 }
 
-static void block_generic_Release (block_t *block)
-{
-    /* That is always true for blocks allocated with block_Alloc(). */
-    assert (block->p_start == (unsigned char *)(block + 1));
-    block_Invalidate (block);
-    free (block);
-}
-
 static void BlockMetaCopy( block_t *restrict out, const block_t *in )
 {
     out->p_next    = in->p_next;
@@ -126,6 +119,247 @@ static void BlockMetaCopy( block_t *restrict out, const block_t *in )
 /* Maximum size of reserved footer before shrinking with realloc(). */
 #define BLOCK_WASTE_SIZE   2048
 
+/**
+ * @section Block pool.
+ *
+ * The blocks of block_Alloc() are carved out of power of two size classes,
+ * from 512 bytes to 64 KiB, larger blocks are left to malloc(). Released
+ * blocks go to a cache of the releasing thread, so that most allocations
+ * are served without any lock. A thread cache that overflows, typically
+ * in the consumer of a FIFO, moves half of a class to a shared pool, from
+ * which the caches of the producers refill. Both are bounded, the excess
+ * is freed.
+ */
+#define BLOCK_POOL_MIN_SHIFT 9
+#define BLOCK_POOL_MAX_SHIFT 16
+#define BLOCK_POOL_CLASSES   (BLOCK_POOL_MAX_SHIFT - BLOCK_POOL_MIN_SHIFT + 1)
+
+/* Bytes of each class kept by a thread, and by the shared pool */
+#define BLOCK_CACHE_SIZE     (64 * 1024)
+#define BLOCK_POOL_SIZE      (2 * 1024 * 1024)
+
+typedef struct
+{
+    block_t *p_free[BLOCK_POOL_CLASSES];
+    unsigned i_free[BLOCK_POOL_CLASSES];
+
+    /* Not yet accounted in the shared statistics */
+    uint64_t i_hits;
+    uint64_t i_recycled;
+    uint64_t i_mallocs;
+    uint64_t i_frees;
+    uint64_t i_oversized;
+} block_cache_t;
+
+static struct
+{
+    vlc_mutex_t lock;
+    block_t *p_free[BLOCK_POOL_CLASSES];
+    unsigned i_free[BLOCK_POOL_CLASSES];
+    block_pool_stats_t stats;
+
+    vlc_threadvar_t key;
+    atomic_bool b_key;
+} pool = {
+    .lock = VLC_STATIC_MUTEX,
+    .b_key = ATOMIC_VAR_INIT(false),
+};
+
+static unsigned BlockClass (size_t alloc)
+{
+    if (alloc <= (1 << BLOCK_POOL_MIN_SHIFT))
+        return 0;
+    if (alloc > (1 << BLOCK_POOL_MAX_SHIFT))
+        return BLOCK_POOL_CLASSES;
+    return (sizeof (unsigned) * 8 - clz (alloc - 1)) - BLOCK_POOL_MIN_SHIFT;
+}
+
+static unsigned BlockCacheMax (unsigned cls)
+{
+    return __MAX(BLOCK_CACHE_SIZE >> (BLOCK_POOL_MIN_SHIFT + cls), 2);
+}
+
+/* Must be called with the pool lock */
+static void BlockCacheAccount (block_cache_t *c)
+{
+    pool.stats.i_hits += c->i_hits;
+    pool.stats.i_recycled += c->i_recycled;
+    pool.stats.i_mallocs += c->i_mallocs;
+    pool.stats.i_frees += c->i_frees;
+    pool.stats.i_oversized += c->i_oversized;
+    c->i_hits = c->i_recycled = c->i_mallocs = c->i_frees =
+    c->i_oversized = 0;
+}
+
+/* Moves up to count blocks of a class from a thread cache to the pool */
+static void BlockCacheSpill (block_cache_t *c, unsigned cls, unsigned count)
+{
+    const unsigned max = BLOCK_POOL_SIZE >> (BLOCK_POOL_MIN_SHIFT + cls);
+    block_t *excess = NULL;
+
+    vlc_mutex_lock (&pool.lock);
+    while (count-- > 0 && c->p_free[cls] != NULL)
+    {
+        block_t *b = c->p_free[cls];
+
+        c->p_free[cls] = b->p_next;
+        c->i_free[cls]--;
+        if (pool.i_free[cls] < max)
+        {
+            b->p_next = pool.p_free[cls];
+            pool.p_free[cls] = b;
+            pool.i_free[cls]++;
+            pool.stats.i_spilled++;
+        }
+        else
+        {
+            b->p_next = excess;
+            excess = b;
+            c->i_frees++;
+        }
+    }
+    BlockCacheAccount (c);
+    vlc_mutex_unlock (&pool.lock);
+
+    while (excess != NULL)
+    {
+        block_t *b = excess;
+
+        excess = b->p_next;
+        free (b);
+    }
+}
+
+/* Moves up to count blocks of a class from the pool to a thread cache */
+static void BlockCacheRefill (block_cache_t *c, unsigned cls, unsigned count)
+{
+    vlc_mutex_lock (&pool.lock);
+    while (count-- > 0 && pool.p_free[cls] != NULL)
+    {
+        block_t *b = pool.p_free[cls];
+
+        pool.p_free[cls] = b->p_next;
+        pool.i_free[cls]--;
+        b->p_next = c->p_free[cls];
+        c->p_free[cls] = b;
+        c->i_free[cls]++;
+        pool.stats.i_refilled++;
+    }
+    BlockCacheAccount (c);
+    vlc_mutex_unlock (&pool.lock);
+}
+
+/* Thread exit */
+static void BlockCacheRelease (void *data)
+{
+    block_cache_t *c = data;
+
+    for (unsigned cls = 0; cls < BLOCK_POOL_CLASSES; cls++)
+        BlockCacheSpill (c, cls, c->i_free[cls]);
+    free (c);
+}
+
+static block_cache_t *BlockCacheGet (void)
+{
+    if (!atomic_load_explicit (&pool.b_key, memory_order_acquire))
+    {
+        bool b_key;
+
+        vlc_mutex_lock (&pool.lock);
+        b_key = atomic_load_explicit (&pool.b_key, memory_order_relaxed);
+        if (!b_key && !vlc_threadvar_create (&pool.key, BlockCacheRelease))
+        {
+            atomic_store_explicit (&pool.b_key, true, memory_order_release);
+            b_key = true;
+        }
+        vlc_mutex_unlock (&pool.lock);
+        if (!b_key)
+            return NULL;
+    }
+
+    block_cache_t *c = vlc_threadvar_get (pool.key);
+    if (unlikely(c == NULL))
+    {
+        c = calloc (1, sizeof (*c));
+        if (c != NULL && vlc_threadvar_set (pool.key, c))
+        {
+            free (c);
+            c = NULL;
+        }
+    }
+    return c;
+}
+
+static block_t *BlockPoolAlloc (size_t alloc)
+{
+    const unsigned cls = BlockClass (alloc);
+    block_cache_t *c = BlockCacheGet ();
+
+    if (cls >= BLOCK_POOL_CLASSES)
+    {
+        if (likely(c != NULL))
+            c->i_oversized++;
+        return malloc (alloc);
+    }
+
+    alloc = (size_t)1 << (BLOCK_POOL_MIN_SHIFT + cls);
+    if (unlikely(c == NULL))
+        return malloc (alloc);
+
+    if (c->p_free[cls] == NULL)
+        BlockCacheRefill (c, cls, (BlockCacheMax (cls) + 1) / 2);
+
+    block_t *b = c->p_free[cls];
+    if (b == NULL)
+    {
+        c->i_mallocs++;
+        return malloc (alloc);
+    }
+    c->p_free[cls] = b->p_next;
+    c->i_free[cls]--;
+    c->i_hits++;
+    return b;
+}
+
+static void block_generic_Release (block_t *block)
+{
+    /* That is always true for blocks allocated with block_Alloc(). */
+    assert (block->p_start == (unsigned char *)(block + 1));
+    block_Invalidate (block);
+
+    const unsigned cls = BlockClass (sizeof (*block) + block->i_size);
+    block_cache_t *c;
+
+    if (cls >= BLOCK_POOL_CLASSES || (c = BlockCacheGet ()) == NULL)
+    {
+        free (block);
+        return;
+    }
+
+    if (c->i_free[cls] >= BlockCacheMax (cls))
+        BlockCacheSpill (c, cls, (BlockCacheMax (cls) + 1) / 2);
+    block->p_next = c->p_free[cls];
+    c->p_free[cls] = block;
+    c->i_free[cls]++;
+    c->i_recycled++;
+}
+
+/**
+ * Returns the statistics of the block_Alloc() pool. The allocations and
+ * releases served by the thread caches are only accounted when the caches
+ * exchange blocks with the shared pool.
+ */
+void block_PoolGetStats (block_pool_stats_t *stats)
+{
+    vlc_mutex_lock (&pool.lock);
+    *stats = pool.stats;
+    stats->i_pooled = 0;
+    for (unsigned cls = 0; cls < BLOCK_POOL_CLASSES; cls++)
+        stats->i_pooled += (size_t)pool.i_free[cls]
+                           << (BLOCK_POOL_MIN_SHIFT + cls);
+    vlc_mutex_unlock (&pool.lock);
+}
+
 block_t *block_Alloc (size_t size)
 {
     /* 2 * BLOCK_PADDING: pre + post padding */
@@ -134,7 +368,7 @@ block_t *block_Alloc (size_t size)
     if (unlikely(alloc <= size))
         return NULL;
 
-    block_t *b = malloc (alloc);
+    block_t *b = BlockPoolAlloc (alloc);
     if (unlikely(b == NULL))
         return NULL;
 
@@ -506,6 +740,11 @@ block_t *block_FilePath (const char *path)
  * @section Thread-safe block queue functions
  */
 
+/**
+ * Slots of the single producer/single consumer ring, power of two
+ */
+#define BLOCK_FIFO_RING_SIZE 4096
+
 /**
  * Internal state for block queues
  */
@@ -520,8 +759,275 @@ struct block_fifo_t
     size_t              i_depth;
     size_t              i_size;
     bool          b_force_wake;
+
+    /* Single producer/single consumer ring (NULL for the locked queue).
+     * Once it is full, blocks are appended to p_first under the lock until
+     * the consumer has drained both. The lock and the condition variables
+     * are only used to park a thread on an empty or full queue. */
+    atomic_uintptr_t    *p_ring;
+
+    struct
+    {
+        atomic_size_t   i_tail;
+        atomic_size_t   i_depth;   /**< blocks ever queued */
+        atomic_size_t   i_size;    /**< bytes ever queued */
+        atomic_bool     b_overflow; /**< p_first is not empty */
+        atomic_bool     b_waiting; /**< parked in block_FifoPace() */
+        atomic_size_t   i_max_depth;
+        atomic_size_t   i_max_size;
+    } producer;
+    uint8_t             pad[64]; /* keep both sides on separate cache lines */
+    struct
+    {
+        atomic_size_t   i_head;
+        atomic_size_t   i_depth;   /**< blocks ever dequeued */
+        atomic_size_t   i_size;    /**< bytes ever dequeued */
+        atomic_bool     b_waiting; /**< parked in block_FifoGet/Show() */
+        atomic_bool     b_force_wake;
+    } consumer;
 };
 
+/* Dequeued counters are read first: they never exceed the queued ones */
+static size_t FifoRingDepth( block_fifo_t *p_fifo )
+{
+    size_t i_out = atomic_load( &p_fifo->consumer.i_depth );
+    return atomic_load( &p_fifo->producer.i_depth ) - i_out;
+}
+
+static size_t FifoRingSize( block_fifo_t *p_fifo )
+{
+    size_t i_out = atomic_load( &p_fifo->consumer.i_size );
+    return atomic_load( &p_fifo->producer.i_size ) - i_out;
+}
+
+static bool FifoRingIsEmpty( block_fifo_t *p_fifo )
+{
+    return atomic_load( &p_fifo->consumer.i_head )
+               == atomic_load( &p_fifo->producer.i_tail )
+        && !atomic_load( &p_fifo->producer.b_overflow );
+}
+
+/* Producer side, only the lock protected overflow needs the ring ordering */
+static void FifoRingPush( block_fifo_t *p_fifo, block_t *p_block )
+{
+    size_t i_tail = atomic_load_explicit( &p_fifo->producer.i_tail,
+                                          memory_order_relaxed );
+
+    if( !atomic_load( &p_fifo->producer.b_overflow )
+     && i_tail - atomic_load( &p_fifo->consumer.i_head ) < BLOCK_FIFO_RING_SIZE )
+    {
+        atomic_store_explicit( &p_fifo->p_ring[i_tail & (BLOCK_FIFO_RING_SIZE - 1)],
+                               (uintptr_t)p_block, memory_order_relaxed );
+        atomic_store( &p_fifo->producer.i_tail, i_tail + 1 );
+        return;
+    }
+
+    vlc_mutex_lock( &p_fifo->lock );
+    *p_fifo->pp_last = p_block;
+    p_fifo->pp_last = &p_block->p_next;
+    atomic_store( &p_fifo->producer.b_overflow, true );
+    vlc_mutex_unlock( &p_fifo->lock );
+}
+
+/* Overflowed blocks are only taken once the ring is empty, the producer
+ * does not use the ring again before they are all gone */
+static block_t *FifoRingPopOverflow( block_fifo_t *p_fifo )
+{
+    block_t *p_block = NULL;
+
+    if( !atomic_load( &p_fifo->producer.b_overflow ) )
+        return NULL;
+
+    vlc_mutex_lock( &p_fifo->lock );
+    if( atomic_load( &p_fifo->consumer.i_head )
+            == atomic_load( &p_fifo->producer.i_tail )
+     && ( p_block = p_fifo->p_first ) != NULL )
+    {
+        p_fifo->p_first = p_block->p_next;
+        if( p_fifo->p_first == NULL )
+        {
+            p_fifo->pp_last = &p_fifo->p_first;
+            atomic_store( &p_fifo->producer.b_overflow, false );
+        }
+        p_block->p_next = NULL;
+    }
+    vlc_mutex_unlock( &p_fifo->lock );
+    return p_block;
+}
+
+static void FifoRingWakeProducer( block_fifo_t *p_fifo )
+{
+    if( !atomic_load( &p_fifo->producer.b_waiting )
+     || FifoRingDepth( p_fifo ) > atomic_load( &p_fifo->producer.i_max_depth )
+     || FifoRingSize( p_fifo ) > atomic_load( &p_fifo->producer.i_max_size ) )
+        return;
+
+    vlc_mutex_lock( &p_fifo->lock );
+    vlc_cond_broadcast( &p_fifo->wait_room );
+    vlc_mutex_unlock( &p_fifo->lock );
+}
+
+/* Consumer side. The head is also moved by block_FifoEmpty(), which may run
+ * on the producer thread, hence the compare and swap. */
+static block_t *FifoRingPop( block_fifo_t *p_fifo )
+{
+    size_t i_head = atomic_load( &p_fifo->consumer.i_head );
+    block_t *p_block;
+
+    for( ;; )
+    {
+        if( i_head == atomic_load( &p_fifo->producer.i_tail ) )
+        {
+            p_block = FifoRingPopOverflow( p_fifo );
+            if( p_block == NULL )
+                return NULL;
+            break;
+        }
+
+        p_block = (block_t *)atomic_load_explicit(
+                &p_fifo->p_ring[i_head & (BLOCK_FIFO_RING_SIZE - 1)],
+                memory_order_relaxed );
+        /* The slot cannot be reused before the head moves past it */
+        if( atomic_compare_exchange_strong( &p_fifo->consumer.i_head,
+                                            &i_head, i_head + 1 ) )
+            break;
+    }
+
+    atomic_fetch_add( &p_fifo->consumer.i_size, p_block->i_buffer );
+    atomic_fetch_add( &p_fifo->consumer.i_depth, 1 );
+    FifoRingWakeProducer( p_fifo );
+    return p_block;
+}
+
+static block_t *FifoRingPeek( block_fifo_t *p_fifo )
+{
+    size_t i_head = atomic_load( &p_fifo->consumer.i_head );
+    block_t *p_block = NULL;
+
+    if( i_head != atomic_load( &p_fifo->producer.i_tail ) )
+        return (block_t *)atomic_load_explicit(
+                &p_fifo->p_ring[i_head & (BLOCK_FIFO_RING_SIZE - 1)],
+                memory_order_relaxed );
+
+    if( atomic_load( &p_fifo->producer.b_overflow ) )
+    {
+        vlc_mutex_lock( &p_fifo->lock );
+        if( atomic_load( &p_fifo->consumer.i_head )
+                == atomic_load( &p_fifo->producer.i_tail ) )
+            p_block = p_fifo->p_first;
+        vlc_mutex_unlock( &p_fifo->lock );
+    }
+    return p_block;
+}
+
+static void FifoRingUnpark( void *data )
+{
+    block_fifo_t *p_fifo = data;
+
+    atomic_store( &p_fifo->consumer.b_waiting, false );
+    vlc_mutex_unlock( &p_fifo->lock );
+}
+
+static void FifoRingUnparkProducer( void *data )
+{
+    block_fifo_t *p_fifo = data;
+
+    atomic_store( &p_fifo->producer.b_waiting, false );
+    vlc_mutex_unlock( &p_fifo->lock );
+}
+
+/* Parks the consumer until a block is queued. The waiting flag is raised
+ * before the ring is checked, and the producer checks it after publishing
+ * its blocks, so that either of them sees the other.
+ * Returns false on a forced wakeup. */
+static bool FifoRingPark( block_fifo_t *p_fifo, bool b_wakeable )
+{
+    bool b_data;
+
+    vlc_mutex_lock( &p_fifo->lock );
+    atomic_store( &p_fifo->consumer.b_waiting, true );
+    vlc_cleanup_push( FifoRingUnpark, p_fifo );
+    while( !( b_data = !FifoRingIsEmpty( p_fifo ) )
+        && !( b_wakeable && atomic_load( &p_fifo->consumer.b_force_wake ) ) )
+        vlc_cond_wait( &p_fifo->wait, &p_fifo->lock );
+    if( b_wakeable && !b_data )
+        atomic_store( &p_fifo->consumer.b_force_wake, false );
+    vlc_cleanup_run();
+    return b_data;
+}
+
+static block_t *FifoRingGet( block_fifo_t *p_fifo )
+{
+    block_t *p_block;
+
+    while( ( p_block = FifoRingPop( p_fifo ) ) == NULL )
+        if( !FifoRingPark( p_fifo, true ) )
+            return NULL;
+
+    if( atomic_load_explicit( &p_fifo->consumer.b_force_wake,
+                              memory_order_relaxed ) )
+        atomic_store( &p_fifo->consumer.b_force_wake, false );
+    return p_block;
+}
+
+static block_t *FifoRingShow( block_fifo_t *p_fifo )
+{
+    block_t *p_block;
+
+    while( ( p_block = FifoRingPeek( p_fifo ) ) == NULL )
+        FifoRingPark( p_fifo, false );
+    return p_block;
+}
+
+static size_t FifoRingPut( block_fifo_t *p_fifo, block_t *p_block )
+{
+    size_t i_size = 0, i_depth = 0;
+
+    for( block_t *b = p_block; b != NULL; b = b->p_next )
+    {
+        i_size += b->i_buffer;
+        i_depth++;
+    }
+    /* Accounted before being visible to the consumer */
+    atomic_fetch_add( &p_fifo->producer.i_size, i_size );
+    atomic_fetch_add( &p_fifo->producer.i_depth, i_depth );
+
+    while( p_block != NULL )
+    {
+        block_t *p_next = p_block->p_next;
+
+        p_block->p_next = NULL;
+        FifoRingPush( p_fifo, p_block );
+        p_block = p_next;
+    }
+
+    if( atomic_load( &p_fifo->consumer.b_waiting ) )
+    {
+        vlc_mutex_lock( &p_fifo->lock );
+        vlc_cond_signal( &p_fifo->wait );
+        vlc_mutex_unlock( &p_fifo->lock );
+    }
+    return i_size;
+}
+
+static void FifoRingPace( block_fifo_t *p_fifo, size_t i_max_depth,
+                          size_t i_max_size )
+{
+    if( FifoRingDepth( p_fifo ) <= i_max_depth
+     && FifoRingSize( p_fifo ) <= i_max_size )
+        return;
+
+    vlc_mutex_lock( &p_fifo->lock );
+    atomic_store( &p_fifo->producer.i_max_depth, i_max_depth );
+    atomic_store( &p_fifo->producer.i_max_size, i_max_size );
+    atomic_store( &p_fifo->producer.b_waiting, true );
+    vlc_cleanup_push( FifoRingUnparkProducer, p_fifo );
+    while( FifoRingDepth( p_fifo ) > i_max_depth
+        || FifoRingSize( p_fifo ) > i_max_size )
+        vlc_cond_wait( &p_fifo->wait_room, &p_fifo->lock );
+    vlc_cleanup_run();
+}
+
 block_fifo_t *block_FifoNew( void )
 {
     block_fifo_t *p_fifo = malloc( sizeof( block_fifo_t ) );
@@ -535,6 +1041,43 @@ block_fifo_t *block_FifoNew( void )
     p_fifo->pp_last = &p_fifo->p_first;
     p_fifo->i_depth = p_fifo->i_size = 0;
     p_fifo->b_force_wake = false;
+    p_fifo->p_ring = NULL;
+
+    return p_fifo;
+}
+
+/**
+ * Creates a queue for exactly one producer thread (block_FifoPut() and
+ * block_FifoPace()) and one consumer thread (block_FifoGet() and
+ * block_FifoShow()). Blocks are exchanged through a ring without locking,
+ * the threads only synchronize when the consumer finds the queue empty or
+ * the producer finds it above its pace limits.
+ */
+block_fifo_t *block_FifoNewSPSC( void )
+{
+    block_fifo_t *p_fifo = block_FifoNew();
+    if( !p_fifo )
+        return NULL;
+
+    p_fifo->p_ring = malloc( BLOCK_FIFO_RING_SIZE * sizeof(*p_fifo->p_ring) );
+    if( !p_fifo->p_ring )
+    {
+        block_FifoRelease( p_fifo );
+        return NULL;
+    }
+
+    atomic_init( &p_fifo->producer.i_tail, 0 );
+    atomic_init( &p_fifo->producer.i_depth, 0 );
+    atomic_init( &p_fifo->producer.i_size, 0 );
+    atomic_init( &p_fifo->producer.b_overflow, false );
+    atomic_init( &p_fifo->producer.b_waiting, false );
+    atomic_init( &p_fifo->producer.i_max_depth, SIZE_MAX );
+    atomic_init( &p_fifo->producer.i_max_size, SIZE_MAX );
+    atomic_init( &p_fifo->consumer.i_head, 0 );
+    atomic_init( &p_fifo->consumer.i_depth, 0 );
+    atomic_init( &p_fifo->consumer.i_size, 0 );
+    atomic_init( &p_fifo->consumer.b_waiting, false );
+    atomic_init( &p_fifo->consumer.b_force_wake, false );
 
     return p_fifo;
 }
@@ -542,6 +1085,7 @@ block_fifo_t *block_FifoNew( void )
 void block_FifoRelease( block_fifo_t *p_fifo )
 {
     block_FifoEmpty( p_fifo );
+    free( p_fifo->p_ring );
     vlc_cond_destroy( &p_fifo->wait_room );
     vlc_cond_destroy( &p_fifo->wait );
     vlc_mutex_destroy( &p_fifo->lock );
@@ -552,6 +1096,13 @@ void block_FifoEmpty( block_fifo_t *p_fifo )
 {
     block_t *block;
 
+    if( p_fifo->p_ring != NULL )
+    {
+        while( ( block = FifoRingPop( p_fifo ) ) != NULL )
+            block_Release( block );
+        return;
+    }
+
     vlc_mutex_lock( &p_fifo->lock );
     block = p_fifo->p_first;
     if (block != NULL)
@@ -594,6 +1145,12 @@ void block_FifoPace (block_fifo_t *fifo, size_t max_depth, size_t max_size)
 {
     vlc_testcancel ();
 
+    if (fifo->p_ring != NULL)
+    {
+        FifoRingPace (fifo, max_depth, max_size);
+        return;
+    }
+
     vlc_mutex_lock (&fifo->lock);
     while ((fifo->i_depth > max_depth) || (fifo->i_size > max_size))
     {
@@ -617,6 +1174,8 @@ size_t block_FifoPut( block_fifo_t *p_fifo, block_t *p_block )
 
     if (p_block == NULL)
         return 0;
+    if (p_fifo->p_ring != NULL)
+        return FifoRingPut (p_fifo, p_block);
     for (p_last = p_block; ; p_last = p_last->p_next)
     {
         i_size += p_last->i_buffer;
@@ -640,7 +1199,12 @@ size_t block_FifoPut( block_fifo_t *p_fifo, block_t *p_block )
 void block_FifoWake( block_fifo_t *p_fifo )
 {
     vlc_mutex_lock( &p_fifo->lock );
-    if( p_fifo->p_first == NULL )
+    if( p_fifo->p_ring != NULL )
+    {
+        if( FifoRingIsEmpty( p_fifo ) )
+            atomic_store( &p_fifo->consumer.b_force_wake, true );
+    }
+    else if( p_fifo->p_first == NULL )
         p_fifo->b_force_wake = true;
     vlc_cond_broadcast( &p_fifo->wait );
     vlc_mutex_unlock( &p_fifo->lock );
@@ -658,6 +1222,9 @@ block_t *block_FifoGet( block_fifo_t *p_fifo )
 
     vlc_testcancel( );
 
+    if( p_fifo->p_ring != NULL )
+        return FifoRingGet( p_fifo );
+
     vlc_mutex_lock( &p_fifo->lock );
     mutex_cleanup_push( &p_fifo->lock );
 
@@ -711,6 +1278,9 @@ block_t *block_FifoShow( block_fifo_t *p_fifo )
 
     vlc_testcancel( );
 
+    if( p_fifo->p_ring != NULL )
+        return FifoRingShow( p_fifo );
+
     vlc_mutex_lock( &p_fifo->lock );
     mutex_cleanup_push( &p_fifo->lock );
 
@@ -723,14 +1293,18 @@ block_t *block_FifoShow( block_fifo_t *p_fifo )
     return b;
 }
 
-/* FIXME: not thread-safe */
+/* FIXME: not thread-safe, unless created by block_FifoNewSPSC() */
 size_t block_FifoSize( const block_fifo_t *p_fifo )
 {
+    if( p_fifo->p_ring != NULL )
+        return FifoRingSize( (block_fifo_t *)p_fifo );
     return p_fifo->i_size;
 }
 
-/* FIXME: not thread-safe */
+/* FIXME: not thread-safe, unless created by block_FifoNewSPSC() */
 size_t block_FifoCount( const block_fifo_t *p_fifo )
 {
+    if( p_fifo->p_ring != NULL )
+        return FifoRingDepth( (block_fifo_t *)p_fifo );
     return p_fifo->i_depth;
 }
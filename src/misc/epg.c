@@ -30,8 +30,96 @@
 #endif
 
 #include <vlc_common.h>
+#include <vlc_atomic.h>
 #include <vlc_epg.h>
 
+/* Event strings are shared by the EPG holding the same event, their
+ * reference count is stored right before the characters */
+typedef struct
+{
+    atomic_uint i_refs;
+    char        psz[];
+} epg_string_t;
+
+static epg_string_t *EpgString( char *psz )
+{
+    return (epg_string_t *)(psz - offsetof(epg_string_t, psz));
+}
+
+static char *EpgStringNew( const char *psz )
+{
+    if( !psz )
+        return NULL;
+
+    const size_t i_size = strlen( psz ) + 1;
+    epg_string_t *p_str = malloc( sizeof(*p_str) + i_size );
+    if( !p_str )
+        return NULL;
+    atomic_init( &p_str->i_refs, 1 );
+    memcpy( p_str->psz, psz, i_size );
+    return p_str->psz;
+}
+
+static char *EpgStringHold( char *psz )
+{
+    if( psz )
+        atomic_fetch_add( &EpgString( psz )->i_refs, 1 );
+    return psz;
+}
+
+static void EpgStringRelease( char *psz )
+{
+    if( !psz )
+        return;
+
+    epg_string_t *p_str = EpgString( psz );
+    if( atomic_fetch_sub( &p_str->i_refs, 1 ) == 1 )
+        free( p_str );
+}
+
+static bool EpgStringEqual( const char *psz_a, const char *psz_b )
+{
+    if( psz_a == psz_b )
+        return true;
+    return psz_a && psz_b && !strcmp( psz_a, psz_b );
+}
+
+/* Replaces a string by a shared one, unless they are equal already */
+static bool EpgStringUpdate( char **ppsz, char *psz )
+{
+    if( EpgStringEqual( *ppsz, psz ) )
+        return false;
+    EpgStringRelease( *ppsz );
+    *ppsz = EpgStringHold( psz );
+    return true;
+}
+
+static void EpgEventDelete( vlc_epg_event_t *p_evt )
+{
+    EpgStringRelease( p_evt->psz_name );
+    EpgStringRelease( p_evt->psz_short_description );
+    EpgStringRelease( p_evt->psz_description );
+    free( p_evt );
+}
+
+/* Events are kept ordered by start time, returns the index of the first one
+ * starting at or after i_start */
+static int EpgFind( const vlc_epg_t *p_epg, int64_t i_start )
+{
+    int i_low = 0;
+    int i_high = p_epg->i_event;
+
+    while( i_low < i_high )
+    {
+        const int i_mid = i_low + (i_high - i_low) / 2;
+        if( p_epg->pp_event[i_mid]->i_start < i_start )
+            i_low = i_mid + 1;
+        else
+            i_high = i_mid;
+    }
+    return i_low;
+}
+
 void vlc_epg_Init( vlc_epg_t *p_epg, const char *psz_name )
 {
     p_epg->psz_name = psz_name ? strdup( psz_name ) : NULL;
@@ -43,13 +131,7 @@ void vlc_epg_Clean( vlc_epg_t *p_epg )
 {
     int i;
     for( i = 0; i < p_epg->i_event; i++ )
-    {
-        vlc_epg_event_t *p_evt = p_epg->pp_event[i];
-        free( p_evt->psz_name );
-        free( p_evt->psz_short_description );
-        free( p_evt->psz_description );
-        free( p_evt );
-    }
+        EpgEventDelete( p_epg->pp_event[i] );
     TAB_CLEAN( p_epg->i_event, p_epg->pp_event );
     free( p_epg->psz_name );
 }
@@ -63,11 +145,18 @@ void vlc_epg_AddEvent( vlc_epg_t *p_epg, int64_t i_start, int i_duration,
         return;
     p_evt->i_start = i_start;
     p_evt->i_duration = i_duration;
-    p_evt->psz_name = psz_name ? strdup( psz_name ) : NULL;
-    p_evt->psz_short_description = psz_short_description ? strdup( psz_short_description ) : NULL;
-    p_evt->psz_description = psz_description ? strdup( psz_description ) : NULL;
+    p_evt->psz_name = EpgStringNew( psz_name );
+    p_evt->psz_short_description = EpgStringNew( psz_short_description );
+    p_evt->psz_description = EpgStringNew( psz_description );
     p_evt->i_rating = i_rating;
-    TAB_APPEND( p_epg->i_event, p_epg->pp_event, p_evt );
+
+    /* Events are usually added in order */
+    if( p_epg->i_event == 0 ||
+        p_epg->pp_event[p_epg->i_event - 1]->i_start <= i_start )
+        TAB_APPEND( p_epg->i_event, p_epg->pp_event, p_evt );
+    else
+        TAB_INSERT( p_epg->i_event, p_epg->pp_event, p_evt,
+                    EpgFind( p_epg, i_start ) );
 }
 
 vlc_epg_t *vlc_epg_New( const char *psz_name )
@@ -91,60 +180,98 @@ void vlc_epg_SetCurrent( vlc_epg_t *p_epg, int64_t i_start )
     if( i_start < 0 )
         return;
 
-    for( i = 0; i < p_epg->i_event; i++ )
-    {
-        if( p_epg->pp_event[i]->i_start == i_start )
-        {
-            p_epg->p_current = p_epg->pp_event[i];
-            break;
-        }
-    }
+    i = EpgFind( p_epg, i_start );
+    if( i < p_epg->i_event && p_epg->pp_event[i]->i_start == i_start )
+        p_epg->p_current = p_epg->pp_event[i];
 }
 
-void vlc_epg_Merge( vlc_epg_t *p_dst, const vlc_epg_t *p_src )
+size_t vlc_epg_MergeChanges( vlc_epg_t *p_dst, const vlc_epg_t *p_src,
+                             vlc_epg_changed_cb pf_changed, void *p_data )
 {
+    size_t i_changes = 0;
     int i;
 
-    /* Add new event */
+    /* Add new events and update the modified ones */
     for( i = 0; i < p_src->i_event; i++ )
     {
-        vlc_epg_event_t *p_evt = p_src->pp_event[i];
-        bool b_add = true;
-        int j;
+        const vlc_epg_event_t *p_evt = p_src->pp_event[i];
+        const int j = EpgFind( p_dst, p_evt->i_start );
 
-        for( j = 0; j < p_dst->i_event; j++ )
+        if( j < p_dst->i_event && p_dst->pp_event[j]->i_start == p_evt->i_start )
         {
-            if( p_dst->pp_event[j]->i_start == p_evt->i_start && p_dst->pp_event[j]->i_duration == p_evt->i_duration )
+            vlc_epg_event_t *p_old = p_dst->pp_event[j];
+            bool b_changed = false;
+
+            if( p_old->i_duration != p_evt->i_duration ||
+                p_old->i_rating != p_evt->i_rating )
             {
-                b_add = false;
-                break;
+                p_old->i_duration = p_evt->i_duration;
+                p_old->i_rating = p_evt->i_rating;
+                b_changed = true;
             }
-            if( p_dst->pp_event[j]->i_start > p_evt->i_start )
-                break;
+            b_changed |= EpgStringUpdate( &p_old->psz_name, p_evt->psz_name );
+            b_changed |= EpgStringUpdate( &p_old->psz_short_description,
+                                          p_evt->psz_short_description );
+            b_changed |= EpgStringUpdate( &p_old->psz_description,
+                                          p_evt->psz_description );
+            if( !b_changed )
+                continue;
+            if( pf_changed )
+                pf_changed( p_data, p_old, false );
         }
-        if( b_add )
+        else
         {
-            vlc_epg_event_t *p_copy = calloc( 1, sizeof(vlc_epg_event_t) );
+            vlc_epg_event_t *p_copy = malloc( sizeof(*p_copy) );
             if( !p_copy )
                 break;
             p_copy->i_start = p_evt->i_start;
             p_copy->i_duration = p_evt->i_duration;
-            p_copy->psz_name = p_evt->psz_name ? strdup( p_evt->psz_name ) : NULL;
-            p_copy->psz_short_description = p_evt->psz_short_description ? strdup( p_evt->psz_short_description ) : NULL;
-            p_copy->psz_description = p_evt->psz_description ? strdup( p_evt->psz_description ) : NULL;
+            p_copy->psz_name = EpgStringHold( p_evt->psz_name );
+            p_copy->psz_short_description = EpgStringHold( p_evt->psz_short_description );
+            p_copy->psz_description = EpgStringHold( p_evt->psz_description );
             p_copy->i_rating = p_evt->i_rating;
             TAB_INSERT( p_dst->i_event, p_dst->pp_event, p_copy, j );
+            if( pf_changed )
+                pf_changed( p_data, p_copy, false );
         }
+        i_changes++;
     }
+
     /* Update current */
     if( p_src->p_current )
+    {
+        const vlc_epg_event_t *p_current = p_dst->p_current;
         vlc_epg_SetCurrent( p_dst, p_src->p_current->i_start );
+        if( p_dst->p_current != p_current )
+            i_changes++;
+    }
 
     /* Keep only 1 old event  */
     if( p_dst->p_current )
     {
-        while( p_dst->i_event > 1 && p_dst->pp_event[0] != p_dst->p_current && p_dst->pp_event[1] != p_dst->p_current )
-            TAB_REMOVE( p_dst->i_event, p_dst->pp_event, p_dst->pp_event[0] );
+        int i_old = EpgFind( p_dst, p_dst->p_current->i_start );
+        while( p_dst->pp_event[i_old] != p_dst->p_current )
+            i_old++;
+        i_old--;
+
+        if( i_old > 0 )
+        {
+            for( i = 0; i < i_old; i++ )
+            {
+                if( pf_changed )
+                    pf_changed( p_data, p_dst->pp_event[i], true );
+                EpgEventDelete( p_dst->pp_event[i] );
+            }
+            p_dst->i_event -= i_old;
+            memmove( &p_dst->pp_event[0], &p_dst->pp_event[i_old],
+                     p_dst->i_event * sizeof(*p_dst->pp_event) );
+            i_changes += i_old;
+        }
     }
+    return i_changes;
 }
 
+void vlc_epg_Merge( vlc_epg_t *p_dst, const vlc_epg_t *p_src )
+{
+    vlc_epg_MergeChanges( p_dst, p_src, NULL, NULL );
+}
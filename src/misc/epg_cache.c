@@ -0,0 +1,357 @@
+/*****************************************************************************
+ * epg_cache.c: Electronic Program Guide kept across sessions
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/*****************************************************************************
+ * Preamble
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <time.h>
+
+#include <vlc_common.h>
+#include <vlc_epg.h>
+#include <vlc_block.h>
+#include <vlc_fs.h>
+#include <vlc_configuration.h>
+
+/* One file per transport stream, in the user cache directory:
+ *  header:  magic, network_id (16), ts_id (16), service count (32)
+ *  service: service_id (16), reserved (16), event count (32)
+ *  event:   start (64), duration (32), rating (8), reserved (24),
+ *           name, short description and description lengths (32 each,
+ *           ~0 for none) followed by the strings, without terminator
+ * All values are little endian. */
+#define EPG_CACHE_MAGIC "VLCEPG01"
+#define EPG_CACHE_HEADER_SIZE 16
+#define EPG_CACHE_SERVICE_SIZE 8
+#define EPG_CACHE_EVENT_SIZE 28
+#define EPG_CACHE_NO_STRING UINT32_C(0xffffffff)
+
+/* Bounds a corrupted file */
+#define EPG_CACHE_SERVICES_MAX 1024
+
+typedef struct
+{
+    uint16_t    i_service_id;
+    vlc_epg_t   epg;
+} epg_cache_service_t;
+
+struct vlc_epg_cache_t
+{
+    vlc_object_t *p_obj;
+    char         *psz_path;
+    uint16_t     i_network_id;
+    uint16_t     i_ts_id;
+
+    int                  i_service;
+    epg_cache_service_t **pp_service;
+
+    bool         b_changed;
+};
+
+static epg_cache_service_t *ServiceGet( vlc_epg_cache_t *p_cache,
+                                        uint16_t i_service_id )
+{
+    for( int i = 0; i < p_cache->i_service; i++ )
+    {
+        if( p_cache->pp_service[i]->i_service_id == i_service_id )
+            return p_cache->pp_service[i];
+    }
+
+    if( p_cache->i_service >= EPG_CACHE_SERVICES_MAX )
+        return NULL;
+
+    epg_cache_service_t *p_service = malloc( sizeof(*p_service) );
+    if( !p_service )
+        return NULL;
+    p_service->i_service_id = i_service_id;
+    vlc_epg_Init( &p_service->epg, NULL );
+    TAB_APPEND( p_cache->i_service, p_cache->pp_service, p_service );
+    return p_service;
+}
+
+static void ServicesClean( vlc_epg_cache_t *p_cache )
+{
+    for( int i = 0; i < p_cache->i_service; i++ )
+    {
+        vlc_epg_Clean( &p_cache->pp_service[i]->epg );
+        free( p_cache->pp_service[i] );
+    }
+    TAB_CLEAN( p_cache->i_service, p_cache->pp_service );
+}
+
+static bool EventIsOver( const vlc_epg_event_t *p_evt, int64_t i_now )
+{
+    return p_evt->i_start + p_evt->i_duration <= i_now;
+}
+
+/*****************************************************************************
+ * Loading
+ *****************************************************************************/
+static bool ReadString( const uint8_t **pp, const uint8_t *p_end,
+                        uint32_t i_length, char **ppsz )
+{
+    *ppsz = NULL;
+    if( i_length == EPG_CACHE_NO_STRING )
+        return true;
+    if( i_length > (size_t)(p_end - *pp) )
+        return false;
+
+    *ppsz = strndup( (const char *)*pp, i_length );
+    *pp += i_length;
+    return *ppsz != NULL;
+}
+
+static bool Load( vlc_epg_cache_t *p_cache )
+{
+    block_t *p_file = block_FilePath( p_cache->psz_path );
+    if( !p_file )
+        return false;
+
+    const uint8_t *p = p_file->p_buffer;
+    const uint8_t *p_end = &p_file->p_buffer[p_file->i_buffer];
+    const int64_t i_now = time( NULL );
+    bool b_valid = false;
+
+    if( p_file->i_buffer < EPG_CACHE_HEADER_SIZE ||
+        memcmp( p, EPG_CACHE_MAGIC, 8 ) ||
+        GetWLE( &p[8] ) != p_cache->i_network_id ||
+        GetWLE( &p[10] ) != p_cache->i_ts_id ||
+        GetDWLE( &p[12] ) > EPG_CACHE_SERVICES_MAX )
+        goto end;
+
+    uint32_t i_service = GetDWLE( &p[12] );
+    p += EPG_CACHE_HEADER_SIZE;
+
+    for( ; i_service > 0; i_service-- )
+    {
+        if( p_end - p < EPG_CACHE_SERVICE_SIZE )
+            goto end;
+
+        epg_cache_service_t *p_service = ServiceGet( p_cache, GetWLE( p ) );
+        uint32_t i_event = GetDWLE( &p[4] );
+        p += EPG_CACHE_SERVICE_SIZE;
+        if( !p_service )
+            goto end;
+
+        for( ; i_event > 0; i_event-- )
+        {
+            if( p_end - p < EPG_CACHE_EVENT_SIZE )
+                goto end;
+
+            const int64_t i_start = GetQWLE( p );
+            const int i_duration = GetDWLE( &p[8] );
+            const uint8_t i_rating = p[12];
+            const uint32_t i_name = GetDWLE( &p[16] );
+            const uint32_t i_short = GetDWLE( &p[20] );
+            const uint32_t i_description = GetDWLE( &p[24] );
+            char *psz_name, *psz_short = NULL, *psz_description = NULL;
+            p += EPG_CACHE_EVENT_SIZE;
+
+            bool b_ok = ReadString( &p, p_end, i_name, &psz_name ) &&
+                        ReadString( &p, p_end, i_short, &psz_short ) &&
+                        ReadString( &p, p_end, i_description,
+                                    &psz_description );
+            if( b_ok && i_start + i_duration > i_now )
+                vlc_epg_AddEvent( &p_service->epg, i_start, i_duration,
+                                  psz_name, psz_short, psz_description,
+                                  i_rating );
+            free( psz_name );
+            free( psz_short );
+            free( psz_description );
+            if( !b_ok )
+                goto end;
+        }
+
+        /* The event on air, if any, is the first one left */
+        vlc_epg_t *p_epg = &p_service->epg;
+        if( p_epg->i_event > 0 && p_epg->pp_event[0]->i_start <= i_now )
+            p_epg->p_current = p_epg->pp_event[0];
+    }
+    b_valid = p == p_end;
+
+end:
+    block_Release( p_file );
+    if( !b_valid )
+        msg_Warn( p_cache->p_obj, "invalid EPG cache %s", p_cache->psz_path );
+    return b_valid;
+}
+
+/*****************************************************************************
+ * Storing
+ *****************************************************************************/
+static bool WriteString( FILE *f, const char *psz )
+{
+    return !psz || fwrite( psz, 1, strlen( psz ), f ) == strlen( psz );
+}
+
+static void Save( vlc_epg_cache_t *p_cache )
+{
+    const int64_t i_now = time( NULL );
+    char *psz_tmp;
+    if( asprintf( &psz_tmp, "%s.part", p_cache->psz_path ) == -1 )
+        return;
+
+    FILE *f = vlc_fopen( psz_tmp, "wb" );
+    if( !f )
+    {
+        msg_Dbg( p_cache->p_obj, "cannot store the EPG into %s", psz_tmp );
+        free( psz_tmp );
+        return;
+    }
+
+    uint8_t header[EPG_CACHE_HEADER_SIZE];
+    memcpy( header, EPG_CACHE_MAGIC, 8 );
+    SetWLE( &header[8], p_cache->i_network_id );
+    SetWLE( &header[10], p_cache->i_ts_id );
+    SetDWLE( &header[12], p_cache->i_service );
+    bool b_error = fwrite( header, 1, sizeof(header), f ) != sizeof(header);
+
+    for( int i = 0; i < p_cache->i_service && !b_error; i++ )
+    {
+        const epg_cache_service_t *p_service = p_cache->pp_service[i];
+        const vlc_epg_t *p_epg = &p_service->epg;
+
+        int i_event = 0;
+        for( int j = 0; j < p_epg->i_event; j++ )
+            i_event += !EventIsOver( p_epg->pp_event[j], i_now );
+
+        uint8_t service[EPG_CACHE_SERVICE_SIZE];
+        SetWLE( &service[0], p_service->i_service_id );
+        SetWLE( &service[2], 0 );
+        SetDWLE( &service[4], i_event );
+        b_error = fwrite( service, 1, sizeof(service), f ) != sizeof(service);
+
+        for( int j = 0; j < p_epg->i_event && !b_error; j++ )
+        {
+            const vlc_epg_event_t *p_evt = p_epg->pp_event[j];
+            if( EventIsOver( p_evt, i_now ) )
+                continue;
+
+            uint8_t event[EPG_CACHE_EVENT_SIZE];
+            memset( event, 0, sizeof(event) );
+            SetQWLE( &event[0], p_evt->i_start );
+            SetDWLE( &event[8], p_evt->i_duration );
+            event[12] = p_evt->i_rating;
+#define LENGTH( psz ) ( (psz) ? strlen( psz ) : EPG_CACHE_NO_STRING )
+            SetDWLE( &event[16], LENGTH( p_evt->psz_name ) );
+            SetDWLE( &event[20], LENGTH( p_evt->psz_short_description ) );
+            SetDWLE( &event[24], LENGTH( p_evt->psz_description ) );
+#undef LENGTH
+            b_error = fwrite( event, 1, sizeof(event), f ) != sizeof(event) ||
+                      !WriteString( f, p_evt->psz_name ) ||
+                      !WriteString( f, p_evt->psz_short_description ) ||
+                      !WriteString( f, p_evt->psz_description );
+        }
+    }
+
+    if( fclose( f ) || b_error || vlc_rename( psz_tmp, p_cache->psz_path ) )
+    {
+        msg_Warn( p_cache->p_obj, "cannot store the EPG into %s",
+                  p_cache->psz_path );
+        vlc_unlink( psz_tmp );
+    }
+    free( psz_tmp );
+}
+
+/*****************************************************************************
+ * API
+ *****************************************************************************/
+vlc_epg_cache_t *vlc_epg_cache_Open( vlc_object_t *p_obj,
+                                     uint16_t i_network_id, uint16_t i_ts_id )
+{
+    vlc_epg_cache_t *p_cache = malloc( sizeof(*p_cache) );
+    if( !p_cache )
+        return NULL;
+
+    char *psz_dir = config_GetUserDir( VLC_CACHE_DIR );
+    if( !psz_dir )
+    {
+        free( p_cache );
+        return NULL;
+    }
+
+    vlc_mkdir( psz_dir, 0700 );
+
+    char *psz_epg_dir;
+    if( asprintf( &psz_epg_dir, "%s" DIR_SEP "epg", psz_dir ) == -1 )
+        psz_epg_dir = NULL;
+    free( psz_dir );
+    if( !psz_epg_dir )
+    {
+        free( p_cache );
+        return NULL;
+    }
+    vlc_mkdir( psz_epg_dir, 0700 );
+
+    if( asprintf( &p_cache->psz_path, "%s" DIR_SEP "%04x-%04x.epg",
+                  psz_epg_dir, i_network_id, i_ts_id ) == -1 )
+    {
+        free( psz_epg_dir );
+        free( p_cache );
+        return NULL;
+    }
+    free( psz_epg_dir );
+
+    p_cache->p_obj = p_obj;
+    p_cache->i_network_id = i_network_id;
+    p_cache->i_ts_id = i_ts_id;
+    p_cache->b_changed = false;
+    TAB_INIT( p_cache->i_service, p_cache->pp_service );
+
+    if( Load( p_cache ) )
+        msg_Dbg( p_obj, "EPG of %d services loaded from %s",
+                 p_cache->i_service, p_cache->psz_path );
+    else
+        ServicesClean( p_cache );
+    return p_cache;
+}
+
+void vlc_epg_cache_Close( vlc_epg_cache_t *p_cache )
+{
+    if( p_cache->b_changed )
+        Save( p_cache );
+
+    ServicesClean( p_cache );
+    free( p_cache->psz_path );
+    free( p_cache );
+}
+
+const vlc_epg_t *vlc_epg_cache_Get( vlc_epg_cache_t *p_cache, int i_index,
+                                    uint16_t *pi_service_id )
+{
+    if( i_index < 0 || i_index >= p_cache->i_service )
+        return NULL;
+
+    *pi_service_id = p_cache->pp_service[i_index]->i_service_id;
+    return &p_cache->pp_service[i_index]->epg;
+}
+
+void vlc_epg_cache_Update( vlc_epg_cache_t *p_cache, uint16_t i_service_id,
+                           const vlc_epg_t *p_epg )
+{
+    epg_cache_service_t *p_service = ServiceGet( p_cache, i_service_id );
+    if( p_service &&
+        vlc_epg_MergeChanges( &p_service->epg, p_epg, NULL, NULL ) > 0 )
+        p_cache->b_changed = true;
+}
@@ -464,7 +464,7 @@ static void *Thread( void *p_data )
         meta_fetcher_scope_t e_prev_scope = p_fetcher->e_scope;
 
         /* scope override */
-        switch ( p_entry->i_options ) {
+        switch ( p_entry->i_options & META_REQUEST_OPTION_SCOPE_ANY ) {
         case META_REQUEST_OPTION_SCOPE_ANY:
             p_fetcher->e_scope = FETCHER_SCOPE_ANY;
             break;
@@ -769,7 +769,10 @@ static void GoAndPreparse( playlist_t *p_playlist, int i_mode,
     char *psz_album = input_item_GetAlbum( p_item->p_input );
     if( sys->p_preparser != NULL && !input_item_IsPreparsed( p_item->p_input )
      && (EMPTY_STR(psz_artist) || EMPTY_STR(psz_album)) )
-        playlist_preparser_Push( sys->p_preparser, p_item->p_input, 0 );
+        playlist_preparser_Push( sys->p_preparser, p_item->p_input,
+                                 (i_mode & PLAYLIST_GO)
+                                     ? META_REQUEST_OPTION_PRIORITY
+                                     : META_REQUEST_OPTION_NONE );
     free( psz_artist );
     free( psz_album );
 }
@@ -1,5 +1,5 @@
 /*****************************************************************************
- * preparser.c: Preparser thread.
+ * preparser.c: Preparser threads.
  *****************************************************************************
  * Copyright © 1999-2009 VLC authors and VideoLAN
  * $Id$
@@ -25,15 +25,44 @@
 # include "config.h"
 #endif
 
+#include <sys/stat.h>
+
 #include <vlc_common.h>
+#include <vlc_arrays.h>
+#include <vlc_fs.h>
+#include <vlc_meta.h>
+#include <vlc_url.h>
 
 #include "fetcher.h"
 #include "preparser.h"
 #include "input/input_interface.h"
+#include "input/item.h"
+#include "input/info.h"
 
 /*****************************************************************************
  * Structures/definitions
  *****************************************************************************/
+
+/* Beyond this many files, the cache is emptied */
+#define PREPARSER_CACHE_MAX 16384
+
+/**
+ * Result of the preparsing of a local file, valid as long as the file keeps
+ * the same modification time and size
+ */
+typedef struct
+{
+    time_t             i_mtime;
+    uint64_t           i_size;
+
+    mtime_t            i_duration;
+    vlc_meta_t        *p_meta;
+    int                i_es;
+    es_format_t      **es;
+    int                i_categories;
+    info_category_t  **pp_categories;
+} preparser_cache_entry_t;
+
 struct playlist_preparser_t
 {
     vlc_object_t        *object;
@@ -41,12 +70,22 @@ struct playlist_preparser_t
 
     vlc_mutex_t     lock;
     vlc_cond_t      wait;
-    bool            b_live;
+    int             i_live;      /* worker threads */
+    int             i_max_live;
+    mtime_t         i_timeout;
+    input_item_t  **pp_urgent;   /* visible or about to play */
+    int             i_urgent;
     input_item_t  **pp_waiting;
     int             i_waiting;
+    input_item_t  **pp_running;
+    int             i_running;
+
+    vlc_dictionary_t cache;      /* preparser_cache_entry_t by path */
+    int              i_cache;
 };
 
 static void *Thread( void * );
+static void CacheEntryDelete( void *, void * );
 
 /*****************************************************************************
  * Public functions
@@ -64,29 +103,75 @@ playlist_preparser_t *playlist_preparser_New( vlc_object_t *parent )
 
     vlc_mutex_init( &p_preparser->lock );
     vlc_cond_init( &p_preparser->wait );
-    p_preparser->b_live = false;
-    p_preparser->i_waiting = 0;
-    p_preparser->pp_waiting = NULL;
+    p_preparser->i_live = 0;
+    p_preparser->i_max_live = var_InheritInteger( parent, "preparse-threads" );
+    if( p_preparser->i_max_live < 1 )
+        p_preparser->i_max_live = 1;
+    p_preparser->i_timeout = var_InheritInteger( parent, "preparse-timeout" )
+                           * (CLOCK_FREQ / 1000);
+    TAB_INIT( p_preparser->i_urgent, p_preparser->pp_urgent );
+    TAB_INIT( p_preparser->i_waiting, p_preparser->pp_waiting );
+    TAB_INIT( p_preparser->i_running, p_preparser->pp_running );
+    vlc_dictionary_init( &p_preparser->cache, 0 );
+    p_preparser->i_cache = 0;
 
     return p_preparser;
 }
 
+static int Find( input_item_t **pp_items, int i_items, input_item_t *p_item )
+{
+    for( int i = 0; i < i_items; i++ )
+        if( pp_items[i] == p_item )
+            return i;
+    return -1;
+}
+
 void playlist_preparser_Push( playlist_preparser_t *p_preparser, input_item_t *p_item,
                               input_item_meta_request_option_t i_options )
 {
-    vlc_gc_incref( p_item );
-    VLC_UNUSED( i_options );
+    const bool b_urgent = i_options & META_REQUEST_OPTION_PRIORITY;
 
     vlc_mutex_lock( &p_preparser->lock );
-    INSERT_ELEM( p_preparser->pp_waiting, p_preparser->i_waiting,
-                 p_preparser->i_waiting, p_item );
-    if( !p_preparser->b_live )
+    /* An item is queued once, requesting it again can only raise its
+     * priority */
+    if( Find( p_preparser->pp_running, p_preparser->i_running, p_item ) >= 0
+     || Find( p_preparser->pp_urgent, p_preparser->i_urgent, p_item ) >= 0 )
+    {
+        vlc_mutex_unlock( &p_preparser->lock );
+        return;
+    }
+
+    int i_index = Find( p_preparser->pp_waiting, p_preparser->i_waiting,
+                        p_item );
+    if( i_index >= 0 )
+    {
+        if( !b_urgent )
+        {
+            vlc_mutex_unlock( &p_preparser->lock );
+            return;
+        }
+        REMOVE_ELEM( p_preparser->pp_waiting, p_preparser->i_waiting, i_index );
+    }
+    else
+        vlc_gc_incref( p_item );
+
+    if( b_urgent )
+        INSERT_ELEM( p_preparser->pp_urgent, p_preparser->i_urgent,
+                     p_preparser->i_urgent, p_item );
+    else
+        INSERT_ELEM( p_preparser->pp_waiting, p_preparser->i_waiting,
+                     p_preparser->i_waiting, p_item );
+
+    /* Spawn workers up to the limit, as long as they would have an item */
+    if( p_preparser->i_live < p_preparser->i_max_live
+     && p_preparser->i_live - p_preparser->i_running
+            < p_preparser->i_urgent + p_preparser->i_waiting )
     {
         if( vlc_clone_detach( NULL, Thread, p_preparser,
                               VLC_THREAD_PRIORITY_LOW ) )
             msg_Warn( p_preparser->object, "cannot spawn pre-parser thread" );
         else
-            p_preparser->b_live = true;
+            p_preparser->i_live++;
     }
     vlc_mutex_unlock( &p_preparser->lock );
 }
@@ -102,17 +187,19 @@ void playlist_preparser_Delete( playlist_preparser_t *p_preparser )
 {
     vlc_mutex_lock( &p_preparser->lock );
     /* Remove pending item to speed up preparser thread exit */
-    while( p_preparser->i_waiting > 0 )
-    {
-        vlc_gc_decref( p_preparser->pp_waiting[0] );
-        REMOVE_ELEM( p_preparser->pp_waiting, p_preparser->i_waiting, 0 );
-    }
-
-    while( p_preparser->b_live )
+    for( int i = 0; i < p_preparser->i_urgent; i++ )
+        vlc_gc_decref( p_preparser->pp_urgent[i] );
+    TAB_CLEAN( p_preparser->i_urgent, p_preparser->pp_urgent );
+    for( int i = 0; i < p_preparser->i_waiting; i++ )
+        vlc_gc_decref( p_preparser->pp_waiting[i] );
+    TAB_CLEAN( p_preparser->i_waiting, p_preparser->pp_waiting );
+
+    while( p_preparser->i_live > 0 )
         vlc_cond_wait( &p_preparser->wait, &p_preparser->lock );
     vlc_mutex_unlock( &p_preparser->lock );
 
     /* Destroy the item preparser */
+    vlc_dictionary_clear( &p_preparser->cache, CacheEntryDelete, NULL );
     vlc_cond_destroy( &p_preparser->wait );
     vlc_mutex_destroy( &p_preparser->lock );
 
@@ -124,11 +211,175 @@ void playlist_preparser_Delete( playlist_preparser_t *p_preparser )
 /*****************************************************************************
  * Privates functions
  *****************************************************************************/
+static void CacheEntryDelete( void *data, void *obj )
+{
+    preparser_cache_entry_t *p_entry = data;
+    VLC_UNUSED( obj );
+
+    if( p_entry->p_meta )
+        vlc_meta_Delete( p_entry->p_meta );
+    for( int i = 0; i < p_entry->i_es; i++ )
+    {
+        es_format_Clean( p_entry->es[i] );
+        free( p_entry->es[i] );
+    }
+    TAB_CLEAN( p_entry->i_es, p_entry->es );
+    for( int i = 0; i < p_entry->i_categories; i++ )
+        info_category_Delete( p_entry->pp_categories[i] );
+    TAB_CLEAN( p_entry->i_categories, p_entry->pp_categories );
+    free( p_entry );
+}
+
+/* Deep copy, from an item or from the cache */
+static preparser_cache_entry_t *CacheEntryNew( mtime_t i_duration,
+                                               const vlc_meta_t *p_meta,
+                                               int i_es, es_format_t **es,
+                                               int i_categories,
+                                               info_category_t **pp_categories )
+{
+    preparser_cache_entry_t *p_entry = malloc( sizeof(*p_entry) );
+    if( !p_entry )
+        return NULL;
+
+    p_entry->i_duration = i_duration;
+    p_entry->p_meta = NULL;
+    TAB_INIT( p_entry->i_es, p_entry->es );
+    TAB_INIT( p_entry->i_categories, p_entry->pp_categories );
+
+    if( p_meta )
+    {
+        p_entry->p_meta = vlc_meta_New();
+        if( !p_entry->p_meta )
+            goto error;
+        vlc_meta_Merge( p_entry->p_meta, p_meta );
+    }
+
+    for( int i = 0; i < i_es; i++ )
+    {
+        es_format_t *p_fmt = malloc( sizeof(*p_fmt) );
+        if( !p_fmt )
+            goto error;
+        es_format_Copy( p_fmt, es[i] );
+        TAB_APPEND( p_entry->i_es, p_entry->es, p_fmt );
+    }
+
+    for( int i = 0; i < i_categories; i++ )
+    {
+        const info_category_t *p_src = pp_categories[i];
+        info_category_t *p_cat = info_category_New( p_src->psz_name );
+        if( !p_cat )
+            goto error;
+        TAB_APPEND( p_entry->i_categories, p_entry->pp_categories, p_cat );
+
+        for( int j = 0; j < p_src->i_infos; j++ )
+        {
+            const info_t *p_info = p_src->pp_infos[j];
+            info_category_AddInfo( p_cat, p_info->psz_name, "%s",
+                                   p_info->psz_value ? p_info->psz_value : "" );
+        }
+    }
+    return p_entry;
+
+error:
+    CacheEntryDelete( p_entry, NULL );
+    return NULL;
+}
+
+/**
+ * Applies the cached result of an earlier preparsing of the same file.
+ * Returns false if there is none or if the file changed since.
+ */
+static bool CacheApply( playlist_preparser_t *p_preparser, const char *psz_path,
+                        const struct stat *p_st, input_item_t *p_item )
+{
+    preparser_cache_entry_t *p_copy = NULL;
+
+    vlc_mutex_lock( &p_preparser->lock );
+    preparser_cache_entry_t *p_entry =
+        vlc_dictionary_value_for_key( &p_preparser->cache, psz_path );
+    if( p_entry != NULL )
+    {
+        if( p_entry->i_mtime == p_st->st_mtime
+         && p_entry->i_size == (uint64_t)p_st->st_size )
+            p_copy = CacheEntryNew( p_entry->i_duration, p_entry->p_meta,
+                                    p_entry->i_es, p_entry->es,
+                                    p_entry->i_categories,
+                                    p_entry->pp_categories );
+        else
+        {
+            vlc_dictionary_remove_value_for_key( &p_preparser->cache, psz_path,
+                                                 CacheEntryDelete, NULL );
+            p_preparser->i_cache--;
+        }
+    }
+    vlc_mutex_unlock( &p_preparser->lock );
+
+    if( p_copy == NULL )
+        return false;
+
+    /* Outside of the preparser lock, as it sends the item events */
+    if( p_copy->p_meta )
+        for( int i = 0; i < VLC_META_TYPE_COUNT; i++ )
+        {
+            const char *psz_value = vlc_meta_Get( p_copy->p_meta, i );
+            if( psz_value )
+                input_item_SetMeta( p_item, i, psz_value );
+        }
+    input_item_SetDuration( p_item, p_copy->i_duration );
+    for( int i = 0; i < p_copy->i_es; i++ )
+        input_item_UpdateTracksInfo( p_item, p_copy->es[i] );
+    for( int i = 0; i < p_copy->i_categories; i++ )
+        input_item_MergeInfos( p_item, p_copy->pp_categories[i] );
+    /* the categories now belong to the item */
+    p_copy->i_categories = 0;
+
+    CacheEntryDelete( p_copy, NULL );
+    return true;
+}
+
+static void CacheStore( playlist_preparser_t *p_preparser, const char *psz_path,
+                        const struct stat *p_st, input_item_t *p_item )
+{
+    preparser_cache_entry_t *p_entry = NULL;
+
+    vlc_mutex_lock( &p_item->lock );
+    /* Without any ES, the file was not understood or it is a playlist,
+     * whose preparsing adds sub-items that cannot be cached here */
+    if( p_item->i_es > 0 )
+        p_entry = CacheEntryNew( p_item->i_duration, p_item->p_meta,
+                                 p_item->i_es, p_item->es,
+                                 p_item->i_categories, p_item->pp_categories );
+    vlc_mutex_unlock( &p_item->lock );
+
+    if( p_entry == NULL )
+        return;
+    p_entry->i_mtime = p_st->st_mtime;
+    p_entry->i_size = p_st->st_size;
+
+    vlc_mutex_lock( &p_preparser->lock );
+    if( vlc_dictionary_value_for_key( &p_preparser->cache, psz_path ) != NULL )
+    {
+        vlc_dictionary_remove_value_for_key( &p_preparser->cache, psz_path,
+                                             CacheEntryDelete, NULL );
+        p_preparser->i_cache--;
+    }
+    else if( p_preparser->i_cache >= PREPARSER_CACHE_MAX )
+    {
+        vlc_dictionary_clear( &p_preparser->cache, CacheEntryDelete, NULL );
+        p_preparser->i_cache = 0;
+    }
+    vlc_dictionary_insert( &p_preparser->cache, psz_path, p_entry );
+    p_preparser->i_cache++;
+    vlc_mutex_unlock( &p_preparser->lock );
+}
+
 /**
  * This function preparses an item when needed.
  */
-static void Preparse( vlc_object_t *obj, input_item_t *p_item )
+static void Preparse( playlist_preparser_t *p_preparser, input_item_t *p_item )
 {
+    vlc_object_t *obj = p_preparser->object;
+
     vlc_mutex_lock( &p_item->lock );
     int i_type = p_item->i_type;
     vlc_mutex_unlock( &p_item->lock );
@@ -140,13 +391,32 @@ static void Preparse( vlc_object_t *obj, input_item_t *p_item )
     }
 
     /* Do not preparse if it is already done (like by playing it) */
-    if( !input_item_IsPreparsed( p_item ) )
+    if( input_item_IsPreparsed( p_item ) )
+        return;
+
+    /* Local files are looked up in the cache */
+    char *psz_uri = input_item_GetURI( p_item );
+    char *psz_path = psz_uri ? make_path( psz_uri ) : NULL;
+    struct stat st;
+    if( psz_path && vlc_stat( psz_path, &st ) )
     {
-        input_Preparse( obj, p_item );
-        input_item_SetPreparsed( p_item, true );
+        free( psz_path );
+        psz_path = NULL;
+    }
 
-        var_SetAddress( obj, "item-change", p_item );
+    if( psz_path == NULL || !CacheApply( p_preparser, psz_path, &st, p_item ) )
+    {
+        int i_ret = input_Preparse( obj, p_item, p_preparser->i_timeout );
+        if( i_ret == VLC_ETIMEOUT )
+            msg_Warn( obj, "preparsing of %s timed out", psz_uri );
+        else if( i_ret == VLC_SUCCESS && psz_path != NULL )
+            CacheStore( p_preparser, psz_path, &st, p_item );
     }
+    free( psz_path );
+    free( psz_uri );
+
+    input_item_SetPreparsed( p_item, true );
+    var_SetAddress( obj, "item-change", p_item );
 }
 
 /**
@@ -196,7 +466,6 @@ static void Art( playlist_preparser_t *p_preparser, input_item_t *p_item )
 static void *Thread( void *data )
 {
     playlist_preparser_t *p_preparser = data;
-    vlc_object_t *obj = p_preparser->object;
 
     for( ;; )
     {
@@ -204,7 +473,12 @@ static void *Thread( void *data )
 
         /* */
         vlc_mutex_lock( &p_preparser->lock );
-        if( p_preparser->i_waiting > 0 )
+        if( p_preparser->i_urgent > 0 )
+        {
+            p_current = p_preparser->pp_urgent[0];
+            REMOVE_ELEM( p_preparser->pp_urgent, p_preparser->i_urgent, 0 );
+        }
+        else if( p_preparser->i_waiting > 0 )
         {
             p_current = p_preparser->pp_waiting[0];
             REMOVE_ELEM( p_preparser->pp_waiting, p_preparser->i_waiting, 0 );
@@ -212,19 +486,26 @@ static void *Thread( void *data )
         else
         {
             p_current = NULL;
-            p_preparser->b_live = false;
+            p_preparser->i_live--;
             vlc_cond_signal( &p_preparser->wait );
         }
+        if( p_current )
+            TAB_APPEND( p_preparser->i_running, p_preparser->pp_running,
+                        p_current );
         vlc_mutex_unlock( &p_preparser->lock );
 
         if( !p_current )
             break;
 
-        Preparse( obj, p_current );
+        Preparse( p_preparser, p_current );
 
         Art( p_preparser, p_current );
+
+        vlc_mutex_lock( &p_preparser->lock );
+        TAB_REMOVE( p_preparser->i_running, p_preparser->pp_running,
+                    p_current );
+        vlc_mutex_unlock( &p_preparser->lock );
         vlc_gc_decref(p_current);
     }
     return NULL;
 }
-
@@ -36,13 +36,16 @@
 typedef struct playlist_preparser_t playlist_preparser_t;
 
 /**
- * This function creates the preparser object and thread.
+ * This function creates the preparser object. Its threads are started on
+ * demand, up to the "preparse-threads" limit.
  */
 playlist_preparser_t *playlist_preparser_New( vlc_object_t * );
 
 /**
  * This function enqueues the provided item to be preparsed.
  *
+ * Items requested with META_REQUEST_OPTION_PRIORITY are preparsed before the
+ * others. An item already queued is not queued again.
  * The input item is retained until the preparsing is done or until the
  * preparser object is deleted.
  */
@@ -53,7 +56,7 @@ void playlist_preparser_fetcher_Push( playlist_preparser_t *, input_item_t *,
                                       input_item_meta_request_option_t );
 
 /**
- * This function destroys the preparser object and thread.
+ * This function destroys the preparser object and threads.
  *
  * All pending input items will be released.
  */
@@ -0,0 +1,174 @@
+/*****************************************************************************
+ * arib_multi2.c: MULTI2 batch descrambling test
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Checks that decrypt_batch() gives byte for byte the output of decrypt()
+ * on each payload, for both keys, all CBC residue lengths and batch sizes
+ * around the lane counts, with every SIMD kernel the CPU supports. Also
+ * checks that batches undo encrypt().
+ *
+ *   ./test_modules_demux_arib_multi2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../modules/demux/arib/multi2.c"
+
+#define BATCH_MAX 40
+#define ITERATIONS 300
+
+static void random_bytes( uint8_t *p, size_t i )
+{
+    while( i-- > 0 )
+        *p++ = rand();
+}
+
+static void set_keys( MULTI2 *m2 )
+{
+    uint8_t system_key[32], cbc[8], scramble_key[16];
+
+    random_bytes( system_key, sizeof(system_key) );
+    random_bytes( cbc, sizeof(cbc) );
+    random_bytes( scramble_key, sizeof(scramble_key) );
+    m2->set_round( m2, 4 );
+    m2->set_system_key( m2, system_key );
+    m2->set_init_cbc( m2, cbc );
+    m2->set_scramble_key( m2, scramble_key );
+}
+
+/* Returns the number of mismatching payloads */
+static int check_batch( MULTI2 *m2, int32_t type, int32_t count )
+{
+    static uint8_t plain[BATCH_MAX][184], batch[BATCH_MAX][184],
+                   single[BATCH_MAX][184];
+    uint8_t *pp_buf[BATCH_MAX];
+    int32_t pi_size[BATCH_MAX];
+    int i_errors = 0;
+
+    for( int i = 0; i < count; i++ )
+    {
+        /* cover every residue length, and full TS payloads */
+        pi_size[i] = (rand() % 4) ? 1 + rand() % 184 : 184;
+        random_bytes( plain[i], pi_size[i] );
+        memcpy( batch[i], plain[i], pi_size[i] );
+        memcpy( single[i], plain[i], pi_size[i] );
+        pp_buf[i] = batch[i];
+        if( m2->decrypt( m2, type, single[i], pi_size[i] ) )
+            abort();
+    }
+
+    if( m2->decrypt_batch( m2, type, pp_buf, pi_size, count ) )
+        abort();
+
+    for( int i = 0; i < count; i++ )
+    {
+        if( memcmp( batch[i], single[i], pi_size[i] ) )
+        {
+            fprintf( stderr, "type %d, batch of %d, payload %d (%d bytes): "
+                     "batch and single decryption differ\n",
+                     type, count, i, pi_size[i] );
+            i_errors++;
+        }
+    }
+
+    /* encrypt() then decrypt_batch() gives the plain text back */
+    for( int i = 0; i < count; i++ )
+    {
+        memcpy( batch[i], plain[i], pi_size[i] );
+        if( m2->encrypt( m2, type, batch[i], pi_size[i] ) )
+            abort();
+    }
+    if( m2->decrypt_batch( m2, type, pp_buf, pi_size, count ) )
+        abort();
+    for( int i = 0; i < count; i++ )
+    {
+        if( memcmp( batch[i], plain[i], pi_size[i] ) )
+        {
+            fprintf( stderr, "type %d, batch of %d, payload %d (%d bytes): "
+                     "encryption not undone\n", type, count, i, pi_size[i] );
+            i_errors++;
+        }
+    }
+    return i_errors;
+}
+
+static int check_kernels( MULTI2 *m2, uint32_t i_simd, const char *psz_name )
+{
+    MULTI2_PRIVATE_DATA *prv = private_data( m2 );
+    int i_errors = 0;
+
+    if( ( prv->simd & i_simd ) != i_simd )
+    {
+        printf( "%s: not supported, skipped\n", psz_name );
+        return 0;
+    }
+
+    const uint32_t i_detected = prv->simd;
+    prv->simd = i_simd;
+    for( int n = 0; n < ITERATIONS; n++ )
+    {
+        if( n % 50 == 0 )
+            set_keys( m2 );
+        i_errors += check_batch( m2, 0x02, n % (BATCH_MAX + 1) );
+        i_errors += check_batch( m2, 0x03, rand() % (BATCH_MAX + 1) );
+    }
+    prv->simd = i_detected;
+
+    printf( "%s: %d errors\n", psz_name, i_errors );
+    return i_errors;
+}
+
+int main( void )
+{
+    MULTI2 *m2 = create_multi2();
+    int i_errors = 0;
+
+    if( !m2 )
+        return 1;
+    srand( 0 );
+    set_keys( m2 );
+
+    uint8_t buf[8] = { 0 };
+    uint8_t *p_buf = buf;
+    int32_t i_size = 8;
+    if( m2->decrypt_batch( m2, 0x02, &p_buf, &i_size, 0 )
+     || !m2->decrypt_batch( m2, 0x02, NULL, &i_size, 1 ) )
+    {
+        fprintf( stderr, "invalid parameters not handled\n" );
+        i_errors++;
+    }
+
+    i_errors += check_kernels( m2, 0, "scalar" );
+#if defined(MULTI2_HAVE_SSE2)
+    i_errors += check_kernels( m2, MULTI2_SIMD_SSE2, "sse2" );
+#endif
+#if defined(MULTI2_HAVE_AVX2)
+    i_errors += check_kernels( m2, MULTI2_SIMD_AVX2, "avx2" );
+    i_errors += check_kernels( m2, MULTI2_SIMD_AVX2 | MULTI2_SIMD_SSE2,
+                               "avx2+sse2" );
+#endif
+#if defined(MULTI2_HAVE_NEON)
+    i_errors += check_kernels( m2, MULTI2_SIMD_NEON, "neon" );
+#endif
+
+    m2->release( m2 );
+    return i_errors ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/*****************************************************************************
+ * arib_str.c: ARIB STD-B24 string decoder benchmark
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Collects the event names and texts of the EIT found in TS captures (PID
+ * 0x12, 0x26 and 0x27), then times their decoding:
+ *
+ *   ./test_modules_demux_arib_str capture1.ts [capture2.ts...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../../modules/demux/arib/str.c"
+
+#define ITERATIONS 20
+
+typedef struct
+{
+    const unsigned char *p;
+    size_t i;
+} string_t;
+
+static string_t *strings;
+static size_t i_strings, i_alloc;
+static size_t i_bytes;
+
+static void add_string( const unsigned char *p, size_t i )
+{
+    if( i == 0 )
+        return;
+    if( i_strings == i_alloc )
+    {
+        i_alloc = i_alloc ? 2 * i_alloc : 4096;
+        strings = realloc( strings, i_alloc * sizeof(*strings) );
+        if( !strings )
+            abort();
+    }
+
+    unsigned char *p_copy = malloc( i );
+    if( !p_copy )
+        abort();
+    memcpy( p_copy, p, i );
+    strings[i_strings].p = p_copy;
+    strings[i_strings].i = i;
+    i_strings++;
+    i_bytes += i;
+}
+
+static void parse_descriptors( const unsigned char *p, size_t i )
+{
+    while( i >= 2 && (size_t)p[1] + 2 <= i )
+    {
+        const unsigned char *d = &p[2];
+        const size_t i_d = p[1];
+
+        if( p[0] == 0x4d && i_d >= 4 && (size_t)4 + d[3] < i_d )
+        {
+            /* short event: name and text */
+            size_t i_name = d[3];
+            add_string( &d[4], i_name );
+            if( 5 + i_name + d[4 + i_name] <= i_d )
+                add_string( &d[5 + i_name], d[4 + i_name] );
+        }
+        else if( p[0] == 0x4e && i_d >= 5 && (size_t)5 + d[4] < i_d )
+        {
+            /* extended event: item descriptions, items and text */
+            const unsigned char *q = &d[5], *end = &d[5 + d[4]];
+            while( q < end && q + 1 + q[0] < end )
+            {
+                add_string( &q[1], q[0] );
+                q += 1 + q[0];
+                if( q + 1 + q[0] > end )
+                    break;
+                add_string( &q[1], q[0] );
+                q += 1 + q[0];
+            }
+            if( end + 1 + end[0] <= d + i_d )
+                add_string( &end[1], end[0] );
+        }
+        p += 2 + i_d;
+        i -= 2 + i_d;
+    }
+}
+
+static void parse_section( const unsigned char *p, size_t i )
+{
+    if( i < 14 + 4 || p[0] < 0x4e || p[0] > 0x6f )
+        return;
+
+    i -= 4; /* CRC */
+    size_t i_pos = 14;
+    while( i_pos + 12 <= i )
+    {
+        const size_t i_loop = ((p[i_pos + 10] & 0x0f) << 8) | p[i_pos + 11];
+        if( i_pos + 12 + i_loop > i )
+            break;
+        parse_descriptors( &p[i_pos + 12], i_loop );
+        i_pos += 12 + i_loop;
+    }
+}
+
+/* Reassembles the sections of the EIT PIDs */
+static void parse_file( const char *psz_path )
+{
+    FILE *f = fopen( psz_path, "rb" );
+    if( !f )
+    {
+        perror( psz_path );
+        return;
+    }
+
+    static unsigned char sections[3][4096 + 188];
+    size_t i_section[3] = { 0, 0, 0 };
+    unsigned char pkt[188];
+
+    while( fread( pkt, 1, 188, f ) == 188 )
+    {
+        const int i_pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        int i_eit;
+
+        if( pkt[0] != 0x47 )
+        {
+            fprintf( stderr, "%s: lost sync\n", psz_path );
+            break;
+        }
+        if( i_pid == 0x12 )
+            i_eit = 0;
+        else if( i_pid == 0x26 || i_pid == 0x27 )
+            i_eit = i_pid - 0x25;
+        else
+            continue;
+
+        size_t i_pos = 4;
+        if( pkt[3] & 0x20 )
+            i_pos += 1 + pkt[4];
+        if( !( pkt[3] & 0x10 ) || i_pos >= 188 )
+            continue;
+
+        unsigned char *s = sections[i_eit];
+        if( pkt[1] & 0x40 )
+        {
+            const size_t i_pointer = pkt[i_pos++];
+            if( i_pos + i_pointer > 188 )
+                continue;
+            /* end of the previous section */
+            if( i_section[i_eit] > 0 )
+            {
+                memcpy( &s[i_section[i_eit]], &pkt[i_pos], i_pointer );
+                i_section[i_eit] += i_pointer;
+                parse_section( s, i_section[i_eit] );
+            }
+            i_pos += i_pointer;
+            i_section[i_eit] = 0;
+
+            /* sections starting in this packet */
+            while( i_pos + 3 <= 188 && pkt[i_pos] != 0xff )
+            {
+                const size_t i_length = 3 + (((pkt[i_pos + 1] & 0x0f) << 8) |
+                                             pkt[i_pos + 2]);
+                if( i_pos + i_length > 188 )
+                {
+                    memcpy( s, &pkt[i_pos], 188 - i_pos );
+                    i_section[i_eit] = 188 - i_pos;
+                    break;
+                }
+                parse_section( &pkt[i_pos], i_length );
+                i_pos += i_length;
+            }
+        }
+        else if( i_section[i_eit] > 0 && i_section[i_eit] <= 4096 )
+        {
+            memcpy( &s[i_section[i_eit]], &pkt[i_pos], 188 - i_pos );
+            i_section[i_eit] += 188 - i_pos;
+
+            const size_t i_length = 3 + (((s[1] & 0x0f) << 8) | s[2]);
+            if( i_section[i_eit] >= i_length )
+            {
+                parse_section( s, i_length );
+                i_section[i_eit] = 0;
+            }
+        }
+    }
+    fclose( f );
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc < 2 )
+    {
+        fprintf( stderr, "usage: %s <file.ts>...\n", argv[0] );
+        return 77; /* skipped */
+    }
+
+    for( int i = 1; i < argc; i++ )
+        parse_file( argv[i] );
+
+    if( i_strings == 0 )
+    {
+        fprintf( stderr, "no EIT strings found\n" );
+        return 77;
+    }
+
+    static char out[ARIB_STR_MAX(255)];
+    size_t i_out = 0;
+    const double f_start = now();
+    for( int n = 0; n < ITERATIONS; n++ )
+        for( size_t i = 0; i < i_strings; i++ )
+            i_out += arib_str_decode( strings[i].p, strings[i].i, out,
+                                      sizeof(out) );
+    const double f_duration = now() - f_start;
+
+    printf( "%zu strings, %zu bytes, %zu bytes decoded in %.3f s: "
+            "%.0f strings/s, %.1f MB/s\n", i_strings, i_bytes,
+            i_out / ITERATIONS, f_duration,
+            ITERATIONS * i_strings / f_duration,
+            ITERATIONS * i_bytes / f_duration / 1e6 );
+
+    for( size_t i = 0; i < i_strings; i++ )
+        free( (void *)strings[i].p );
+    free( strings );
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*****************************************************************************
+ * arib_str_decode.c: ARIB STD-B24 string decoder test
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Decodes fixed ARIB strings and compares the result with the UTF-8 output
+ * of the function pointer based decoder which the table driven one
+ * replaced, except for:
+ *  - designations of a set which is already invoked, which now take effect
+ *    at once as STD-B24 specifies ("G0 designations while invoked", "G2
+ *    designation", "G0 final bytes");
+ *  - DEL, which was written as the overlong sequence C1 BF.
+ *
+ * The decoder stops at the first code it does not handle, and before a
+ * character which does not fit in the output. DRCS are not supported: their
+ * designation stops the decoding.
+ *
+ *   ./test_modules_demux_arib_str_decode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../modules/demux/arib/str.c"
+
+static const struct
+{
+    const char *psz_name;
+    const char *psz_in;
+    const char *psz_out;
+    int i_out_max; /* output buffer size, 0 for ARIB_STR_MAX() */
+} tests[] = {
+    { "alphanumeric (LS1)",
+      "\x0e\x48\x65\x6c\x6c\x6f\x2c\x20\x41\x52\x49\x42\x21",
+      "\x48\x65\x6c\x6c\x6f\x2c\x20\x41\x52\x49\x42\x21", 0 }, /* "Hello, ARIB!" */
+    { "alphanumeric yen sign and overline",
+      "\x0e\x61\x5c\x62\x7e\x63\x7d\x7b",
+      "\x61\xc2\xa5\x62\xe2\x80\xbe\x63\x7d\x7b", 0 }, /* "a¥b‾c}{" */
+    { "kanji (default G0 in GL)",
+      "\x34\x41\x3b\x7a\x46\x7c\x4b\x5c",
+      "\xe6\xbc\xa2\xe5\xad\x97\xe6\x97\xa5\xe6\x9c\xac", 0 }, /* "漢字日本" */
+    { "hiragana (default G2 in GR)",
+      "\xa2\xa4\xa6\xf3",
+      "\xe3\x81\x82\xe3\x81\x84\xe3\x81\x86\xe3\x82\x93", 0 }, /* "あいうん" */
+    { "katakana (SS3)",
+      "\x1d\x22\x1d\x24\x34\x41",
+      "\xe3\x82\xa2\xe3\x82\xa4\xe6\xbc\xa2", 0 }, /* "アイ漢" */
+    { "hiragana (SS2), then LS1",
+      "\x19\x22\x0e\x41",
+      "\xe3\x81\x82\x41", 0 }, /* "あA" */
+    { "katakana (LS3R)",
+      "\x1b\x7c\xa2\xa4\xa6",
+      "\xe3\x82\xa2\xe3\x82\xa4\xe3\x82\xa6", 0 }, /* "アイウ" */
+    { "LS2, LS3 and LS0",
+      "\x1b\x6e\x22\x24\x1b\x6f\x22\x24\x0f\x34\x41",
+      "\xe3\x81\x82\xe3\x81\x84\xe3\x82\xa2\xe3\x82\xa4\xe6\xbc\xa2", 0 }, /* "あいアイ漢" */
+    { "LS1R and LS2R",
+      "\x1b\x7e\xc1\xc2\x1b\x7d\xa2",
+      "\x41\x42\xe3\x81\x82", 0 }, /* "ABあ" */
+    { "G0 designations while invoked",
+      "\x1b\x28\x4a\x56\x4c\x43\x1b\x24\x42\x34\x41",
+      "\x56\x4c\x43\xe6\xbc\xa2", 0 }, /* "VLC漢" */
+    { "G1 designation",
+      "\x1b\x29\x30\x0e\x22\x24\x0f\x46\x7c",
+      "\xe3\x81\x82\xe3\x81\x84\xe6\x97\xa5", 0 }, /* "あい日" */
+    { "G1 2-byte designation",
+      "\x1b\x24\x29\x42\x0e\x34\x41",
+      "\xe6\xbc\xa2", 0 }, /* "漢" */
+    { "G2 designation",
+      "\x1b\x2a\x31\x19\x22\xa2",
+      "\xe3\x82\xa2\xe3\x82\xa2", 0 }, /* "アア" */
+    { "G3 designation",
+      "\x1b\x2b\x30\x1b\x7c\xa2\x1d\x24",
+      "\xe3\x81\x82\xe3\x81\x84", 0 }, /* "あい" */
+    { "G0 final bytes",
+      "\x1b\x28\x31\x22\x1b\x28\x39\x34\x41\x1b\x28\x3b\x34\x41",
+      "\xe3\x82\xa2\xe6\xbc\xa2\xe6\xbc\xa2", 0 }, /* "ア漢漢" */
+    { "CR, SP and DEL",
+      "\x0e\x61\x0d\x62\x20\x0f\x20\x7f",
+      "\x61\x0d\x62\x20\x20\x7f", 0 }, /* "a\rb  DEL" */
+    { "character size controls",
+      "\x0e\x61\x89\x62\x8a\x88\x63",
+      "\x61\x62\x63", 0 }, /* "abc" */
+    { "additional symbols (gaiji)",
+      "\x7a\x50\x7a\x56\x7b\x21\x7c\x21\x7d\x21\x7e\x21\x7e\x41\x7e\x7d",
+      "\xf0\x9f\x85\x8a\xf0\x9f\x88\x91\xe2\x9b\xa3\xe2\x9e\xa1\xe3\x88\xaa\xe2\x85\xa0\xf0\x9f\x84\x90\xe3\x89\x9b", 0 }, /* "🅊🈑⛣➡㈪Ⅰ🄐㉛" */
+    { "unknown C0 control",
+      "\x0e\x61\x07\x62",
+      "\x61", 0 }, /* "a" */
+    { "invalid GR code",
+      "\xa2\xa0\xa4",
+      "\xe3\x81\x82", 0 }, /* "あ" */
+    { "DRCS designation",
+      "\x0e\x61\x1b\x28\x20\x41\x21",
+      "\x61", 0 }, /* "a" */
+    { "truncated escape",
+      "\x0e\x61\x1b",
+      "\x61", 0 }, /* "a" */
+    { "unknown C1 control",
+      "\x0e\x61\x90\x62",
+      "\x61", 0 }, /* "a" */
+    { "output full, alphanumeric",
+      "\x0e\x48\x65\x6c\x6c\x6f\x2c\x20\x41\x52\x49\x42\x21",
+      "\x48\x65\x6c\x6c\x6f\x2c\x20", 7 }, /* "Hello, " */
+    { "output full, kanji",
+      "\x34\x41\x3b\x7a\x46\x7c\x4b\x5c",
+      "\xe6\xbc\xa2\xe5\xad\x97", 7 }, /* "漢字" */
+    { "output full, 4 byte symbol",
+      "\x0e\x61\x0f\x7e\x41",
+      "\x61", 4 }, /* "a" */
+};
+
+int main( void )
+{
+    int i_errors = 0;
+
+    for( size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++ )
+    {
+        const size_t i_in = strlen( tests[i].psz_in );
+        const size_t i_expected = strlen( tests[i].psz_out );
+        char out[ARIB_STR_MAX(64) + 1];
+        int i_out_max = tests[i].i_out_max;
+
+        if( i_out_max == 0 )
+            i_out_max = ARIB_STR_MAX(i_in);
+        memset( out, 0xff, sizeof(out) );
+
+        const int i_out = arib_str_decode(
+                (const unsigned char *)tests[i].psz_in, i_in, out, i_out_max );
+
+        if( i_out < 0 || (size_t)i_out != i_expected ||
+            memcmp( out, tests[i].psz_out, i_expected ) )
+        {
+            fprintf( stderr, "%s: got %d bytes:", tests[i].psz_name, i_out );
+            for( int j = 0; j < i_out && j < i_out_max; j++ )
+                fprintf( stderr, " %02x", (unsigned char)out[j] );
+            fprintf( stderr, ", expected %zu bytes\n", i_expected );
+            i_errors++;
+        }
+        else if( (unsigned char)out[i_out_max] != 0xff )
+        {
+            fprintf( stderr, "%s: output buffer overflow\n",
+                     tests[i].psz_name );
+            i_errors++;
+        }
+    }
+
+    printf( "%zu strings, %d errors\n", sizeof(tests) / sizeof(tests[0]),
+            i_errors );
+    return i_errors ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/*****************************************************************************
+ * ts_rs.c: Reed-Solomon (204,188) decoder test and benchmark
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Encodes random packets, damages up to 8 bytes of each and checks that
+ * ts_rs_Correct() restores them, that packets with more errors are not
+ * "repaired" into other packets, then times intact and damaged packets:
+ *
+ *   ./test_modules_demux_ts_rs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../../modules/demux/ts_rs.c"
+
+#define PACKETS 20000
+
+static void encode( const ts_rs_t *rs, uint8_t *p )
+{
+    uint64_t hi, lo;
+
+    p[0] = 0x47;
+    for( int i = 1; i < 188; i++ )
+        p[i] = rand();
+    /* the parity is the remainder of the packet times x^16 */
+    memset( &p[188], 0, 16 );
+    Remainder( rs, p, TS_RS_PACKET_SIZE, &hi, &lo );
+    for( int i = 0; i < 8; i++ )
+    {
+        p[188 + i] = hi >> (8 * (7 - i));
+        p[196 + i] = lo >> (8 * (7 - i));
+    }
+}
+
+/* Damages n distinct bytes */
+static void damage( uint8_t *p, int n )
+{
+    bool pb_done[TS_RS_PACKET_SIZE] = { false };
+
+    while( n > 0 )
+    {
+        const int i = rand() % TS_RS_PACKET_SIZE;
+        if( pb_done[i] )
+            continue;
+        pb_done[i] = true;
+        p[i] ^= 1 + rand() % 255;
+        n--;
+    }
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( void )
+{
+    static uint8_t packets[PACKETS][TS_RS_PACKET_SIZE];
+    static uint8_t originals[PACKETS][TS_RS_PACKET_SIZE];
+    ts_rs_t *rs = ts_rs_New();
+    if( !rs )
+        return 1;
+
+    srand( 0 );
+    for( int n = 0; n < PACKETS; n++ )
+    {
+        encode( rs, originals[n] );
+        memcpy( packets[n], originals[n], TS_RS_PACKET_SIZE );
+    }
+
+    double f_start = now();
+    for( int n = 0; n < PACKETS; n++ )
+        if( ts_rs_Correct( rs, packets[n] ) != 0 )
+        {
+            fprintf( stderr, "packet %d: intact packet not recognized\n", n );
+            return 1;
+        }
+    const double f_intact = now() - f_start;
+
+    /* Within the capacity of the code */
+    double f_damaged = 0.;
+    for( int n = 0; n < PACKETS; n++ )
+    {
+        const int i_errors = 1 + n % 8;
+        damage( packets[n], i_errors );
+
+        f_start = now();
+        const int i_ret = ts_rs_Correct( rs, packets[n] );
+        f_damaged += now() - f_start;
+
+        if( i_ret != i_errors ||
+            memcmp( packets[n], originals[n], TS_RS_PACKET_SIZE ) )
+        {
+            fprintf( stderr, "packet %d: %d errors, returned %d\n", n,
+                     i_errors, i_ret );
+            return 1;
+        }
+    }
+
+    /* Beyond: the packet must be reported or, rarely, decoded into another
+     * codeword, never altered into something else */
+    int i_uncorrectable = 0, i_miscorrected = 0;
+    for( int n = 0; n < PACKETS; n++ )
+    {
+        damage( packets[n], 9 + n % 8 );
+
+        uint8_t copy[TS_RS_PACKET_SIZE];
+        memcpy( copy, packets[n], TS_RS_PACKET_SIZE );
+        const int i_ret = ts_rs_Correct( rs, packets[n] );
+        if( i_ret < 0 )
+        {
+            if( memcmp( copy, packets[n], TS_RS_PACKET_SIZE ) )
+            {
+                fprintf( stderr, "packet %d: altered but reported\n", n );
+                return 1;
+            }
+            i_uncorrectable++;
+        }
+        else
+        {
+            if( ts_rs_Correct( rs, packets[n] ) != 0 )
+            {
+                fprintf( stderr, "packet %d: not a codeword\n", n );
+                return 1;
+            }
+            i_miscorrected++;
+        }
+    }
+
+    printf( "%d packets: intact %.0f packets/s, 1 to 8 errors %.0f packets/s, "
+            "9 to 16 errors %d reported %d miscorrected\n", PACKETS,
+            PACKETS / f_intact, PACKETS / f_damaged, i_uncorrectable,
+            i_miscorrected );
+    ts_rs_Delete( rs );
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*****************************************************************************
+ * ts_sync.c: TS sync byte search test and benchmark
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Checks ts_sync_Find() against a byte by byte search on packets of random
+ * sizes mixed with random garbage, then times both:
+ *
+ *   ./test_modules_demux_ts_sync
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../../modules/demux/ts_sync.c"
+
+#define BUFFERS 2000
+#define LOCK 5
+
+static const unsigned sizes[] = { 188, 192, 204 };
+
+static int reference( const uint8_t *p, size_t i_buffer, size_t i_max,
+                      unsigned *pi_found )
+{
+    for( size_t i = 0; i < i_max; i++ )
+        for( unsigned s = 0; s < 3; s++ )
+        {
+            unsigned k = 0;
+            while( k < LOCK && i + k * sizes[s] < i_buffer &&
+                   p[i + k * sizes[s]] == 0x47 )
+                k++;
+            if( k == LOCK )
+            {
+                *pi_found = s;
+                return i;
+            }
+        }
+    return -1;
+}
+
+/* Garbage, with stray sync bytes, followed by packets of a random size */
+static size_t fill( uint8_t *p, size_t i_buffer )
+{
+    size_t i_garbage = rand() % i_buffer;
+    const unsigned i_size = sizes[rand() % 3];
+
+    for( size_t i = 0; i < i_buffer; i++ )
+        p[i] = (rand() % 16) ? rand() : 0x47;
+    for( size_t i = i_garbage; i < i_buffer; i += i_size )
+        p[i] = 0x47;
+    return i_garbage;
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( void )
+{
+    static uint8_t buffers[BUFFERS][TS_SYNC_WINDOW];
+    int pi_expected[BUFFERS];
+    unsigned pi_size[BUFFERS];
+    double f_reference = 0., f_sync = 0.;
+
+    srand( 0 );
+    for( int n = 0; n < BUFFERS; n++ )
+    {
+        const size_t i_buffer = 1 + rand() % TS_SYNC_WINDOW;
+        const size_t i_max = 1 + rand() % i_buffer;
+
+        fill( buffers[n], i_buffer );
+
+        double f_start = now();
+        pi_expected[n] = reference( buffers[n], i_buffer, i_max, &pi_size[n] );
+        f_reference += now() - f_start;
+
+        unsigned i_found = 0;
+        f_start = now();
+        const int i_pos = ts_sync_Find( buffers[n], i_buffer, i_max, sizes, 3,
+                                        LOCK, &i_found );
+        f_sync += now() - f_start;
+
+        if( i_pos != pi_expected[n] ||
+            ( i_pos >= 0 && i_found != pi_size[n] ) )
+        {
+            fprintf( stderr, "buffer %d (%zu bytes, max %zu): found %d/%u "
+                     "instead of %d/%u\n", n, i_buffer, i_max, i_pos,
+                     i_found, pi_expected[n], pi_size[n] );
+            return 1;
+        }
+    }
+
+    printf( "%d buffers: byte by byte %.3f s, ts_sync_Find %.3f s\n",
+            BUFFERS, f_reference, f_sync );
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*****************************************************************************
+ * csa.c: CSA batch descrambling test
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Checks that csa_DecryptBatch() gives byte for byte the output of
+ * csa_Decrypt() on each packet, for random keys, clear, even and odd
+ * packets, adaptation fields of any length and partial packet sizes, in
+ * batches around the lane count. Also checks that batches undo
+ * csa_Encrypt().
+ *
+ * Runs the 64 bits kernel, then the 128 and 256 bits ones when the CPU
+ * supports them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../../modules/mux/mpeg/csa.c"
+
+#define BATCH_MAX (2 * CSA_BATCH_MAX + 3)
+#define ITERATIONS 400
+
+static void random_bytes( uint8_t *p, size_t i )
+{
+    while( i-- > 0 )
+        *p++ = rand();
+}
+
+static void set_keys( csa_t *c )
+{
+    random_bytes( c->o_ck, 8 );
+    random_bytes( c->e_ck, 8 );
+    csa_ComputeKey( c->o_kk, c->o_ck );
+    csa_ComputeKey( c->e_kk, c->e_ck );
+}
+
+static void random_packet( uint8_t *pkt )
+{
+    random_bytes( pkt, 188 );
+    pkt[0] = 0x47;
+
+    /* clear, reserved, even and odd scrambling control */
+    pkt[3] &= 0x3f;
+    pkt[3] |= ( rand() % 4 ) << 6;
+
+    pkt[3] &= ~0x20;
+    if( rand() % 2 )
+    {
+        pkt[3] |= 0x20;
+        switch( rand() % 4 )
+        {
+            case 0: /* leaves less than a block, or nothing */
+                pkt[4] = 176 + rand() % 8;
+                break;
+            case 1: /* invalid, past the end of the packet */
+                pkt[4] = 184 + rand() % 72;
+                break;
+            default:
+                pkt[4] = rand() % 176;
+                break;
+        }
+    }
+}
+
+/* Returns the number of mismatching packets */
+static int check_batch( csa_t *c, int i_pkt, int i_pkt_size )
+{
+    static uint8_t plain[BATCH_MAX][188], batch[BATCH_MAX][188],
+                   single[BATCH_MAX][188];
+    uint8_t *pp_pkt[BATCH_MAX];
+    int i_errors = 0;
+
+    for( int i = 0; i < i_pkt; i++ )
+    {
+        random_packet( plain[i] );
+        memcpy( batch[i], plain[i], 188 );
+        memcpy( single[i], plain[i], 188 );
+        pp_pkt[i] = batch[i];
+        csa_Decrypt( c, single[i], i_pkt_size );
+    }
+
+    csa_DecryptBatch( c, pp_pkt, i_pkt, i_pkt_size );
+
+    for( int i = 0; i < i_pkt; i++ )
+    {
+        if( memcmp( batch[i], single[i], 188 ) )
+        {
+            fprintf( stderr, "batch of %d, packet %d (%d bytes, control "
+                     "%02x, adaptation field %d): batch and single "
+                     "descrambling differ\n", i_pkt, i, i_pkt_size,
+                     plain[i][3] & 0xe0, plain[i][3] & 0x20 ? plain[i][4] : -1 );
+            i_errors++;
+        }
+    }
+
+    /* csa_Encrypt() then csa_DecryptBatch() gives the packets back */
+    for( int i = 0; i < i_pkt; i++ )
+    {
+        plain[i][3] &= ~0x20;
+        if( rand() % 2 )
+        {
+            plain[i][3] |= 0x20;
+            plain[i][4] = rand() % 176;
+        }
+        plain[i][3] &= 0x3f;
+        memcpy( batch[i], plain[i], 188 );
+
+        c->use_odd = rand() % 2;
+        csa_Encrypt( c, batch[i], 188 );
+    }
+    csa_DecryptBatch( c, pp_pkt, i_pkt, 188 );
+    for( int i = 0; i < i_pkt; i++ )
+    {
+        if( memcmp( batch[i], plain[i], 188 ) )
+        {
+            fprintf( stderr, "batch of %d, packet %d: scrambling not undone\n",
+                     i_pkt, i );
+            i_errors++;
+        }
+    }
+    return i_errors;
+}
+
+/* Returns the number of mismatching packets, with the kernel of i_width
+ * bits forced */
+static int check_kernel( csa_t *c, unsigned i_simd, int i_width )
+{
+    int i_errors = 0;
+
+    if( ( c->simd & i_simd ) != i_simd )
+    {
+        printf( "%d bit words: not supported, skipped\n", i_width );
+        return 0;
+    }
+
+    const unsigned i_detected = c->simd;
+    c->simd = i_simd;
+    srand( i_width );
+
+    for( int n = 0; n < ITERATIONS; n++ )
+    {
+        if( n % 50 == 0 )
+            set_keys( c );
+
+        /* full packets, and partial sizes down to the header */
+        const int i_pkt_size = n % 2 ? 188 : 4 + rand() % 185;
+        i_errors += check_batch( c, n % (2 * i_width + 4), i_pkt_size );
+    }
+    c->simd = i_detected;
+
+    printf( "%d bit words: %d errors\n", i_width, i_errors );
+    return i_errors;
+}
+
+int main( void )
+{
+    csa_t *c = csa_New();
+    int i_errors = 0;
+
+    if( !c )
+        return 1;
+
+    i_errors += check_kernel( c, 0, 64 );
+#if defined(CSA_HAVE_SSE2)
+    i_errors += check_kernel( c, CSA_SIMD_SSE2, 128 );
+#endif
+#if defined(CSA_HAVE_AVX2)
+    i_errors += check_kernel( c, CSA_SIMD_AVX2 | CSA_SIMD_SSE2, 256 );
+#endif
+
+    csa_Delete( c );
+    return i_errors ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/*****************************************************************************
+ * demux_ts.c: TS demuxer throughput benchmark
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Replays recorded multiplexes through the TS demuxer as fast as possible
+ * and reports packets per second. Elementary streams are dropped by the
+ * dummy stream output, so mostly the demuxer itself is measured:
+ *
+ *   ./test_src_input_demux_ts capture1.ts [capture2.ts...]
+ */
+
+#include "../../libvlc/test.h"
+
+#include <sys/stat.h>
+
+static const char *bench_args[] = {
+    "--ignore-config",
+    "-I",
+    "dummy",
+    "--no-media-library",
+    "--demux=ts",
+    "--sout=#dummy",
+};
+
+/* Finds the stride of the sync bytes as the demuxer does, so that 192 bytes
+ * (M2TS/TTS) and 204 bytes recordings are counted right */
+static int packet_size( const char *psz_path )
+{
+    static const int pi_sizes[] = { 188, 192, 204 };
+    unsigned char buf[8 * 204 * 2];
+
+    FILE *f = fopen( psz_path, "rb" );
+    if( !f )
+        return -1;
+    const size_t i_buf = fread( buf, 1, sizeof(buf), f );
+    fclose( f );
+
+    for( size_t i = 0; i < sizeof(pi_sizes) / sizeof(pi_sizes[0]); i++ )
+    {
+        const size_t i_size = pi_sizes[i];
+        for( size_t i_offset = 0; i_offset < i_size; i_offset++ )
+        {
+            size_t i_pos = i_offset;
+            unsigned i_sync = 0;
+            while( i_pos < i_buf && buf[i_pos] == 0x47 )
+            {
+                i_pos += i_size;
+                i_sync++;
+            }
+            if( i_pos >= i_buf && i_sync >= 4 )
+                return i_size;
+        }
+    }
+    return 188;
+}
+
+static int bench( libvlc_instance_t *vlc, const char *psz_path )
+{
+    struct stat st;
+    if( stat( psz_path, &st ) )
+    {
+        perror( psz_path );
+        return -1;
+    }
+    const int i_packet_size = packet_size( psz_path );
+    if( i_packet_size < 0 )
+    {
+        perror( psz_path );
+        return -1;
+    }
+
+    libvlc_media_t *md = libvlc_media_new_path( vlc, psz_path );
+    assert( md != NULL );
+    libvlc_media_player_t *mp = libvlc_media_player_new_from_media( md );
+    assert( mp != NULL );
+    libvlc_media_release( md );
+
+    const int64_t i_start = libvlc_clock();
+    libvlc_media_player_play( mp );
+
+    libvlc_state_t state;
+    do
+    {
+        usleep( 10000 );
+        state = libvlc_media_player_get_state( mp );
+    } while( state != libvlc_Ended && state != libvlc_Error );
+
+    const int64_t i_duration = libvlc_clock() - i_start;
+    libvlc_media_player_stop( mp );
+    libvlc_media_player_release( mp );
+
+    if( state == libvlc_Error || i_duration <= 0 )
+    {
+        log( "%s: playback error\n", psz_path );
+        return -1;
+    }
+
+    const double f_packets = (double)st.st_size / i_packet_size;
+    log( "%s: %.0f packets of %d bytes in %.3f s, %.0f packets/s\n",
+         psz_path, f_packets, i_packet_size, i_duration / 1e6,
+         f_packets * 1e6 / i_duration );
+    return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc < 2 )
+    {
+        log( "usage: %s <file.ts>...\n", argv[0] );
+        return 77; /* skipped */
+    }
+
+    setenv( "VLC_PLUGIN_PATH", "../modules", 1 );
+
+    libvlc_instance_t *vlc = libvlc_new( sizeof(bench_args) / sizeof(bench_args[0]),
+                                         bench_args );
+    assert( vlc != NULL );
+
+    int i_ret = 0;
+    for( int i = 1; i < argc; i++ )
+        if( bench( vlc, argv[i] ) )
+            i_ret = 1;
+
+    libvlc_release( vlc );
+    return i_ret;
+}
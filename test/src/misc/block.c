@@ -0,0 +1,183 @@
+/*****************************************************************************
+ * block.c: block_Alloc() pool and block_fifo_t benchmark
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Each stream is a producer thread allocating blocks with the sizes of UDP
+ * datagrams, TS packets and PES, and a consumer thread releasing them, as
+ * an access and a decoder would. The same load is run with a plain malloc()
+ * per block, with block_Alloc(), then with block_Alloc() and the single
+ * producer/single consumer fifo:
+ *
+ *   ./test_src_misc_block [streams] [blocks per stream]
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+#define CHAIN 32
+
+static void MallocRelease( block_t *b )
+{
+    free( b );
+}
+
+/* block_Alloc() without the pool */
+static block_t *MallocAlloc( size_t size )
+{
+    block_t *b = malloc( sizeof(*b) + 96 + size );
+    if( !b )
+        return NULL;
+    block_Init( b, b + 1, 96 + size );
+    b->p_buffer += 32;
+    b->i_buffer = size;
+    b->pf_release = MallocRelease;
+    return b;
+}
+
+typedef struct
+{
+    block_t *(*pf_alloc)( size_t );
+    block_fifo_t *p_fifo;
+    unsigned i_blocks;
+    unsigned i_seed;
+} stream_bench_t;
+
+static size_t NextSize( unsigned *pi_seed )
+{
+    const unsigned r = rand_r( pi_seed ) % 100;
+    if( r < 60 )
+        return 188;
+    if( r < 90 )
+        return 7 * 188;
+    return 2048 + rand_r( pi_seed ) % 61440;
+}
+
+static void *Producer( void *data )
+{
+    stream_bench_t *p_bench = data;
+
+    for( unsigned i = 0; i < p_bench->i_blocks; i += CHAIN )
+    {
+        block_t *p_chain = NULL, **pp_last = &p_chain;
+
+        for( unsigned j = 0; j < CHAIN; j++ )
+        {
+            block_t *b = p_bench->pf_alloc( NextSize( &p_bench->i_seed ) );
+            if( !b )
+                abort();
+            b->p_buffer[0] = j;
+            block_ChainLastAppend( &pp_last, b );
+        }
+        /* Keep a few chains in flight, as a FIFO would */
+        block_FifoPace( p_bench->p_fifo, 8, SIZE_MAX );
+        block_FifoPut( p_bench->p_fifo, p_chain );
+    }
+    return NULL;
+}
+
+static void *Consumer( void *data )
+{
+    stream_bench_t *p_bench = data;
+
+    for( unsigned i = 0; i < p_bench->i_blocks; )
+    {
+        block_t *b = block_FifoGet( p_bench->p_fifo );
+        i++;
+        block_Release( b );
+    }
+    return NULL;
+}
+
+static double Run( block_t *(*pf_alloc)( size_t ),
+                   block_fifo_t *(*pf_fifo)( void ), unsigned i_streams,
+                   unsigned i_blocks )
+{
+    stream_bench_t bench[i_streams];
+    vlc_thread_t producers[i_streams], consumers[i_streams];
+
+    const mtime_t i_start = mdate();
+    for( unsigned i = 0; i < i_streams; i++ )
+    {
+        bench[i].pf_alloc = pf_alloc;
+        bench[i].p_fifo = pf_fifo();
+        bench[i].i_blocks = i_blocks;
+        bench[i].i_seed = i;
+        if( !bench[i].p_fifo
+         || vlc_clone( &consumers[i], Consumer, &bench[i],
+                       VLC_THREAD_PRIORITY_LOW )
+         || vlc_clone( &producers[i], Producer, &bench[i],
+                       VLC_THREAD_PRIORITY_LOW ) )
+            abort();
+    }
+    for( unsigned i = 0; i < i_streams; i++ )
+    {
+        vlc_join( producers[i], NULL );
+        vlc_join( consumers[i], NULL );
+        block_FifoRelease( bench[i].p_fifo );
+    }
+    return (mdate() - i_start) / (double)CLOCK_FREQ;
+}
+
+int main( int argc, char *argv[] )
+{
+    const unsigned i_streams = argc > 1 ? strtoul( argv[1], NULL, 0 ) : 4;
+    const unsigned i_blocks = argc > 2 ? strtoul( argv[2], NULL, 0 )
+                                       : 1000000;
+    if( i_streams == 0 || i_streams > 64 || i_blocks < CHAIN )
+    {
+        fprintf( stderr, "usage: %s [streams] [blocks per stream]\n",
+                 argv[0] );
+        return 1;
+    }
+    const unsigned i_total = i_streams * (i_blocks / CHAIN * CHAIN);
+
+    const double f_malloc = Run( MallocAlloc, block_FifoNew, i_streams,
+                                 i_blocks );
+    printf( "malloc: %u blocks in %.3f s, %.2f Mblocks/s\n",
+            i_total, f_malloc, i_total / f_malloc / 1e6 );
+
+    const double f_pool = Run( block_Alloc, block_FifoNew, i_streams,
+                               i_blocks );
+    printf( "pool:   %u blocks in %.3f s, %.2f Mblocks/s (%+.0f%%)\n",
+            i_total, f_pool, i_total / f_pool / 1e6,
+            100. * (f_malloc / f_pool - 1.) );
+
+    const double f_spsc = Run( block_Alloc, block_FifoNewSPSC, i_streams,
+                               i_blocks );
+    printf( "spsc:   %u blocks in %.3f s, %.2f Mblocks/s (%+.0f%%)\n",
+            i_total, f_spsc, i_total / f_spsc / 1e6,
+            100. * (f_pool / f_spsc - 1.) );
+
+    block_pool_stats_t stats;
+    block_PoolGetStats( &stats );
+    printf( "pool: %"PRIu64" hits, %"PRIu64" recycled, %"PRIu64" refilled, "
+            "%"PRIu64" spilled, %"PRIu64" mallocs, %"PRIu64" frees, "
+            "%"PRIu64" oversized, %zu KiB pooled\n",
+            stats.i_hits, stats.i_recycled, stats.i_refilled,
+            stats.i_spilled, stats.i_mallocs, stats.i_frees,
+            stats.i_oversized, stats.i_pooled / 1024 );
+    return 0;
+}
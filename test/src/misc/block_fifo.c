@@ -0,0 +1,248 @@
+/*****************************************************************************
+ * block_fifo.c: single producer/single consumer block_fifo_t stress test
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Queues numbered blocks from the main thread to a consumer thread through
+ * block_FifoNewSPSC(), with single blocks, chains and bursts larger than
+ * the ring, which go through the locked overflow list. Checks that every
+ * block comes out once, in order, with its size, while the producer paces,
+ * wakes and empties the queue. Also checks that pacing bounds the depth,
+ * that blocks queued while the overflow list drains stay behind it, and that
+ * a consumer cancelled while parked leaves a usable queue.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+#define BLOCKS    2000000
+#define BURST     6000 /* more than the ring slots */
+#define LAST      UINT64_MAX
+
+static block_fifo_t *p_fifo;
+
+typedef struct
+{
+    bool     b_gapless; /* no block_FifoEmpty() */
+    uint64_t i_received;
+    uint64_t i_wakes;
+} consumer_t;
+
+static void Fail( const char *psz_msg, uint64_t v, uint64_t i_last )
+{
+    fprintf( stderr, "%s: block %"PRIu64" after %"PRIu64"\n", psz_msg, v,
+             i_last );
+    abort();
+}
+
+static size_t BlockSize( uint64_t v )
+{
+    return sizeof(v) + v % 300;
+}
+
+static block_t *BlockNew( uint64_t v )
+{
+    block_t *b = block_Alloc( v == LAST ? sizeof(v) : BlockSize( v ) );
+    if( !b )
+        abort();
+    memcpy( b->p_buffer, &v, sizeof(v) );
+    return b;
+}
+
+static void *Consumer( void *data )
+{
+    consumer_t *p_consumer = data;
+    uint64_t i_last = 0;
+
+    for( ;; )
+    {
+        block_t *b = block_FifoGet( p_fifo );
+        if( b == NULL )
+        {
+            p_consumer->i_wakes++;
+            continue;
+        }
+
+        uint64_t v;
+        const size_t i_buffer = b->i_buffer;
+        memcpy( &v, b->p_buffer, sizeof(v) );
+        block_Release( b );
+        if( v == LAST )
+            break;
+
+        if( v <= i_last )
+            Fail( "out of order", v, i_last );
+        if( p_consumer->b_gapless && v != i_last + 1 )
+            Fail( "lost", v, i_last );
+        if( i_buffer != BlockSize( v ) )
+            Fail( "wrong size", v, i_last );
+        i_last = v;
+        p_consumer->i_received++;
+    }
+    return NULL;
+}
+
+static void Produce( bool b_empty, unsigned *pi_seed )
+{
+    consumer_t consumer = { .b_gapless = !b_empty };
+    vlc_thread_t thread;
+    uint64_t v = 1;
+
+    p_fifo = block_FifoNewSPSC();
+    if( p_fifo == NULL
+     || vlc_clone( &thread, Consumer, &consumer, VLC_THREAD_PRIORITY_LOW ) )
+        abort();
+
+    while( v < BLOCKS )
+    {
+        const unsigned r = rand_r( pi_seed ) % 1000;
+
+        if( r < 5 )
+            block_FifoPace( p_fifo, 100, SIZE_MAX );
+        else if( r < 8 )
+            block_FifoPace( p_fifo, SIZE_MAX, 20000 );
+        else if( r < 10 )
+            block_FifoWake( p_fifo );
+        else if( r < 11 && b_empty )
+            block_FifoEmpty( p_fifo );
+        else if( r < 60 )
+        {
+            block_t *p_chain = NULL, **pp_last = &p_chain;
+
+            for( unsigned i = 0; i < 10; i++ )
+                block_ChainLastAppend( &pp_last, BlockNew( v++ ) );
+            block_FifoPut( p_fifo, p_chain );
+        }
+        else if( r < 62 )
+        {
+            for( unsigned i = 0; i < BURST; i++ )
+                block_FifoPut( p_fifo, BlockNew( v++ ) );
+        }
+        else
+            block_FifoPut( p_fifo, BlockNew( v++ ) );
+    }
+    block_FifoPut( p_fifo, BlockNew( LAST ) );
+    vlc_join( thread, NULL );
+
+    printf( "%s: %"PRIu64" of %"PRIu64" blocks received, %"PRIu64" wakes\n",
+            b_empty ? "emptied" : "ordered", consumer.i_received, v - 1,
+            consumer.i_wakes );
+    if( block_FifoCount( p_fifo ) != 0
+     || ( !b_empty && consumer.i_received != v - 1 ) )
+        abort();
+    block_FifoRelease( p_fifo );
+}
+
+/* The queue only shrinks behind block_FifoPace() */
+static void Pace( void )
+{
+    consumer_t consumer = { .b_gapless = true };
+    vlc_thread_t thread;
+
+    p_fifo = block_FifoNewSPSC();
+    if( p_fifo == NULL
+     || vlc_clone( &thread, Consumer, &consumer, VLC_THREAD_PRIORITY_LOW ) )
+        abort();
+
+    for( uint64_t v = 1; v <= BLOCKS / 10; v++ )
+    {
+        block_FifoPace( p_fifo, 50, SIZE_MAX );
+        if( block_FifoCount( p_fifo ) > 50 )
+            Fail( "not paced", v, v - 1 );
+        block_FifoPut( p_fifo, BlockNew( v ) );
+    }
+    block_FifoPut( p_fifo, BlockNew( LAST ) );
+    vlc_join( thread, NULL );
+    block_FifoRelease( p_fifo );
+}
+
+/* Blocks overflowing the ring before the consumer starts, then more blocks
+ * while it drains them */
+static void Overflow( void )
+{
+    consumer_t consumer = { .b_gapless = true };
+    vlc_thread_t thread;
+    uint64_t v = 1;
+
+    p_fifo = block_FifoNewSPSC();
+    if( p_fifo == NULL )
+        abort();
+
+    for( ; v <= 2 * BURST; v++ )
+        block_FifoPut( p_fifo, BlockNew( v ) );
+    if( block_FifoCount( p_fifo ) != 2 * BURST )
+        abort();
+
+    if( vlc_clone( &thread, Consumer, &consumer, VLC_THREAD_PRIORITY_LOW ) )
+        abort();
+    /* Room in the ring, the overflow list still queued */
+    block_FifoPace( p_fifo, 2 * BURST - 100, SIZE_MAX );
+    for( ; v <= 100 * BURST; v++ )
+        block_FifoPut( p_fifo, BlockNew( v ) );
+    block_FifoPut( p_fifo, BlockNew( LAST ) );
+    vlc_join( thread, NULL );
+    if( consumer.i_received != 100 * BURST )
+        abort();
+    block_FifoRelease( p_fifo );
+}
+
+/* A consumer cancelled while it waits for blocks */
+static void Cancel( void )
+{
+    consumer_t consumer = { .b_gapless = true };
+    vlc_thread_t thread;
+
+    p_fifo = block_FifoNewSPSC();
+    if( p_fifo == NULL
+     || vlc_clone( &thread, Consumer, &consumer, VLC_THREAD_PRIORITY_LOW ) )
+        abort();
+
+    block_FifoPut( p_fifo, BlockNew( 1 ) );
+    /* Leave it time to park once the queue is drained */
+    do
+        usleep( 100000 );
+    while( block_FifoCount( p_fifo ) > 0 );
+    vlc_cancel( thread );
+    vlc_join( thread, NULL );
+    if( consumer.i_received != 1 )
+        abort();
+
+    block_FifoPut( p_fifo, BlockNew( 2 ) );
+    block_FifoRelease( p_fifo );
+}
+
+int main( void )
+{
+    unsigned i_seed = 0;
+
+    Produce( false, &i_seed );
+    Produce( true, &i_seed );
+    Pace();
+    Overflow();
+    Cancel();
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*****************************************************************************
+ * epg.c: test for the EPG events and their merging
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Checks that events are kept ordered by start time, then merges program
+ * guides with vlc_epg_MergeChanges(): the count and the callbacks of
+ * inserted, updated and removed events, merges changing nothing, and the
+ * current event. Also checks that the strings of the merged events are
+ * shared with the source rather than copied, and released by whichever
+ * guide goes last. */
+
+#include "../../libvlc/test.h"
+
+#include "../../../src/misc/epg.c"
+
+static unsigned Refs( const char *psz )
+{
+    return atomic_load( &EpgString( (char *)psz )->i_refs );
+}
+
+static void CheckOrder( const vlc_epg_t *p_epg )
+{
+    for( int i = 1; i < p_epg->i_event; i++ )
+        assert( p_epg->pp_event[i - 1]->i_start
+                <= p_epg->pp_event[i]->i_start );
+}
+
+typedef struct
+{
+    unsigned i_changed;
+    unsigned i_removed;
+    int64_t  i_last_start;
+} changes_t;
+
+static void Changed( void *p_data, const vlc_epg_event_t *p_evt,
+                     bool b_removed )
+{
+    changes_t *p_changes = p_data;
+
+    if( b_removed )
+        p_changes->i_removed++;
+    else
+        p_changes->i_changed++;
+    p_changes->i_last_start = p_evt->i_start;
+}
+
+static size_t Merge( vlc_epg_t *p_dst, const vlc_epg_t *p_src,
+                     changes_t *p_changes )
+{
+    memset( p_changes, 0, sizeof(*p_changes) );
+    return vlc_epg_MergeChanges( p_dst, p_src, Changed, p_changes );
+}
+
+static void test_order( void )
+{
+    static const int64_t pi_start[] = { 500, 100, 300, 900, 0, 700, 300 };
+    vlc_epg_t epg;
+
+    log( "Testing the event order\n" );
+
+    vlc_epg_Init( &epg, "order" );
+    for( size_t i = 0; i < ARRAY_SIZE(pi_start); i++ )
+        vlc_epg_AddEvent( &epg, pi_start[i], 100, "name", NULL, NULL, 0 );
+    assert( epg.i_event == (int)ARRAY_SIZE(pi_start) );
+    CheckOrder( &epg );
+    assert( epg.pp_event[0]->i_start == 0 );
+    assert( epg.pp_event[epg.i_event - 1]->i_start == 900 );
+
+    vlc_epg_SetCurrent( &epg, 700 );
+    assert( epg.p_current != NULL && epg.p_current->i_start == 700 );
+    vlc_epg_SetCurrent( &epg, 800 );
+    assert( epg.p_current == NULL );
+    vlc_epg_SetCurrent( &epg, -1 );
+    assert( epg.p_current == NULL );
+    vlc_epg_Clean( &epg );
+}
+
+static void test_merge( void )
+{
+    vlc_epg_t src, dst;
+    changes_t changes;
+
+    log( "Testing the EPG merges\n" );
+
+    vlc_epg_Init( &src, "src" );
+    vlc_epg_Init( &dst, "dst" );
+    vlc_epg_AddEvent( &src, 1000, 600, "first", "short", NULL, 0 );
+    vlc_epg_AddEvent( &src, 1600, 600, "second", NULL, "long", 0 );
+    vlc_epg_AddEvent( &src, 2200, 600, "third", NULL, NULL, 12 );
+
+    /* Inserted in an empty guide */
+    assert( Merge( &dst, &src, &changes ) == 3 );
+    assert( changes.i_changed == 3 && changes.i_removed == 0 );
+    assert( dst.i_event == 3 );
+    CheckOrder( &dst );
+    for( int i = 0; i < dst.i_event; i++ )
+    {
+        const vlc_epg_event_t *p_evt = dst.pp_event[i];
+        assert( p_evt->i_start == src.pp_event[i]->i_start );
+        assert( p_evt->i_duration == src.pp_event[i]->i_duration );
+        assert( p_evt->i_rating == src.pp_event[i]->i_rating );
+        assert( p_evt->psz_name == src.pp_event[i]->psz_name );
+        assert( Refs( p_evt->psz_name ) == 2 );
+    }
+    assert( Refs( dst.pp_event[0]->psz_short_description ) == 2 );
+    assert( dst.pp_event[0]->psz_description == NULL );
+
+    /* Nothing new */
+    assert( Merge( &dst, &src, &changes ) == 0 );
+    assert( changes.i_changed == 0 && changes.i_removed == 0 );
+    assert( Refs( dst.pp_event[0]->psz_name ) == 2 );
+
+    /* Equal strings are not replaced, other ones are */
+    vlc_epg_t update;
+    vlc_epg_Init( &update, "update" );
+    vlc_epg_AddEvent( &update, 1000, 600, "first", "short", NULL, 0 );
+    vlc_epg_AddEvent( &update, 1600, 600, "renamed", NULL, "long", 0 );
+    assert( Merge( &dst, &update, &changes ) == 1 );
+    assert( changes.i_changed == 1 && changes.i_last_start == 1600 );
+    assert( dst.i_event == 3 );
+    assert( dst.pp_event[0]->psz_name == src.pp_event[0]->psz_name );
+    assert( dst.pp_event[1]->psz_name == update.pp_event[1]->psz_name );
+    assert( !strcmp( dst.pp_event[1]->psz_name, "renamed" ) );
+    assert( Refs( src.pp_event[1]->psz_name ) == 1 );
+    assert( Refs( update.pp_event[1]->psz_name ) == 2 );
+    assert( dst.pp_event[1]->psz_description
+            == src.pp_event[1]->psz_description );
+
+    /* Duration and rating changes */
+    vlc_epg_Clean( &update );
+    vlc_epg_Init( &update, "update" );
+    vlc_epg_AddEvent( &update, 2200, 300, "third", NULL, NULL, 12 );
+    assert( Merge( &dst, &update, &changes ) == 1 );
+    assert( changes.i_last_start == 2200 && dst.pp_event[2]->i_duration == 300 );
+    vlc_epg_Clean( &update );
+    vlc_epg_Init( &update, "update" );
+    vlc_epg_AddEvent( &update, 2200, 300, "third", NULL, NULL, 16 );
+    assert( Merge( &dst, &update, &changes ) == 1 );
+    assert( dst.pp_event[2]->i_rating == 16 );
+    vlc_epg_Clean( &update );
+
+    /* Inserted in the middle and at both ends */
+    vlc_epg_Init( &update, "update" );
+    vlc_epg_AddEvent( &update, 400, 600, "before", NULL, NULL, 0 );
+    vlc_epg_AddEvent( &update, 1300, 300, "between", NULL, NULL, 0 );
+    vlc_epg_AddEvent( &update, 2800, 600, "after", NULL, NULL, 0 );
+    assert( Merge( &dst, &update, &changes ) == 3 );
+    assert( changes.i_changed == 3 && changes.i_removed == 0 );
+    assert( dst.i_event == 6 );
+    CheckOrder( &dst );
+    assert( !strcmp( dst.pp_event[0]->psz_name, "before" ) );
+    assert( !strcmp( dst.pp_event[2]->psz_name, "between" ) );
+    assert( !strcmp( dst.pp_event[5]->psz_name, "after" ) );
+    vlc_epg_Clean( &update );
+
+    /* Back to the source events, with a current one: the event before it
+     * is kept, older ones are removed */
+    vlc_epg_SetCurrent( &src, 2200 );
+    assert( Merge( &dst, &src, &changes ) == 2 + 1 + 3 );
+    assert( changes.i_changed == 2 && changes.i_removed == 3 );
+    assert( dst.p_current != NULL && dst.p_current->i_start == 2200 );
+    assert( dst.i_event == 3 );
+    assert( dst.pp_event[0]->i_start == 1600 );
+    assert( !strcmp( dst.pp_event[0]->psz_name, "second" ) );
+    CheckOrder( &dst );
+
+    /* Same events and current event, the strings being equal */
+    vlc_epg_Init( &update, "update" );
+    vlc_epg_AddEvent( &update, 1600, 600, "second", NULL, "long", 0 );
+    vlc_epg_AddEvent( &update, 2200, 600, "third", NULL, NULL, 12 );
+    vlc_epg_SetCurrent( &update, 2200 );
+    assert( Merge( &dst, &update, &changes ) == 0 );
+    assert( changes.i_changed == 0 && changes.i_removed == 0 );
+    assert( dst.pp_event[0]->psz_name == src.pp_event[1]->psz_name );
+    vlc_epg_Clean( &update );
+
+    /* The destination outlives the source */
+    const char *psz_third = dst.pp_event[1]->psz_name;
+    assert( psz_third == src.pp_event[2]->psz_name );
+    assert( Refs( psz_third ) == 2 );
+    vlc_epg_Clean( &src );
+    assert( Refs( psz_third ) == 1 );
+    assert( !strcmp( psz_third, "third" ) );
+    vlc_epg_Clean( &dst );
+}
+
+static void test_merge_callback( void )
+{
+    vlc_epg_t src, dst;
+
+    log( "Testing merges without callback\n" );
+
+    vlc_epg_Init( &src, NULL );
+    vlc_epg_Init( &dst, NULL );
+    vlc_epg_AddEvent( &src, 0, 60, "a", NULL, NULL, 0 );
+    vlc_epg_AddEvent( &src, 60, 60, "b", NULL, NULL, 0 );
+    vlc_epg_AddEvent( &src, 120, 60, "c", NULL, NULL, 0 );
+    vlc_epg_SetCurrent( &src, 120 );
+    assert( vlc_epg_MergeChanges( &dst, &src, NULL, NULL ) == 3 + 1 + 1 );
+    assert( dst.i_event == 2 && dst.p_current == dst.pp_event[1] );
+
+    /* vlc_epg_Merge() does the same */
+    vlc_epg_Clean( &dst );
+    vlc_epg_Init( &dst, NULL );
+    vlc_epg_Merge( &dst, &src );
+    assert( dst.i_event == 2 && dst.p_current == dst.pp_event[1] );
+    assert( Refs( dst.pp_event[0]->psz_name ) == 2 );
+
+    vlc_epg_Clean( &dst );
+    assert( Refs( src.pp_event[1]->psz_name ) == 1 );
+    vlc_epg_Clean( &src );
+}
+
+int main( void )
+{
+    test_init();
+
+    test_order();
+    test_merge();
+    test_merge_callback();
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*****************************************************************************
+ * epg_cache.c: test for the EPG kept across sessions
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Stores program guides, loads them back in a new cache and compares them,
+ * then checks that truncated or altered cache files are rejected as a
+ * whole. The cache directory is a temporary XDG_CACHE_HOME. */
+
+#include <time.h>
+
+#include "../../libvlc/test.h"
+#include "../lib/libvlc_internal.h"
+
+#include <vlc_common.h>
+#include <vlc_epg.h>
+
+#define NETWORK_ID 0x7fe0
+#define TS_ID      0x7fe1
+
+static char psz_cache_home[] = "/tmp/vlc-test-epg-XXXXXX";
+static char psz_path[64 + sizeof(psz_cache_home)];
+
+static bool StrEq( const char *a, const char *b )
+{
+    return a == b || ( a && b && !strcmp( a, b ) );
+}
+
+static int CountServices( vlc_object_t *p_obj )
+{
+    vlc_epg_cache_t *p_cache = vlc_epg_cache_Open( p_obj, NETWORK_ID, TS_ID );
+    assert( p_cache != NULL );
+
+    uint16_t i_service_id;
+    int i_service = 0;
+    while( vlc_epg_cache_Get( p_cache, i_service, &i_service_id ) )
+        i_service++;
+    vlc_epg_cache_Close( p_cache );
+    return i_service;
+}
+
+static void WriteFile( const uint8_t *p, size_t i )
+{
+    FILE *f = fopen( psz_path, "wb" );
+    assert( f != NULL );
+    assert( fwrite( p, 1, i, f ) == i );
+    assert( fclose( f ) == 0 );
+}
+
+static void test_round_trip( vlc_object_t *p_obj, int64_t i_now )
+{
+    vlc_epg_t epg;
+
+    log( "Testing the EPG cache round trip\n" );
+
+    /* No file yet */
+    assert( CountServices( p_obj ) == 0 );
+
+    vlc_epg_cache_t *p_cache = vlc_epg_cache_Open( p_obj, NETWORK_ID, TS_ID );
+    assert( p_cache != NULL );
+
+    vlc_epg_Init( &epg, NULL );
+    vlc_epg_AddEvent( &epg, i_now - 7200, 3600, "over", NULL, NULL, 0 );
+    vlc_epg_AddEvent( &epg, i_now - 600, 1800, "on air", "short",
+                      "description", 12 );
+    vlc_epg_AddEvent( &epg, i_now + 1200, 600, "next", NULL, "", 0 );
+    vlc_epg_cache_Update( p_cache, 0x0400, &epg );
+    vlc_epg_Clean( &epg );
+
+    vlc_epg_Init( &epg, NULL );
+    vlc_epg_AddEvent( &epg, i_now + 3600, 60, NULL, NULL, NULL, 255 );
+    vlc_epg_cache_Update( p_cache, 0x0401, &epg );
+    vlc_epg_Clean( &epg );
+
+    vlc_epg_cache_Close( p_cache );
+
+    p_cache = vlc_epg_cache_Open( p_obj, NETWORK_ID, TS_ID );
+    assert( p_cache != NULL );
+
+    uint16_t i_service_id;
+    const vlc_epg_t *p_epg = vlc_epg_cache_Get( p_cache, 0, &i_service_id );
+    assert( p_epg != NULL && i_service_id == 0x0400 );
+    /* The event which is over is not stored */
+    assert( p_epg->i_event == 2 );
+
+    const vlc_epg_event_t *p_evt = p_epg->pp_event[0];
+    assert( p_epg->p_current == p_evt );
+    assert( p_evt->i_start == i_now - 600 && p_evt->i_duration == 1800 );
+    assert( StrEq( p_evt->psz_name, "on air" ) );
+    assert( StrEq( p_evt->psz_short_description, "short" ) );
+    assert( StrEq( p_evt->psz_description, "description" ) );
+    assert( p_evt->i_rating == 12 );
+
+    p_evt = p_epg->pp_event[1];
+    assert( p_evt->i_start == i_now + 1200 && p_evt->i_duration == 600 );
+    assert( StrEq( p_evt->psz_name, "next" ) );
+    assert( p_evt->psz_short_description == NULL );
+    assert( StrEq( p_evt->psz_description, "" ) );
+
+    p_epg = vlc_epg_cache_Get( p_cache, 1, &i_service_id );
+    assert( p_epg != NULL && i_service_id == 0x0401 );
+    assert( p_epg->i_event == 1 && p_epg->p_current == NULL );
+    p_evt = p_epg->pp_event[0];
+    assert( p_evt->psz_name == NULL && p_evt->i_rating == 255 );
+
+    assert( vlc_epg_cache_Get( p_cache, 2, &i_service_id ) == NULL );
+    vlc_epg_cache_Close( p_cache );
+}
+
+static void test_load_validation( vlc_object_t *p_obj )
+{
+    log( "Testing the EPG cache file validation\n" );
+
+    FILE *f = fopen( psz_path, "rb" );
+    assert( f != NULL );
+    static uint8_t file[4096], altered[4096 + 1];
+    const size_t i_file = fread( file, 1, sizeof(file), f );
+    fclose( f );
+    assert( i_file > 16 && i_file < sizeof(file) );
+
+    /* Every truncation is rejected, not only the ones which cut a field */
+    for( size_t i = 0; i < i_file; i++ )
+    {
+        WriteFile( file, i );
+        assert( CountServices( p_obj ) == 0 );
+    }
+
+    /* Trailing data */
+    memcpy( altered, file, i_file );
+    altered[i_file] = 0;
+    WriteFile( altered, i_file + 1 );
+    assert( CountServices( p_obj ) == 0 );
+
+    /* Magic, network and transport stream identifiers */
+    static const size_t pi_header[] = { 0, 7, 8, 9, 10, 11 };
+    for( size_t i = 0; i < sizeof(pi_header) / sizeof(pi_header[0]); i++ )
+    {
+        memcpy( altered, file, i_file );
+        altered[pi_header[i]] ^= 0x01;
+        WriteFile( altered, i_file );
+        assert( CountServices( p_obj ) == 0 );
+    }
+
+    /* More services than the bound, or than stored */
+    memcpy( altered, file, i_file );
+    SetDWLE( &altered[12], 1025 );
+    WriteFile( altered, i_file );
+    assert( CountServices( p_obj ) == 0 );
+    SetDWLE( &altered[12], 3 );
+    WriteFile( altered, i_file );
+    assert( CountServices( p_obj ) == 0 );
+
+    /* Event count and string length past the end of the file */
+    memcpy( altered, file, i_file );
+    SetDWLE( &altered[16 + 4], 3 );
+    WriteFile( altered, i_file );
+    assert( CountServices( p_obj ) == 0 );
+    memcpy( altered, file, i_file );
+    SetDWLE( &altered[16 + 8 + 16], 0xfffffffe );
+    WriteFile( altered, i_file );
+    assert( CountServices( p_obj ) == 0 );
+
+    /* The untouched file still loads */
+    WriteFile( file, i_file );
+    assert( CountServices( p_obj ) == 2 );
+}
+
+int main( void )
+{
+    test_init();
+
+    assert( mkdtemp( psz_cache_home ) != NULL );
+    setenv( "XDG_CACHE_HOME", psz_cache_home, 1 );
+    snprintf( psz_path, sizeof(psz_path), "%s/vlc/epg/%04x-%04x.epg",
+              psz_cache_home, NETWORK_ID, TS_ID );
+
+    libvlc_instance_t *p_vlc = libvlc_new( test_defaults_nargs,
+                                           test_defaults_args );
+    assert( p_vlc != NULL );
+    vlc_object_t *p_obj = VLC_OBJECT(p_vlc->p_libvlc_int);
+
+    const int64_t i_now = time( NULL );
+    test_round_trip( p_obj, i_now );
+    test_load_validation( p_obj );
+
+    libvlc_release( p_vlc );
+
+    char psz_dir[sizeof(psz_path)];
+    unlink( psz_path );
+    snprintf( psz_dir, sizeof(psz_dir), "%s/vlc/epg", psz_cache_home );
+    rmdir( psz_dir );
+    snprintf( psz_dir, sizeof(psz_dir), "%s/vlc", psz_cache_home );
+    rmdir( psz_dir );
+    rmdir( psz_cache_home );
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*****************************************************************************
+ * preparser.c: preparser queue and cache test
+ *****************************************************************************
+ * Copyright (C) 2014 VLC authors and VideoLAN
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+/* Runs the preparser with a single worker over an input_Preparse() stub,
+ * which records the order of the items and gives them a title, a duration,
+ * an ES and an info. Checks that priority items go first and that items
+ * are queued once, that a file is preparsed again only if its modification
+ * time or its size changed, and that timed out items are not cached. */
+
+#include <sys/types.h>
+#include <utime.h>
+
+#include "../../libvlc/test.h"
+#include "../lib/libvlc_internal.h"
+
+#include <vlc_common.h>
+#include <vlc_fs.h>
+#include <vlc_url.h>
+
+#include "../../../src/playlist/preparser.c"
+
+#define TIMEOUT_MS 50
+
+static char psz_dir[] = "/tmp/vlc-test-preparser-XXXXXX";
+
+static vlc_mutex_t lock = VLC_STATIC_MUTEX;
+static vlc_cond_t  gate = VLC_STATIC_COND;
+static bool        b_gate_open;
+static char        psz_order[256];
+static int         i_calls;
+
+/*****************************************************************************
+ * Stubs
+ *****************************************************************************/
+int input_Preparse( vlc_object_t *p_parent, input_item_t *p_item,
+                    mtime_t i_timeout )
+{
+    VLC_UNUSED( p_parent );
+    char *psz_name = input_item_GetName( p_item );
+    int i_ret = VLC_SUCCESS;
+
+    assert( psz_name != NULL );
+    assert( i_timeout == TIMEOUT_MS * (CLOCK_FREQ / 1000) );
+
+    vlc_mutex_lock( &lock );
+    i_calls++;
+    strcat( psz_order, psz_name );
+    strcat( psz_order, " " );
+    if( !strcmp( psz_name, "gate" ) )
+        while( !b_gate_open )
+            vlc_cond_wait( &gate, &lock );
+    vlc_mutex_unlock( &lock );
+
+    /* Interrupted once the demuxer found its ES */
+    if( !strcmp( psz_name, "slow" ) )
+    {
+        mwait( mdate() + i_timeout );
+        i_ret = VLC_ETIMEOUT;
+    }
+    if( strcmp( psz_name, "empty" ) )
+    {
+        es_format_t fmt;
+
+        es_format_Init( &fmt, VIDEO_ES, VLC_CODEC_MPGV );
+        fmt.i_id = 0x100;
+        input_item_UpdateTracksInfo( p_item, &fmt );
+        input_item_SetTitle( p_item, psz_name );
+        input_item_SetDuration( p_item, 1234 );
+        input_item_AddInfo( p_item, "Stream 0", "Codec", "MPEG-2" );
+    }
+    free( psz_name );
+    return i_ret;
+}
+
+playlist_fetcher_t *playlist_fetcher_New( vlc_object_t *p_parent )
+{
+    VLC_UNUSED( p_parent );
+    return NULL;
+}
+
+void playlist_fetcher_Push( playlist_fetcher_t *p_fetcher, input_item_t *p_item,
+                            input_item_meta_request_option_t i_options )
+{
+    VLC_UNUSED( p_fetcher ); VLC_UNUSED( p_item ); VLC_UNUSED( i_options );
+}
+
+void playlist_fetcher_Delete( playlist_fetcher_t *p_fetcher )
+{
+    VLC_UNUSED( p_fetcher );
+}
+
+/* Not exported by libvlccore */
+void input_item_SetPreparsed( input_item_t *p_item, bool b_preparsed )
+{
+    assert( b_preparsed );
+    vlc_mutex_lock( &p_item->lock );
+    if( !p_item->p_meta )
+        p_item->p_meta = vlc_meta_New();
+    vlc_meta_SetStatus( p_item->p_meta,
+                        vlc_meta_GetStatus( p_item->p_meta ) | ITEM_PREPARSED );
+    vlc_mutex_unlock( &p_item->lock );
+}
+
+void input_item_UpdateTracksInfo( input_item_t *p_item, const es_format_t *p_fmt )
+{
+    es_format_t *p_copy = malloc( sizeof(*p_copy) );
+    assert( p_copy != NULL );
+    es_format_Copy( p_copy, p_fmt );
+
+    vlc_mutex_lock( &p_item->lock );
+    TAB_APPEND( p_item->i_es, p_item->es, p_copy );
+    vlc_mutex_unlock( &p_item->lock );
+}
+
+/* The workers are joined once the preparser is deleted */
+static vlc_thread_t pi_threads[64];
+static int i_threads;
+
+int vlc_clone_detach( vlc_thread_t *p_thread, void *(*entry)( void * ),
+                      void *data, int i_priority )
+{
+    VLC_UNUSED( p_thread );
+    vlc_mutex_lock( &lock );
+    assert( i_threads < 64 );
+    int i_ret = vlc_clone( &pi_threads[i_threads], entry, data, i_priority );
+    if( !i_ret )
+        i_threads++;
+    vlc_mutex_unlock( &lock );
+    return i_ret;
+}
+
+/*****************************************************************************
+ * Test
+ *****************************************************************************/
+static void GetPath( char *psz_path, const char *psz_name )
+{
+    snprintf( psz_path, 64, "%s/%s", psz_dir, psz_name );
+}
+
+static void WriteFile( const char *psz_name, const char *psz_data )
+{
+    char psz_path[64];
+    GetPath( psz_path, psz_name );
+
+    FILE *f = fopen( psz_path, "wb" );
+    assert( f != NULL );
+    assert( fputs( psz_data, f ) >= 0 );
+    assert( fclose( f ) == 0 );
+}
+
+static input_item_t *NewItem( const char *psz_name )
+{
+    char psz_path[64];
+    GetPath( psz_path, psz_name );
+
+    char *psz_uri = vlc_path2uri( psz_path, NULL );
+    assert( psz_uri != NULL );
+    input_item_t *p_item = input_item_NewWithType( psz_uri, psz_name, 0, NULL,
+                                                   0, -1, ITEM_TYPE_FILE );
+    assert( p_item != NULL );
+    free( psz_uri );
+    return p_item;
+}
+
+/* Preparses new items for the given files, returns the number of calls */
+static int PreparseFiles( playlist_preparser_t *p_preparser,
+                         input_item_t **pp_item,
+                         const char *const *ppsz_names, int i_items )
+{
+    vlc_mutex_lock( &lock );
+    i_calls = 0;
+    psz_order[0] = '\0';
+    vlc_mutex_unlock( &lock );
+
+    for( int i = 0; i < i_items; i++ )
+    {
+        pp_item[i] = NewItem( ppsz_names[i] );
+        playlist_preparser_Push( p_preparser, pp_item[i], 0 );
+    }
+    for( int i = 0; i < i_items; i++ )
+        while( !input_item_IsPreparsed( pp_item[i] ) )
+            usleep( 10000 );
+
+    vlc_mutex_lock( &lock );
+    const int i_ret = i_calls;
+    vlc_mutex_unlock( &lock );
+    return i_ret;
+}
+
+static void ReleaseItems( input_item_t **pp_item, int i_items )
+{
+    for( int i = 0; i < i_items; i++ )
+        input_item_Release( pp_item[i] );
+}
+
+static void test_priority( playlist_preparser_t *p_preparser )
+{
+    static const char *const ppsz_names[] = {
+        "gate", "n0", "n1", "n2", "n3", "u0", "u1"
+    };
+    input_item_t *pp_item[7];
+
+    log( "Testing the preparser queue order\n" );
+
+    for( int i = 0; i < 7; i++ )
+    {
+        WriteFile( ppsz_names[i], ppsz_names[i] );
+        pp_item[i] = NewItem( ppsz_names[i] );
+    }
+
+    /* The single worker is held by the first item while the others queue */
+    playlist_preparser_Push( p_preparser, pp_item[0], 0 );
+    for( bool b_started = false; !b_started; )
+    {
+        usleep( 10000 );
+        vlc_mutex_lock( &lock );
+        b_started = i_calls > 0;
+        vlc_mutex_unlock( &lock );
+    }
+    for( int i = 1; i < 5; i++ )
+        playlist_preparser_Push( p_preparser, pp_item[i], 0 );
+    playlist_preparser_Push( p_preparser, pp_item[5],
+                             META_REQUEST_OPTION_PRIORITY );
+    playlist_preparser_Push( p_preparser, pp_item[6],
+                             META_REQUEST_OPTION_PRIORITY );
+    /* Queued once, and raised to the priority queue */
+    playlist_preparser_Push( p_preparser, pp_item[1], 0 );
+    playlist_preparser_Push( p_preparser, pp_item[3],
+                             META_REQUEST_OPTION_PRIORITY );
+    playlist_preparser_Push( p_preparser, pp_item[0], 0 );
+
+    vlc_mutex_lock( &lock );
+    b_gate_open = true;
+    vlc_cond_signal( &gate );
+    vlc_mutex_unlock( &lock );
+
+    for( int i = 0; i < 7; i++ )
+        while( !input_item_IsPreparsed( pp_item[i] ) )
+            usleep( 10000 );
+
+    vlc_mutex_lock( &lock );
+    assert( !strcmp( psz_order, "gate u0 u1 n2 n0 n1 n3 " ) );
+    assert( i_calls == 7 );
+    vlc_mutex_unlock( &lock );
+    ReleaseItems( pp_item, 7 );
+}
+
+static void test_cache( playlist_preparser_t *p_preparser )
+{
+    static const char *const ppsz_names[] = { "n0", "n1", "n2", "n3" };
+    input_item_t *pp_item[4];
+
+    log( "Testing the preparser cache\n" );
+
+    /* Known files, new items */
+    assert( PreparseFiles( p_preparser, pp_item, ppsz_names, 4 ) == 0 );
+    char *psz_title = input_item_GetTitle( pp_item[2] );
+    char *psz_codec = input_item_GetInfo( pp_item[2], "Stream 0", "Codec" );
+    assert( psz_title != NULL && !strcmp( psz_title, "n2" ) );
+    assert( psz_codec != NULL && !strcmp( psz_codec, "MPEG-2" ) );
+    assert( input_item_GetDuration( pp_item[2] ) == 1234 );
+    vlc_mutex_lock( &pp_item[2]->lock );
+    assert( pp_item[2]->i_es == 1 );
+    assert( pp_item[2]->es[0]->i_codec == VLC_CODEC_MPGV );
+    vlc_mutex_unlock( &pp_item[2]->lock );
+    free( psz_title );
+    free( psz_codec );
+    ReleaseItems( pp_item, 4 );
+
+    /* Same modification time, other size */
+    char psz_path[64];
+    struct stat st;
+    GetPath( psz_path, "n0" );
+    assert( vlc_stat( psz_path, &st ) == 0 );
+    WriteFile( "n0", "n0 changed" );
+    struct utimbuf times = { .actime = st.st_atime, .modtime = st.st_mtime };
+    assert( utime( psz_path, &times ) == 0 );
+
+    /* Same size, other modification time */
+    GetPath( psz_path, "n1" );
+    assert( vlc_stat( psz_path, &st ) == 0 );
+    times.actime = st.st_atime;
+    times.modtime = st.st_mtime - 100;
+    assert( utime( psz_path, &times ) == 0 );
+
+    assert( PreparseFiles( p_preparser, pp_item, ppsz_names, 4 ) == 2 );
+    assert( !strcmp( psz_order, "n0 n1 " ) );
+    ReleaseItems( pp_item, 4 );
+
+    /* Stored again */
+    assert( PreparseFiles( p_preparser, pp_item, ppsz_names, 4 ) == 0 );
+    ReleaseItems( pp_item, 4 );
+}
+
+static void test_not_cached( playlist_preparser_t *p_preparser )
+{
+    static const char *const ppsz_names[] = { "slow", "empty" };
+    input_item_t *pp_item[2];
+
+    log( "Testing timed out and empty preparsing results\n" );
+
+    WriteFile( "slow", "slow" );
+    WriteFile( "empty", "empty" );
+    for( int i = 0; i < 2; i++ )
+    {
+        assert( PreparseFiles( p_preparser, pp_item, ppsz_names, 2 ) == 2 );
+        ReleaseItems( pp_item, 2 );
+    }
+}
+
+int main( void )
+{
+    static const char *const ppsz_files[] = {
+        "gate", "n0", "n1", "n2", "n3", "u0", "u1", "slow", "empty"
+    };
+    static const char *ppsz_args[] = {
+        "-v", "--ignore-config", "-I", "dummy", "--no-media-library",
+        "--preparse-threads=1", "--preparse-timeout=50",
+    };
+
+    test_init();
+
+    assert( mkdtemp( psz_dir ) != NULL );
+
+    libvlc_instance_t *p_vlc = libvlc_new( ARRAY_SIZE(ppsz_args), ppsz_args );
+    assert( p_vlc != NULL );
+
+    playlist_preparser_t *p_preparser =
+        playlist_preparser_New( VLC_OBJECT(p_vlc->p_libvlc_int) );
+    assert( p_preparser != NULL );
+
+    test_priority( p_preparser );
+    test_cache( p_preparser );
+    test_not_cached( p_preparser );
+
+    playlist_preparser_Delete( p_preparser );
+    for( int i = 0; i < i_threads; i++ )
+        vlc_join( pi_threads[i], NULL );
+    libvlc_release( p_vlc );
+
+    for( size_t i = 0; i < ARRAY_SIZE(ppsz_files); i++ )
+    {
+        char psz_path[64];
+        GetPath( psz_path, ppsz_files[i] );
+        unlink( psz_path );
+    }
+    rmdir( psz_dir );
+    return 0;
+}